@@ -0,0 +1,126 @@
+#ifndef AOBAKER_H_
+#define AOBAKER_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file AOBaker.h
+/// @brief bakes per vertex ambient occlusion and sky lighting for a GroupedObj on the CPU. For each vertex
+/// cosine weighted rays are cast over the hemisphere about the normal using the BVH, rays which escape
+/// pick up the sky colour (a gradient from horizon to zenith) and rays which hit within the occlusion
+/// distance are counted as dark. The result is the RGB irradiance which the shader multiplies the
+/// texture colour by. Baking is progressive, each pass adds more samples to every vertex and can be
+/// run on a background thread so the scene can be drawn with the partial result. Results are saved to
+/// a cache keyed by the mesh hash and reloaded (and refined further if needed) on the next run.
+//----------------------------------------------------------------------------------------------------------------------
+#include "GroupedObj.h"
+#include "BVH.h"
+#include <ngl/Vec3.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief the bake parameters
+struct AOSettings
+{
+  /// @brief samples per vertex added by each pass
+  unsigned int samplesPerPass = 16;
+  /// @brief stop refining once every vertex has this many samples
+  unsigned int maxSamples = 256;
+  /// @brief hits further away than this don't occlude, in model units
+  float maxDistance = 200.0f;
+  /// @brief the sky colours, rays below the horizon get the ground colour
+  ngl::Vec3 skyZenith = ngl::Vec3(0.9f, 0.95f, 1.1f);
+  ngl::Vec3 skyHorizon = ngl::Vec3(1.0f, 1.0f, 1.0f);
+  ngl::Vec3 ground = ngl::Vec3(0.45f, 0.4f, 0.35f);
+  /// @brief number of threads to use, 0 means use the hardware concurrency
+  unsigned int threads = 0;
+};
+
+class AOBaker
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor, if a cache is found it is loaded, no baking is done until runPass or start is called
+  /// @param[in] _mesh the mesh to bake, must outlive the baker
+  /// @param[in] _cacheDir the directory to use for the cache, an empty string disables it
+  /// @param[in] _settings the bake parameters
+  //----------------------------------------------------------------------------------------------------------------------
+  AOBaker(const GroupedObj &_mesh, const std::string &_cacheDir, const AOSettings &_settings = AOSettings());
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief dtor stops the background bake if running
+  //----------------------------------------------------------------------------------------------------------------------
+  ~AOBaker();
+  AOBaker(const AOBaker &) = delete;
+  AOBaker &operator=(const AOBaker &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief run one progressive pass on the calling thread (the pass itself uses all the threads)
+  /// @returns false if the bake has already converged
+  //----------------------------------------------------------------------------------------------------------------------
+  bool runPass();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief start refining on a background thread until maxSamples is reached, the cache is written when done
+  //----------------------------------------------------------------------------------------------------------------------
+  void start();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief stop the background thread after the current pass
+  //----------------------------------------------------------------------------------------------------------------------
+  void stop();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief is the background thread still running
+  //----------------------------------------------------------------------------------------------------------------------
+  bool running() const { return m_running; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief get the latest lighting if it has changed since the last call
+  /// @param[out] o_light one RGB value per vertex in vertexData order
+  /// @returns true if o_light was filled in
+  //----------------------------------------------------------------------------------------------------------------------
+  bool fetchResult(std::vector<ngl::Vec3> &o_light);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief write the cache now, this is done automatically when a background bake finishes
+  //----------------------------------------------------------------------------------------------------------------------
+  bool saveCache() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief samples per vertex done so far
+  //----------------------------------------------------------------------------------------------------------------------
+  unsigned int samples() const { return m_samples; }
+  bool converged() const { return m_samples >= m_settings.maxSamples; }
+  bool fromCache() const { return m_fromCache; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the samples (rays) per second of the last pass
+  //----------------------------------------------------------------------------------------------------------------------
+  double samplesPerSecond() const { return m_samplesPerSecond; }
+
+private:
+  bool loadCache();
+  void publish();
+
+  const GroupedObj &m_mesh;
+  AOSettings m_settings;
+  std::string m_cacheName;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the BVH is only built when we first need to trace
+  //----------------------------------------------------------------------------------------------------------------------
+  std::unique_ptr<BVH> m_bvh;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the running sum of the sky colour per vertex, divide by m_samples for the result
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<ngl::Vec3> m_sum;
+  std::atomic<unsigned int> m_samples{0};
+  double m_samplesPerSecond = 0.0;
+  bool m_fromCache = false;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the averaged result handed to the render thread
+  //----------------------------------------------------------------------------------------------------------------------
+  std::mutex m_resultLock;
+  std::vector<ngl::Vec3> m_result;
+  bool m_newResult = false;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the background bake
+  //----------------------------------------------------------------------------------------------------------------------
+  std::thread m_thread;
+  std::atomic<bool> m_running{false};
+  std::atomic<bool> m_stop{false};
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef BVH_H_
+#define BVH_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file BVH.h
+/// @brief a bounding volume hierarchy over the triangles of a GroupedObj for CPU ray casting.
+/// The tree is built with a binned surface area heuristic, sub trees are built in parallel and
+/// the nodes are stored flattened in a single array (32 bytes per node, children adjacent).
+/// Rays can be traced one at a time or as packets of 4 coherent rays which are tested against
+/// each box at once using SSE. Hits are mapped back to the MeshData group so the caller can get
+/// the group name and material from the GroupedObj.
+/// @note the BVH takes a copy of the triangle positions in tree order so it doesn't need the GroupedObj
+/// to stay around, but the mesh id's are only valid for the mesh it was built from.
+//----------------------------------------------------------------------------------------------------------------------
+#include "GroupedObj.h"
+#include <ngl/Vec3.h>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/// @brief a flattened BVH node, if m_count is 0 this is an interior node and m_leftFirst is the index
+/// of the left child (the right child is m_leftFirst+1) else it is a leaf of m_count triangles starting at m_leftFirst
+struct BVHNode
+{
+  float m_min[3];
+  uint32_t m_leftFirst;
+  float m_max[3];
+  uint32_t m_count;
+};
+
+/// @brief the result of a ray query
+struct BVHHit
+{
+  /// @brief distance along the ray (in units of the direction length)
+  float m_t = 0.0f;
+  /// @brief barycentric coordinates of the hit
+  float m_u = 0.0f;
+  float m_v = 0.0f;
+  /// @brief the triangle hit as an index into the packed data (vert = 3 * m_triangle) or ~0 if no hit
+  uint32_t m_triangle = ~0u;
+  /// @brief the MeshData group the triangle belongs to
+  size_t m_meshID = 0;
+  bool hit() const { return m_triangle != ~0u; }
+};
+
+/// @brief a packet of 4 rays stored as SoA so they can be loaded straight into SIMD registers
+struct alignas(16) RayPacket4
+{
+  float m_ox[4], m_oy[4], m_oz[4];
+  float m_dx[4], m_dy[4], m_dz[4];
+  float m_tMax[4];
+};
+
+class BVH
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the BVH
+  /// @param[in] _mesh the mesh to build from
+  /// @param[in] _threads the number of threads to use, 0 means use the hardware concurrency
+  //----------------------------------------------------------------------------------------------------------------------
+  BVH(const GroupedObj &_mesh, unsigned int _threads = 0);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief find the closest hit along a ray
+  /// @param[in] _origin the ray origin
+  /// @param[in] _dir the ray direction (need not be normalized)
+  /// @param[in] _tMax the maximum distance along the ray
+  //----------------------------------------------------------------------------------------------------------------------
+  BVHHit intersect(const ngl::Vec3 &_origin, const ngl::Vec3 &_dir, float _tMax = 1e30f) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief test if anything is hit along the ray, stops at the first hit so cheaper than intersect
+  //----------------------------------------------------------------------------------------------------------------------
+  bool occluded(const ngl::Vec3 &_origin, const ngl::Vec3 &_dir, float _tMax = 1e30f) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief trace a packet of 4 rays, the rays should be coherent (i.e. neighbouring pixels)
+  /// @param[in] _rays the packet
+  /// @param[out] o_hits the closest hit for each ray
+  //----------------------------------------------------------------------------------------------------------------------
+  void intersect4(const RayPacket4 &_rays, BVHHit o_hits[4]) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief which MeshData group does a triangle belong to
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t meshForTriangle(uint32_t _triangle) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the bounds of the whole tree
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 boundsMin() const;
+  ngl::Vec3 boundsMax() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build stats
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t numNodes() const { return m_numNodes; }
+  size_t numTriangles() const { return m_triIndex.size(); }
+  double buildTime() const { return m_buildTime; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief trace primary rays from a camera inside the bounds, as single rays and as packets, plus
+  /// random incoherent rays and print the Mrays/s for each
+  /// @param[in] _width the image width to trace
+  /// @param[in] _height the image height to trace
+  /// @param[in] _threads the number of threads to use, 0 means use the hardware concurrency
+  //----------------------------------------------------------------------------------------------------------------------
+  void benchmark(int _width, int _height, unsigned int _threads = 0) const;
+
+private:
+  /// @brief pre-computed triangle data for the intersection test, v0 and two edges
+  struct Triangle
+  {
+    float m_v0[3];
+    float m_e1[3];
+    float m_e2[3];
+  };
+  void buildNode(uint32_t _node, uint32_t _first, uint32_t _count, int _depth);
+  void updateBounds(uint32_t _node, uint32_t _first, uint32_t _count);
+  float findSplit(const BVHNode &_node, uint32_t _first, uint32_t _count, int &o_axis, float &o_pos) const;
+  bool intersectTriangle(uint32_t _index, const ngl::Vec3 &_o, const ngl::Vec3 &_d, float &io_t, float &o_u, float &o_v) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the flattened nodes, node 0 is the root and node 1 is unused so child pairs share a cache line
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<BVHNode> m_nodes;
+  std::atomic<uint32_t> m_nodesUsed{2};
+  size_t m_numNodes = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief triangle index in tree order and the triangle data re-ordered to match
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<uint32_t> m_triIndex;
+  std::vector<Triangle> m_triangles;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief per triangle bounds and centroid used during the build only
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_triBounds;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief first triangle of each group sorted by triangle, with the matching MeshData index
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<std::pair<uint32_t, size_t>> m_groupStarts;
+  int m_parallelDepth = 0;
+  double m_buildTime = 0.0;
+};
+
+#endif
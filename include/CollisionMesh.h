@@ -0,0 +1,90 @@
+#ifndef COLLISIONMESH_H_
+#define COLLISIONMESH_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file CollisionMesh.h
+/// @brief a Bullet collision representation of a GroupedObj used for ray and sphere sweep queries.
+/// The btTriangleIndexVertexArray strides directly over the packed VertData of the GroupedObj so no
+/// copy of the vertex data is made, each group becomes a sub part so hits can be mapped back to the MeshData.
+/// The BVH can be serialized to a cache directory keyed on the mesh hash to skip the build next time.
+/// @note the GroupedObj must outlive this class as we point at its data
+//----------------------------------------------------------------------------------------------------------------------
+#include "GroupedObj.h"
+#include <ngl/Vec3.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+class btTriangleIndexVertexArray;
+class btBvhTriangleMeshShape;
+class btOptimizedBvh;
+
+/// @brief result of a ray or sweep query, all values are in model space
+struct RayHit
+{
+  /// @brief did we hit anything
+  bool m_hit = false;
+  /// @brief the fraction along the ray / sweep of the hit 0-1
+  float m_fraction = 1.0f;
+  /// @brief the hit point (for the sweep this is the centre of the sphere at the hit)
+  ngl::Vec3 m_point;
+  /// @brief the normal of the hit triangle
+  ngl::Vec3 m_normal;
+  /// @brief the index of the MeshData group hit
+  size_t m_meshID = 0;
+  /// @brief the triangle within the group hit
+  int m_triangle = -1;
+};
+
+class CollisionMesh
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the collision mesh from the loaded obj
+  /// @param[in] _mesh the mesh to build from
+  /// @param[in] _cacheDir if not empty the BVH is loaded from / saved to this directory
+  //----------------------------------------------------------------------------------------------------------------------
+  CollisionMesh(const GroupedObj &_mesh, const std::string &_cacheDir = "");
+  ~CollisionMesh();
+  CollisionMesh(const CollisionMesh &) = delete;
+  CollisionMesh &operator=(const CollisionMesh &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief cast a ray from _from to _to and return the closest hit
+  //----------------------------------------------------------------------------------------------------------------------
+  RayHit rayCast(const ngl::Vec3 &_from, const ngl::Vec3 &_to) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief sweep a sphere of _radius from _from to _to and return the first contact
+  //----------------------------------------------------------------------------------------------------------------------
+  RayHit sphereSweep(const ngl::Vec3 &_from, const ngl::Vec3 &_to, float _radius) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief fire _numRays random rays through the bounds of the mesh and print the rays per second
+  /// @returns the number of rays per second
+  //----------------------------------------------------------------------------------------------------------------------
+  double benchmark(size_t _numRays) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief was the BVH loaded from the cache
+  //----------------------------------------------------------------------------------------------------------------------
+  bool fromCache() const { return m_fromCache; }
+
+private:
+  bool loadBvh(const std::string &_fname);
+  void saveBvh(const std::string &_fname) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the mesh we point into
+  //----------------------------------------------------------------------------------------------------------------------
+  const GroupedObj &m_mesh;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief map from Bullet sub part to MeshData index (empty groups are skipped)
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<size_t> m_partToMesh;
+  std::unique_ptr<btTriangleIndexVertexArray> m_vertexArray;
+  std::unique_ptr<btBvhTriangleMeshShape> m_shape;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief if the BVH is loaded from disk it is de-serialized in place in this aligned buffer
+  //----------------------------------------------------------------------------------------------------------------------
+  void *m_bvhBuffer = nullptr;
+  btOptimizedBvh *m_cachedBvh = nullptr;
+  bool m_fromCache = false;
+  bool m_quantized = true;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef FILEWATCHER_H_
+#define FILEWATCHER_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file FileWatcher.h
+/// @brief reports when watched files are written. On Linux this uses inotify on the directory of each file
+/// (editors often save by writing a new file and renaming it over the old one, which a watch on the file
+/// itself would miss), elsewhere it falls back to comparing modification times. poll never blocks so it
+/// can be called from a timer on the GUI thread.
+//----------------------------------------------------------------------------------------------------------------------
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class FileWatcher
+{
+public:
+  FileWatcher();
+  ~FileWatcher();
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief start watching a file, watching the same file twice is harmless
+  /// @param[in] _path the file, poll reports it with exactly this string
+  //----------------------------------------------------------------------------------------------------------------------
+  bool watch(const std::string &_path);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the watched files written since the last call, each reported once
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<std::string> poll();
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the inotify instance, -1 if we are polling modification times
+  //----------------------------------------------------------------------------------------------------------------------
+  int m_fd = -1;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the watch descriptor of each directory and the files we care about in it by name
+  //----------------------------------------------------------------------------------------------------------------------
+  std::unordered_map<int, std::unordered_map<std::string, std::string>> m_watches;
+  std::unordered_map<std::string, int> m_directories;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the last modification times for the fallback
+  //----------------------------------------------------------------------------------------------------------------------
+  std::unordered_map<std::string, std::filesystem::file_time_type> m_times;
+};
+
+#endif
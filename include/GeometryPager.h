@@ -0,0 +1,187 @@
+#ifndef GEOMETRYPAGER_H_
+#define GEOMETRYPAGER_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file GeometryPager.h
+/// @brief draws a GroupedObj too big for GPU memory by paging its geometry through a fixed size pool. The
+/// triangles are split once into spatial chunks (median splits of the triangle centres until a chunk fits a
+/// pool slot), each with its own welded vertices and indices sorted by group, and written page aligned to a
+/// chunk file in the cache which is memory mapped. Each frame the chunks in the view frustum or within the
+/// prefetch distance of the eye are wanted. Missing ones are paged in from the file on a background thread
+/// nearest first, then copied into a free slot of the pool a few per frame. When the pool is full the chunk
+/// least recently wanted is evicted, or the furthest wanted one if it is further than the new one. Only
+/// resident chunks in the frustum are drawn, one call per chunk for each batch it has triangles of.
+//----------------------------------------------------------------------------------------------------------------------
+#include "GroupedObj.h"
+#include "MemoryReport.h"
+#include <ngl/AbstractVAO.h>
+#include <ngl/Mat4.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief the paging parameters
+struct PagerSettings
+{
+  /// @brief the GL memory to use for the vertices and indices
+  size_t poolBytes = size_t(256) << 20;
+  /// @brief the largest chunk when the chunk file is written
+  size_t chunkBytes = size_t(2) << 20;
+  /// @brief the bytes copied into the pool per frame, at least one chunk is always copied
+  size_t uploadBytesPerFrame = size_t(16) << 20;
+  /// @brief chunks this close to the eye are kept even when outside the frustum so turning round is free
+  float prefetchDistance = 50.0f;
+  /// @brief the most chunks asked of the page in thread at once
+  size_t maxPagingIn = 16;
+};
+
+class GeometryPager
+{
+public:
+  struct Stats
+  {
+    size_t m_chunks = 0;
+    size_t m_slots = 0;
+    size_t m_resident = 0;
+    size_t m_residentBytes = 0;
+    /// @brief chunks wanted last frame, and the ones in the frustum that could not be drawn
+    size_t m_wanted = 0;
+    size_t m_missing = 0;
+    size_t m_pending = 0;
+    size_t m_evictions = 0;
+    /// @brief the bytes copied to the pool and read from the file, and the rate of each while copying
+    size_t m_uploadedBytes = 0;
+    double m_uploadMBps = 0.0;
+    size_t m_pagedInBytes = 0;
+    double m_pageInMBps = 0.0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the chunk file for a mesh
+  //----------------------------------------------------------------------------------------------------------------------
+  static std::string cacheName(const std::string &_cacheDir, const GroupedObj &_mesh);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief split the mesh into chunks and write the chunk file, no GL needed
+  /// @param[in] _mesh the mesh, only the welded vertices and indices are read
+  /// @param[in] _fname the file to write
+  /// @param[in] _chunkBytes the largest chunk
+  //----------------------------------------------------------------------------------------------------------------------
+  static bool writeChunkFile(const GroupedObj &_mesh, const std::string &_fname, size_t _chunkBytes);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor maps the chunk file, allocates the pool and starts the page in thread, needs a current GL
+  /// context
+  /// @param[in] _mesh the mesh the file was written for, its batches are drawn. It needs no VAO
+  /// @param[in] _fname the chunk file
+  //----------------------------------------------------------------------------------------------------------------------
+  GeometryPager(const GroupedObj &_mesh, const std::string &_fname, const PagerSettings &_settings = PagerSettings());
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief dtor stops the thread and unmaps the file, needs the GL context current
+  //----------------------------------------------------------------------------------------------------------------------
+  ~GeometryPager();
+  GeometryPager(const GeometryPager &) = delete;
+  GeometryPager &operator=(const GeometryPager &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief false if the file is missing, was written for another mesh or a chunk is bigger than the pool
+  //----------------------------------------------------------------------------------------------------------------------
+  bool valid() const { return m_valid; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief call once a frame with the GL context current to work out the wanted chunks, ask for the missing
+  /// ones, copy what has been paged in and evict to make room
+  /// @param[in] _project the projection matrix
+  /// @param[in] _modelView the model to eye matrix of the mesh
+  //----------------------------------------------------------------------------------------------------------------------
+  void update(const ngl::Mat4 &_project, const ngl::Mat4 &_modelView);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draw the resident triangles of a batch in the frustum, with the material for the batch set
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawBatch(size_t _batchID) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief true while chunks are being paged in or copied so the caller should keep drawing
+  //----------------------------------------------------------------------------------------------------------------------
+  bool busy() const;
+  Stats stats() const;
+  void printStats(std::ostream &_out) const;
+  void memoryUsage(MemoryReport &io_report) const;
+
+private:
+  /// @brief the index range of a chunk holding the triangles of one batch
+  struct Span
+  {
+    uint32_t m_batch;
+    uint32_t m_firstIndex;
+    uint32_t m_numIndices;
+  };
+  struct Chunk
+  {
+    float m_min[3];
+    float m_max[3];
+    /// @brief where the vertices start in the file, the indices follow them
+    uint64_t m_offset = 0;
+    uint32_t m_numVertices = 0;
+    uint32_t m_numIndices = 0;
+    std::vector<Span> m_spans;
+    /// @brief the pool slot or -1, and the page in state
+    int m_slot = -1;
+    bool m_requested = false;
+    bool m_pagedIn = false;
+    float m_distance = 0.0f;
+    uint64_t m_lastWanted = 0;
+  };
+
+  bool load(const GroupedObj &_mesh, const std::string &_fname);
+  bool map(const std::string &_fname);
+  void unmap();
+  void pageInLoop();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief find a slot for a chunk at _distance, evicting if the pool is full
+  /// @returns the slot or -1 if everything resident is wanted and nearer
+  //----------------------------------------------------------------------------------------------------------------------
+  int acquireSlot(float _distance);
+  void upload(size_t _chunk, int _slot);
+  size_t chunkBytes(const Chunk &_chunk) const;
+
+  PagerSettings m_settings;
+  bool m_valid = false;
+  std::vector<Chunk> m_chunks;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the mapped chunk file
+  //----------------------------------------------------------------------------------------------------------------------
+  const unsigned char *m_data = nullptr;
+  size_t m_dataSize = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the pool, each slot holds the vertices and indices of the largest chunk
+  //----------------------------------------------------------------------------------------------------------------------
+  std::unique_ptr<ngl::AbstractVAO> m_vao;
+  size_t m_slotVertices = 0;
+  size_t m_slotIndices = 0;
+  std::vector<int> m_slotChunk;
+  std::vector<int> m_freeSlots;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the chunks to draw this frame nearest first, and the wanted ones
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<size_t> m_drawList;
+  std::vector<size_t> m_wanted;
+  uint64_t m_frame = 0;
+  size_t m_missing = 0;
+  size_t m_residentBytes = 0;
+  size_t m_uploadedThisFrame = 0;
+  size_t m_evictions = 0;
+  size_t m_outstanding = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the page in thread and its queues, everything else is only used on the GL thread
+  //----------------------------------------------------------------------------------------------------------------------
+  mutable std::mutex m_lock;
+  std::condition_variable m_wake;
+  std::deque<size_t> m_requests;
+  std::vector<size_t> m_pagedIn;
+  size_t m_pagedInBytes = 0;
+  double m_pageInSeconds = 0.0;
+  bool m_quit = false;
+  std::thread m_thread;
+};
+
+#endif
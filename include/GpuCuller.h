@@ -0,0 +1,138 @@
+#ifndef GPUCULLER_H_
+#define GPUCULLER_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file GpuCuller.h
+/// @brief culls the groups of a GroupedObj on the GPU so the CPU never walks them. A compute shader tests the
+/// bounds of every group against the frustum and against a Hi-Z pyramid (the max depth of each 2x2 block of
+/// the level below) built from the depth of the previous frame, then writes the survivors of each batch as
+/// DrawElementsIndirectCommand records. With GL 4.6 the records are compacted and drawn with
+/// glMultiDrawElementsIndirectCount, otherwise (Mesa llvmpipe is GL 4.5, run with LIBGL_ALWAYS_SOFTWARE=1 to
+/// test without hardware) every group keeps its record and the culled ones get an instance count of 0.
+/// The occlusion test uses the matrix the depth was drawn with so it is exact for a still camera, a moving
+/// camera can see a group that was hidden last frame pop in a frame late.
+//----------------------------------------------------------------------------------------------------------------------
+#include "GroupedObj.h"
+#include "MemoryReport.h"
+#include <ngl/Mat4.h>
+#include <ngl/Types.h>
+#include <array>
+#include <iosfwd>
+
+class GpuCuller
+{
+public:
+  struct Stats
+  {
+    /// @brief the counts from the last cull
+    uint32_t m_tested = 0;
+    uint32_t m_frustumCulled = 0;
+    uint32_t m_occluded = 0;
+    uint32_t m_drawn = 0;
+    /// @brief the average GPU time of the frames and of the cull and pyramid passes since the last call
+    size_t m_frames = 0;
+    double m_frameMs = 0.0;
+    double m_cullMs = 0.0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor builds the group bounds and the buffers, needs a current GL 4.3 context
+  /// @param[in] _mesh the mesh to cull, it must have a VAO. Re-create the culler if its layout changes
+  //----------------------------------------------------------------------------------------------------------------------
+  explicit GpuCuller(const GroupedObj &_mesh);
+  ~GpuCuller();
+  GpuCuller(const GpuCuller &) = delete;
+  GpuCuller &operator=(const GpuCuller &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief false if the context can't run compute shaders or the shaders failed to build
+  //----------------------------------------------------------------------------------------------------------------------
+  bool valid() const { return m_valid; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief is the draw count read from the GPU (GL 4.6) rather than drawing every record
+  //----------------------------------------------------------------------------------------------------------------------
+  bool compacted() const { return m_compact; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bracket each frame so its GPU time is measured, culled or not
+  //----------------------------------------------------------------------------------------------------------------------
+  void beginFrame();
+  void endFrame();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the draw records for this frame, call before drawing any batch. Changes the program
+  /// @param[in] _mvp the matrix the mesh is drawn with
+  //----------------------------------------------------------------------------------------------------------------------
+  void cull(const ngl::Mat4 &_mvp);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draw the groups of a batch that survived the cull, with the material for the batch already set
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawBatch(size_t _batchID) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the Hi-Z pyramid from the depth of the frame just drawn for the next cull. Changes the program
+  /// @param[in] _fbo the framebuffer drawn to
+  /// @param[in] _width _height its size in pixels
+  /// @param[in] _mvp the matrix the frame was drawn with
+  //----------------------------------------------------------------------------------------------------------------------
+  void captureDepth(GLuint _fbo, int _width, int _height, const ngl::Mat4 &_mvp);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief read the counts of the last cull back (this waits for it) and the times since the last call
+  //----------------------------------------------------------------------------------------------------------------------
+  Stats stats();
+  void printStats(std::ostream &_out);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add the buffers and the pyramid to a report
+  //----------------------------------------------------------------------------------------------------------------------
+  void memoryUsage(MemoryReport &io_report) const;
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief (re-)create the depth copy and the pyramid for a new framebuffer size
+  /// @returns false if the depth format of the framebuffer can't be copied
+  //----------------------------------------------------------------------------------------------------------------------
+  bool resize(GLuint _fbo, int _width, int _height);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief collect the timestamps of the oldest frame if the GPU has finished it
+  //----------------------------------------------------------------------------------------------------------------------
+  void readTimes(size_t _slot);
+
+  const GroupedObj &m_mesh;
+  bool m_valid = false;
+  bool m_compact = false;
+  GLuint m_groups = 0;
+  GLuint m_commands = 0;
+  GLuint m_counts = 0;
+  GLuint m_stats = 0;
+  size_t m_numGroups = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the copy of the framebuffer depth and the pyramid made from it, the pyramid is used once
+  /// m_hizValid is set
+  //----------------------------------------------------------------------------------------------------------------------
+  GLuint m_depthFBO = 0;
+  GLuint m_depth = 0;
+  GLuint m_hiz = 0;
+  int m_width = 0;
+  int m_height = 0;
+  int m_levels = 0;
+  bool m_hizValid = false;
+  bool m_hizBroken = false;
+  ngl::Mat4 m_hizMVP;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief timestamps at the start, either side of the cull, either side of the pyramid and at the end of
+  /// the last few frames, read back once the GPU has caught up so the queries never stall
+  //----------------------------------------------------------------------------------------------------------------------
+  enum Stamp
+  {
+    FrameStart,
+    CullStart,
+    CullEnd,
+    DepthStart,
+    DepthEnd,
+    FrameEnd,
+    NumStamps
+  };
+  static constexpr size_t c_timeSlots = 4;
+  std::array<std::array<GLuint, NumStamps>, c_timeSlots> m_queries = {};
+  std::array<uint32_t, c_timeSlots> m_written = {};
+  size_t m_frame = 0;
+  size_t m_timedFrames = 0;
+  double m_frameMs = 0.0;
+  double m_cullMs = 0.0;
+};
+
+#endif
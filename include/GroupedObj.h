@@ -44,7 +44,24 @@
 #include <vector>
 #include <ngl/Obj.h>
 #include "VAO.h"
+#include "VertexCache.h"
+#include "MemoryReport.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+
+/// @brief a simple structure to hold our packed vertex data, this is the layout of the VAO buffer
+struct VertData
+{
+  GLfloat x; // position from obj
+  GLfloat y;
+  GLfloat z;
+  GLfloat nx; // normal from obj mesh
+  GLfloat ny;
+  GLfloat nz;
+  GLfloat u; // tex cords
+  GLfloat v; // tex cords
+};
 
 /// @brief simple data structure to store the Mesh information, it has an overloaded < operator
 /// to allow for sorting by the Material name type
@@ -58,32 +75,296 @@ struct MeshData
   size_t m_startIndex;
   /// @brief the number of vertices to draw from the start index
   size_t m_numVerts;
+  /// @brief the range of the welded vertices used by the group in drawVertexData
+  size_t m_firstVertex = 0;
+  size_t m_numVertices = 0;
+  /// @brief the vertex the group's indices count from, the first vertex of the buffer segment holding it
+  size_t m_baseVertex = 0;
   /// @brief overloaded < operator for mesh sorting
   bool operator<(const MeshData &_r) const { return m_material < _r.m_material; }
 };
 
+/// @brief a run of groups with the same material whose index ranges are contiguous and in one buffer segment
+/// so they can be drawn with one call
+struct DrawBatch
+{
+  /// @brief the material of every group in the batch
+  std::string m_material;
+  /// @brief the index range covering all the groups
+  size_t m_startIndex;
+  size_t m_numVerts;
+  /// @brief the groups in the batch, some may be empty
+  size_t m_firstMesh;
+  size_t m_numMeshes;
+};
+
 class GroupedObj : public ngl::Obj
 {
 public:
-  GroupedObj(std::string_view _fname);
+  /// @brief flag to say if the VAO should be created when loading, without it the mesh can be
+  /// used for CPU side work with no GL context
+  enum class CreateVAO : bool
+  {
+    True = true,
+    False = false
+  };
+  /// @brief flag to say if the vertex data should be laid out in material order so the groups sharing a
+  /// material are drawn as one batch, without it the data stays in file order
+  enum class SortByMaterial : bool
+  {
+    True = true,
+    False = false
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor loads the mesh and optimises the triangle order of each group for the vertex cache
+  /// @param[in] _fname the obj file or packed .nmesh file to load
+  /// @param[in] _createVAO create the VAO, needs a GL context
+  /// @param[in] _cacheDir where to cache the optimised triangle order, empty to always optimise
+  /// @param[in] _sort lay the data out in material order to batch the draws
+  /// @param[in] _threads the threads packing and optimising may use, 0 for all of them
+  //----------------------------------------------------------------------------------------------------------------------
+  GroupedObj(std::string_view _fname, CreateVAO _createVAO = CreateVAO::True, const std::string &_cacheDir = std::string(),
+             SortByMaterial _sort = SortByMaterial::True, unsigned int _threads = 0);
   bool load(std::string_view _fname, CalcBB _calcBB = CalcBB::True) noexcept override;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief load several meshes at once without VAOs, each on a thread of its own. Call upload on each one to
+  /// give it a VAO of its own, or combine them to draw them all from one
+  /// @param[in] _paths the obj or .nmesh files to load
+  /// @param[in] _threads the threads to load on, 0 for all of them. They are split between the models and the
+  /// packing and optimising inside each one, so this is the most threads the whole load uses
+  /// @param[in] _cacheDir where to cache the optimised triangle order, empty to always optimise
+  /// @returns the meshes in the order of _paths, null for any that failed to load
+  //----------------------------------------------------------------------------------------------------------------------
+  static std::vector<std::shared_ptr<GroupedObj>> loadMany(const std::vector<std::string> &_paths,
+                                                           unsigned int _threads = 0,
+                                                           const std::string &_cacheDir = std::string());
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief concatenate meshes loaded without VAOs into one so they share a VAO, the groups keep their names and
+  /// are sorted by material across all of them. Call upload on the result to create the VAO
+  /// @param[in] _meshes the meshes to combine, they must still have their CPU data
+  /// @returns the combined mesh or null if any mesh is missing
+  //----------------------------------------------------------------------------------------------------------------------
+  static std::shared_ptr<GroupedObj> combine(const std::vector<std::shared_ptr<GroupedObj>> &_meshes);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief create the VAO of a mesh loaded with CreateVAO::False, needs a current GL context
+  //----------------------------------------------------------------------------------------------------------------------
+  void upload();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief create the VAO of a mesh loaded with CreateVAO::False but leave its buffers empty, the groups are
+  /// then filled with uploadGroup. Needs the GL context the mesh is drawn with as VAOs are not shared
+  //----------------------------------------------------------------------------------------------------------------------
+  void allocateVAO();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief copy the vertices and indices of one group into the buffers made by allocateVAO. This only uses
+  /// the buffer ids so it can run on another thread with a context sharing the one used by allocateVAO
+  /// @param[in] _meshID the index of the mesh group
+  /// @returns false if there is no VAO
+  //----------------------------------------------------------------------------------------------------------------------
+  bool uploadGroup(size_t _meshID) const;
   void debugPrint();
   void draw(size_t _meshID) const;
   size_t numMeshes() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the draw batches in material order, each covers one or more groups whose data is contiguous.
+  /// The per group ranges are still there for culling, picking and partial uploads
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t numBatches() const { return m_batches.size(); }
+  const DrawBatch &getBatch(size_t _batchID) const { return m_batches[_batchID]; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draw every group of a batch with one call
+  /// @param[in] _batchID the index of the batch
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawBatch(size_t _batchID) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draw a run of neighbouring groups with one call, their data is contiguous in the layout order
+  /// @param[in] _first the index of the first group
+  /// @param[in] _count the number of groups
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawGroups(size_t _first, size_t _count) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draw the groups of a batch from DrawElementsIndirectCommand records in the bound
+  /// GL_DRAW_INDIRECT_BUFFER, one record per group of the batch starting at _offset
+  /// @param[in] _batchID the index of the batch
+  /// @param[in] _offset the byte offset of the first record
+  /// @param[in] _countOffset if not negative the byte offset of the record count in the bound GL_PARAMETER_BUFFER
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawBatchIndirect(size_t _batchID, GLintptr _offset, GLintptr _countOffset = -1) const;
   std::string getMaterial(unsigned int _m) const;
   std::string getName(unsigned int _m) const;
   bool parseGroup(std::vector<std::string> &_tokens) noexcept;
   bool parseMaterial(std::vector<std::string> &_tokens) noexcept;
   bool parseFace(std::vector<std::string> &_tokens) noexcept override;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief access the mesh information for a group
+  /// @param[in] _meshID the index of the mesh group
+  //----------------------------------------------------------------------------------------------------------------------
+  const MeshData &getMeshData(size_t _meshID) const { return m_meshes[_meshID]; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief replace the vertex data of a single group in the VAO, only the welded vertices of the group are
+  /// uploaded. drawVertexData and (unless released) vertexData are updated too so the CPU side queries see it
+  /// @param[in] _meshID the index of the mesh group
+  /// @param[in] _data the new vertex data in vertexData order, must be exactly m_numVerts long
+  /// @returns false if the data does not match the group size
+  //----------------------------------------------------------------------------------------------------------------------
+  bool updateMesh(size_t _meshID, const std::vector<VertData> &_data);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief take the data of a re-loaded copy of the same file (loaded without a VAO, so it can be done on
+  /// another thread). If every non empty group still has the same name, material and size only the vertex and
+  /// index ranges of the groups that changed are uploaded, otherwise the VAO is re-created. Any vertex
+  /// lighting is lost when the VAO is re-created
+  /// @param[in] _fresh the re-loaded mesh
+  /// @returns the number of groups changed
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t patch(const GroupedObj &_fresh);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief map the welded vertex data of a single group for writing, the old contents are invalidated so
+  /// all m_numVertices elements must be written (in drawVertexData order) before calling unmapMesh. Only the
+  /// buffer changes, the CPU copies (and so collision, the BVH and AO bake, patch and combine) keep the data
+  /// as loaded and gpuDataEdited is set until a patch or re-build uploads them again
+  /// @param[in] _meshID the index of the mesh group
+  /// @returns the mapped data or nullptr on failure
+  //----------------------------------------------------------------------------------------------------------------------
+  VertData *mapMesh(size_t _meshID);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief orphan the vertex buffers before re-writing every group (each frame), so the writes don't wait for
+  /// the draws still reading the old data. Every group must then be mapped and written before it is drawn
+  //----------------------------------------------------------------------------------------------------------------------
+  void orphanMeshes();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief unmap the data mapped with mapMesh
+  //----------------------------------------------------------------------------------------------------------------------
+  void unmapMesh();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief has the buffer been written with mapMesh since the CPU copies were last uploaded, if so what is
+  /// drawn is not what vertexData / drawVertexData hold
+  //----------------------------------------------------------------------------------------------------------------------
+  bool gpuDataEdited() const { return m_gpuEdited; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief set the baked lighting for every vertex, this is bound to attribute location 3 (inLight). The
+  /// values of the corners welded into one vertex are averaged
+  /// @param[in] _light one RGB value per vertex in vertexData order
+  /// @returns false if the data does not match the vertex count
+  //----------------------------------------------------------------------------------------------------------------------
+  bool setVertexLighting(const std::vector<ngl::Vec3> &_light);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the stats for the data uploaded using updateMesh / mapMesh
+  //----------------------------------------------------------------------------------------------------------------------
+  const VAO::UploadStats &uploadStats() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the packed vertex data as uploaded to the VAO, 3 verts per triangle in m_meshes offset order
+  //----------------------------------------------------------------------------------------------------------------------
+  const std::vector<VertData> &vertexData() const { return m_vertexData; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the welded vertices in the VAO and the index buffer drawn, index i plus the group's m_baseVertex
+  /// is the vertex used by element i of vertexData so the m_startIndex / m_numVerts ranges apply to both
+  //----------------------------------------------------------------------------------------------------------------------
+  const std::vector<VertData> &drawVertexData() const { return m_drawVertices; }
+  const std::vector<GLuint> &indices() const { return m_indices; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the buffer segments the data is split into, each index counts from the first vertex of its segment.
+  /// There is one unless the data is bigger than the buffer limit
+  //----------------------------------------------------------------------------------------------------------------------
+  const std::vector<VAO::Segment> &segments() const { return m_segments; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the largest vertex or index buffer a mesh loaded after this call is split to fit, default 1 GB
+  //----------------------------------------------------------------------------------------------------------------------
+  static void setBufferLimit(size_t _bytes) { s_bufferLimit = std::max<size_t>(_bytes, sizeof(VertData) * 3); }
+  static size_t bufferLimit() { return s_bufferLimit; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the FIFO cache stats of the index buffer before and after optimising and the time taken in ms
+  //----------------------------------------------------------------------------------------------------------------------
+  const vertexcache::CacheStats &cacheStatsBefore() const { return m_cacheBefore; }
+  const vertexcache::CacheStats &cacheStatsAfter() const { return m_cacheAfter; }
+  double optimiseTime() const { return m_optimiseTime; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a hash of the packed data and groups, use to key data cached to disk
+  //----------------------------------------------------------------------------------------------------------------------
+  uint64_t hash() const { return m_hash; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief approximate bytes held on the CPU (the obj data plus the packed copy) and in the VAO
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t cpuBytes() const;
+  size_t gpuBytes() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add the geometry and index bytes to a report
+  //----------------------------------------------------------------------------------------------------------------------
+  void memoryUsage(MemoryReport &io_report) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief opt in to freeing the CPU copies once the VAO exists. The obj data and the per corner vertexData
+  /// are freed, the welded drawVertexData / indices used for picking are kept. Anything reading vertexData
+  /// (the AO bake, BVH, software renderer and texture streamer setGroups) must be done before this is called
+  //----------------------------------------------------------------------------------------------------------------------
+  void releaseCPUData();
+  bool cpuDataReleased() const { return m_vertexData.empty() && !m_indices.empty(); }
 
 private:
+  /// @brief an empty mesh for combine to fill
+  GroupedObj() = default;
   std::vector<MeshData> m_meshes;
+  std::vector<DrawBatch> m_batches;
   MeshData m_currentMesh;
   std::string m_currentMeshName;
   std::string m_currentMaterial;
-  unsigned int m_faceCount;
-  unsigned int m_offset;
+  /// @brief the parser state, the corners read in the current group and where it starts
+  size_t m_faceCount = 0;
+  size_t m_offset = 0;
+  /// @brief a group has been started so the next g line must store it
+  bool m_inGroup = false;
+  /// @brief the position, uv and normal index of each triangle corner, 3 per triangle. Kept flat rather than
+  /// in ngl::Face so parsing doesn't allocate per face. 64 bit so a scan can have more than 4G positions
+  std::vector<uint64_t> m_faceVerts;
+  std::vector<uint64_t> m_faceUVs;
+  std::vector<uint64_t> m_faceNorms;
+  /// @brief the packed vertex data we upload to the VAO, kept for the CPU side queries
+  std::vector<VertData> m_vertexData;
+  /// @brief the hash of m_vertexData and m_meshes
+  uint64_t m_hash = 0;
+  /// @brief the welded vertices and the indices into them, one per element of m_vertexData
+  std::vector<VertData> m_drawVertices;
+  std::vector<GLuint> m_indices;
+  /// @brief set by mapMesh, the buffer no longer matches m_drawVertices
+  bool m_gpuEdited = false;
+  std::vector<VAO::Segment> m_segments;
+  static inline size_t s_bufferLimit = size_t(1) << 30;
+  std::string m_cacheDir;
+  /// @brief the threads packVertexData and optimiseVertexOrder may use, 0 for all of them
+  unsigned int m_threads = 0;
+  vertexcache::CacheStats m_cacheBefore;
+  vertexcache::CacheStats m_cacheAfter;
+  double m_optimiseTime = 0.0;
+  void computeHash();
+  void packVertexData();
+  size_t objDataBytes() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief load the groups and packed vertex data from a file written by SponzaConvert
+  //----------------------------------------------------------------------------------------------------------------------
+  bool loadMeshFile(std::string_view _fname);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief weld each group, re-order its triangles for the vertex cache and overdraw then its vertices for
+  /// fetch order. The triangles of m_vertexData are re-ordered to match
+  //----------------------------------------------------------------------------------------------------------------------
+  void optimiseVertexOrder();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief move the corners, welded vertices and indices of each group into m_meshes order so the groups
+  /// sharing a material sit next to each other. Corners outside every group are never drawn and are dropped
+  //----------------------------------------------------------------------------------------------------------------------
+  void sortByMaterial();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief join the runs of same material groups with contiguous ranges into m_batches
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildBatches();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief split the weld ranges (the groups plus any corners between them) into m_segments, the caller then
+  /// writes the indices of each range counting from its base vertex
+  /// @param[in] _ranges the vertex and index range of each weld range in layout order
+  /// @returns the base vertex of each range, the first vertex of its segment
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<size_t> planSegments(const std::vector<VAO::Segment> &_ranges);
   void createVAO(ResetVAO _reset = ResetVAO::False) noexcept override;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief make the VAO and its buffers, filling them if _fill is set
+  //----------------------------------------------------------------------------------------------------------------------
+  void buildVAO(bool _fill);
 };
 
 #endif
@@ -0,0 +1,122 @@
+#ifndef LINEREADER_H_
+#define LINEREADER_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file LineReader.h
+/// @brief reads a text file a line at a time for the obj and mtl parsers. A thread of its own reads the file,
+/// decompressing .gz (zlib) and .zst (zstd) files as it goes, and cuts the text into blocks at line ends.
+/// The blocks are handed to the parser through a bounded queue so reading and decompressing overlap the
+/// parsing, the uncompressed text never goes to disk and at most a few blocks of it are held at once.
+/// Define SPONZA_HAVE_ZLIB / SPONZA_HAVE_ZSTD (the CMake file does if it finds them) to read each format.
+//----------------------------------------------------------------------------------------------------------------------
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+/// @brief the read settings
+struct LineReaderSettings
+{
+  /// @brief the text in a block, a block is cut at the last line end after this many bytes
+  size_t blockBytes = size_t(1) << 20;
+  /// @brief the blocks waiting for the parser before the reader thread stops to let it catch up
+  size_t maxBlocks = 8;
+  /// @brief the file bytes read at once
+  size_t readBytes = size_t(256) << 10;
+};
+
+class LineReader
+{
+public:
+  enum class Codec
+  {
+    None,
+    Gzip,
+    Zstd
+  };
+  struct Stats
+  {
+    /// @brief the bytes read from the file and the text they expanded to
+    size_t m_fileBytes = 0;
+    size_t m_textBytes = 0;
+    /// @brief the time the thread spent reading and decompressing, and the time the parser waited for it
+    double m_readSeconds = 0.0;
+    double m_waitSeconds = 0.0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the codec for a file from its extension
+  //----------------------------------------------------------------------------------------------------------------------
+  static Codec codecOf(std::string_view _path);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor opens the file and starts the reader thread
+  //----------------------------------------------------------------------------------------------------------------------
+  LineReader(const std::string &_path, const LineReaderSettings &_settings = LineReaderSettings());
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief dtor stops the thread, the rest of the file is not read
+  //----------------------------------------------------------------------------------------------------------------------
+  ~LineReader();
+  LineReader(const LineReader &) = delete;
+  LineReader &operator=(const LineReader &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief false if the file could not be opened or needs a codec this build does not have
+  //----------------------------------------------------------------------------------------------------------------------
+  bool isOpen() const { return m_file != nullptr; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the next line without its line end, \n, \r\n and \r all end a line
+  /// @returns false at the end of the text or if the file is corrupt
+  //----------------------------------------------------------------------------------------------------------------------
+  bool getline(std::string &o_line);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief true if the read or decompression failed, the lines before the error were still returned
+  //----------------------------------------------------------------------------------------------------------------------
+  bool failed() const;
+  Codec codec() const { return m_codec; }
+  Stats stats() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief print the bytes read against the text size and how much of the read the parser waited for
+  /// @param[in] _seconds the end to end load time to report with them
+  //----------------------------------------------------------------------------------------------------------------------
+  void printStats(std::ostream &_out, double _seconds) const;
+
+private:
+  void readLoop();
+  bool decompress();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add decompressed text, the whole lines in it are queued once there is a block of them
+  //----------------------------------------------------------------------------------------------------------------------
+  bool emit(const char *_data, size_t _size, bool _last);
+  bool push(std::string &&_block);
+
+  LineReaderSettings m_settings;
+  std::string m_path;
+  Codec m_codec = Codec::None;
+  std::FILE *m_file = nullptr;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the text of the next block and the time spent waiting for room in the queue, only touched by
+  /// the reader thread
+  //----------------------------------------------------------------------------------------------------------------------
+  std::string m_pending;
+  double m_blockedSeconds = 0.0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the block being parsed and the position in it, only touched by the parser
+  //----------------------------------------------------------------------------------------------------------------------
+  std::string m_block;
+  size_t m_pos = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the queue between the threads
+  //----------------------------------------------------------------------------------------------------------------------
+  mutable std::mutex m_lock;
+  std::condition_variable m_ready;
+  std::condition_variable m_space;
+  std::deque<std::string> m_blocks;
+  bool m_done = false;
+  bool m_failed = false;
+  bool m_quit = false;
+  Stats m_stats;
+  std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef MEMORYREPORT_H_
+#define MEMORYREPORT_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file MemoryReport.h
+/// @brief a breakdown of the CPU and GPU bytes held by each subsystem (geometry, indices, textures per
+/// material, shader programs). Each class adds its own entries with memoryUsage(MemoryReport &), so a scene
+/// builds a report by asking everything it owns. GPU sizes are what we asked the driver for, it may pad them.
+//----------------------------------------------------------------------------------------------------------------------
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+struct MemoryUsage
+{
+  std::string m_subsystem;
+  std::string m_name;
+  size_t m_cpuBytes = 0;
+  size_t m_gpuBytes = 0;
+};
+
+class MemoryReport
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add an entry
+  /// @param[in] _subsystem the group the entry is totalled under, such as "geometry" or "textures"
+  /// @param[in] _name what the bytes are, such as a material name
+  //----------------------------------------------------------------------------------------------------------------------
+  void add(const std::string &_subsystem, const std::string &_name, size_t _cpuBytes, size_t _gpuBytes);
+  const std::vector<MemoryUsage> &entries() const { return m_entries; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the total bytes of one subsystem, or of everything if _subsystem is empty
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t cpuBytes(const std::string &_subsystem = std::string()) const;
+  size_t gpuBytes(const std::string &_subsystem = std::string()) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief print the totals of each subsystem, with each entry if _detail is set
+  //----------------------------------------------------------------------------------------------------------------------
+  void print(std::ostream &_out, bool _detail = false) const;
+
+private:
+  std::vector<MemoryUsage> m_entries;
+};
+
+#endif
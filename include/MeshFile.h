@@ -0,0 +1,53 @@
+#ifndef MESHFILE_H_
+#define MESHFILE_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file MeshFile.h
+/// @brief the packed binary mesh format written by SponzaConvert and loaded directly by GroupedObj. The
+/// file is a header (the group table and bounds) followed by the packed triangle corners exactly as
+/// GroupedObj::vertexData holds them (8 floats x,y,z,nx,ny,nz,u,v per corner), so loading is one read
+/// with no parsing. Groups of the same material are stored next to each other.
+//----------------------------------------------------------------------------------------------------------------------
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace meshfile
+{
+/// @brief the extension GroupedObj uses to pick the binary loader
+constexpr char c_extension[] = ".nmesh";
+/// @brief floats per corner, must match VertData
+constexpr size_t c_floatsPerCorner = 8;
+
+/// @brief a group as stored, the start and count are in corners (3 per triangle)
+struct Group
+{
+  std::string m_name;
+  std::string m_material;
+  uint64_t m_startIndex = 0;
+  uint64_t m_numVerts = 0;
+};
+
+struct Header
+{
+  std::vector<Group> m_groups;
+  float m_min[3] = {0.0f, 0.0f, 0.0f};
+  float m_max[3] = {0.0f, 0.0f, 0.0f};
+  uint64_t m_numCorners = 0;
+};
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief write the header, the corners must follow it
+//----------------------------------------------------------------------------------------------------------------------
+bool writeHeader(std::ostream &_out, const Header &_header);
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief read and check the header, the stream is left at the first corner
+//----------------------------------------------------------------------------------------------------------------------
+bool readHeader(std::istream &_in, Header &o_header);
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief does the path name a packed mesh file
+//----------------------------------------------------------------------------------------------------------------------
+bool isMeshFile(std::string_view _path);
+} // end namespace meshfile
+
+#endif
@@ -13,8 +13,10 @@
 /// @brief Alias MTL loader and accessor
 /// @todo add serialisation to save the data to binary formats for quick read / write
 #include <ngl/Vec3.h>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 /* @note the illum section is as follows should enum at some stage
 0		Color on and Ambient off
@@ -62,6 +64,15 @@ typedef struct
 
 } mtlItem;
 
+namespace ngl
+{
+class Texture;
+}
+class MemoryReport;
+class ResourceManager;
+struct TextureResource;
+class TextureStreamer;
+
 class Mtl
 {
 public:
@@ -97,6 +108,39 @@ public:
   /// only load them once, we then associate the id's in the mtlItem structure
   //----------------------------------------------------------------------------------------------------------------------
   void loadTextures();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief turn the texture loading done by load on or off, turn it off to load the textures in parts with
+  /// texturesToLoad and addTexture (decoding them on other threads)
+  //----------------------------------------------------------------------------------------------------------------------
+  void setLoadTextures(bool _load) { m_loadTextures = _load; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the texture files used by the materials that have not been loaded yet, each named once
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<std::string> texturesToLoad() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief upload a texture decoded elsewhere and point the materials using it at it, needs the GL context.
+  /// With a streamer the image is ignored and the streamer loads the file itself
+  /// @param[in] _name the texture as named in the mtl file
+  /// @param[in] _image the decoded image
+  //----------------------------------------------------------------------------------------------------------------------
+  void addTexture(const std::string &_name, const ngl::Texture &_image);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief point the materials using a texture at one already uploaded by the ResourceManager, on another
+  /// context say. Doesn't need GL
+  /// @param[in] _name the texture as named in the mtl file
+  /// @param[in] _texture the shared texture, held until clear
+  //----------------------------------------------------------------------------------------------------------------------
+  void addTexture(const std::string &_name, std::shared_ptr<TextureResource> _texture);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief get textures from a ResourceManager rather than loading our own, so materials sharing files
+  /// share the GL textures. Call before load, the manager must outlive this
+  //----------------------------------------------------------------------------------------------------------------------
+  void setResourceManager(ResourceManager *_resources) { m_resources = _resources; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief stream the mip levels of the textures on demand rather than loading them in full, this takes
+  /// priority over a ResourceManager. Call before load, the streamer owns the textures and must outlive this
+  //----------------------------------------------------------------------------------------------------------------------
+  void setTextureStreamer(TextureStreamer *_streamer) { m_streamer = _streamer; }
 
   std::string convertToPath(std::string _p) const;
   //----------------------------------------------------------------------------------------------------------------------
@@ -138,13 +182,38 @@ public:
   /// @returns true or false depending upon success
   //----------------------------------------------------------------------------------------------------------------------
   bool loadBinary(const std::string &_fname);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief re-read the mtl file after an edit and update only the materials whose values changed, textures
+  /// not already loaded are loaded and the others are left alone. Materials removed from the file are kept
+  /// as the mesh may still use them
+  /// @param[in] _fname the name of the file to load
+  /// @param[out] o_changed the names of the materials that were added or changed
+  /// @returns false if the file could not be read
+  //----------------------------------------------------------------------------------------------------------------------
+  bool reload(const std::string &_fname, std::vector<std::string> &o_changed);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief re-load a texture file after an edit and point every material using it at the new image
+  /// @param[in] _name the texture as named in the mtl file
+  /// @returns false if the texture is not one of ours or could not be re-loaded
+  //----------------------------------------------------------------------------------------------------------------------
+  bool reloadTexture(const std::string &_name);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the texture files used by the materials
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<std::string> textureNames() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add the material data and the texture bytes of each material to a report, a texture shared by
+  /// several materials is counted once under the first of them by name. Needs a current GL context as the
+  /// sizes are read back from the textures so partly resident streamed textures are counted correctly
+  //----------------------------------------------------------------------------------------------------------------------
+  void memoryUsage(MemoryReport &io_report) const;
 
 private:
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief a flag to indicate if we should load textures when reading file
   /// as this takes time we may just skip for later be default flag is on
   //----------------------------------------------------------------------------------------------------------------------
-  bool m_loadTextures;
+  bool m_loadTextures = true;
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief map used to store the material for name lookup
   //----------------------------------------------------------------------------------------------------------------------
@@ -152,7 +221,7 @@ private:
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief current item used in the parser for storing values
   //----------------------------------------------------------------------------------------------------------------------
-  mtlItem *m_current;
+  mtlItem *m_current = nullptr;
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief name of the current material being parsed used for map
   //----------------------------------------------------------------------------------------------------------------------
@@ -161,6 +230,24 @@ private:
   /// @brief a list  of texture id's loaded so we can delete them in dtor
   //----------------------------------------------------------------------------------------------------------------------
   std::vector<GLuint> m_textureID;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief handles to the shared textures when using a ResourceManager
+  //----------------------------------------------------------------------------------------------------------------------
+  ResourceManager *m_resources = nullptr;
+  TextureStreamer *m_streamer = nullptr;
+  std::vector<std::shared_ptr<TextureResource>> m_textureHandles;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the GL id of each texture file loaded, so each file is only loaded once
+  //----------------------------------------------------------------------------------------------------------------------
+  std::unordered_map<std::string, GLuint> m_textureNames;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief load a single texture using the streamer, the manager or directly
+  //----------------------------------------------------------------------------------------------------------------------
+  GLuint loadTexture(const std::string &_name);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief set the id of every material slot using the texture _name
+  //----------------------------------------------------------------------------------------------------------------------
+  void assignTexture(const std::string &_name, GLuint _id);
 };
 
 #endif
@@ -4,8 +4,22 @@
 #include <ngl/Transformation.h>
 #include "Mtl.h"
 #include "GroupedObj.h"
+#include "CollisionMesh.h"
+#include "AOBaker.h"
+#include "ShaderVariants.h"
+#include "ResourceManager.h"
+#include "TextureStreamer.h"
+#include "FileWatcher.h"
+#include "UploadThread.h"
+#include "GpuCuller.h"
+#include "PVS.h"
+#include "GeometryPager.h"
 #include <QOpenGLWindow>
+#include <chrono>
+#include <future>
+#include <limits>
 #include <memory>
+#include <thread>
 
 //----------------------------------------------------------------------------------------------------------------------
 /// @file NGLScene.h
@@ -73,9 +87,113 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     std::unique_ptr<Mtl> m_mtl;
     //----------------------------------------------------------------------------------------------------------------------
-    /// @brief the mesh to draw
+    /// @brief streams the texture mips on demand when SPONZA_STREAM_TEXTURES is set
     //----------------------------------------------------------------------------------------------------------------------
-    std::unique_ptr <GroupedObj> m_model;
+    std::unique_ptr<TextureStreamer> m_streamer;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the on disk cache of linked shader programs, process wide as the shared variants keep using it
+    //----------------------------------------------------------------------------------------------------------------------
+    ShaderCache *m_shaderCache = nullptr;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the original texture shader used for the debug views of the other maps
+    //----------------------------------------------------------------------------------------------------------------------
+    std::shared_ptr<ShaderVariants> m_textureShader;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the specialised shaders for each set of material features
+    //----------------------------------------------------------------------------------------------------------------------
+    std::shared_ptr<ShaderVariants> m_variants;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the obj or packed .nmesh file to load
+    //----------------------------------------------------------------------------------------------------------------------
+    std::string m_modelPath = "models/sponza.obj";
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the materials for it, either file can be .gz or .zst compressed
+    //----------------------------------------------------------------------------------------------------------------------
+    std::string m_mtlPath = "models/sponza.mtl";
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the mesh to draw, shared through the ResourceManager
+    //----------------------------------------------------------------------------------------------------------------------
+    std::shared_ptr<GroupedObj> m_model;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief free the CPU geometry once the GPU copy and the derived data exist
+    //----------------------------------------------------------------------------------------------------------------------
+    bool m_releaseCPU = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief collision version of the mesh used for picking and stopping the camera going through walls
+    //----------------------------------------------------------------------------------------------------------------------
+    std::unique_ptr<CollisionMesh> m_collision;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief bakes the ambient occlusion / sky lighting in the background, declared after the mesh so it
+    /// is stopped and destroyed first
+    //----------------------------------------------------------------------------------------------------------------------
+    std::unique_ptr<AOBaker> m_aoBaker;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief timer used to redraw while the bake is refining
+    //----------------------------------------------------------------------------------------------------------------------
+    int m_aoTimer = 0;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief watches the obj, mtl and texture files so edits are shown without a restart
+    //----------------------------------------------------------------------------------------------------------------------
+    std::unique_ptr<FileWatcher> m_watcher;
+    int m_watchTimer = 0;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the edited obj being parsed in the background
+    //----------------------------------------------------------------------------------------------------------------------
+    std::future<std::unique_ptr<GroupedObj>> m_pendingModel;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief culls the groups on the GPU when m_gpuCull is set (SPONZA_GPU_CULL or G), made the first frame
+    /// culling is on once the mesh is complete and again when its layout changes. It also times the frames on
+    /// the GPU while culling is on
+    //----------------------------------------------------------------------------------------------------------------------
+    std::unique_ptr<GpuCuller> m_culler;
+    bool m_gpuCull = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the groups visible from each part of the model, built offline by SponzaPVS. Groups outside the
+    /// set of the eye are skipped when not culling on the GPU, P switches it off
+    //----------------------------------------------------------------------------------------------------------------------
+    std::unique_ptr<PVS> m_pvs;
+    bool m_usePVS = true;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the last group picked with the middle mouse button. A bobs it up and down by mapping its vertices
+    /// every frame, so the per group upload path is exercised and its rate is printed when A stops it
+    //----------------------------------------------------------------------------------------------------------------------
+    size_t m_pickedGroup = std::numeric_limits<size_t>::max();
+    bool m_animateGroup = false;
+    float m_animateHeight = 0.0f;
+    std::chrono::steady_clock::time_point m_animateStart;
+    VAO::UploadStats m_animateStats;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief pages the geometry through a fixed GPU pool when SPONZA_PAGED_GEOMETRY is set, the model then
+    /// never gets a VAO of its own
+    //----------------------------------------------------------------------------------------------------------------------
+    std::unique_ptr<GeometryPager> m_pager;
+    PagerSettings m_pagerSettings;
+    bool m_paged = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the asynchronous load (SPONZA_ASYNC_LOAD). The loader thread runs the parse / decode graph and
+    /// the uploads go through the upload thread, whose completions are polled from m_uploadTimer
+    //----------------------------------------------------------------------------------------------------------------------
+    std::unique_ptr<UploadThread> m_uploader;
+    std::thread m_loader;
+    int m_uploadTimer = 0;
+    bool m_loading = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the loader has finished, once the uploads drain the scene is complete
+    //----------------------------------------------------------------------------------------------------------------------
+    bool m_sceneParsed = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the mtl has been read and m_mtl can be used on this thread
+    //----------------------------------------------------------------------------------------------------------------------
+    bool m_materialsReady = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief which groups have their geometry on the GPU while loading, empty once everything is
+    //----------------------------------------------------------------------------------------------------------------------
+    std::vector<bool> m_groupReady;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief for the time to first frame and time to complete
+    //----------------------------------------------------------------------------------------------------------------------
+    std::chrono::steady_clock::time_point m_loadStart;
+    bool m_firstFrame = true;
     //----------------------------------------------------------------------------------------------------------------------
     /// @brief choose which texture map to draw
     //----------------------------------------------------------------------------------------------------------------------
@@ -85,6 +203,76 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     void loadMatricesToShader();
     //----------------------------------------------------------------------------------------------------------------------
+    /// @brief build the global mouse transform for a given model position
+    /// @param [in] _pos the model position
+    //----------------------------------------------------------------------------------------------------------------------
+    ngl::Mat4 mouseTransform(const ngl::Vec3 &_pos) const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief move the model to _pos unless the camera would pass through the mesh
+    /// @param [in] _pos the new model position
+    /// @returns true if the move was done
+    //----------------------------------------------------------------------------------------------------------------------
+    bool moveCamera(const ngl::Vec3 &_pos);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief load the texture shader and the material variants
+    //----------------------------------------------------------------------------------------------------------------------
+    void loadShaders();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief load everything before returning, overlapping the stages with a TaskGraph
+    //----------------------------------------------------------------------------------------------------------------------
+    void loadScene();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief start loading in the background, the groups and textures are drawn as they arrive with the Kd
+    /// colour standing in for the missing textures
+    //----------------------------------------------------------------------------------------------------------------------
+    void loadSceneAsync();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief take the parsed mesh, make its VAO here and queue the upload of each group
+    //----------------------------------------------------------------------------------------------------------------------
+    void uploadModel(std::shared_ptr<GroupedObj> _model);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief called once the asynchronous load has drained to build the derived data and start watching
+    //----------------------------------------------------------------------------------------------------------------------
+    void finishLoading();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief watch the model, mtl and texture files for edits
+    //----------------------------------------------------------------------------------------------------------------------
+    void watchFiles();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief build the collision mesh and start the lighting bake for the current model
+    //----------------------------------------------------------------------------------------------------------------------
+    void buildMeshData();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief release the model's CPU geometry if SPONZA_RELEASE_CPU is set
+    //----------------------------------------------------------------------------------------------------------------------
+    void releaseMeshData();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief page the current model, writing its chunk file first if there isn't one for this layout. Falls
+    /// back to uploading the whole mesh if paging can't be set up
+    //----------------------------------------------------------------------------------------------------------------------
+    void createPager();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief apply any edits reported by the file watcher, the mtl and textures are patched straight away and
+    /// the obj is parsed on another thread then patched into the VAO once ready
+    //----------------------------------------------------------------------------------------------------------------------
+    void checkForEdits();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief patch the re-loaded obj into the model and rebuild the data derived from it
+    /// @param [in] _fresh the re-loaded mesh
+    //----------------------------------------------------------------------------------------------------------------------
+    void patchModel(const GroupedObj &_fresh);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief fire a ray through the mouse position and report the group hit
+    /// @param [in] _x the mouse x position in window coordinates
+    /// @param [in] _y the mouse y position in window coordinates
+    //----------------------------------------------------------------------------------------------------------------------
+    void pick(float _x, float _y);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief write the picked group's vertices raised by _lift into the VAO with mapMesh
+    /// @param [in] _lift added to the y of every vertex
+    //----------------------------------------------------------------------------------------------------------------------
+    void streamPickedGroup(float _lift);
+    //----------------------------------------------------------------------------------------------------------------------
     /// @brief Qt Event called when a key is pressed
     /// @param [in] _event the Qt event to query for size etc
     //----------------------------------------------------------------------------------------------------------------------
@@ -113,6 +301,11 @@ private:
     /// @param _event the Qt Event structure
     //----------------------------------------------------------------------------------------------------------------------
     void wheelEvent( QWheelEvent *_event) override;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief timer event used to pick up new bake passes and file edits
+    /// @param _event the Qt Event structure
+    //----------------------------------------------------------------------------------------------------------------------
+    void timerEvent(QTimerEvent *_event) override;
 
 
 };
@@ -0,0 +1,107 @@
+#ifndef PVS_H_
+#define PVS_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file PVS.h
+/// @brief a precomputed potentially visible set for a static GroupedObj. The bounds of the mesh are split into
+/// a grid of cube shaped view cells, rays are cast with the BVH from points sampled in each cell (the cells
+/// are shared between all the threads) and every group hit is marked visible from that cell. Groups touching
+/// a cell are always visible from it and each cell also takes the sets of its 6 neighbours to cover what the
+/// sampling missed, but it is still a sampled answer so a very small group seen through a gap can be lost.
+/// The sets are stored as PackBits compressed bitsets, each distinct set once, in a cache file keyed by the
+/// mesh hash. They are built offline by SponzaPVS and looked up each frame from the eye position, outside
+/// the grid everything is drawn.
+//----------------------------------------------------------------------------------------------------------------------
+#include "GroupedObj.h"
+#include "BVH.h"
+#include <ngl/Vec3.h>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/// @brief the build parameters
+struct PVSSettings
+{
+  /// @brief cells along the longest side of the bounds
+  int cellsOnLongestAxis = 32;
+  /// @brief points sampled in each cell and the rays cast from each one
+  unsigned int samplesPerCell = 8;
+  unsigned int raysPerSample = 256;
+  /// @brief add the sets of the 6 neighbours to each cell
+  bool dilate = true;
+  /// @brief number of threads to use, 0 means use the hardware concurrency
+  unsigned int threads = 0;
+};
+
+class PVS
+{
+public:
+  PVS() = default;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief cast the rays and build the sets
+  /// @param[in] _mesh the mesh to build for, it must still have its CPU data
+  /// @param[in] _bvh a BVH of _mesh
+  /// @param[in] _settings the build parameters
+  //----------------------------------------------------------------------------------------------------------------------
+  void build(const GroupedObj &_mesh, const BVH &_bvh, const PVSSettings &_settings = PVSSettings());
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the cache file for a mesh
+  //----------------------------------------------------------------------------------------------------------------------
+  static std::string cacheName(const std::string &_cacheDir, const GroupedObj &_mesh);
+  bool save(const std::string &_fname) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief load the sets built for _mesh
+  /// @returns false if there is no file or it was built for a different mesh
+  //----------------------------------------------------------------------------------------------------------------------
+  bool load(const std::string &_fname, const GroupedObj &_mesh);
+  bool valid() const { return !m_cellSets.empty(); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the groups potentially visible from a point, the lookup is counted in the stats
+  /// @param[in] _pos the eye in model space
+  /// @returns one flag per MeshData group, or nullptr outside the grid when everything should be drawn. The
+  /// set is valid until the next call
+  //----------------------------------------------------------------------------------------------------------------------
+  const std::vector<char> *visibleFrom(const ngl::Vec3 &_pos);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the size of the grid, the bytes stored and what plain bitsets for every cell would take
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t numCells() const { return m_cellSets.size(); }
+  size_t numSets() const { return m_sets.size(); }
+  size_t storedBytes() const;
+  size_t rawBytes() const { return numCells() * ((m_numGroups + 7) / 8); }
+  double buildTime() const { return m_buildTime; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief print the size and the average share of the groups culled by the lookups since the last call
+  //----------------------------------------------------------------------------------------------------------------------
+  void printStats(std::ostream &_out);
+
+private:
+  uint64_t m_hash = 0;
+  size_t m_numGroups = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the corner of the grid, the size of a cell and the number of cells along each axis
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_min[3] = {0.0f, 0.0f, 0.0f};
+  float m_cellSize = 1.0f;
+  int m_dims[3] = {0, 0, 0};
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the set of each cell (x fastest) and the distinct compressed sets
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<uint32_t> m_cellSets;
+  std::vector<std::vector<uint8_t>> m_sets;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the last set expanded for visibleFrom and the number of groups in it
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t m_current = ~0u;
+  std::vector<char> m_visible;
+  size_t m_numVisible = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the lookups since the last printStats, the number outside the grid and the groups they left in
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t m_lookups = 0;
+  size_t m_outside = 0;
+  size_t m_visibleSum = 0;
+  double m_buildTime = 0.0;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file Parallel.h
+/// @brief a very small helper to split a loop over a number of std::threads, the work is handed out in
+/// chunks using an atomic counter so uneven work loads balance themselves.
+//----------------------------------------------------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace parallel
+{
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief the number of threads to use if the caller passes 0
+//----------------------------------------------------------------------------------------------------------------------
+inline unsigned int numThreads(unsigned int _requested = 0)
+{
+  if (_requested != 0)
+  {
+    return _requested;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief call _func(i) for i in [_begin,_end) using _threads threads (the calling thread is one of them)
+/// @param[in] _begin the first index
+/// @param[in] _end one past the last index
+/// @param[in] _func the function to call, must be safe to call concurrently
+/// @param[in] _threads number of threads 0 means hardware concurrency
+/// @param[in] _chunk how many indices a thread grabs at a time
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Func>
+void forEach(size_t _begin, size_t _end, Func &&_func, unsigned int _threads = 0, size_t _chunk = 64)
+{
+  if (_end <= _begin)
+  {
+    return;
+  }
+  unsigned int threads = numThreads(_threads);
+  _chunk = std::max<size_t>(1, _chunk);
+  threads = static_cast<unsigned int>(std::min<size_t>(threads, (_end - _begin + _chunk - 1) / _chunk));
+  std::atomic<size_t> next{_begin};
+  auto worker = [&]()
+  {
+    for (;;)
+    {
+      size_t start = next.fetch_add(_chunk);
+      if (start >= _end)
+      {
+        break;
+      }
+      size_t end = std::min(_end, start + _chunk);
+      for (size_t i = start; i < end; ++i)
+      {
+        _func(i);
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned int t = 1; t < threads; ++t)
+  {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : pool)
+  {
+    t.join();
+  }
+}
+} // end namespace parallel
+
+#endif
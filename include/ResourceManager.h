@@ -0,0 +1,164 @@
+#ifndef RESOURCEMANAGER_H_
+#define RESOURCEMANAGER_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file ResourceManager.h
+/// @brief a shared cache of meshes, textures and shader programs. Resources are handed out as shared_ptr
+/// handles keyed by their source path, so loading the same asset again (another scene in the same review
+/// session, or two materials using one texture) just returns the existing copy. The manager keeps a
+/// reference to everything it loads; once no one else holds a handle the resource is unreferenced but
+/// stays cached until the CPU or GPU byte budget is exceeded, then unreferenced resources are released
+/// in least recently used order. Entries remember the modification time of the source file (and meshes
+/// their content hash) so if the file changes on disk the next request reloads it.
+/// The cached copy always matches its file, so a user that changes a mesh (patching it, baking lighting into
+/// it, releasing its CPU data) detaches it first. GL resources are freed as entries go, so purge with the
+/// context current before it is destroyed, the manager itself only goes at static exit.
+//----------------------------------------------------------------------------------------------------------------------
+#include "GroupedObj.h"
+#include "ShaderVariants.h"
+#include <ngl/Types.h>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ngl
+{
+class Texture;
+}
+
+/// @brief a GL texture owned by the ResourceManager, deleted when the last handle goes
+struct TextureResource
+{
+  GLuint m_id = 0;
+  int m_width = 0;
+  int m_height = 0;
+  TextureResource() = default;
+  TextureResource(const TextureResource &) = delete;
+  TextureResource &operator=(const TextureResource &) = delete;
+  ~TextureResource()
+  {
+    if (m_id != 0)
+    {
+      glDeleteTextures(1, &m_id);
+    }
+  }
+};
+
+class ResourceManager
+{
+public:
+  enum class Kind : int
+  {
+    Mesh = 0,
+    Texture = 1,
+    Program = 2
+  };
+  /// @brief usage counters, the byte counts include unreferenced resources still in the cache
+  struct Stats
+  {
+    size_t m_count[3] = {0, 0, 0};
+    size_t m_cpuBytes[3] = {0, 0, 0};
+    size_t m_gpuBytes[3] = {0, 0, 0};
+    size_t m_unreferenced = 0;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+    size_t m_evictions = 0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the manager shared by every scene in the process
+  //----------------------------------------------------------------------------------------------------------------------
+  static ResourceManager &instance();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor
+  /// @param[in] _cpuBudget the CPU bytes to allow before evicting
+  /// @param[in] _gpuBudget the GPU bytes to allow before evicting
+  //----------------------------------------------------------------------------------------------------------------------
+  ResourceManager(size_t _cpuBudget = size_t(1) << 30, size_t _gpuBudget = size_t(1) << 30);
+  ResourceManager(const ResourceManager &) = delete;
+  ResourceManager &operator=(const ResourceManager &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief change the budget, this evicts straight away if we are now over it
+  //----------------------------------------------------------------------------------------------------------------------
+  void setBudget(size_t _cpuBytes, size_t _gpuBytes);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief get a mesh, loading it (and creating the VAO) if needed, needs a current GL context
+  /// @param[in] _path the obj file
+  /// @param[in] _cacheDir where the mesh caches its optimised triangle order
+  /// @param[in] _parsed the mesh already loaded without a VAO (on another thread) to use if it isn't cached
+  /// @returns the mesh or nullptr if the file could not be loaded
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<GroupedObj> mesh(const std::string &_path, const std::string &_cacheDir = std::string(),
+                                   std::shared_ptr<GroupedObj> _parsed = nullptr);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief get a texture, loading it and uploading it with mip maps if needed
+  /// @param[in] _path the image file
+  /// @param[in] _decoded the image already decoded (on another thread) to upload if it isn't cached
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<TextureResource> texture(const std::string &_path, const ngl::Texture *_decoded = nullptr);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the cached mesh / texture for a file if it is loaded and up to date, nothing is loaded so a
+  /// caller can check before paying for the parse or decode it would hand to mesh or texture
+  /// @returns nullptr if it is not cached
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<GroupedObj> cachedMesh(const std::string &_path);
+  std::shared_ptr<TextureResource> cachedTexture(const std::string &_path);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief get the shader variants for a vertex / fragment pair
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<ShaderVariants> shaders(const std::string &_baseName, const std::string &_vertex,
+                                          const std::string &_fragment, ShaderCache *_cache = nullptr);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief evict unreferenced resources in LRU order until we are within budget
+  //----------------------------------------------------------------------------------------------------------------------
+  void trim();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief evict every unreferenced resource
+  //----------------------------------------------------------------------------------------------------------------------
+  void purge();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief take a mesh out of the cache before changing it, later requests for its file load it again rather
+  /// than getting the changed copy
+  /// @returns false if the mesh was not cached (never was or has already been detached)
+  //----------------------------------------------------------------------------------------------------------------------
+  bool detach(const std::shared_ptr<GroupedObj> &_mesh);
+  Stats stats() const;
+  void printStats() const;
+
+private:
+  struct Entry
+  {
+    Kind m_kind;
+    std::shared_ptr<void> m_resource;
+    size_t m_cpuBytes = 0;
+    size_t m_gpuBytes = 0;
+    uint64_t m_lastUse = 0;
+    uint64_t m_hash = 0;
+    std::filesystem::file_time_type m_fileTime;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief look up a resource or load it with _load, which fills in the entry
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<void> acquire(Kind _kind, const std::string &_key, const std::string &_path,
+                                const std::function<bool(Entry &)> &_load);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the resource for _key if it was loaded from _path as it is now, counted as a hit
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<void> lookup(const std::string &_key, std::filesystem::file_time_type _time);
+  void trimLocked(size_t _cpuBudget, size_t _gpuBudget);
+
+  mutable std::mutex m_lock;
+  std::unordered_map<std::string, Entry> m_entries;
+  size_t m_cpuBudget;
+  size_t m_gpuBudget;
+  size_t m_cpuBytes = 0;
+  size_t m_gpuBytes = 0;
+  uint64_t m_clock = 0;
+  size_t m_hits = 0;
+  size_t m_misses = 0;
+  size_t m_evictions = 0;
+};
+
+#endif
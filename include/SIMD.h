@@ -0,0 +1,126 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file SIMD.h
+/// @brief a minimal 4 wide float type used by the BVH packet code and the software rasterizer.
+/// It uses SSE if we have it else plain scalar code the compiler may vectorize. Comparisons return a
+/// mask which can be used with select4 / mask4.
+//----------------------------------------------------------------------------------------------------------------------
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_USE_SSE 1
+#endif
+
+namespace simd
+{
+#ifdef SIMD_USE_SSE
+struct Float4
+{
+  __m128 v;
+  Float4() = default;
+  Float4(__m128 _v) : v(_v) {}
+  explicit Float4(float _f) : v(_mm_set1_ps(_f)) {}
+  static Float4 load(const float *_p) { return Float4(_mm_load_ps(_p)); }
+  static Float4 loadu(const float *_p) { return Float4(_mm_loadu_ps(_p)); }
+  static Float4 set(float _a, float _b, float _c, float _d) { return Float4(_mm_setr_ps(_a, _b, _c, _d)); }
+  void store(float *_p) const { _mm_storeu_ps(_p, v); }
+};
+inline Float4 operator+(Float4 _a, Float4 _b) { return _mm_add_ps(_a.v, _b.v); }
+inline Float4 operator-(Float4 _a, Float4 _b) { return _mm_sub_ps(_a.v, _b.v); }
+inline Float4 operator*(Float4 _a, Float4 _b) { return _mm_mul_ps(_a.v, _b.v); }
+inline Float4 operator/(Float4 _a, Float4 _b) { return _mm_div_ps(_a.v, _b.v); }
+inline Float4 min4(Float4 _a, Float4 _b) { return _mm_min_ps(_a.v, _b.v); }
+inline Float4 max4(Float4 _a, Float4 _b) { return _mm_max_ps(_a.v, _b.v); }
+inline Float4 operator<(Float4 _a, Float4 _b) { return _mm_cmplt_ps(_a.v, _b.v); }
+inline Float4 operator<=(Float4 _a, Float4 _b) { return _mm_cmple_ps(_a.v, _b.v); }
+inline Float4 operator>(Float4 _a, Float4 _b) { return _mm_cmpgt_ps(_a.v, _b.v); }
+inline Float4 operator>=(Float4 _a, Float4 _b) { return _mm_cmpge_ps(_a.v, _b.v); }
+inline Float4 operator&(Float4 _a, Float4 _b) { return _mm_and_ps(_a.v, _b.v); }
+inline Float4 operator|(Float4 _a, Float4 _b) { return _mm_or_ps(_a.v, _b.v); }
+inline int mask4(Float4 _a) { return _mm_movemask_ps(_a.v); }
+// per lane _m ? _a : _b where _m is a comparison result
+inline Float4 select4(Float4 _m, Float4 _a, Float4 _b) { return _mm_or_ps(_mm_and_ps(_m.v, _a.v), _mm_andnot_ps(_m.v, _b.v)); }
+// swap 4 rows of 4 to 4 columns, e.g. 4 RGBA pixels to one register per channel and back
+inline void transpose4(Float4 &io_a, Float4 &io_b, Float4 &io_c, Float4 &io_d) { _MM_TRANSPOSE4_PS(io_a.v, io_b.v, io_c.v, io_d.v); }
+#else
+struct Float4
+{
+  float v[4];
+  Float4() = default;
+  explicit Float4(float _f) { v[0] = v[1] = v[2] = v[3] = _f; }
+  static Float4 load(const float *_p)
+  {
+    Float4 r;
+    std::copy(_p, _p + 4, r.v);
+    return r;
+  }
+  static Float4 loadu(const float *_p) { return load(_p); }
+  static Float4 set(float _a, float _b, float _c, float _d)
+  {
+    Float4 r;
+    r.v[0] = _a;
+    r.v[1] = _b;
+    r.v[2] = _c;
+    r.v[3] = _d;
+    return r;
+  }
+  void store(float *_p) const { std::copy(v, v + 4, _p); }
+};
+template <typename Op>
+inline Float4 apply4(Float4 _a, Float4 _b, Op _op)
+{
+  Float4 r;
+  for (int i = 0; i < 4; ++i)
+  {
+    r.v[i] = _op(_a.v[i], _b.v[i]);
+  }
+  return r;
+}
+// comparisons return 1.0 / 0.0 per lane in the scalar version
+inline Float4 operator+(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return x + y; }); }
+inline Float4 operator-(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return x - y; }); }
+inline Float4 operator*(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return x * y; }); }
+inline Float4 operator/(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return x / y; }); }
+inline Float4 min4(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return std::min(x, y); }); }
+inline Float4 max4(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return std::max(x, y); }); }
+inline Float4 operator<(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return x < y ? 1.0f : 0.0f; }); }
+inline Float4 operator<=(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return x <= y ? 1.0f : 0.0f; }); }
+inline Float4 operator>(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return x > y ? 1.0f : 0.0f; }); }
+inline Float4 operator>=(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return x >= y ? 1.0f : 0.0f; }); }
+inline Float4 operator&(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return (x != 0.0f && y != 0.0f) ? 1.0f : 0.0f; }); }
+inline Float4 operator|(Float4 _a, Float4 _b) { return apply4(_a, _b, [](float x, float y) { return (x != 0.0f || y != 0.0f) ? 1.0f : 0.0f; }); }
+inline int mask4(Float4 _a)
+{
+  int m = 0;
+  for (int i = 0; i < 4; ++i)
+  {
+    m |= (_a.v[i] != 0.0f) << i;
+  }
+  return m;
+}
+inline Float4 select4(Float4 _m, Float4 _a, Float4 _b)
+{
+  Float4 r;
+  for (int i = 0; i < 4; ++i)
+  {
+    r.v[i] = _m.v[i] != 0.0f ? _a.v[i] : _b.v[i];
+  }
+  return r;
+}
+inline void transpose4(Float4 &io_a, Float4 &io_b, Float4 &io_c, Float4 &io_d)
+{
+  Float4 *rows[4] = {&io_a, &io_b, &io_c, &io_d};
+  for (int i = 0; i < 4; ++i)
+  {
+    for (int j = i + 1; j < 4; ++j)
+    {
+      std::swap(rows[i]->v[j], rows[j]->v[i]);
+    }
+  }
+}
+#endif
+} // end namespace simd
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SHADERCACHE_H_
+#define SHADERCACHE_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file ShaderCache.h
+/// @brief an on disk cache of linked program binaries (glGetProgramBinary / glProgramBinary) so the shaders
+/// don't need compiling from source every launch. Entries are keyed by a hash of the shader sources and
+/// the GL vendor, renderer and version strings, so a driver update or an edit to a shader just misses the
+/// cache. If the driver rejects a binary the caller falls back to compiling from source and the entry is
+/// replaced. The programs are still created and owned by the ngl::ShaderLib.
+//----------------------------------------------------------------------------------------------------------------------
+#include <ngl/Types.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ShaderCache
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor, needs a current GL context to query the driver
+  /// @param[in] _dir the directory to store the binaries in
+  //----------------------------------------------------------------------------------------------------------------------
+  ShaderCache(const std::string &_dir);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief does the driver support program binaries at all
+  //----------------------------------------------------------------------------------------------------------------------
+  bool enabled() const { return m_enabled; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the cache key for a program from all of its source text
+  //----------------------------------------------------------------------------------------------------------------------
+  uint64_t key(const std::vector<std::string_view> &_sources) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief try to load a cached binary into a program created with ngl::ShaderLib::createShaderProgram, on
+  /// success the program is linked and its uniforms registered so it can be used straight away
+  /// @param[in] _program the name of the program in the ShaderLib
+  /// @param[in] _key the key from key()
+  /// @returns false if there is no entry or the driver rejected it
+  //----------------------------------------------------------------------------------------------------------------------
+  bool load(const std::string &_program, uint64_t _key);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief mark a program so the driver keeps the binary, call before it is linked
+  //----------------------------------------------------------------------------------------------------------------------
+  void prepare(const std::string &_program) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief write the binary of a linked program to the cache
+  //----------------------------------------------------------------------------------------------------------------------
+  bool save(const std::string &_program, uint64_t _key);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief counters for the startup report
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t hits() const { return m_hits; }
+  size_t misses() const { return m_misses; }
+
+private:
+  std::string fileName(uint64_t _key) const;
+
+  std::string m_dir;
+  std::string m_driver;
+  bool m_enabled = false;
+  size_t m_hits = 0;
+  size_t m_misses = 0;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef SHADERVARIANTS_H_
+#define SHADERVARIANTS_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file ShaderVariants.h
+/// @brief builds specialised versions of a shader pair for each combination of material features. The
+/// features of a material are turned into #defines which are inserted after the #version line of the
+/// sources, so the compiler strips out the texture fetches, uniforms and discard a material doesn't need.
+/// Variants are compiled the first time they are used, or up front for every material with precompile,
+/// and the programs are kept in the ngl::ShaderLib under the name base_features (in hex). If a ShaderCache
+/// is given linked binaries are loaded from it and new builds are added to it.
+//----------------------------------------------------------------------------------------------------------------------
+#include "Mtl.h"
+#include "MemoryReport.h"
+#include "ShaderCache.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+class ShaderVariants
+{
+public:
+  /// @brief the material feature bits, each maps to a #define in the shader
+  enum Feature : uint32_t
+  {
+    DiffuseMap = 1 << 0,
+    AlphaMap = 1 << 1,
+    AlphaTest = 1 << 2,
+    BumpMap = 1 << 3,
+    Transparent = 1 << 4
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor loads the shader sources, nothing is compiled until a variant is needed
+  /// @param[in] _baseName the name used for the programs in the ShaderLib
+  /// @param[in] _vertex the vertex shader file
+  /// @param[in] _fragment the fragment shader file
+  /// @param[in] _cache optional program binary cache, must outlive this
+  //----------------------------------------------------------------------------------------------------------------------
+  ShaderVariants(const std::string &_baseName, const std::string &_vertex, const std::string &_fragment,
+                 ShaderCache *_cache = nullptr);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief work out the feature bits for a material
+  //----------------------------------------------------------------------------------------------------------------------
+  static uint32_t features(const mtlItem &_material);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the #define block for a set of feature bits
+  //----------------------------------------------------------------------------------------------------------------------
+  static std::string defines(uint32_t _features);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief make the variant for a set of features the active shader, compiling it if needed
+  /// @param[in] _features the feature bits
+  /// @returns the name of the program in the ShaderLib or an empty string if the variant failed to build
+  //----------------------------------------------------------------------------------------------------------------------
+  const std::string &use(uint32_t _features);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief compile all the variants needed by a material file so there are no hitches while drawing
+  //----------------------------------------------------------------------------------------------------------------------
+  void precompile(const Mtl &_mtl);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief how many variants have been built
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t numVariants() const { return m_programs.size(); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the total time spent compiling and linking in ms
+  //----------------------------------------------------------------------------------------------------------------------
+  double buildTime() const { return m_buildTime; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the bytes of shader source we keep to build variants from
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t sourceBytes() const { return m_vertexSource.size() + m_fragmentSource.size(); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add the sources and the program binaries of the variants to a report, needs a current GL context
+  //----------------------------------------------------------------------------------------------------------------------
+  void memoryUsage(MemoryReport &io_report) const;
+
+private:
+  const std::string &build(uint32_t _features);
+
+  std::string m_baseName;
+  std::string m_vertexSource;
+  std::string m_fragmentSource;
+  ShaderCache *m_cache = nullptr;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the program names of the variants built so far, failed builds are stored as an empty name
+  //----------------------------------------------------------------------------------------------------------------------
+  std::unordered_map<uint32_t, std::string> m_programs;
+  double m_buildTime = 0.0;
+};
+
+#endif
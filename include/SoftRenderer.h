@@ -0,0 +1,125 @@
+#ifndef SOFTRENDERER_H_
+#define SOFTRENDERER_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file SoftRenderer.h
+/// @brief a CPU rendering backend for machines with no GPU. It draws the same GroupedObj mesh ranges with the
+/// Mtl materials and follows TextureShader (colour = vec4(ka,d) * texture(map_Ka), discard if alpha is 0,
+/// blended with GL_ONE, GL_ONE_MINUS_SRC_ALPHA). Rendering is done in three parallel passes, vertex
+/// transform, triangle setup / binning into screen tiles and then each tile is rasterized and shaded
+/// by one thread, the edge functions, interpolation, filtering and blending are all done for 4 pixels at a
+/// time (only the texel fetches are per pixel as there is no gather in SSE2). UV's are perspective correct and
+/// textures are sampled bilinearly from the mip level picked using the analytic UV derivatives.
+/// @note this uses its own copy of the textures on the CPU so the Mtl can be loaded without GL textures
+//----------------------------------------------------------------------------------------------------------------------
+#include "GroupedObj.h"
+#include "Mtl.h"
+#include <ngl/Mat4.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class SoftRenderer
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor loads the CPU textures for the materials used by the mesh
+  /// @param[in] _mesh the mesh to draw, must outlive the renderer
+  /// @param[in] _mtl the materials for the mesh
+  /// @param[in] _width the image width
+  /// @param[in] _height the image height
+  //----------------------------------------------------------------------------------------------------------------------
+  SoftRenderer(const GroupedObj &_mesh, const Mtl &_mtl, int _width, int _height);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief render a frame
+  /// @param[in] _mvp the model view projection matrix
+  /// @param[in] _threads the number of threads to use, 0 means use the hardware concurrency
+  //----------------------------------------------------------------------------------------------------------------------
+  void render(const ngl::Mat4 &_mvp, unsigned int _threads = 0);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief write the last frame as a binary PPM
+  /// @param[in] _fname the file to write
+  //----------------------------------------------------------------------------------------------------------------------
+  bool writeImage(const std::string &_fname) const;
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the number of triangles which made it through clipping to the rasterizer last frame
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t trianglesDrawn() const { return m_trianglesDrawn; }
+
+private:
+  /// @brief RGBA8 texture with a full mip chain
+  struct Texture
+  {
+    std::vector<int> m_width;
+    std::vector<int> m_height;
+    std::vector<std::vector<unsigned char>> m_mips;
+  };
+  /// @brief the bits of the mtlItem the shader uses
+  struct Material
+  {
+    const Texture *m_texture = nullptr;
+    float m_ka[3] = {1.0f, 1.0f, 1.0f};
+    float m_d = 1.0f;
+  };
+  /// @brief a transformed vertex in clip space
+  struct ClipVert
+  {
+    float x, y, z, w;
+    float u, v;
+  };
+  /// @brief triangle ready to rasterize, the edge functions and the attribute planes f(x,y) = a*x + b*y + c
+  /// for depth, 1/w, u/w and v/w
+  struct SetupTri
+  {
+    float m_edgeA[3], m_edgeB[3], m_edgeC[3];
+    bool m_inclusive[3];
+    float m_z[3];
+    float m_q[3];
+    float m_uq[3];
+    float m_vq[3];
+    int m_minX, m_minY, m_maxX, m_maxY;
+    uint32_t m_material;
+  };
+  const Texture *loadTexture(const std::string &_name);
+  void setupTriangles(size_t _chunk);
+  void setupClipped(const ClipVert *_v, uint32_t _material, size_t _chunk);
+  void rasterTile(size_t _tile);
+  void rasterTriangle(const SetupTri &_tri, int _x0, int _y0, int _x1, int _y1);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bilinearly sample 4 pixels from the mip level each one's squared UV footprint _rho picks
+  /// @param[in] _covered the lanes to sample, the others are left 0
+  /// @param[out] o_rgba a row of 4 lanes per channel
+  //----------------------------------------------------------------------------------------------------------------------
+  void sample4(const Texture &_tex, const float _u[4], const float _v[4], const float _rho[4], int _covered,
+               float o_rgba[4][4]) const;
+
+  const GroupedObj &m_mesh;
+  int m_width;
+  int m_height;
+  int m_tilesX;
+  int m_tilesY;
+  std::unordered_map<std::string, std::unique_ptr<Texture>> m_textures;
+  std::vector<Material> m_materials;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the triangles in draw (m_meshes) order with the material of each
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<uint32_t> m_drawTris;
+  std::vector<uint32_t> m_drawMaterial;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief per frame data, the clip verts, the setup triangles and tile bins for each chunk of triangles.
+  /// Chunks are processed in order by each tile so the draw order matches the GL version
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<ClipVert> m_clipVerts;
+  std::vector<std::vector<SetupTri>> m_setup;
+  std::vector<std::vector<std::vector<uint32_t>>> m_bins;
+  size_t m_trianglesDrawn = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the frame buffer RGBA float and depth 0-1
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_colour;
+  std::vector<float> m_depth;
+};
+
+#endif
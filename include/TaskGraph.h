@@ -0,0 +1,116 @@
+#ifndef TASKGRAPH_H_
+#define TASKGRAPH_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file TaskGraph.h
+/// @brief a small work stealing scheduler for a graph of dependent tasks, used to overlap the stages of
+/// loading a scene. Each worker pops its newest task and steals the oldest task of another worker when it
+/// runs dry. Tasks marked Affinity::Main only ever run on the thread that called run (the one with the GL
+/// context) and that thread runs nothing else while there are workers, so GL work is never stuck behind a
+/// long parse. Tasks may add more tasks while the graph runs (one decode per texture once the mtl file has
+/// been read, say). Each task is timed so the critical path can be printed and shown in the trace.
+//----------------------------------------------------------------------------------------------------------------------
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class TaskGraph
+{
+public:
+  /// @brief the id of a task, its index in the order added
+  using TaskId = size_t;
+  /// @brief which threads may run a task
+  enum class Affinity : bool
+  {
+    Any = false,
+    Main = true
+  };
+  TaskGraph() = default;
+  TaskGraph(const TaskGraph &) = delete;
+  TaskGraph &operator=(const TaskGraph &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add a task, safe to call from a running task
+  /// @param[in] _name the name shown in the trace and the critical path
+  /// @param[in] _affinity Main for anything that needs the GL context
+  /// @param[in] _func the work, returning false fails the graph and skips everything that depends on it
+  /// @param[in] _dependencies the tasks that must finish first
+  /// @returns the id used to depend on this task
+  //----------------------------------------------------------------------------------------------------------------------
+  TaskId add(std::string _name, Affinity _affinity, std::function<bool()> _func,
+             const std::vector<TaskId> &_dependencies = {});
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief run every task and return once they (and any they added) are done
+  /// @param[in] _threads the worker threads to start as well as the calling thread, 0 means hardware concurrency - 1
+  /// @returns false if any task failed
+  //----------------------------------------------------------------------------------------------------------------------
+  bool run(unsigned int _threads = 0);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the chain of tasks that finished last, each one waiting on the dependency that finished last
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<TaskId> criticalPath() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief print the wall time, the total task time and the critical path with the time of each task
+  //----------------------------------------------------------------------------------------------------------------------
+  void printCriticalPath(std::ostream &_out) const;
+
+private:
+  static constexpr TaskId c_noTask = ~TaskId(0);
+  struct Task
+  {
+    std::string m_name;
+    Affinity m_affinity;
+    std::function<bool()> m_func;
+    std::vector<TaskId> m_dependencies;
+    std::vector<TaskId> m_successors;
+    /// @brief the task that added this one while running, if any
+    TaskId m_parent = c_noTask;
+    /// @brief dependencies not yet finished
+    size_t m_waiting = 0;
+    bool m_done = false;
+    /// @brief the task failed, or was skipped as something it depends on failed
+    bool m_failed = false;
+    /// @brief trace clock times in microseconds
+    int64_t m_start = 0;
+    int64_t m_end = 0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief queue a task whose dependencies are done, m_lock must be held
+  /// @param[in] _worker the worker to give Any tasks to, the one that made it ready if it is a worker
+  //----------------------------------------------------------------------------------------------------------------------
+  void scheduleLocked(TaskId _id, size_t _worker);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief take the next task for a worker, m_lock must be held
+  /// @returns false if there is nothing to do
+  //----------------------------------------------------------------------------------------------------------------------
+  bool takeLocked(size_t _worker, TaskId &o_id);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief run a task then release its successors, a skipped task just releases them
+  //----------------------------------------------------------------------------------------------------------------------
+  void execute(TaskId _id, Task &io_task, size_t _worker);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief take and execute tasks until the graph is finished
+  //----------------------------------------------------------------------------------------------------------------------
+  void workerLoop(size_t _worker);
+
+  /// @brief the tasks are few and coarse so one lock guards the graph and the queues
+  mutable std::mutex m_lock;
+  std::condition_variable m_wake;
+  std::vector<std::unique_ptr<Task>> m_tasks;
+  /// @brief the Any tasks of each worker, the calling thread is worker 0
+  std::vector<std::deque<TaskId>> m_queues;
+  /// @brief the tasks that must run on the calling thread
+  std::deque<TaskId> m_mainQueue;
+  size_t m_unfinished = 0;
+  size_t m_nextQueue = 0;
+  bool m_running = false;
+  bool m_failed = false;
+  int64_t m_runStart = 0;
+  int64_t m_runEnd = 0;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef TEXTURESTREAMER_H_
+#define TEXTURESTREAMER_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file TextureStreamer.h
+/// @brief streams texture mip levels in and out of GL memory based on what is on screen. At start only the
+/// small tail of each mip chain is uploaded. Each frame the groups inside the view frustum work out the
+/// mip level they need from their texel density (texels per model unit, measured from the UVs) and the
+/// pixels per unit at their closest point to the eye. Missing finer levels are decoded on a background
+/// thread and uploaded a few per frame through pixel unpack buffers, the sampled range is clamped with
+/// GL_TEXTURE_BASE_LEVEL and GL_TEXTURE_MIN_LOD is faded down so new detail blends in. When the resident
+/// bytes go over the budget the finest levels of textures which need less detail (least recently needed
+/// first) are released, if that is not enough every request is biased a level coarser.
+/// Source images are decoded again when a level is needed, only the levels waiting for upload are kept.
+//----------------------------------------------------------------------------------------------------------------------
+#include "GroupedObj.h"
+#include "Mtl.h"
+#include <ngl/Mat4.h>
+#include <ngl/Types.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief the streaming parameters
+struct StreamSettings
+{
+  /// @brief the GL memory to use for textures
+  size_t budgetBytes = size_t(256) << 20;
+  /// @brief levels this size and smaller are uploaded at start and never released
+  int tailSize = 64;
+  /// @brief the bytes uploaded per frame, at least one level is always uploaded
+  size_t uploadBytesPerFrame = size_t(8) << 20;
+  /// @brief how much MIN_LOD drops per frame after a finer level arrives
+  float fadeRate = 0.25f;
+};
+
+class TextureStreamer
+{
+public:
+  struct Stats
+  {
+    size_t m_textures = 0;
+    size_t m_residentBytes = 0;
+    /// @brief the bytes needed for every texture to be at its wanted level
+    size_t m_wantedBytes = 0;
+    size_t m_uploadedBytes = 0;
+    size_t m_evictedBytes = 0;
+    size_t m_pending = 0;
+    int m_bias = 0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor starts the decode thread, needs a current GL context
+  //----------------------------------------------------------------------------------------------------------------------
+  TextureStreamer(const StreamSettings &_settings = StreamSettings());
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief dtor stops the decode thread and deletes the textures, needs the GL context current
+  //----------------------------------------------------------------------------------------------------------------------
+  ~TextureStreamer();
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add a texture, the GL name is valid straight away but has no levels until the tail is decoded
+  /// @param[in] _path the image file
+  /// @returns the GL texture id
+  //----------------------------------------------------------------------------------------------------------------------
+  GLuint add(const std::string &_path);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief work out the bounds and texel density of each group and which textures it uses, call after the
+  /// materials are loaded
+  //----------------------------------------------------------------------------------------------------------------------
+  void setGroups(const GroupedObj &_mesh, const Mtl &_mtl);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief call once a frame with the GL context current to update the demand, upload finished levels
+  /// and evict to the budget
+  /// @param[in] _project the projection matrix
+  /// @param[in] _modelView the model to eye matrix of the mesh
+  /// @param[in] _viewportHeight the height of the viewport in pixels
+  //----------------------------------------------------------------------------------------------------------------------
+  void update(const ngl::Mat4 &_project, const ngl::Mat4 &_modelView, int _viewportHeight);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief true while levels are being decoded, uploaded or faded in so the caller should keep drawing
+  //----------------------------------------------------------------------------------------------------------------------
+  bool busy() const;
+  Stats stats() const;
+  void printStats() const;
+
+private:
+  struct Texture
+  {
+    std::string m_path;
+    GLuint m_id = 0;
+    int m_width = 0;
+    int m_height = 0;
+    /// @brief number of levels in the full chain, 0 until the image has been decoded
+    int m_levels = 0;
+    /// @brief the first level of the tail which is always resident
+    int m_tail = 0;
+    /// @brief the finest level uploaded, m_levels when nothing is resident
+    int m_resident = 0;
+    /// @brief the finest level needed by the visible groups
+    int m_wanted = 0;
+    /// @brief the finest level asked of the decode thread, -1 if there is no request outstanding
+    int m_requested = -1;
+    /// @brief levels sitting in m_ready
+    int m_queued = 0;
+    bool m_failed = false;
+    float m_minLod = 0.0f;
+    uint64_t m_lastNeeded = 0;
+  };
+  struct Group
+  {
+    ngl::Vec3 m_min;
+    ngl::Vec3 m_max;
+    /// @brief UV area per unit of model area, the texel density is sqrt(this * width * height)
+    float m_uvDensity = 0.0f;
+    std::vector<size_t> m_textures;
+  };
+  /// @brief a decoded level waiting for upload, a level of -1 means the image could not be loaded
+  struct Level
+  {
+    size_t m_texture;
+    int m_level;
+    int m_width;
+    int m_height;
+    /// @brief the size of level 0 so the first result can fill in the texture
+    int m_fullWidth;
+    int m_fullHeight;
+    /// @brief set on the finest level of a request, the last one to arrive
+    bool m_lastOfRequest;
+    std::vector<unsigned char> m_pixels;
+  };
+  /// @brief ask the decode thread for levels [m_first, m_last] of a texture, m_first of -1 asks for the tail
+  struct Request
+  {
+    size_t m_texture;
+    std::string m_path;
+    int m_first;
+    int m_last;
+  };
+
+  void decodeLoop();
+  void decode(const Request &_request);
+  void request(size_t _texture, int _first, int _last);
+  void upload(size_t _budget);
+  void evict();
+  static size_t levelBytes(const Texture &_t, int _level);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the bytes of levels _first to the end of the chain
+  //----------------------------------------------------------------------------------------------------------------------
+  static size_t chainBytes(const Texture &_t, int _first);
+
+  StreamSettings m_settings;
+  std::vector<Texture> m_textures;
+  std::vector<Group> m_groups;
+  uint64_t m_frame = 0;
+  int m_bias = 0;
+  size_t m_residentBytes = 0;
+  size_t m_wantedBytes = 0;
+  size_t m_uploadedBytes = 0;
+  size_t m_evictedBytes = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a small ring of unpack buffers so a new upload doesn't wait on the one before
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<GLuint> m_pbos;
+  size_t m_nextPbo = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief levels decoded but not yet uploaded, only touched on the GL thread
+  //----------------------------------------------------------------------------------------------------------------------
+  std::deque<Level> m_ready;
+  size_t m_outstanding = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the decode thread and its queues, everything else is only used on the GL thread
+  //----------------------------------------------------------------------------------------------------------------------
+  mutable std::mutex m_lock;
+  std::condition_variable m_wake;
+  std::deque<Request> m_requests;
+  std::vector<Level> m_decoded;
+  bool m_quit = false;
+  std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file Trace.h
+/// @brief a low overhead timeline tracer which writes the Chrome trace event JSON format so the results
+/// can be loaded in chrome://tracing or ui.perfetto.dev. Use TRACE_SCOPE("name") to time a block, each
+/// thread records into its own buffer without taking a lock so spans from worker threads can be seen
+/// overlapping. Tracing is off until trace::setEnabled(true) (main does this if SPONZA_TRACE is set) and
+/// a disabled scope only costs a flag check. For a name made at run time use TRACE_SCOPE("load ", path) rather
+/// than building the string at the call site. Define SPONZA_NO_TRACE to compile the scopes out entirely.
+//----------------------------------------------------------------------------------------------------------------------
+#include <cstdint>
+#include <string>
+
+namespace trace
+{
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief turn recording on or off
+//----------------------------------------------------------------------------------------------------------------------
+void setEnabled(bool _enabled);
+bool enabled();
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief microseconds since the trace clock started
+//----------------------------------------------------------------------------------------------------------------------
+int64_t now();
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief record a complete span on the calling thread
+//----------------------------------------------------------------------------------------------------------------------
+void record(std::string _name, const char *_category, int64_t _start, int64_t _duration);
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief record the current value of a counter, shown as a graph over time (does nothing when disabled)
+//----------------------------------------------------------------------------------------------------------------------
+void counter(std::string _name, int64_t _value);
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief name the calling thread in the trace
+//----------------------------------------------------------------------------------------------------------------------
+void setThreadName(const std::string &_name);
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief the load and bake progress messages (batching, packing, vertex cache, AO passes) are only printed
+/// when verbose, it starts on if SPONZA_VERBOSE is set
+//----------------------------------------------------------------------------------------------------------------------
+void setVerbose(bool _verbose);
+bool verbose();
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief print a whole message to std::cout under a lock, so messages from loads running in parallel don't
+/// interleave
+//----------------------------------------------------------------------------------------------------------------------
+void print(const std::string &_message);
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief write everything recorded so far, threads can keep recording while this runs
+/// @param[in] _fname the json file to write
+//----------------------------------------------------------------------------------------------------------------------
+bool write(const std::string &_fname);
+
+/// @brief times the enclosing block and records it when it goes out of scope
+class Scope
+{
+public:
+  Scope(const char *_name, const char *_category = "sponza")
+  {
+    if (enabled())
+    {
+      m_name = _name;
+      m_category = _category;
+      m_start = now();
+    }
+  }
+  /// @brief named _prefix followed by _detail, joined only when tracing is on
+  Scope(const char *_prefix, const std::string &_detail, const char *_category = "sponza")
+  {
+    if (enabled())
+    {
+      m_name.reserve(std::char_traits<char>::length(_prefix) + _detail.size());
+      m_name.append(_prefix).append(_detail);
+      m_category = _category;
+      m_start = now();
+    }
+  }
+  ~Scope()
+  {
+    if (m_start >= 0)
+    {
+      record(std::move(m_name), m_category, m_start, now() - m_start);
+    }
+  }
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  std::string m_name;
+  const char *m_category = nullptr;
+  int64_t m_start = -1;
+};
+} // end namespace trace
+
+#define TRACE_JOIN2(_a, _b) _a##_b
+#define TRACE_JOIN(_a, _b) TRACE_JOIN2(_a, _b)
+#ifndef SPONZA_NO_TRACE
+#define TRACE_SCOPE(...) trace::Scope TRACE_JOIN(traceScope_, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SCOPE(...)
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef UPLOADTHREAD_H_
+#define UPLOADTHREAD_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file UploadThread.h
+/// @brief runs GL uploads on a thread of its own with a context shared with the window, so buffers and
+/// textures can be filled while the GUI thread keeps drawing. Each job is followed by a fence and its
+/// completion runs on the GUI thread (from poll) only once the GPU has the data, at which point the
+/// objects it filled are safe to draw with. Vertex array objects are not shared between contexts so they
+/// must still be made on the GUI thread, only their buffers are filled here.
+//----------------------------------------------------------------------------------------------------------------------
+#include <ngl/Types.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class QOpenGLContext;
+class QOffscreenSurface;
+class QThread;
+
+class UploadThread
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief ctor, call on the GUI thread
+  /// @param[in] _share the window context to share objects with
+  //----------------------------------------------------------------------------------------------------------------------
+  explicit UploadThread(QOpenGLContext *_share);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief dtor, jobs not yet run are dropped and their completions are not called
+  //----------------------------------------------------------------------------------------------------------------------
+  ~UploadThread();
+  UploadThread(const UploadThread &) = delete;
+  UploadThread &operator=(const UploadThread &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief queue a job, safe to call from any thread. Jobs run and complete in the order queued
+  /// @param[in] _name the name shown in the trace
+  /// @param[in] _upload run on the upload thread with the shared context current, may be empty
+  /// @param[in] _done run on the GUI thread from poll once the GPU has finished the upload, passed the result
+  //----------------------------------------------------------------------------------------------------------------------
+  void enqueue(std::string _name, std::function<bool()> _upload, std::function<void(bool)> _done);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief run the completions of the finished jobs, call on the GUI thread with the window context current
+  /// @returns the number of jobs completed
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t poll();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief are there jobs queued, running or waiting to complete
+  //----------------------------------------------------------------------------------------------------------------------
+  bool busy() const;
+
+private:
+  struct Job
+  {
+    std::string m_name;
+    std::function<bool()> m_upload;
+    std::function<void(bool)> m_done;
+    bool m_ok = true;
+    GLsync m_fence = nullptr;
+  };
+  void uploadLoop();
+
+  std::unique_ptr<QOffscreenSurface> m_surface;
+  std::unique_ptr<QOpenGLContext> m_context;
+  mutable std::mutex m_lock;
+  std::condition_variable m_wake;
+  std::deque<Job> m_queue;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief uploaded and fenced jobs waiting for poll, and the number being uploaded right now
+  //----------------------------------------------------------------------------------------------------------------------
+  std::deque<Job> m_fenced;
+  size_t m_running = 0;
+  bool m_quit = false;
+  std::unique_ptr<QThread> m_thread;
+};
+
+#endif
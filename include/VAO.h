@@ -18,18 +18,58 @@
 #define VAO_H_
 
 #include <ngl/AbstractVAO.h>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
 
 class VAO : public ngl::AbstractVAO
 {
 public:
   //----------------------------------------------------------------------------------------------------------------------
+  /// @brief simple counters for the data streamed into the buffer after the initial setData
+  //----------------------------------------------------------------------------------------------------------------------
+  struct UploadStats
+  {
+    /// @brief total number of bytes uploaded
+    size_t bytes = 0;
+    /// @brief number of sub data / mapped range uploads
+    size_t uploads = 0;
+    /// @brief CPU time spent in the upload calls in seconds
+    double seconds = 0.0;
+    /// @brief the measured bandwidth in MB/s
+    double mbPerSecond() const { return seconds > 0.0 ? (bytes / (1024.0 * 1024.0)) / seconds : 0.0; }
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a part of the vertex and index data held in buffers (and a GL vertex array) of its own. The indices
+  /// of a segment count from its first vertex so they stay 32 bit however big the whole data is
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Segment
+  {
+    size_t m_firstVertex = 0;
+    size_t m_numVertices = 0;
+    size_t m_firstIndex = 0;
+    size_t m_numIndices = 0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief split data into segments at range boundaries so no segment's vertex or index buffer is bigger than
+  /// _maxBytes and its vertices can all be reached with a 32 bit index. A range bigger than the limit gets a
+  /// segment of its own
+  /// @param[in] _ranges contiguous vertex and index ranges in layout order, a range is never split
+  /// @param[in] _vertexBytes the size of a vertex
+  /// @param[in] _maxBytes the largest buffer wanted
+  /// @param[out] o_segmentOf the segment of each range
+  /// @returns the segments, at least one
+  //----------------------------------------------------------------------------------------------------------------------
+  static std::vector<Segment> planSegments(const std::vector<Segment> &_ranges, size_t _vertexBytes, size_t _maxBytes,
+                                           std::vector<size_t> &o_segmentOf);
+  //----------------------------------------------------------------------------------------------------------------------
   /// @brief creator method for the factory
   /// @param _mode the mode to draw with.
   /// @returns a new AbstractVAO * object
   //----------------------------------------------------------------------------------------------------------------------
   static std::unique_ptr<AbstractVAO> create(GLenum _mode = GL_TRIANGLES) { return std::unique_ptr<AbstractVAO>(new VAO(_mode)); }
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief draw the VAO using glDrawArrays
+  /// @brief draw the VAO using glDrawArrays, or glDrawElements if there is an index buffer
   //----------------------------------------------------------------------------------------------------------------------
   virtual void draw() const;
   //----------------------------------------------------------------------------------------------------------------------
@@ -41,34 +81,201 @@ public:
   //----------------------------------------------------------------------------------------------------------------------
   virtual void removeVAO();
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief, this method sets the data for the VAO if data has already been set it will remove the existing data
-  /// and then re-set with the new data.
+  /// @brief, this method sets the data for the VAO, if data of the same size has already been set the
+  /// existing buffer is re-specified (orphaned) rather than deleted and re-created.
   //----------------------------------------------------------------------------------------------------------------------
   // void setData(size_t _size,const GLfloat &_data,GLenum _mode=GL_STATIC_DRAW) ;
   virtual void setData(const VertexData &_data);
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief return the id of the buffer, if there is only 1 buffer just return this
-  /// if we have the more than one buffer the sub class manages the id's
-  /// @param _buffer index (default to 0 for single buffer VAO's)
+  /// @brief allocate the buffer without filling it, the data is added later with setSubData (or from a
+  /// shared context using getBufferID)
+  /// @param _size the size of the buffer in bytes
+  /// @param _usage the buffer usage hint
+  //----------------------------------------------------------------------------------------------------------------------
+  void allocateData(size_t _size, GLenum _usage = GL_STATIC_DRAW);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief upload a sub range of the buffer using glBufferSubData
+  /// @param _offset the offset in bytes from the start of the buffer
+  /// @param _size the number of bytes to copy
+  /// @param _data the source data
+  //----------------------------------------------------------------------------------------------------------------------
+  void setSubData(size_t _offset, size_t _size, const GLvoid *_data);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief set the data for an extra per vertex attribute held in its own buffer, this lets data computed
+  /// later (such as baked lighting) be added without re-packing the interleaved buffer. If the attribute
+  /// already has a buffer of the same size it is updated in place. The VAO must be bound.
+  /// @param _index the attribute location
+  /// @param _size the number of bytes to copy
+  /// @param _data the tightly packed float data
+  /// @param _components the number of floats per vertex
+  /// @param _usage the buffer usage hint
+  //----------------------------------------------------------------------------------------------------------------------
+  void setAttributeData(GLuint _index, size_t _size, const GLvoid *_data, GLint _components, GLenum _usage = GL_DYNAMIC_DRAW);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief set an index buffer, once set the draw methods use glDrawElements and the start / count are
+  /// in indices. The VAO must be bound.
+  /// @param _count the number of indices
+  /// @param _data the indices, nullptr to allocate the buffer without filling it
+  //----------------------------------------------------------------------------------------------------------------------
+  void setIndexData(size_t _count, const GLuint *_data);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief upload a sub range of the index buffer using glBufferSubData. The VAO must be bound.
+  /// @param _first the first index to replace
+  /// @param _count the number of indices
+  /// @param _data the indices
+  //----------------------------------------------------------------------------------------------------------------------
+  void setIndexSubData(size_t _first, size_t _count, const GLuint *_data);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief create the vertex and index buffers of each segment, replacing any data set before. Afterwards the
+  /// sub data, attribute, map and draw calls take offsets into the whole data and go to the segments holding
+  /// it. Set the vertex attribute pointers of each segment with bindSegment. The VAO must be bound.
+  /// @param _segments the segments, see planSegments
+  /// @param _vertexBytes the size of a vertex
+  /// @param _vertices all the vertices or nullptr to leave the buffers empty
+  /// @param _indices all the indices, each counting from the first vertex of its segment, or nullptr
+  /// @param _usage the vertex buffer usage hint
+  //----------------------------------------------------------------------------------------------------------------------
+  void allocateSegments(const std::vector<Segment> &_segments, size_t _vertexBytes, const GLvoid *_vertices,
+                        const GLuint *_indices, GLenum _usage = GL_STATIC_DRAW);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bind the vertex array and vertex buffer of a segment so setVertexAttributePointer applies to it
+  //----------------------------------------------------------------------------------------------------------------------
+  void bindSegment(size_t _segment);
+  size_t numSegments() const { return m_stores.size(); }
+  const Segment &segment(size_t _segment) const { return m_stores[_segment].m_range; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the segment holding an index
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t findSegment(size_t _index) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief orphan the buffer storage, the driver gives us fresh memory and the GPU can keep reading
+  /// the old copy until any pending draws are done. The contents are undefined after this call.
+  //----------------------------------------------------------------------------------------------------------------------
+  void orphanBuffer();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief return the id of the vertex buffer of a segment, the offsets into it are from the segment start
+  /// @param _buffer the segment (default to 0 for single buffer VAO's)
+  //----------------------------------------------------------------------------------------------------------------------
+  GLuint getBufferID(unsigned int _buffer) const override
+  {
+    return _buffer < m_stores.size() ? m_stores[_buffer].m_buffer : 0;
+  }
+  GLuint getIndexBufferID(size_t _segment = 0) const
+  {
+    return _segment < m_stores.size() ? m_stores[_segment].m_indexBuffer : 0;
+  }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draw a range of the data, with an index buffer the range can cross segments and is drawn from each
+  /// in turn, counts too big for a GLsizei are drawn in pieces. The VAO must be bound.
+  //----------------------------------------------------------------------------------------------------------------------
+  void draw(size_t _startIndex, size_t _numVerts, GLenum _mode = GL_TRIANGLES) const;
   //----------------------------------------------------------------------------------------------------------------------
-  GLuint getBufferID(unsigned int) const override{ return m_buffer; }
-  /// overide the draw method
-  void draw(unsigned int _startIndex, unsigned int _numVerts, GLenum _mode = GL_TRIANGLES) const;
+  /// @brief draw the DrawElementsIndirectCommand records in the bound GL_DRAW_INDIRECT_BUFFER, needs the index
+  /// buffer and only draws from the first segment. The VAO must be bound.
+  /// @param _offset the byte offset of the first record
+  /// @param _maxDraws the number of records
+  /// @param _countOffset if not negative the byte offset in the bound GL_PARAMETER_BUFFER of the number of
+  /// records to draw, at most _maxDraws. Needs GL 4.6
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawIndirect(GLintptr _offset, GLsizei _maxDraws, GLintptr _countOffset = -1, GLenum _mode = GL_TRIANGLES) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief draw a range of the index buffer with a value added to every index, so several meshes with
+  /// indices starting at 0 can share the buffers. The base is from the start of the segment. The VAO must be
+  /// bound.
+  /// @param _startIndex the first index to draw
+  /// @param _numIndices the number of indices
+  /// @param _baseVertex added to each index
+  //----------------------------------------------------------------------------------------------------------------------
+  void drawBaseVertex(size_t _startIndex, size_t _numIndices, GLint _baseVertex, GLenum _mode = GL_TRIANGLES) const;
 
   int getSize() const;
   ngl::Real *mapBuffer(unsigned int, GLenum);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief map a range of the buffer using glMapBufferRange, the default access flags are set for
+  /// writes that replace the range (its old contents are discarded, the driver still waits for draws reading it).
+  /// Only add GL_MAP_UNSYNCHRONIZED_BIT when no draw in flight reads the range, i.e. straight after orphanBuffer
+  /// @param _offset the offset in bytes from the start of the buffer
+  /// @param _size the number of bytes to map
+  /// @param _access the glMapBufferRange access flags
+  /// @returns a pointer to the mapped range or nullptr on failure
+  //----------------------------------------------------------------------------------------------------------------------
+  void *mapBufferRange(size_t _offset, size_t _size, GLbitfield _access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief unmap a buffer mapped with mapBufferRange and add the range to the upload stats
+  //----------------------------------------------------------------------------------------------------------------------
+  void unmapBufferRange();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the size in bytes of the buffer stores of every segment
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t getBufferSize() const;
+  size_t getIndexBufferSize() const;
+  size_t getAttributeBufferSize() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief access the upload counters
+  //----------------------------------------------------------------------------------------------------------------------
+  const UploadStats &uploadStats() const { return m_stats; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief reset the upload counters
+  //----------------------------------------------------------------------------------------------------------------------
+  void resetUploadStats() { m_stats = UploadStats(); }
 
 protected:
   //----------------------------------------------------------------------------------------------------------------------
   /// @brief ctor calles parent ctor to allocate vao;
   //----------------------------------------------------------------------------------------------------------------------
-  VAO(GLenum _mode) : AbstractVAO(_mode) {}
+  VAO(GLenum _mode) : AbstractVAO(_mode), m_stores(1) {}
 
 private:
   //----------------------------------------------------------------------------------------------------------------------
-  /// @brief the id of the buffer for the VAO
+  /// @brief the buffers of a segment
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Store
+  {
+    /// @brief the GL vertex array, 0 for the first segment which uses m_id
+    GLuint m_vao = 0;
+    GLuint m_buffer = 0;
+    GLuint m_indexBuffer = 0;
+    /// @brief the vertex and index store sizes in bytes
+    size_t m_size = 0;
+    size_t m_indexSize = 0;
+    /// @brief the part of the whole data held, with one segment it is all of it
+    Segment m_range;
+    /// @brief the extra attribute buffers keyed by attribute index, the id and size in bytes
+    std::unordered_map<GLuint, std::pair<GLuint, size_t>> m_attributes;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief (re-)specify the vertex buffer store of a single segment VAO, _data may be nullptr
+  //----------------------------------------------------------------------------------------------------------------------
+  void bufferData(size_t _size, const GLvoid *_data, GLenum _usage);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief delete the buffers of every segment and the vertex arrays of all but the first
+  //----------------------------------------------------------------------------------------------------------------------
+  void deleteStores();
+  GLuint vertexArray(size_t _segment) const { return _segment == 0 ? m_id : m_stores[_segment].m_vao; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief where the vertex data of a segment starts in the whole data in bytes
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t firstByte(size_t _segment) const { return m_stores[_segment].m_range.m_firstVertex * m_vertexBytes; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the segments, always at least one
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<Store> m_stores;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the vertex size set by allocateSegments, 0 when the data was set as bytes with setData
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t m_vertexBytes = 0;
+  GLenum m_usage = GL_STATIC_DRAW;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the currently mapped range (size 0 if nothing is mapped) and when it was mapped
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t m_mappedSize = 0;
+  size_t m_mappedSegment = 0;
+  bool m_mappedForWrite = false;
+  std::chrono::high_resolution_clock::time_point m_mapTime;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the upload counters
   //----------------------------------------------------------------------------------------------------------------------
-  GLuint m_buffer = 0;
+  UploadStats m_stats;
 };
 
 #endif
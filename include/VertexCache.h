@@ -0,0 +1,70 @@
+#ifndef VERTEXCACHE_H_
+#define VERTEXCACHE_H_
+//----------------------------------------------------------------------------------------------------------------------
+/// @file VertexCache.h
+/// @brief index buffer re-ordering for the post transform vertex cache and for overdraw. Triangles are
+/// first sorted with Tom Forsyth's linear speed vertex cache optimisation (a greedy pick of the best
+/// scoring triangle using a simulated LRU cache). The result is then split into clusters where the cache
+/// had to start cold anyway and the clusters are sorted so the ones facing out from the centre of the
+/// mesh are drawn first, a view independent way of getting more fragments rejected by early Z. The
+/// statistics use a FIFO cache as that is closer to what the hardware does.
+//----------------------------------------------------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vertexcache
+{
+/// @brief the cache behaviour of an index buffer
+struct CacheStats
+{
+  size_t m_triangles = 0;
+  size_t m_vertices = 0;
+  /// @brief vertices transformed, every cache miss is a run of the vertex shader
+  size_t m_misses = 0;
+  /// @brief average cache miss ratio, transformed vertices per triangle (0.5 is the best possible for a grid)
+  double acmr() const { return m_triangles != 0 ? static_cast<double>(m_misses) / m_triangles : 0.0; }
+  /// @brief average transform to vertex ratio, 1.0 means each vertex is only transformed once
+  double atvr() const { return m_vertices != 0 ? static_cast<double>(m_misses) / m_vertices : 0.0; }
+  void operator+=(const CacheStats &_s)
+  {
+    m_triangles += _s.m_triangles;
+    m_vertices += _s.m_vertices;
+    m_misses += _s.m_misses;
+  }
+};
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief simulate a FIFO cache over the triangles
+/// @param[in] _indices the triangle list
+/// @param[in] _numVertices the number of vertices indexed
+/// @param[in] _cacheSize the number of entries in the cache
+//----------------------------------------------------------------------------------------------------------------------
+CacheStats analyse(const std::vector<uint32_t> &_indices, size_t _numVertices, unsigned int _cacheSize = 16);
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief find a triangle order with good vertex cache use
+/// @param[in] _indices the triangle list
+/// @param[in] _numVertices the number of vertices indexed
+/// @returns the new order, element i is the index of the triangle to draw i'th
+//----------------------------------------------------------------------------------------------------------------------
+std::vector<uint32_t> optimiseCache(const std::vector<uint32_t> &_indices, size_t _numVertices);
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief re-order clusters of an already cache optimised triangle list to reduce overdraw
+/// @param[in] _indices the cache optimised triangle list
+/// @param[in] _positions the vertex positions, 3 floats at the start of each vertex
+/// @param[in] _stride the number of floats between vertices
+/// @param[in] _cacheSize the FIFO size used to find where the clusters start
+/// @returns the new order, element i is the index of the triangle to draw i'th
+//----------------------------------------------------------------------------------------------------------------------
+std::vector<uint32_t> optimiseOverdraw(const std::vector<uint32_t> &_indices, const float *_positions, size_t _stride,
+                                       unsigned int _cacheSize = 16);
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief re-order the vertices into the order they are first used so the vertex fetch reads memory
+/// in order
+/// @param[in,out] io_indices the triangle list, re-written to use the new vertex order
+/// @param[in] _numVertices the number of vertices indexed
+/// @returns the remap, element i is the old index of the vertex now at i
+//----------------------------------------------------------------------------------------------------------------------
+std::vector<uint32_t> optimiseFetch(std::vector<uint32_t> &io_indices, size_t _numVertices);
+} // end namespace vertexcache
+
+#endif
@@ -0,0 +1,125 @@
+#version 430 core
+/// @brief tests the bounds of each group against the frustum and the Hi-Z pyramid and writes the draw
+/// records of the survivors, see GpuCuller.h
+layout (local_size_x = 64) in;
+
+struct Group
+{
+  vec4 minBound;
+  vec4 maxBound;
+  uint count;
+  uint firstIndex;
+  uint batch;
+  uint batchFirst;
+};
+/// @brief the DrawElementsIndirectCommand layout
+struct Command
+{
+  uint count;
+  uint instanceCount;
+  uint firstIndex;
+  int baseVertex;
+  uint baseInstance;
+};
+layout (std430, binding = 0) readonly buffer Groups { Group groups[]; };
+layout (std430, binding = 1) writeonly buffer Commands { Command commands[]; };
+/// @brief the survivors of each batch when compacting
+layout (std430, binding = 2) buffer Counts { uint counts[]; };
+layout (std430, binding = 3) buffer Stats { uint numTested; uint numFrustumCulled; uint numOccluded; uint numDrawn; };
+
+uniform mat4 MVP;
+/// @brief the matrix the depth in the pyramid was drawn with
+uniform mat4 hizMVP;
+uniform sampler2D hiz;
+uniform int useHiZ;
+/// @brief pack the survivors of each batch at the start of its records rather than zeroing the culled ones
+uniform int compact;
+uniform int numGroups;
+
+bool inFrustum(vec3 _min, vec3 _max)
+{
+  // the rows of the matrix give the clip planes
+  vec4 w = vec4(MVP[0][3], MVP[1][3], MVP[2][3], MVP[3][3]);
+  for (int i = 0; i < 3; ++i)
+  {
+    vec4 row = vec4(MVP[0][i], MVP[1][i], MVP[2][i], MVP[3][i]);
+    for (int s = -1; s <= 1; s += 2)
+    {
+      vec4 plane = w + float(s) * row;
+      // the corner furthest along the plane normal
+      vec3 p = mix(_min, _max, greaterThanEqual(plane.xyz, vec3(0.0)));
+      if (dot(plane.xyz, p) + plane.w < 0.0)
+        return false;
+    }
+  }
+  return true;
+}
+
+bool occluded(vec3 _min, vec3 _max)
+{
+  vec3 lo = vec3(1e30);
+  vec3 hi = vec3(-1e30);
+  for (int c = 0; c < 8; ++c)
+  {
+    vec3 corner = vec3((c & 1) != 0 ? _max.x : _min.x, (c & 2) != 0 ? _max.y : _min.y, (c & 4) != 0 ? _max.z : _min.z);
+    vec4 clip = hizMVP * vec4(corner, 1.0);
+    // the box crosses the near plane so it is right in front of the camera
+    if (clip.w <= 0.0)
+      return false;
+    vec3 ndc = clip.xyz / clip.w;
+    lo = min(lo, ndc);
+    hi = max(hi, ndc);
+  }
+  ivec2 size = textureSize(hiz, 0);
+  ivec2 pMin = clamp(ivec2((lo.xy * 0.5 + 0.5) * vec2(size)), ivec2(0), size - 1);
+  ivec2 pMax = clamp(ivec2((hi.xy * 0.5 + 0.5) * vec2(size)), ivec2(0), size - 1);
+  // texel x of level l covers pixels x << l on so pick the level where the rectangle spans at most 2x2 texels
+  ivec2 extent = pMax - pMin;
+  int level = int(ceil(log2(float(max(max(extent.x, extent.y), 1)))));
+  level = clamp(level, 0, textureQueryLevels(hiz) - 1);
+  ivec2 levelMax = textureSize(hiz, level) - 1;
+  ivec2 a = min(pMin >> level, levelMax);
+  ivec2 b = min(pMax >> level, levelMax);
+  float farthest = max(max(texelFetch(hiz, a, level).r, texelFetch(hiz, ivec2(b.x, a.y), level).r),
+                       max(texelFetch(hiz, ivec2(a.x, b.y), level).r, texelFetch(hiz, b, level).r));
+  return lo.z * 0.5 + 0.5 > farthest;
+}
+
+void main()
+{
+  uint id = gl_GlobalInvocationID.x;
+  if (id >= uint(numGroups))
+    return;
+  Group g = groups[id];
+  bool visible = g.count != 0u;
+  if (visible)
+  {
+    atomicAdd(numTested, 1u);
+    if (!inFrustum(g.minBound.xyz, g.maxBound.xyz))
+    {
+      visible = false;
+      atomicAdd(numFrustumCulled, 1u);
+    }
+    else if (useHiZ != 0 && occluded(g.minBound.xyz, g.maxBound.xyz))
+    {
+      visible = false;
+      atomicAdd(numOccluded, 1u);
+    }
+  }
+  Command command;
+  command.count = g.count;
+  command.instanceCount = visible ? 1u : 0u;
+  command.firstIndex = g.firstIndex;
+  command.baseVertex = 0;
+  command.baseInstance = 0u;
+  if (compact == 0)
+  {
+    commands[id] = command;
+  }
+  else if (visible)
+  {
+    commands[g.batchFirst + atomicAdd(counts[g.batch], 1u)] = command;
+  }
+  if (visible)
+    atomicAdd(numDrawn, 1u);
+}
@@ -0,0 +1,36 @@
+#version 430 core
+/// @brief builds one level of the Hi-Z pyramid. Level 0 is a copy of the depth buffer and each level after
+/// holds the farthest depth of the 2x2 texels below it, the last texel of an odd sized level also takes the
+/// row or column which has no pair so every pixel is covered by texel (x >> level, y >> level)
+layout (local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D depthTex;
+layout (r32f, binding = 0) readonly uniform image2D srcLevel;
+layout (r32f, binding = 1) writeonly uniform image2D dstLevel;
+uniform int level;
+
+void main()
+{
+  ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 dstSize = imageSize(dstLevel);
+  if (any(greaterThanEqual(p, dstSize)))
+    return;
+  float depth = 0.0;
+  if (level == 0)
+  {
+    depth = texelFetch(depthTex, p, 0).r;
+  }
+  else
+  {
+    ivec2 srcSize = imageSize(srcLevel);
+    ivec2 last = min(2 * p + 1 + ivec2(equal(p, dstSize - 1)) * (srcSize & 1), srcSize - 1);
+    for (int y = 2 * p.y; y <= last.y; ++y)
+    {
+      for (int x = 2 * p.x; x <= last.x; ++x)
+      {
+        depth = max(depth, imageLoad(srcLevel, ivec2(x, y)).r);
+      }
+    }
+  }
+  imageStore(dstLevel, p, vec4(depth));
+}
@@ -0,0 +1,75 @@
+#version 330 core
+/// @file MaterialFrag.glsl
+/// @brief the material shader, this is compiled once per set of material features by ShaderVariants which
+/// adds the #defines below after the #version line so each surface only pays for what it uses
+/// HAS_DIFFUSE_MAP  sample map_Kd else the colour is just ka
+/// HAS_ALPHA_MAP    take the alpha from the red channel of map_d
+/// ALPHA_TEST       discard fragments below the cutoff, without it a diffuse map still discards where its alpha is 0
+/// HAS_BUMP_MAP     perturb the normal with the tangent space normal map in map_bump
+/// TRANSPARENT      use the d value of the material (transp) as the alpha
+/// @brief our output fragment colour
+layout (location =0) out vec4 fragColour;
+// the vertex UV
+in vec2 vertUV;
+// the baked ambient occlusion / sky light
+in vec3 vertLight;
+uniform vec3 ka;
+#ifdef HAS_DIFFUSE_MAP
+uniform sampler2D tex;
+#endif
+#ifdef HAS_ALPHA_MAP
+uniform sampler2D alphaTex;
+#endif
+#ifdef TRANSPARENT
+uniform float transp;
+#endif
+#ifdef HAS_BUMP_MAP
+uniform sampler2D bumpTex;
+in vec3 vertPos;
+in vec3 vertNormal;
+// build a tangent frame from the screen space derivatives as we have no tangents in the mesh
+mat3 cotangentFrame(vec3 _n, vec3 _p, vec2 _uv)
+{
+  vec3 dp1 = dFdx(_p);
+  vec3 dp2 = dFdy(_p);
+  vec2 duv1 = dFdx(_uv);
+  vec2 duv2 = dFdy(_uv);
+  vec3 dp2perp = cross(dp2, _n);
+  vec3 dp1perp = cross(_n, dp1);
+  vec3 t = dp2perp * duv1.x + dp1perp * duv2.x;
+  vec3 b = dp2perp * duv1.y + dp1perp * duv2.y;
+  float invmax = inversesqrt(max(max(dot(t, t), dot(b, b)), 1e-12));
+  return mat3(t * invmax, b * invmax, _n);
+}
+#endif
+void main ()
+{
+#ifdef HAS_DIFFUSE_MAP
+  vec4 diffuse = texture(tex,vertUV);
+#else
+  vec4 diffuse = vec4(1.0);
+#endif
+#ifdef HAS_ALPHA_MAP
+  diffuse.a = texture(alphaTex,vertUV).r;
+#endif
+#ifdef ALPHA_TEST
+  if (diffuse.a < 0.5)
+      discard;
+#elif defined(HAS_DIFFUSE_MAP)
+  // diffuse maps with their own alpha cut outs, as TextureFrag does
+  if (diffuse.a == 0)
+      discard;
+#endif
+  vec3 light = vertLight;
+#ifdef HAS_BUMP_MAP
+  // the baked light is for the smooth normal, scale it by how much more or less of the sky the bumped normal sees
+  vec3 n = normalize(vertNormal);
+  vec3 bumped = normalize(cotangentFrame(n, vertPos, vertUV) * (texture(bumpTex,vertUV).xyz * 2.0 - 1.0));
+  light *= (0.75 + 0.25 * bumped.y) / (0.75 + 0.25 * n.y);
+#endif
+#ifdef TRANSPARENT
+  fragColour = vec4(ka*light,transp)*diffuse;
+#else
+  fragColour = vec4(ka*light*diffuse.rgb,1.0);
+#endif
+}
@@ -5,6 +5,8 @@ layout (location =0) out vec4 fragColour;
 uniform sampler2D tex;
 // the vertex UV
 in vec2 vertUV;
+// the baked ambient occlusion / sky light
+in vec3 vertLight;
 uniform vec3 ka;
 uniform float transp;
 void main ()
@@ -13,5 +15,5 @@ void main ()
   if (diffuse.a == 0)
       discard;
  // set the fragment colour to the current texture
- fragColour = vec4(ka,transp)*diffuse;
+ fragColour = vec4(ka*vertLight,transp)*diffuse;
 }
@@ -5,9 +5,17 @@ layout (location = 0) in vec3 inVert;
 layout (location = 1) in vec3 inNormal;
 /// @brief the in uv
 layout (location = 2) in vec2 inUV;
+/// @brief the baked lighting, if the array isn't enabled this is the generic value set by the app
+layout (location = 3) in vec3 inLight;
 uniform mat4 MVP;
 // we use this to pass the UV values to the frag shader
 out vec2 vertUV;
+out vec3 vertLight;
+#ifdef HAS_BUMP_MAP
+// model space position and normal for the derivative based tangent frame
+out vec3 vertPos;
+out vec3 vertNormal;
+#endif
 
 void main(void)
 {
@@ -17,4 +25,9 @@ void main(void)
 gl_Position = MVP*vec4(inVert, 1.0);
 // pass the UV values to the frag shader
 vertUV=inUV.st;
+vertLight=inLight;
+#ifdef HAS_BUMP_MAP
+vertPos=inVert;
+vertNormal=inNormal;
+#endif
 }
@@ -0,0 +1,265 @@
+#include "AOBaker.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+constexpr char c_aoHeader[] = "ngl::aobin";
+constexpr size_t c_aoHeaderSize = sizeof(c_aoHeader) - 1;
+static_assert(sizeof(ngl::Vec3) == 3 * sizeof(float), "the cache writes ngl::Vec3 as 3 floats");
+
+/// @brief a small hash based random number generator, seeded per vertex and pass so the result
+/// doesn't depend on how the vertices are split between threads
+struct Rng
+{
+  uint32_t m_state;
+  explicit Rng(uint32_t _seed) : m_state(_seed * 747796405u + 2891336453u) {}
+  float next()
+  {
+    // PCG RXS-M-XS 32 bit
+    m_state = m_state * 747796405u + 2891336453u;
+    uint32_t word = ((m_state >> ((m_state >> 28u) + 4u)) ^ m_state) * 277803737u;
+    word = (word >> 22u) ^ word;
+    return (word >> 8) * (1.0f / 16777216.0f);
+  }
+};
+
+uint32_t hashSeed(uint32_t _a, uint32_t _b)
+{
+  uint32_t h = _a * 0x9e3779b1u ^ (_b + 0x7f4a7c15u + (_a << 6) + (_a >> 2));
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
+} // end anon namespace
+
+AOBaker::AOBaker(const GroupedObj &_mesh, const std::string &_cacheDir, const AOSettings &_settings)
+    : m_mesh(_mesh), m_settings(_settings)
+{
+  m_sum.resize(m_mesh.vertexData().size(), ngl::Vec3(0.0f, 0.0f, 0.0f));
+  if (_cacheDir.size() != 0)
+  {
+    std::stringstream name;
+    name << _cacheDir << '/' << std::hex << m_mesh.hash() << ".ao";
+    m_cacheName = name.str();
+    m_fromCache = loadCache();
+    if (m_fromCache == true)
+    {
+      publish();
+    }
+  }
+}
+
+AOBaker::~AOBaker()
+{
+  stop();
+}
+
+bool AOBaker::runPass()
+{
+  if (converged())
+  {
+    return false;
+  }
+  TRACE_SCOPE("AO pass");
+  if (!m_bvh)
+  {
+    m_bvh = std::make_unique<BVH>(m_mesh, m_settings.threads);
+  }
+  auto &verts = m_mesh.vertexData();
+  // push the ray start off the surface by a small amount relative to the scene size
+  float epsilon = (m_bvh->boundsMax() - m_bvh->boundsMin()).length() * 1e-5f;
+  unsigned int firstSample = m_samples;
+  unsigned int count = std::min(m_settings.samplesPerPass, m_settings.maxSamples - firstSample);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  parallel::forEach(0, verts.size(), [&](size_t i)
+  {
+    const VertData &v = verts[i];
+    ngl::Vec3 n(v.nx, v.ny, v.nz);
+    if (n.lengthSquared() < 1e-12f)
+    {
+      // no normal in the file so use the face normal
+      size_t tri = i - i % 3;
+      ngl::Vec3 a(verts[tri].x, verts[tri].y, verts[tri].z);
+      ngl::Vec3 b(verts[tri + 1].x, verts[tri + 1].y, verts[tri + 1].z);
+      ngl::Vec3 c(verts[tri + 2].x, verts[tri + 2].y, verts[tri + 2].z);
+      n = (b - a).cross(c - a);
+      if (n.lengthSquared() < 1e-12f)
+      {
+        n = ngl::Vec3(0.0f, 1.0f, 0.0f);
+      }
+    }
+    n.normalize();
+    // orthonormal basis about the normal (Duff et al. 2017)
+    float sign = std::copysign(1.0f, n.m_z);
+    float a = -1.0f / (sign + n.m_z);
+    float b = n.m_x * n.m_y * a;
+    ngl::Vec3 t(1.0f + sign * n.m_x * n.m_x * a, sign * b, -sign * n.m_x);
+    ngl::Vec3 bt(b, sign + n.m_y * n.m_y * a, -n.m_y);
+    ngl::Vec3 origin = ngl::Vec3(v.x, v.y, v.z) + n * epsilon;
+    ngl::Vec3 sum(0.0f, 0.0f, 0.0f);
+    Rng rng(hashSeed(static_cast<uint32_t>(i), firstSample));
+    for (unsigned int s = 0; s < count; ++s)
+    {
+      // cosine weighted direction so the estimate is just the average of the sky colour seen
+      float r1 = rng.next();
+      float r2 = rng.next();
+      float r = std::sqrt(r1);
+      float phi = 6.28318531f * r2;
+      ngl::Vec3 dir = t * (r * std::cos(phi)) + bt * (r * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1.0f - r1));
+      if (m_bvh->occluded(origin, dir, m_settings.maxDistance))
+      {
+        continue;
+      }
+      if (dir.m_y >= 0.0f)
+      {
+        sum += m_settings.skyHorizon + (m_settings.skyZenith - m_settings.skyHorizon) * dir.m_y;
+      }
+      else
+      {
+        sum += m_settings.ground;
+      }
+    }
+    m_sum[i] += sum;
+  }, m_settings.threads, 256);
+  auto end = std::chrono::high_resolution_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  m_samplesPerSecond = seconds > 0.0 ? (static_cast<double>(verts.size()) * count) / seconds : 0.0;
+  m_samples += count;
+  if (trace::verbose())
+  {
+    std::ostringstream message;
+    message << "AO pass " << m_samples << "/" << m_settings.maxSamples << " samples " << m_samplesPerSecond / 1e6
+            << " Msamples/s\n";
+    trace::print(message.str());
+  }
+  publish();
+  return true;
+}
+
+void AOBaker::publish()
+{
+  if (m_samples == 0)
+  {
+    return;
+  }
+  float scale = 1.0f / m_samples;
+  std::lock_guard<std::mutex> lock(m_resultLock);
+  m_result.resize(m_sum.size());
+  for (size_t i = 0; i < m_sum.size(); ++i)
+  {
+    m_result[i] = m_sum[i] * scale;
+  }
+  m_newResult = true;
+}
+
+bool AOBaker::fetchResult(std::vector<ngl::Vec3> &o_light)
+{
+  std::lock_guard<std::mutex> lock(m_resultLock);
+  if (m_newResult == false)
+  {
+    return false;
+  }
+  o_light = m_result;
+  m_newResult = false;
+  return true;
+}
+
+void AOBaker::start()
+{
+  if (m_running || converged())
+  {
+    return;
+  }
+  stop();
+  m_stop = false;
+  m_running = true;
+  m_thread = std::thread([this]()
+  {
+    trace::setThreadName("AO bake");
+    while (!m_stop && runPass())
+    {
+    }
+    if (converged())
+    {
+      saveCache();
+    }
+    m_running = false;
+  });
+}
+
+void AOBaker::stop()
+{
+  m_stop = true;
+  if (m_thread.joinable())
+  {
+    m_thread.join();
+  }
+}
+
+bool AOBaker::loadCache()
+{
+  std::ifstream fileIn(m_cacheName, std::ios::in | std::ios::binary);
+  if (!fileIn.is_open())
+  {
+    return false;
+  }
+  char header[c_aoHeaderSize + 1];
+  fileIn.read(header, c_aoHeaderSize);
+  header[c_aoHeaderSize] = 0;
+  if (strcmp(header, c_aoHeader))
+  {
+    std::cerr << m_cacheName << " is not an ngl::aobin file\n";
+    return false;
+  }
+  uint64_t numVerts = 0;
+  unsigned int samples = 0;
+  fileIn.read(reinterpret_cast<char *>(&numVerts), sizeof(numVerts));
+  fileIn.read(reinterpret_cast<char *>(&samples), sizeof(samples));
+  if (numVerts != m_sum.size())
+  {
+    std::cerr << m_cacheName << " has the wrong number of vertices\n";
+    return false;
+  }
+  fileIn.read(reinterpret_cast<char *>(m_sum.data()), static_cast<std::streamsize>(m_sum.size() * sizeof(ngl::Vec3)));
+  if (!fileIn)
+  {
+    std::cerr << "truncated ao cache " << m_cacheName << '\n';
+    std::fill(m_sum.begin(), m_sum.end(), ngl::Vec3(0.0f, 0.0f, 0.0f));
+    return false;
+  }
+  m_samples = samples;
+  return true;
+}
+
+bool AOBaker::saveCache() const
+{
+  if (m_cacheName.size() == 0 || m_samples == 0)
+  {
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(m_cacheName).parent_path(), ec);
+  std::ofstream fileOut(m_cacheName, std::ios::out | std::ios::binary);
+  if (!fileOut.is_open())
+  {
+    std::cerr << "could not write ao cache " << m_cacheName << '\n';
+    return false;
+  }
+  uint64_t numVerts = m_sum.size();
+  unsigned int samples = m_samples;
+  fileOut.write(c_aoHeader, c_aoHeaderSize);
+  fileOut.write(reinterpret_cast<const char *>(&numVerts), sizeof(numVerts));
+  fileOut.write(reinterpret_cast<const char *>(&samples), sizeof(samples));
+  fileOut.write(reinterpret_cast<const char *>(m_sum.data()), static_cast<std::streamsize>(m_sum.size() * sizeof(ngl::Vec3)));
+  return true;
+}
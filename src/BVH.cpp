@@ -0,0 +1,725 @@
+#include "BVH.h"
+#include "Parallel.h"
+#include "SIMD.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <numeric>
+#include <random>
+
+namespace
+{
+constexpr int c_bins = 16;
+constexpr uint32_t c_maxLeafSize = 8;
+constexpr uint32_t c_parallelMinTris = 4096;
+// the traversal stacks are fixed size, intersect4 holds up to one node per level plus one so the build
+// stops splitting (however many triangles are left) before a tree could overflow them
+constexpr int c_stackSize = 64;
+constexpr int c_maxDepth = c_stackSize - 2;
+constexpr float c_noHit = 1e30f;
+// min, max and centroid per triangle, size_t so the offsets of a mesh with billions of triangles don't wrap
+constexpr size_t c_boundsFloats = 9;
+
+float area(const float *_min, const float *_max)
+{
+  float ex = _max[0] - _min[0];
+  float ey = _max[1] - _min[1];
+  float ez = _max[2] - _min[2];
+  return ex * ey + ey * ez + ez * ex;
+}
+
+// slab test returns the entry distance or c_noHit if the box is missed
+inline float intersectBox(const BVHNode &_n, const float _o[3], const float _invD[3], float _tMax)
+{
+  float tx1 = (_n.m_min[0] - _o[0]) * _invD[0];
+  float tx2 = (_n.m_max[0] - _o[0]) * _invD[0];
+  float tmin = std::min(tx1, tx2);
+  float tmax = std::max(tx1, tx2);
+  float ty1 = (_n.m_min[1] - _o[1]) * _invD[1];
+  float ty2 = (_n.m_max[1] - _o[1]) * _invD[1];
+  tmin = std::max(tmin, std::min(ty1, ty2));
+  tmax = std::min(tmax, std::max(ty1, ty2));
+  float tz1 = (_n.m_min[2] - _o[2]) * _invD[2];
+  float tz2 = (_n.m_max[2] - _o[2]) * _invD[2];
+  tmin = std::max(tmin, std::min(tz1, tz2));
+  tmax = std::min(tmax, std::max(tz1, tz2));
+  if (tmax >= tmin && tmin < _tMax && tmax > 0.0f)
+  {
+    return tmin;
+  }
+  return c_noHit;
+}
+
+inline float safeInverse(float _d)
+{
+  return std::fabs(_d) > 1e-12f ? 1.0f / _d : std::copysign(1e30f, _d);
+}
+
+} // end anon namespace
+
+using namespace simd;
+
+BVH::BVH(const GroupedObj &_mesh, unsigned int _threads)
+{
+  TRACE_SCOPE("BVH build");
+  auto start = std::chrono::high_resolution_clock::now();
+  auto &verts = _mesh.vertexData();
+  // the nodes link with 32 bit indices to stay 32 bytes and a tree can need 2N of them, so a bigger mesh is
+  // refused rather than silently truncated
+  constexpr size_t maxTris = (size_t(1) << 31) - 1;
+  size_t meshTris = verts.size() / 3;
+  if (meshTris > maxTris)
+  {
+    std::cerr << "BVH : " << meshTris << " triangles is more than the " << maxTris << " a BVH can index, it will be empty\n";
+  }
+  uint32_t numTris = meshTris > maxTris ? 0 : static_cast<uint32_t>(meshTris);
+  unsigned int threads = parallel::numThreads(_threads);
+  // spawn a task per level until we have roughly one sub tree per thread
+  m_parallelDepth = 0;
+  while ((1u << m_parallelDepth) < threads)
+  {
+    ++m_parallelDepth;
+  }
+
+  for (size_t i = 0; i < _mesh.numMeshes(); ++i)
+  {
+    m_groupStarts.push_back({static_cast<uint32_t>(_mesh.getMeshData(i).m_startIndex / 3), i});
+  }
+  std::sort(m_groupStarts.begin(), m_groupStarts.end());
+
+  m_triIndex.resize(numTris);
+  std::iota(m_triIndex.begin(), m_triIndex.end(), 0);
+  // per triangle min, max and centroid
+  m_triBounds.resize(numTris * c_boundsFloats);
+  parallel::forEach(0, numTris, [&](size_t t)
+  {
+    float *b = &m_triBounds[t * c_boundsFloats];
+    for (int a = 0; a < 3; ++a)
+    {
+      float p0 = (&verts[t * 3].x)[a];
+      float p1 = (&verts[t * 3 + 1].x)[a];
+      float p2 = (&verts[t * 3 + 2].x)[a];
+      b[a] = std::min(p0, std::min(p1, p2));
+      b[a + 3] = std::max(p0, std::max(p1, p2));
+      b[a + 6] = (p0 + p1 + p2) / 3.0f;
+    }
+  }, threads, 4096);
+
+  // worst case is 2N-1 nodes plus the unused node 1
+  m_nodes.resize(std::max<size_t>(2, 2 * static_cast<size_t>(numTris)));
+  BVHNode &root = m_nodes[0];
+  root.m_leftFirst = 0;
+  root.m_count = numTris;
+  updateBounds(0, 0, numTris);
+  if (numTris != 0)
+  {
+    buildNode(0, 0, numTris, 0);
+  }
+  m_numNodes = m_nodesUsed;
+  m_nodes.resize(m_numNodes);
+  m_nodes.shrink_to_fit();
+
+  // copy the triangles in tree order so leaves read contiguous memory
+  m_triangles.resize(numTris);
+  parallel::forEach(0, numTris, [&](size_t i)
+  {
+    const VertData *v = &verts[static_cast<size_t>(m_triIndex[i]) * 3];
+    Triangle &t = m_triangles[i];
+    t.m_v0[0] = v[0].x;
+    t.m_v0[1] = v[0].y;
+    t.m_v0[2] = v[0].z;
+    t.m_e1[0] = v[1].x - v[0].x;
+    t.m_e1[1] = v[1].y - v[0].y;
+    t.m_e1[2] = v[1].z - v[0].z;
+    t.m_e2[0] = v[2].x - v[0].x;
+    t.m_e2[1] = v[2].y - v[0].y;
+    t.m_e2[2] = v[2].z - v[0].z;
+  }, threads, 4096);
+  m_triBounds.clear();
+  m_triBounds.shrink_to_fit();
+  auto end = std::chrono::high_resolution_clock::now();
+  m_buildTime = std::chrono::duration<double>(end - start).count();
+}
+
+void BVH::updateBounds(uint32_t _node, uint32_t _first, uint32_t _count)
+{
+  BVHNode &n = m_nodes[_node];
+  n.m_min[0] = n.m_min[1] = n.m_min[2] = c_noHit;
+  n.m_max[0] = n.m_max[1] = n.m_max[2] = -c_noHit;
+  for (uint32_t i = _first; i < _first + _count; ++i)
+  {
+    const float *b = &m_triBounds[m_triIndex[i] * c_boundsFloats];
+    for (int a = 0; a < 3; ++a)
+    {
+      n.m_min[a] = std::min(n.m_min[a], b[a]);
+      n.m_max[a] = std::max(n.m_max[a], b[a + 3]);
+    }
+  }
+}
+
+float BVH::findSplit(const BVHNode &, uint32_t _first, uint32_t _count, int &o_axis, float &o_pos) const
+{
+  // bin on the centroid bounds rather than the node bounds so the bins are all useful
+  float cmin[3] = {c_noHit, c_noHit, c_noHit};
+  float cmax[3] = {-c_noHit, -c_noHit, -c_noHit};
+  for (uint32_t i = _first; i < _first + _count; ++i)
+  {
+    const float *c = &m_triBounds[m_triIndex[i] * c_boundsFloats + 6];
+    for (int a = 0; a < 3; ++a)
+    {
+      cmin[a] = std::min(cmin[a], c[a]);
+      cmax[a] = std::max(cmax[a], c[a]);
+    }
+  }
+  float bestCost = c_noHit;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    float extent = cmax[axis] - cmin[axis];
+    if (extent <= 0.0f)
+    {
+      continue;
+    }
+    struct Bin
+    {
+      float m_min[3] = {c_noHit, c_noHit, c_noHit};
+      float m_max[3] = {-c_noHit, -c_noHit, -c_noHit};
+      uint32_t m_count = 0;
+    } bins[c_bins];
+    float scale = c_bins / extent;
+    for (uint32_t i = _first; i < _first + _count; ++i)
+    {
+      const float *b = &m_triBounds[m_triIndex[i] * c_boundsFloats];
+      int binIdx = std::min(c_bins - 1, static_cast<int>((b[6 + axis] - cmin[axis]) * scale));
+      Bin &bin = bins[binIdx];
+      ++bin.m_count;
+      for (int a = 0; a < 3; ++a)
+      {
+        bin.m_min[a] = std::min(bin.m_min[a], b[a]);
+        bin.m_max[a] = std::max(bin.m_max[a], b[a + 3]);
+      }
+    }
+    // sweep from both sides to get the area and count either side of each plane
+    float leftArea[c_bins - 1], rightArea[c_bins - 1];
+    uint32_t leftCount[c_bins - 1], rightCount[c_bins - 1];
+    Bin left, right;
+    uint32_t leftSum = 0, rightSum = 0;
+    for (int i = 0; i < c_bins - 1; ++i)
+    {
+      leftSum += bins[i].m_count;
+      leftCount[i] = leftSum;
+      for (int a = 0; a < 3; ++a)
+      {
+        left.m_min[a] = std::min(left.m_min[a], bins[i].m_min[a]);
+        left.m_max[a] = std::max(left.m_max[a], bins[i].m_max[a]);
+      }
+      leftArea[i] = leftSum ? area(left.m_min, left.m_max) : 0.0f;
+      rightSum += bins[c_bins - 1 - i].m_count;
+      rightCount[c_bins - 2 - i] = rightSum;
+      for (int a = 0; a < 3; ++a)
+      {
+        right.m_min[a] = std::min(right.m_min[a], bins[c_bins - 1 - i].m_min[a]);
+        right.m_max[a] = std::max(right.m_max[a], bins[c_bins - 1 - i].m_max[a]);
+      }
+      rightArea[c_bins - 2 - i] = rightSum ? area(right.m_min, right.m_max) : 0.0f;
+    }
+    float planeStep = extent / c_bins;
+    for (int i = 0; i < c_bins - 1; ++i)
+    {
+      if (leftCount[i] == 0 || rightCount[i] == 0)
+      {
+        continue;
+      }
+      float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        o_axis = axis;
+        o_pos = cmin[axis] + planeStep * (i + 1);
+      }
+    }
+  }
+  return bestCost;
+}
+
+void BVH::buildNode(uint32_t _node, uint32_t _first, uint32_t _count, int _depth)
+{
+  BVHNode &n = m_nodes[_node];
+  // clustered or coincident centroids can give very lopsided splits, so past c_maxDepth this is a leaf
+  if (_count <= 2 || _depth >= c_maxDepth)
+  {
+    return;
+  }
+  int axis = 0;
+  float pos = 0.0f;
+  float splitCost = findSplit(n, _first, _count, axis, pos);
+  // both costs are scaled by the node area, a traversal step costs about one triangle test
+  float nodeArea = area(n.m_min, n.m_max);
+  float leafCost = _count * nodeArea;
+  splitCost += nodeArea;
+  uint32_t i = _first;
+  if (splitCost < leafCost)
+  {
+    uint32_t j = _first + _count - 1;
+    while (i <= j && j != ~0u)
+    {
+      if (m_triBounds[m_triIndex[i] * c_boundsFloats + 6 + axis] < pos)
+      {
+        ++i;
+      }
+      else
+      {
+        std::swap(m_triIndex[i], m_triIndex[j--]);
+      }
+    }
+  }
+  else if (_count <= c_maxLeafSize)
+  {
+    return;
+  }
+  uint32_t leftCount = i - _first;
+  if (leftCount == 0 || leftCount == _count)
+  {
+    // no useful SAH split (all centroids the same or leaf cost cheaper but too many triangles)
+    // so fall back to an object median on the longest axis
+    float extent[3] = {n.m_max[0] - n.m_min[0], n.m_max[1] - n.m_min[1], n.m_max[2] - n.m_min[2]};
+    axis = extent[0] > extent[1] ? (extent[0] > extent[2] ? 0 : 2) : (extent[1] > extent[2] ? 1 : 2);
+    leftCount = _count / 2;
+    std::nth_element(m_triIndex.begin() + _first, m_triIndex.begin() + _first + leftCount,
+                     m_triIndex.begin() + _first + _count, [this, axis](uint32_t _a, uint32_t _b)
+                     { return m_triBounds[_a * c_boundsFloats + 6 + axis] < m_triBounds[_b * c_boundsFloats + 6 + axis]; });
+  }
+  uint32_t left = m_nodesUsed.fetch_add(2);
+  m_nodes[left].m_leftFirst = _first;
+  m_nodes[left].m_count = leftCount;
+  m_nodes[left + 1].m_leftFirst = _first + leftCount;
+  m_nodes[left + 1].m_count = _count - leftCount;
+  n.m_leftFirst = left;
+  n.m_count = 0;
+  updateBounds(left, _first, leftCount);
+  updateBounds(left + 1, _first + leftCount, _count - leftCount);
+  if (_depth < m_parallelDepth && _count > c_parallelMinTris)
+  {
+    auto task = std::async(std::launch::async, [this, left, _first, leftCount, _depth]()
+                           {
+                             TRACE_SCOPE("BVH subtree");
+                             buildNode(left, _first, leftCount, _depth + 1);
+                           });
+    buildNode(left + 1, _first + leftCount, _count - leftCount, _depth + 1);
+    task.get();
+  }
+  else
+  {
+    buildNode(left, _first, leftCount, _depth + 1);
+    buildNode(left + 1, _first + leftCount, _count - leftCount, _depth + 1);
+  }
+}
+
+bool BVH::intersectTriangle(uint32_t _index, const ngl::Vec3 &_o, const ngl::Vec3 &_d, float &io_t, float &o_u, float &o_v) const
+{
+  // Moller Trumbore
+  const Triangle &tri = m_triangles[_index];
+  float px = _d.m_y * tri.m_e2[2] - _d.m_z * tri.m_e2[1];
+  float py = _d.m_z * tri.m_e2[0] - _d.m_x * tri.m_e2[2];
+  float pz = _d.m_x * tri.m_e2[1] - _d.m_y * tri.m_e2[0];
+  float det = tri.m_e1[0] * px + tri.m_e1[1] * py + tri.m_e1[2] * pz;
+  if (std::fabs(det) < 1e-12f)
+  {
+    return false;
+  }
+  float invDet = 1.0f / det;
+  float sx = _o.m_x - tri.m_v0[0];
+  float sy = _o.m_y - tri.m_v0[1];
+  float sz = _o.m_z - tri.m_v0[2];
+  float u = (sx * px + sy * py + sz * pz) * invDet;
+  if (u < 0.0f || u > 1.0f)
+  {
+    return false;
+  }
+  float qx = sy * tri.m_e1[2] - sz * tri.m_e1[1];
+  float qy = sz * tri.m_e1[0] - sx * tri.m_e1[2];
+  float qz = sx * tri.m_e1[1] - sy * tri.m_e1[0];
+  float v = (_d.m_x * qx + _d.m_y * qy + _d.m_z * qz) * invDet;
+  if (v < 0.0f || u + v > 1.0f)
+  {
+    return false;
+  }
+  float t = (tri.m_e2[0] * qx + tri.m_e2[1] * qy + tri.m_e2[2] * qz) * invDet;
+  if (t > 1e-5f && t < io_t)
+  {
+    io_t = t;
+    o_u = u;
+    o_v = v;
+    return true;
+  }
+  return false;
+}
+
+BVHHit BVH::intersect(const ngl::Vec3 &_origin, const ngl::Vec3 &_dir, float _tMax) const
+{
+  BVHHit hit;
+  if (m_triangles.empty())
+  {
+    return hit;
+  }
+  float o[3] = {_origin.m_x, _origin.m_y, _origin.m_z};
+  float invD[3] = {safeInverse(_dir.m_x), safeInverse(_dir.m_y), safeInverse(_dir.m_z)};
+  float t = _tMax;
+  uint32_t hitIndex = ~0u;
+  const BVHNode *stack[c_stackSize];
+  int stackPtr = 0;
+  const BVHNode *node = &m_nodes[0];
+  if (intersectBox(*node, o, invD, t) == c_noHit)
+  {
+    return hit;
+  }
+  for (;;)
+  {
+    if (node->m_count != 0)
+    {
+      for (uint32_t i = node->m_leftFirst; i < node->m_leftFirst + node->m_count; ++i)
+      {
+        if (intersectTriangle(i, _origin, _dir, t, hit.m_u, hit.m_v))
+        {
+          hitIndex = i;
+        }
+      }
+      if (stackPtr == 0)
+      {
+        break;
+      }
+      node = stack[--stackPtr];
+      continue;
+    }
+    // visit the nearest child first and only push the other if it is hit
+    const BVHNode *child1 = &m_nodes[node->m_leftFirst];
+    const BVHNode *child2 = &m_nodes[node->m_leftFirst + 1];
+    float dist1 = intersectBox(*child1, o, invD, t);
+    float dist2 = intersectBox(*child2, o, invD, t);
+    if (dist1 > dist2)
+    {
+      std::swap(dist1, dist2);
+      std::swap(child1, child2);
+    }
+    if (dist1 == c_noHit)
+    {
+      if (stackPtr == 0)
+      {
+        break;
+      }
+      node = stack[--stackPtr];
+    }
+    else
+    {
+      node = child1;
+      if (dist2 != c_noHit)
+      {
+        stack[stackPtr++] = child2;
+      }
+    }
+  }
+  if (hitIndex != ~0u)
+  {
+    hit.m_t = t;
+    hit.m_triangle = m_triIndex[hitIndex];
+    hit.m_meshID = meshForTriangle(hit.m_triangle);
+  }
+  return hit;
+}
+
+bool BVH::occluded(const ngl::Vec3 &_origin, const ngl::Vec3 &_dir, float _tMax) const
+{
+  if (m_triangles.empty())
+  {
+    return false;
+  }
+  float o[3] = {_origin.m_x, _origin.m_y, _origin.m_z};
+  float invD[3] = {safeInverse(_dir.m_x), safeInverse(_dir.m_y), safeInverse(_dir.m_z)};
+  float t = _tMax;
+  float u, v;
+  const BVHNode *stack[c_stackSize];
+  int stackPtr = 0;
+  stack[stackPtr++] = &m_nodes[0];
+  while (stackPtr != 0)
+  {
+    const BVHNode *node = stack[--stackPtr];
+    if (intersectBox(*node, o, invD, t) == c_noHit)
+    {
+      continue;
+    }
+    if (node->m_count != 0)
+    {
+      for (uint32_t i = node->m_leftFirst; i < node->m_leftFirst + node->m_count; ++i)
+      {
+        if (intersectTriangle(i, _origin, _dir, t, u, v))
+        {
+          return true;
+        }
+      }
+    }
+    else
+    {
+      stack[stackPtr++] = &m_nodes[node->m_leftFirst + 1];
+      stack[stackPtr++] = &m_nodes[node->m_leftFirst];
+    }
+  }
+  return false;
+}
+
+void BVH::intersect4(const RayPacket4 &_rays, BVHHit o_hits[4]) const
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    o_hits[i] = BVHHit();
+  }
+  if (m_triangles.empty())
+  {
+    return;
+  }
+  const Float4 ox = Float4::load(_rays.m_ox);
+  const Float4 oy = Float4::load(_rays.m_oy);
+  const Float4 oz = Float4::load(_rays.m_oz);
+  const Float4 dx = Float4::load(_rays.m_dx);
+  const Float4 dy = Float4::load(_rays.m_dy);
+  const Float4 dz = Float4::load(_rays.m_dz);
+  alignas(16) float inv[3][4];
+  for (int i = 0; i < 4; ++i)
+  {
+    inv[0][i] = safeInverse(_rays.m_dx[i]);
+    inv[1][i] = safeInverse(_rays.m_dy[i]);
+    inv[2][i] = safeInverse(_rays.m_dz[i]);
+  }
+  const Float4 idx = Float4::load(inv[0]);
+  const Float4 idy = Float4::load(inv[1]);
+  const Float4 idz = Float4::load(inv[2]);
+  const Float4 zero(0.0f);
+  const Float4 one(1.0f);
+  const Float4 epsilon(1e-5f);
+  Float4 t = Float4::load(_rays.m_tMax);
+  Float4 hitU(0.0f), hitV(0.0f);
+  // triangle index per lane stored as float bits would be awkward so track it with a scalar array
+  alignas(16) float laneT[4];
+  alignas(16) float laneU[4];
+  alignas(16) float laneV[4];
+  uint32_t hitIndex[4] = {~0u, ~0u, ~0u, ~0u};
+
+  const BVHNode *stack[c_stackSize];
+  int stackPtr = 0;
+  stack[stackPtr++] = &m_nodes[0];
+  while (stackPtr != 0)
+  {
+    const BVHNode *node = stack[--stackPtr];
+    // one box against all 4 rays
+    Float4 tx1 = (Float4(node->m_min[0]) - ox) * idx;
+    Float4 tx2 = (Float4(node->m_max[0]) - ox) * idx;
+    Float4 tmin = min4(tx1, tx2);
+    Float4 tmax = max4(tx1, tx2);
+    Float4 ty1 = (Float4(node->m_min[1]) - oy) * idy;
+    Float4 ty2 = (Float4(node->m_max[1]) - oy) * idy;
+    tmin = max4(tmin, min4(ty1, ty2));
+    tmax = min4(tmax, max4(ty1, ty2));
+    Float4 tz1 = (Float4(node->m_min[2]) - oz) * idz;
+    Float4 tz2 = (Float4(node->m_max[2]) - oz) * idz;
+    tmin = max4(tmin, min4(tz1, tz2));
+    tmax = min4(tmax, max4(tz1, tz2));
+    int active = mask4((tmax >= tmin) & (tmin < t) & (tmax > zero));
+    if (active == 0)
+    {
+      continue;
+    }
+    if (node->m_count == 0)
+    {
+      // push the far child first, the order is picked using the first active ray
+      int lane = 0;
+      while (((active >> lane) & 1) == 0)
+      {
+        ++lane;
+      }
+      const BVHNode &left = m_nodes[node->m_leftFirst];
+      const BVHNode &right = m_nodes[node->m_leftFirst + 1];
+      float o[3] = {_rays.m_ox[lane], _rays.m_oy[lane], _rays.m_oz[lane]};
+      float invD[3] = {inv[0][lane], inv[1][lane], inv[2][lane]};
+      bool leftFirst = intersectBox(left, o, invD, c_noHit) <= intersectBox(right, o, invD, c_noHit);
+      stack[stackPtr++] = leftFirst ? &right : &left;
+      stack[stackPtr++] = leftFirst ? &left : &right;
+      continue;
+    }
+    for (uint32_t i = node->m_leftFirst; i < node->m_leftFirst + node->m_count; ++i)
+    {
+      // one triangle against all 4 rays
+      const Triangle &tri = m_triangles[i];
+      Float4 e1x(tri.m_e1[0]), e1y(tri.m_e1[1]), e1z(tri.m_e1[2]);
+      Float4 e2x(tri.m_e2[0]), e2y(tri.m_e2[1]), e2z(tri.m_e2[2]);
+      Float4 px = dy * e2z - dz * e2y;
+      Float4 py = dz * e2x - dx * e2z;
+      Float4 pz = dx * e2y - dy * e2x;
+      Float4 det = e1x * px + e1y * py + e1z * pz;
+      Float4 invDet = one / det;
+      Float4 sx = ox - Float4(tri.m_v0[0]);
+      Float4 sy = oy - Float4(tri.m_v0[1]);
+      Float4 sz = oz - Float4(tri.m_v0[2]);
+      Float4 u = (sx * px + sy * py + sz * pz) * invDet;
+      Float4 qx = sy * e1z - sz * e1y;
+      Float4 qy = sz * e1x - sx * e1z;
+      Float4 qz = sx * e1y - sy * e1x;
+      Float4 v = (dx * qx + dy * qy + dz * qz) * invDet;
+      Float4 tt = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+      // a zero determinant gives inf / nan which fail these tests
+      Float4 hitMask = (u >= zero) & (v >= zero) & ((u + v) <= one) & (tt > epsilon) & (tt < t);
+      int hits = mask4(hitMask);
+      if (hits == 0)
+      {
+        continue;
+      }
+      t = select4(hitMask, tt, t);
+      hitU = select4(hitMask, u, hitU);
+      hitV = select4(hitMask, v, hitV);
+      for (int lane = 0; lane < 4; ++lane)
+      {
+        if ((hits >> lane) & 1)
+        {
+          hitIndex[lane] = i;
+        }
+      }
+    }
+  }
+  t.store(laneT);
+  hitU.store(laneU);
+  hitV.store(laneV);
+  for (int lane = 0; lane < 4; ++lane)
+  {
+    if (hitIndex[lane] != ~0u)
+    {
+      o_hits[lane].m_t = laneT[lane];
+      o_hits[lane].m_u = laneU[lane];
+      o_hits[lane].m_v = laneV[lane];
+      o_hits[lane].m_triangle = m_triIndex[hitIndex[lane]];
+      o_hits[lane].m_meshID = meshForTriangle(o_hits[lane].m_triangle);
+    }
+  }
+}
+
+size_t BVH::meshForTriangle(uint32_t _triangle) const
+{
+  // find the last group starting at or before the triangle
+  auto it = std::upper_bound(m_groupStarts.begin(), m_groupStarts.end(), std::make_pair(_triangle, ~size_t(0)));
+  if (it == m_groupStarts.begin())
+  {
+    return 0;
+  }
+  return (--it)->second;
+}
+
+ngl::Vec3 BVH::boundsMin() const
+{
+  return ngl::Vec3(m_nodes[0].m_min[0], m_nodes[0].m_min[1], m_nodes[0].m_min[2]);
+}
+
+ngl::Vec3 BVH::boundsMax() const
+{
+  return ngl::Vec3(m_nodes[0].m_max[0], m_nodes[0].m_max[1], m_nodes[0].m_max[2]);
+}
+
+void BVH::benchmark(int _width, int _height, unsigned int _threads) const
+{
+  unsigned int threads = parallel::numThreads(_threads);
+  std::cout << "BVH " << numTriangles() << " triangles " << numNodes() << " nodes ("
+            << numNodes() * sizeof(BVHNode) / 1024 << " KB) built in " << m_buildTime * 1000.0 << " ms\n";
+  if (m_triangles.empty())
+  {
+    return;
+  }
+  // pin hole camera in the middle of the scene looking down the longest axis
+  ngl::Vec3 minB = boundsMin();
+  ngl::Vec3 maxB = boundsMax();
+  ngl::Vec3 eye((minB.m_x + maxB.m_x) * 0.5f, minB.m_y + (maxB.m_y - minB.m_y) * 0.25f, (minB.m_z + maxB.m_z) * 0.5f);
+  bool alongX = (maxB.m_x - minB.m_x) > (maxB.m_z - minB.m_z);
+  float aspect = static_cast<float>(_width) / _height;
+  float scale = std::tan(0.5f * 60.0f * 3.14159265f / 180.0f);
+  auto primaryDir = [&](int _x, int _y)
+  {
+    float sx = (2.0f * (_x + 0.5f) / _width - 1.0f) * aspect * scale;
+    float sy = (1.0f - 2.0f * (_y + 0.5f) / _height) * scale;
+    return alongX ? ngl::Vec3(1.0f, sy, sx) : ngl::Vec3(sx, sy, 1.0f);
+  };
+  using clock = std::chrono::high_resolution_clock;
+  size_t numRays = static_cast<size_t>(_width) * _height;
+
+  // single coherent rays, a row per work item
+  std::atomic<size_t> hits{0};
+  auto start = clock::now();
+  parallel::forEach(0, _height, [&](size_t y)
+  {
+    size_t rowHits = 0;
+    for (int x = 0; x < _width; ++x)
+    {
+      if (intersect(eye, primaryDir(x, static_cast<int>(y))).hit())
+      {
+        ++rowHits;
+      }
+    }
+    hits += rowHits;
+  }, threads, 4);
+  double single = std::chrono::duration<double>(clock::now() - start).count();
+  std::cout << "primary rays single   " << numRays / single / 1e6 << " Mrays/s (" << hits << " hits)\n";
+
+  // 2x2 pixel packets
+  hits = 0;
+  start = clock::now();
+  parallel::forEach(0, _height / 2, [&](size_t py)
+  {
+    size_t rowHits = 0;
+    RayPacket4 packet;
+    BVHHit result[4];
+    for (int px = 0; px < _width / 2; ++px)
+    {
+      for (int lane = 0; lane < 4; ++lane)
+      {
+        ngl::Vec3 d = primaryDir(px * 2 + (lane & 1), static_cast<int>(py) * 2 + (lane >> 1));
+        packet.m_ox[lane] = eye.m_x;
+        packet.m_oy[lane] = eye.m_y;
+        packet.m_oz[lane] = eye.m_z;
+        packet.m_dx[lane] = d.m_x;
+        packet.m_dy[lane] = d.m_y;
+        packet.m_dz[lane] = d.m_z;
+        packet.m_tMax[lane] = c_noHit;
+      }
+      intersect4(packet, result);
+      for (auto &r : result)
+      {
+        rowHits += r.hit() ? 1 : 0;
+      }
+    }
+    hits += rowHits;
+  }, threads, 2);
+  double packets = std::chrono::duration<double>(clock::now() - start).count();
+  size_t packetRays = static_cast<size_t>(_width / 2) * (_height / 2) * 4;
+  std::cout << "primary rays packet4  " << packetRays / packets / 1e6 << " Mrays/s (" << hits << " hits)\n";
+
+  // incoherent rays between random points in the bounds
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> rx(minB.m_x, maxB.m_x);
+  std::uniform_real_distribution<float> ry(minB.m_y, maxB.m_y);
+  std::uniform_real_distribution<float> rz(minB.m_z, maxB.m_z);
+  std::vector<ngl::Vec3> points(numRays * 2);
+  for (auto &p : points)
+  {
+    p = ngl::Vec3(rx(rng), ry(rng), rz(rng));
+  }
+  hits = 0;
+  start = clock::now();
+  parallel::forEach(0, numRays, [&](size_t i)
+  {
+    const ngl::Vec3 &a = points[i * 2];
+    const ngl::Vec3 &b = points[i * 2 + 1];
+    if (intersect(a, ngl::Vec3(b.m_x - a.m_x, b.m_y - a.m_y, b.m_z - a.m_z), 1.0f).hit())
+    {
+      ++hits;
+    }
+  }, threads, 1024);
+  double random = std::chrono::duration<double>(clock::now() - start).count();
+  std::cout << "random rays single    " << numRays / random / 1e6 << " Mrays/s (" << hits << " hits)\n";
+  std::cout << "using " << threads << " threads\n";
+}
@@ -0,0 +1,278 @@
+#include "CollisionMesh.h"
+#include <btBulletCollisionCommon.h>
+#include <BulletCollision/NarrowPhaseCollision/btRaycastCallback.h>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace
+{
+// callback to keep the closest hit of a ray, returning the hit fraction clips the ray so
+// only closer triangles are reported after the first hit
+struct ClosestRayCallback : public btTriangleRaycastCallback
+{
+  ClosestRayCallback(const btVector3 &_from, const btVector3 &_to) : btTriangleRaycastCallback(_from, _to) {}
+  btScalar reportHit(const btVector3 &_normal, btScalar _fraction, int _partId, int _triangleIndex) override
+  {
+    if (_fraction < m_closest)
+    {
+      m_closest = _fraction;
+      m_normal = _normal;
+      m_partId = _partId;
+      m_triangle = _triangleIndex;
+    }
+    return _fraction;
+  }
+  btScalar m_closest = 1.0f;
+  btVector3 m_normal;
+  int m_partId = -1;
+  int m_triangle = -1;
+};
+
+struct ClosestSweepCallback : public btTriangleConvexcastCallback
+{
+  ClosestSweepCallback(const btConvexShape *_shape, const btTransform &_from, const btTransform &_to)
+      : btTriangleConvexcastCallback(_shape, _from, _to, btTransform::getIdentity(), 0.0f) {}
+  btScalar reportHit(const btVector3 &_normal, const btVector3 &, btScalar _fraction, int _partId, int _triangleIndex) override
+  {
+    if (_fraction < m_closest)
+    {
+      m_closest = _fraction;
+      m_normal = _normal;
+      m_partId = _partId;
+      m_triangle = _triangleIndex;
+    }
+    return _fraction;
+  }
+  btScalar m_closest = 1.0f;
+  btVector3 m_normal;
+  int m_partId = -1;
+  int m_triangle = -1;
+};
+
+btVector3 toBt(const ngl::Vec3 &_v) { return btVector3(_v.m_x, _v.m_y, _v.m_z); }
+ngl::Vec3 toNGL(const btVector3 &_v) { return ngl::Vec3(_v.x(), _v.y(), _v.z()); }
+
+const char *c_bvhHeader = "ngl::bvhbin";
+constexpr size_t c_bvhHeaderSize = 11;
+} // end anon namespace
+
+CollisionMesh::CollisionMesh(const GroupedObj &_mesh, const std::string &_cacheDir) : m_mesh(_mesh)
+{
+  // the welded vertices and the mesh's index buffer, the triangle order matches vertexData
+  auto &verts = m_mesh.drawVertexData();
+  auto &indices = m_mesh.indices();
+  static_assert(sizeof(GLuint) == sizeof(int), "the index buffer is passed to bullet as PHY_INTEGER");
+
+  m_vertexArray = std::make_unique<btTriangleIndexVertexArray>();
+  for (size_t i = 0; i < m_mesh.numMeshes(); ++i)
+  {
+    auto &data = m_mesh.getMeshData(i);
+    if (data.m_numVerts < 3)
+    {
+      continue;
+    }
+    btIndexedMesh part;
+    part.m_numTriangles = static_cast<int>(data.m_numVerts / 3);
+    part.m_triangleIndexBase = reinterpret_cast<const unsigned char *>(&indices[data.m_startIndex]);
+    part.m_triangleIndexStride = 3 * sizeof(int);
+    // the indices count from the base vertex of the group's buffer segment
+    part.m_numVertices = static_cast<int>(verts.size() - data.m_baseVertex);
+    // stride straight over the interleaved data, x,y,z are the first 3 floats of VertData
+    part.m_vertexBase = reinterpret_cast<const unsigned char *>(&verts[data.m_baseVertex].x);
+    part.m_vertexStride = sizeof(VertData);
+    part.m_indexType = PHY_INTEGER;
+    part.m_vertexType = PHY_FLOAT;
+    m_vertexArray->addIndexedMesh(part, PHY_INTEGER);
+    m_partToMesh.push_back(i);
+  }
+
+  // the quantized bvh packs the part and triangle ids into 31 bits (10 for the part) so large
+  // group counts need the un-quantized version
+  m_quantized = m_partToMesh.size() <= 1024;
+
+  std::string cacheName;
+  if (_cacheDir.size() != 0)
+  {
+    std::stringstream name;
+    name << _cacheDir << '/' << std::hex << m_mesh.hash() << ".bvh";
+    cacheName = name.str();
+    m_fromCache = loadBvh(cacheName);
+  }
+  if (m_fromCache == true)
+  {
+    m_shape = std::make_unique<btBvhTriangleMeshShape>(m_vertexArray.get(), m_quantized, false);
+    m_shape->setOptimizedBvh(m_cachedBvh);
+  }
+  else
+  {
+    m_shape = std::make_unique<btBvhTriangleMeshShape>(m_vertexArray.get(), m_quantized, true);
+    if (cacheName.size() != 0)
+    {
+      saveBvh(cacheName);
+    }
+  }
+}
+
+CollisionMesh::~CollisionMesh()
+{
+  // the shape doesn't own a bvh set with setOptimizedBvh so we tidy up the in place one ourselves
+  m_shape.reset();
+  if (m_cachedBvh != nullptr)
+  {
+    m_cachedBvh->~btOptimizedBvh();
+  }
+  if (m_bvhBuffer != nullptr)
+  {
+    btAlignedFree(m_bvhBuffer);
+  }
+}
+
+bool CollisionMesh::loadBvh(const std::string &_fname)
+{
+  std::ifstream fileIn(_fname, std::ios::in | std::ios::binary);
+  if (!fileIn.is_open())
+  {
+    return false;
+  }
+  char header[c_bvhHeaderSize + 1];
+  fileIn.read(header, c_bvhHeaderSize);
+  header[c_bvhHeaderSize] = 0;
+  if (strcmp(header, c_bvhHeader))
+  {
+    std::cerr << _fname << " is not an ngl::bvhbin file\n";
+    return false;
+  }
+  unsigned int size = 0;
+  fileIn.read(reinterpret_cast<char *>(&size), sizeof(size));
+  m_bvhBuffer = btAlignedAlloc(size, 16);
+  fileIn.read(reinterpret_cast<char *>(m_bvhBuffer), size);
+  if (!fileIn)
+  {
+    std::cerr << "truncated bvh cache " << _fname << '\n';
+    btAlignedFree(m_bvhBuffer);
+    m_bvhBuffer = nullptr;
+    return false;
+  }
+  m_cachedBvh = btOptimizedBvh::deSerializeInPlace(m_bvhBuffer, size, false);
+  return m_cachedBvh != nullptr;
+}
+
+void CollisionMesh::saveBvh(const std::string &_fname) const
+{
+  auto bvh = m_shape->getOptimizedBvh();
+  unsigned int size = bvh->calculateSerializeBufferSize();
+  void *buffer = btAlignedAlloc(size, 16);
+  bvh->serializeInPlace(buffer, size, false);
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(_fname).parent_path(), ec);
+  std::ofstream fileOut(_fname, std::ios::out | std::ios::binary);
+  if (fileOut.is_open())
+  {
+    fileOut.write(c_bvhHeader, c_bvhHeaderSize);
+    fileOut.write(reinterpret_cast<char *>(&size), sizeof(size));
+    fileOut.write(reinterpret_cast<char *>(buffer), size);
+  }
+  else
+  {
+    std::cerr << "could not write bvh cache " << _fname << '\n';
+  }
+  btAlignedFree(buffer);
+}
+
+RayHit CollisionMesh::rayCast(const ngl::Vec3 &_from, const ngl::Vec3 &_to) const
+{
+  RayHit result;
+  auto from = toBt(_from);
+  auto to = toBt(_to);
+  ClosestRayCallback callback(from, to);
+  m_shape->performRaycast(&callback, from, to);
+  if (callback.m_partId >= 0)
+  {
+    result.m_hit = true;
+    result.m_fraction = callback.m_closest;
+    result.m_point = toNGL(lerp(from, to, callback.m_closest));
+    result.m_normal = toNGL(callback.m_normal);
+    result.m_meshID = m_partToMesh[callback.m_partId];
+    result.m_triangle = callback.m_triangle;
+  }
+  return result;
+}
+
+RayHit CollisionMesh::sphereSweep(const ngl::Vec3 &_from, const ngl::Vec3 &_to, float _radius) const
+{
+  RayHit result;
+  btSphereShape sphere(_radius);
+  btTransform from;
+  from.setIdentity();
+  from.setOrigin(toBt(_from));
+  btTransform to;
+  to.setIdentity();
+  to.setOrigin(toBt(_to));
+  ClosestSweepCallback callback(&sphere, from, to);
+  // the sweep needs the aabb of the sphere in its local space
+  btVector3 extent(_radius, _radius, _radius);
+  m_shape->performConvexcast(&callback, toBt(_from), toBt(_to), btVector3(0, 0, 0) - extent, extent);
+  if (callback.m_partId >= 0)
+  {
+    result.m_hit = true;
+    result.m_fraction = callback.m_closest;
+    result.m_point = toNGL(lerp(toBt(_from), toBt(_to), callback.m_closest));
+    result.m_normal = toNGL(callback.m_normal);
+    result.m_meshID = m_partToMesh[callback.m_partId];
+    result.m_triangle = callback.m_triangle;
+  }
+  return result;
+}
+
+double CollisionMesh::benchmark(size_t _numRays) const
+{
+  // the welded vertices cover the same bounds and are kept when the mesh releases its CPU data
+  auto &verts = m_mesh.drawVertexData();
+  if (verts.size() == 0 || _numRays == 0)
+  {
+    return 0.0;
+  }
+  ngl::Vec3 minV(verts[0].x, verts[0].y, verts[0].z);
+  ngl::Vec3 maxV = minV;
+  for (auto &v : verts)
+  {
+    minV.m_x = std::min(minV.m_x, v.x);
+    minV.m_y = std::min(minV.m_y, v.y);
+    minV.m_z = std::min(minV.m_z, v.z);
+    maxV.m_x = std::max(maxV.m_x, v.x);
+    maxV.m_y = std::max(maxV.m_y, v.y);
+    maxV.m_z = std::max(maxV.m_z, v.z);
+  }
+  // generate the rays first so we only time the queries, fixed seed to make runs comparable
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> x(minV.m_x, maxV.m_x);
+  std::uniform_real_distribution<float> y(minV.m_y, maxV.m_y);
+  std::uniform_real_distribution<float> z(minV.m_z, maxV.m_z);
+  std::vector<ngl::Vec3> points(_numRays * 2);
+  for (auto &p : points)
+  {
+    p.m_x = x(rng);
+    p.m_y = y(rng);
+    p.m_z = z(rng);
+  }
+  size_t hits = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < _numRays; ++i)
+  {
+    if (rayCast(points[i * 2], points[i * 2 + 1]).m_hit)
+    {
+      ++hits;
+    }
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  double raysPerSecond = _numRays / seconds;
+  std::cout << "Bullet ray benchmark " << _numRays << " rays " << hits << " hits in " << seconds * 1000.0 << " ms "
+            << raysPerSecond << " rays/s\n";
+  return raysPerSecond;
+}
@@ -0,0 +1,104 @@
+#include "FileWatcher.h"
+#include <algorithm>
+#include <iostream>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher()
+{
+#ifdef __linux__
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd < 0)
+  {
+    std::cerr << "inotify not available, polling file times instead\n";
+  }
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+  if (m_fd >= 0)
+  {
+    close(m_fd);
+  }
+#endif
+}
+
+bool FileWatcher::watch(const std::string &_path)
+{
+  std::filesystem::path path(_path);
+#ifdef __linux__
+  if (m_fd >= 0)
+  {
+    std::string directory = path.has_parent_path() ? path.parent_path().string() : std::string(".");
+    auto found = m_directories.find(directory);
+    if (found == m_directories.end())
+    {
+      int wd = inotify_add_watch(m_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+      if (wd < 0)
+      {
+        std::cerr << "could not watch " << directory << '\n';
+        return false;
+      }
+      found = m_directories.emplace(directory, wd).first;
+    }
+    m_watches[found->second][path.filename().string()] = _path;
+    return true;
+  }
+#endif
+  std::error_code ec;
+  m_times[_path] = std::filesystem::last_write_time(path, ec);
+  return !ec;
+}
+
+std::vector<std::string> FileWatcher::poll()
+{
+  std::vector<std::string> changed;
+  auto add = [&changed](const std::string &_path)
+  {
+    if (std::find(changed.begin(), changed.end(), _path) == changed.end())
+    {
+      changed.push_back(_path);
+    }
+  };
+#ifdef __linux__
+  if (m_fd >= 0)
+  {
+    alignas(inotify_event) char buffer[4096];
+    ssize_t size;
+    while ((size = read(m_fd, buffer, sizeof(buffer))) > 0)
+    {
+      for (char *p = buffer; p < buffer + size;)
+      {
+        auto event = reinterpret_cast<const inotify_event *>(p);
+        p += sizeof(inotify_event) + event->len;
+        auto directory = m_watches.find(event->wd);
+        if (event->len == 0 || directory == m_watches.end())
+        {
+          continue;
+        }
+        auto file = directory->second.find(event->name);
+        if (file != directory->second.end())
+        {
+          add(file->second);
+        }
+      }
+    }
+    return changed;
+  }
+#endif
+  for (auto &file : m_times)
+  {
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(file.first, ec);
+    if (!ec && time != file.second)
+    {
+      file.second = time;
+      add(file.first);
+    }
+  }
+  return changed;
+}
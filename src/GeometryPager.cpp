@@ -0,0 +1,807 @@
+#include "GeometryPager.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include "VAO.h"
+#include <ngl/Vec4.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+constexpr char c_chunkHeader[] = "ngl::chunks";
+constexpr size_t c_chunkHeaderSize = sizeof(c_chunkHeader) - 1;
+/// @brief the chunk data starts on page boundaries so paging one in never touches its neighbours
+constexpr size_t c_pageSize = 4096;
+
+/// @brief a chunk as stored in the table at the start of the file
+struct ChunkRecord
+{
+  float m_min[3];
+  float m_max[3];
+  uint64_t m_offset;
+  uint32_t m_numVertices;
+  uint32_t m_numIndices;
+  uint32_t m_firstRange;
+  uint32_t m_numRanges;
+};
+static_assert(sizeof(ChunkRecord) == 48, "ChunkRecord is written as it is so must not be padded");
+
+/// @brief the indices of one group in a chunk
+struct RangeRecord
+{
+  uint32_t m_meshID;
+  uint32_t m_firstIndex;
+  uint32_t m_numIndices;
+};
+
+size_t pageAlign(size_t _offset)
+{
+  return (_offset + c_pageSize - 1) / c_pageSize * c_pageSize;
+}
+
+float boxDistance(const ngl::Vec3 &_p, const float _min[3], const float _max[3])
+{
+  float dx = std::max({_min[0] - _p.m_x, 0.0f, _p.m_x - _max[0]});
+  float dy = std::max({_min[1] - _p.m_y, 0.0f, _p.m_y - _max[1]});
+  float dz = std::max({_min[2] - _p.m_z, 0.0f, _p.m_z - _max[2]});
+  return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+} // end anon namespace
+
+std::string GeometryPager::cacheName(const std::string &_cacheDir, const GroupedObj &_mesh)
+{
+  std::stringstream name;
+  name << _cacheDir << '/' << std::hex << _mesh.hash() << ".chunks";
+  return name.str();
+}
+
+bool GeometryPager::writeChunkFile(const GroupedObj &_mesh, const std::string &_fname, size_t _chunkBytes)
+{
+  TRACE_SCOPE("GeometryPager::writeChunkFile");
+  auto start = std::chrono::high_resolution_clock::now();
+  const auto &verts = _mesh.drawVertexData();
+  const auto &indices = _mesh.indices();
+  size_t numTris = indices.size() / 3;
+  if (numTris == 0)
+  {
+    std::cerr << "no triangles to write to " << _fname << '\n';
+    return false;
+  }
+  std::vector<uint32_t> triMesh(numTris, 0);
+  for (size_t g = 0; g < _mesh.numMeshes(); ++g)
+  {
+    const MeshData &mesh = _mesh.getMeshData(g);
+    std::fill(triMesh.begin() + static_cast<std::ptrdiff_t>(mesh.m_startIndex / 3),
+              triMesh.begin() + static_cast<std::ptrdiff_t>((mesh.m_startIndex + mesh.m_numVerts) / 3), static_cast<uint32_t>(g));
+  }
+  // the indices count from the first vertex of their buffer segment
+  const auto &segments = _mesh.segments();
+  auto vertexOf = [&](size_t _corner)
+  {
+    auto segment = std::upper_bound(segments.begin(), segments.end(), _corner,
+                                    [](size_t _c, const VAO::Segment &_s) { return _c < _s.m_firstIndex; });
+    return std::prev(segment)->m_firstVertex + indices[_corner];
+  };
+  std::vector<float> centres(numTris * 3);
+  for (size_t t = 0; t < numTris; ++t)
+  {
+    size_t v[3] = {vertexOf(t * 3), vertexOf(t * 3 + 1), vertexOf(t * 3 + 2)};
+    for (int a = 0; a < 3; ++a)
+    {
+      centres[t * 3 + a] = ((&verts[v[0]].x)[a] + (&verts[v[1]].x)[a] + (&verts[v[2]].x)[a]) / 3.0f;
+    }
+  }
+
+  // a chunk can't have more vertices than corners so this many triangles always fit in _chunkBytes
+  size_t maxTris = std::max<size_t>(1, _chunkBytes / (3 * (sizeof(GLuint) + sizeof(VertData))));
+  std::vector<uint32_t> order(numTris);
+  std::iota(order.begin(), order.end(), 0u);
+  std::vector<std::pair<size_t, size_t>> leaves;
+  std::vector<std::pair<size_t, size_t>> stack = {{0, numTris}};
+  while (!stack.empty())
+  {
+    auto [begin, end] = stack.back();
+    stack.pop_back();
+    if (end - begin <= maxTris)
+    {
+      leaves.emplace_back(begin, end);
+      continue;
+    }
+    float lo[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    float hi[3] = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+    for (size_t i = begin; i < end; ++i)
+    {
+      for (int a = 0; a < 3; ++a)
+      {
+        lo[a] = std::min(lo[a], centres[order[i] * 3 + a]);
+        hi[a] = std::max(hi[a], centres[order[i] * 3 + a]);
+      }
+    }
+    int axis = 0;
+    for (int a = 1; a < 3; ++a)
+    {
+      if (hi[a] - lo[a] > hi[axis] - lo[axis])
+      {
+        axis = a;
+      }
+    }
+    size_t mid = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + static_cast<std::ptrdiff_t>(begin), order.begin() + static_cast<std::ptrdiff_t>(mid),
+                     order.begin() + static_cast<std::ptrdiff_t>(end),
+                     [&centres, axis](uint32_t _a, uint32_t _b) { return centres[_a * 3 + axis] < centres[_b * 3 + axis]; });
+    // the far half goes on first so the leaves come out in spatial order
+    stack.emplace_back(mid, end);
+    stack.emplace_back(begin, mid);
+  }
+  // the triangles of each group stay together and in their vertex cache order
+  parallel::forEach(0, leaves.size(), [&](size_t _leaf)
+  {
+    std::sort(order.begin() + static_cast<std::ptrdiff_t>(leaves[_leaf].first),
+              order.begin() + static_cast<std::ptrdiff_t>(leaves[_leaf].second), [&triMesh](uint32_t _a, uint32_t _b)
+              { return triMesh[_a] != triMesh[_b] ? triMesh[_a] < triMesh[_b] : _a < _b; });
+  }, 0, 1);
+
+  // the first pass sizes the chunks so the table can go before the data, the second writes the data
+  std::vector<uint32_t> remap(verts.size(), ~0u);
+  std::vector<size_t> local;
+  auto weld = [&](size_t _leaf)
+  {
+    for (size_t v : local)
+    {
+      remap[v] = ~0u;
+    }
+    local.clear();
+    for (size_t i = leaves[_leaf].first; i < leaves[_leaf].second; ++i)
+    {
+      for (size_t c = 0; c < 3; ++c)
+      {
+        size_t v = vertexOf(order[i] * 3 + c);
+        if (remap[v] == ~0u)
+        {
+          remap[v] = static_cast<uint32_t>(local.size());
+          local.push_back(v);
+        }
+      }
+    }
+  };
+  std::vector<ChunkRecord> records(leaves.size());
+  std::vector<RangeRecord> ranges;
+  for (size_t l = 0; l < leaves.size(); ++l)
+  {
+    weld(l);
+    ChunkRecord &record = records[l];
+    std::fill(record.m_min, record.m_min + 3, std::numeric_limits<float>::max());
+    std::fill(record.m_max, record.m_max + 3, std::numeric_limits<float>::lowest());
+    for (size_t v : local)
+    {
+      for (int a = 0; a < 3; ++a)
+      {
+        record.m_min[a] = std::min(record.m_min[a], (&verts[v].x)[a]);
+        record.m_max[a] = std::max(record.m_max[a], (&verts[v].x)[a]);
+      }
+    }
+    record.m_numVertices = static_cast<uint32_t>(local.size());
+    record.m_numIndices = static_cast<uint32_t>((leaves[l].second - leaves[l].first) * 3);
+    record.m_firstRange = static_cast<uint32_t>(ranges.size());
+    for (size_t i = leaves[l].first; i < leaves[l].second; ++i)
+    {
+      uint32_t index = static_cast<uint32_t>((i - leaves[l].first) * 3);
+      if (ranges.size() == record.m_firstRange || ranges.back().m_meshID != triMesh[order[i]])
+      {
+        ranges.push_back({triMesh[order[i]], index, 0});
+      }
+      ranges.back().m_numIndices += 3;
+    }
+    record.m_numRanges = static_cast<uint32_t>(ranges.size()) - record.m_firstRange;
+  }
+  size_t offset = pageAlign(c_chunkHeaderSize + sizeof(uint64_t) * 2 + sizeof(uint32_t) * 2 +
+                            records.size() * sizeof(ChunkRecord) + ranges.size() * sizeof(RangeRecord));
+  for (auto &record : records)
+  {
+    record.m_offset = offset;
+    offset = pageAlign(offset + record.m_numVertices * sizeof(VertData) + record.m_numIndices * sizeof(GLuint));
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(_fname).parent_path(), ec);
+  std::ofstream fileOut(_fname, std::ios::out | std::ios::binary);
+  if (!fileOut.is_open())
+  {
+    std::cerr << "could not write chunk file " << _fname << '\n';
+    return false;
+  }
+  uint64_t hash = _mesh.hash();
+  uint64_t numGroups = _mesh.numMeshes();
+  uint32_t numChunks = static_cast<uint32_t>(records.size());
+  uint32_t numRanges = static_cast<uint32_t>(ranges.size());
+  fileOut.write(c_chunkHeader, c_chunkHeaderSize);
+  fileOut.write(reinterpret_cast<const char *>(&hash), sizeof(hash));
+  fileOut.write(reinterpret_cast<const char *>(&numGroups), sizeof(numGroups));
+  fileOut.write(reinterpret_cast<const char *>(&numChunks), sizeof(numChunks));
+  fileOut.write(reinterpret_cast<const char *>(&numRanges), sizeof(numRanges));
+  fileOut.write(reinterpret_cast<const char *>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(ChunkRecord)));
+  fileOut.write(reinterpret_cast<const char *>(ranges.data()), static_cast<std::streamsize>(ranges.size() * sizeof(RangeRecord)));
+  std::vector<VertData> chunkVerts;
+  std::vector<GLuint> chunkIndices;
+  for (size_t l = 0; l < leaves.size(); ++l)
+  {
+    weld(l);
+    chunkVerts.clear();
+    chunkIndices.clear();
+    for (size_t v : local)
+    {
+      chunkVerts.push_back(verts[v]);
+    }
+    for (size_t i = leaves[l].first; i < leaves[l].second; ++i)
+    {
+      for (size_t c = 0; c < 3; ++c)
+      {
+        chunkIndices.push_back(remap[vertexOf(order[i] * 3 + c)]);
+      }
+    }
+    // pad up to the page the chunk starts on
+    std::vector<char> padding(records[l].m_offset - static_cast<size_t>(fileOut.tellp()), 0);
+    fileOut.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+    fileOut.write(reinterpret_cast<const char *>(chunkVerts.data()), static_cast<std::streamsize>(chunkVerts.size() * sizeof(VertData)));
+    fileOut.write(reinterpret_cast<const char *>(chunkIndices.data()), static_cast<std::streamsize>(chunkIndices.size() * sizeof(GLuint)));
+  }
+  if (!fileOut)
+  {
+    std::cerr << "error writing chunk file " << _fname << '\n';
+    return false;
+  }
+  if (trace::verbose())
+  {
+    std::ostringstream message;
+    message << "wrote " << records.size() << " chunks (" << numTris << " triangles, " << offset / (1024 * 1024) << " MB) to "
+            << _fname << " in "
+            << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms\n";
+    trace::print(message.str());
+  }
+  return true;
+}
+
+GeometryPager::GeometryPager(const GroupedObj &_mesh, const std::string &_fname, const PagerSettings &_settings)
+    : m_settings(_settings)
+{
+  if (!load(_mesh, _fname) || !map(_fname))
+  {
+    return;
+  }
+  for (auto &chunk : m_chunks)
+  {
+    if (chunk.m_offset + chunkBytes(chunk) > m_dataSize)
+    {
+      std::cerr << "truncated chunk file " << _fname << '\n';
+      return;
+    }
+    m_slotVertices = std::max<size_t>(m_slotVertices, chunk.m_numVertices);
+    m_slotIndices = std::max<size_t>(m_slotIndices, chunk.m_numIndices);
+  }
+  size_t slotBytes = m_slotVertices * sizeof(VertData) + m_slotIndices * sizeof(GLuint);
+  size_t numSlots = std::min(m_settings.poolBytes / std::max<size_t>(slotBytes, 1), m_chunks.size());
+  if (numSlots == 0)
+  {
+    std::cerr << "a pool of " << (m_settings.poolBytes >> 20) << " MB can't hold a chunk of " << (slotBytes >> 10) << " KB\n";
+    return;
+  }
+  m_vao = VAO::create(GL_TRIANGLES);
+  auto vao = reinterpret_cast<VAO *>(m_vao.get());
+  m_vao->bind();
+  vao->allocateData(numSlots * m_slotVertices * sizeof(VertData));
+  vao->setIndexData(numSlots * m_slotIndices, nullptr);
+  // the same layout as GroupedObj, the lighting attribute is left at its generic value
+  m_vao->setVertexAttributePointer(0, 3, GL_FLOAT, sizeof(VertData), 0);
+  m_vao->setVertexAttributePointer(1, 3, GL_FLOAT, sizeof(VertData), 3);
+  m_vao->setVertexAttributePointer(2, 2, GL_FLOAT, sizeof(VertData), 6);
+  m_vao->unbind();
+  m_slotChunk.assign(numSlots, -1);
+  for (size_t s = numSlots; s-- > 0;)
+  {
+    m_freeSlots.push_back(static_cast<int>(s));
+  }
+  if (trace::verbose())
+  {
+    std::ostringstream message;
+    message << "paging " << m_chunks.size() << " chunks (" << (m_dataSize >> 20) << " MB) through " << numSlots
+            << " slots of " << (slotBytes >> 10) << " KB\n";
+    trace::print(message.str());
+  }
+  m_valid = true;
+  m_thread = std::thread(&GeometryPager::pageInLoop, this);
+}
+
+GeometryPager::~GeometryPager()
+{
+  if (m_thread.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      m_quit = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+  }
+  if (m_vao)
+  {
+    m_vao->removeVAO();
+  }
+  unmap();
+}
+
+bool GeometryPager::load(const GroupedObj &_mesh, const std::string &_fname)
+{
+  std::ifstream fileIn(_fname, std::ios::in | std::ios::binary);
+  if (!fileIn.is_open())
+  {
+    return false;
+  }
+  char header[c_chunkHeaderSize + 1];
+  fileIn.read(header, c_chunkHeaderSize);
+  header[c_chunkHeaderSize] = 0;
+  if (strcmp(header, c_chunkHeader))
+  {
+    std::cerr << _fname << " is not an ngl::chunks file\n";
+    return false;
+  }
+  uint64_t hash = 0;
+  uint64_t numGroups = 0;
+  uint32_t numChunks = 0;
+  uint32_t numRanges = 0;
+  fileIn.read(reinterpret_cast<char *>(&hash), sizeof(hash));
+  fileIn.read(reinterpret_cast<char *>(&numGroups), sizeof(numGroups));
+  fileIn.read(reinterpret_cast<char *>(&numChunks), sizeof(numChunks));
+  fileIn.read(reinterpret_cast<char *>(&numRanges), sizeof(numRanges));
+  if (!fileIn || hash != _mesh.hash() || numGroups != _mesh.numMeshes())
+  {
+    std::cerr << _fname << " was written for a different mesh\n";
+    return false;
+  }
+  std::vector<ChunkRecord> records(numChunks);
+  std::vector<RangeRecord> ranges(numRanges);
+  fileIn.read(reinterpret_cast<char *>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(ChunkRecord)));
+  fileIn.read(reinterpret_cast<char *>(ranges.data()), static_cast<std::streamsize>(ranges.size() * sizeof(RangeRecord)));
+  if (!fileIn)
+  {
+    std::cerr << "truncated chunk file " << _fname << '\n';
+    return false;
+  }
+  // the ranges are drawn by batch, the groups of a batch are neighbours so their ranges in a chunk are too
+  std::vector<uint32_t> meshBatch(_mesh.numMeshes(), ~0u);
+  for (size_t b = 0; b < _mesh.numBatches(); ++b)
+  {
+    const DrawBatch &batch = _mesh.getBatch(b);
+    std::fill_n(meshBatch.begin() + static_cast<std::ptrdiff_t>(batch.m_firstMesh), batch.m_numMeshes, static_cast<uint32_t>(b));
+  }
+  m_chunks.resize(numChunks);
+  for (size_t c = 0; c < numChunks; ++c)
+  {
+    const ChunkRecord &record = records[c];
+    Chunk &chunk = m_chunks[c];
+    std::copy_n(record.m_min, 3, chunk.m_min);
+    std::copy_n(record.m_max, 3, chunk.m_max);
+    chunk.m_offset = record.m_offset;
+    chunk.m_numVertices = record.m_numVertices;
+    chunk.m_numIndices = record.m_numIndices;
+    if (static_cast<uint64_t>(record.m_firstRange) + record.m_numRanges > ranges.size())
+    {
+      std::cerr << "bad range table in " << _fname << '\n';
+      return false;
+    }
+    for (uint32_t r = record.m_firstRange; r < record.m_firstRange + record.m_numRanges; ++r)
+    {
+      const RangeRecord &range = ranges[r];
+      if (range.m_meshID >= meshBatch.size() || meshBatch[range.m_meshID] == ~0u)
+      {
+        continue;
+      }
+      uint32_t batch = meshBatch[range.m_meshID];
+      if (!chunk.m_spans.empty() && chunk.m_spans.back().m_batch == batch &&
+          chunk.m_spans.back().m_firstIndex + chunk.m_spans.back().m_numIndices == range.m_firstIndex)
+      {
+        chunk.m_spans.back().m_numIndices += range.m_numIndices;
+      }
+      else
+      {
+        chunk.m_spans.push_back({batch, range.m_firstIndex, range.m_numIndices});
+      }
+    }
+  }
+  return true;
+}
+
+bool GeometryPager::map(const std::string &_fname)
+{
+#ifdef WIN32
+  HANDLE file = CreateFileA(_fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    std::cerr << "could not open " << _fname << " to map\n";
+    return false;
+  }
+  LARGE_INTEGER size;
+  GetFileSizeEx(file, &size);
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr)
+  {
+    std::cerr << "could not map " << _fname << '\n';
+    return false;
+  }
+  // the view keeps the mapping alive
+  void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (data == nullptr)
+  {
+    std::cerr << "could not map " << _fname << '\n';
+    return false;
+  }
+  m_dataSize = static_cast<size_t>(size.QuadPart);
+#else
+  int fd = open(_fname.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    std::cerr << "could not open " << _fname << " to map\n";
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0)
+  {
+    close(fd);
+    std::cerr << "could not map " << _fname << '\n';
+    return false;
+  }
+  void *data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping keeps the file open
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    std::cerr << "could not map " << _fname << '\n';
+    return false;
+  }
+  m_dataSize = static_cast<size_t>(info.st_size);
+#endif
+  m_data = static_cast<const unsigned char *>(data);
+  return true;
+}
+
+void GeometryPager::unmap()
+{
+  if (m_data == nullptr)
+  {
+    return;
+  }
+#ifdef WIN32
+  UnmapViewOfFile(m_data);
+#else
+  munmap(const_cast<unsigned char *>(m_data), m_dataSize);
+#endif
+  m_data = nullptr;
+  m_dataSize = 0;
+}
+
+size_t GeometryPager::chunkBytes(const Chunk &_chunk) const
+{
+  return _chunk.m_numVertices * sizeof(VertData) + _chunk.m_numIndices * sizeof(GLuint);
+}
+
+void GeometryPager::pageInLoop()
+{
+  trace::setThreadName("geometry page in");
+  while (true)
+  {
+    size_t chunk;
+    {
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_wake.wait(lock, [this]() { return m_quit || !m_requests.empty(); });
+      if (m_quit)
+      {
+        return;
+      }
+      chunk = m_requests.front();
+      m_requests.pop_front();
+    }
+    TRACE_SCOPE("page in chunk", "geometry");
+    auto start = std::chrono::high_resolution_clock::now();
+    // only the offset and sizes are read here, the GL thread doesn't change them
+    const unsigned char *data = m_data + m_chunks[chunk].m_offset;
+    size_t bytes = chunkBytes(m_chunks[chunk]);
+#ifndef WIN32
+    madvise(const_cast<unsigned char *>(data), bytes, MADV_WILLNEED);
+#endif
+    // touch every page so the reads from disk happen here and not in the copy on the GL thread
+    volatile unsigned char sink = 0;
+    for (size_t i = 0; i < bytes; i += c_pageSize)
+    {
+      sink = data[i];
+    }
+    (void)sink;
+    auto end = std::chrono::high_resolution_clock::now();
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_pagedIn.push_back(chunk);
+    m_pagedInBytes += bytes;
+    m_pageInSeconds += std::chrono::duration<double>(end - start).count();
+  }
+}
+
+void GeometryPager::update(const ngl::Mat4 &_project, const ngl::Mat4 &_modelView)
+{
+  if (!m_valid)
+  {
+    return;
+  }
+  TRACE_SCOPE("GeometryPager::update", "geometry");
+  ++m_frame;
+  std::vector<size_t> pagedIn;
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    pagedIn.swap(m_pagedIn);
+  }
+  for (size_t c : pagedIn)
+  {
+    m_chunks[c].m_requested = false;
+    m_chunks[c].m_pagedIn = true;
+    --m_outstanding;
+  }
+
+  ngl::Mat4 mvp = _project * _modelView;
+  ngl::Vec4 eye4 = _modelView.inverse() * ngl::Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+  ngl::Vec3 eye(eye4.m_x, eye4.m_y, eye4.m_z);
+  // the rows of the matrix give the clip planes, row i is m_m[0..3][i]
+  float planes[6][4];
+  for (int i = 0; i < 3; ++i)
+  {
+    for (int c = 0; c < 4; ++c)
+    {
+      planes[i * 2][c] = mvp.m_m[c][3] + mvp.m_m[c][i];
+      planes[i * 2 + 1][c] = mvp.m_m[c][3] - mvp.m_m[c][i];
+    }
+  }
+  std::vector<char> visible(m_chunks.size(), 0);
+  m_wanted.clear();
+  for (size_t i = 0; i < m_chunks.size(); ++i)
+  {
+    Chunk &chunk = m_chunks[i];
+    bool inside = true;
+    for (auto &p : planes)
+    {
+      // the corner furthest along the plane normal
+      float x = p[0] >= 0.0f ? chunk.m_max[0] : chunk.m_min[0];
+      float y = p[1] >= 0.0f ? chunk.m_max[1] : chunk.m_min[1];
+      float z = p[2] >= 0.0f ? chunk.m_max[2] : chunk.m_min[2];
+      if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f)
+      {
+        inside = false;
+        break;
+      }
+    }
+    chunk.m_distance = boxDistance(eye, chunk.m_min, chunk.m_max);
+    visible[i] = inside;
+    if (inside || chunk.m_distance <= m_settings.prefetchDistance)
+    {
+      chunk.m_lastWanted = m_frame;
+      m_wanted.push_back(i);
+    }
+  }
+  std::sort(m_wanted.begin(), m_wanted.end(),
+            [this](size_t _a, size_t _b) { return m_chunks[_a].m_distance < m_chunks[_b].m_distance; });
+
+  // ask for the nearest missing chunks
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (size_t i : m_wanted)
+    {
+      Chunk &chunk = m_chunks[i];
+      if (m_outstanding >= m_settings.maxPagingIn)
+      {
+        break;
+      }
+      if (chunk.m_slot < 0 && !chunk.m_requested && !chunk.m_pagedIn)
+      {
+        chunk.m_requested = true;
+        m_requests.push_back(i);
+        ++m_outstanding;
+      }
+    }
+  }
+  m_wake.notify_one();
+
+  // copy what has been paged in, nearest first
+  m_uploadedThisFrame = 0;
+  for (size_t i : m_wanted)
+  {
+    Chunk &chunk = m_chunks[i];
+    if (chunk.m_slot >= 0 || !chunk.m_pagedIn)
+    {
+      continue;
+    }
+    if (m_uploadedThisFrame != 0 && m_uploadedThisFrame >= m_settings.uploadBytesPerFrame)
+    {
+      break;
+    }
+    int slot = acquireSlot(chunk.m_distance);
+    if (slot < 0)
+    {
+      break;
+    }
+    upload(i, slot);
+  }
+
+  m_drawList.clear();
+  m_missing = 0;
+  for (size_t i : m_wanted)
+  {
+    if (!visible[i])
+    {
+      continue;
+    }
+    if (m_chunks[i].m_slot >= 0)
+    {
+      m_drawList.push_back(i);
+    }
+    else
+    {
+      ++m_missing;
+    }
+  }
+  trace::counter("geometry resident KB", static_cast<int64_t>(m_residentBytes >> 10));
+  trace::counter("geometry missing chunks", static_cast<int64_t>(m_missing));
+}
+
+int GeometryPager::acquireSlot(float _distance)
+{
+  if (!m_freeSlots.empty())
+  {
+    int slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    return slot;
+  }
+  // the chunk least recently wanted, or failing that the furthest wanted one if it is further than the new one
+  int victim = -1;
+  for (int chunk : m_slotChunk)
+  {
+    if (chunk < 0)
+    {
+      continue;
+    }
+    const Chunk &c = m_chunks[static_cast<size_t>(chunk)];
+    if (victim < 0)
+    {
+      victim = chunk;
+      continue;
+    }
+    const Chunk &v = m_chunks[static_cast<size_t>(victim)];
+    if (c.m_lastWanted < v.m_lastWanted || (c.m_lastWanted == v.m_lastWanted && c.m_distance > v.m_distance))
+    {
+      victim = chunk;
+    }
+  }
+  if (victim < 0)
+  {
+    return -1;
+  }
+  Chunk &v = m_chunks[static_cast<size_t>(victim)];
+  if (v.m_lastWanted == m_frame && v.m_distance <= _distance)
+  {
+    return -1;
+  }
+  int slot = v.m_slot;
+  v.m_slot = -1;
+  // the pages may be gone by the time it is wanted again so read it ahead again then
+  v.m_pagedIn = false;
+  m_slotChunk[static_cast<size_t>(slot)] = -1;
+  m_residentBytes -= chunkBytes(v);
+  ++m_evictions;
+  return slot;
+}
+
+void GeometryPager::upload(size_t _chunk, int _slot)
+{
+  TRACE_SCOPE("upload chunk", "geometry");
+  Chunk &chunk = m_chunks[_chunk];
+  auto vao = reinterpret_cast<VAO *>(m_vao.get());
+  size_t slot = static_cast<size_t>(_slot);
+  const unsigned char *data = m_data + chunk.m_offset;
+  size_t vertexBytes = chunk.m_numVertices * sizeof(VertData);
+  // the element array binding belongs to the VAO
+  vao->bind();
+  vao->setSubData(slot * m_slotVertices * sizeof(VertData), vertexBytes, data);
+  vao->setIndexSubData(slot * m_slotIndices, chunk.m_numIndices, reinterpret_cast<const GLuint *>(data + vertexBytes));
+  vao->unbind();
+  chunk.m_slot = _slot;
+  m_slotChunk[slot] = static_cast<int>(_chunk);
+  m_residentBytes += chunkBytes(chunk);
+  m_uploadedThisFrame += chunkBytes(chunk);
+}
+
+void GeometryPager::drawBatch(size_t _batchID) const
+{
+  if (m_drawList.empty())
+  {
+    return;
+  }
+  auto vao = reinterpret_cast<const VAO *>(m_vao.get());
+  m_vao->bind();
+  for (size_t i : m_drawList)
+  {
+    const Chunk &chunk = m_chunks[i];
+    auto span = std::lower_bound(chunk.m_spans.begin(), chunk.m_spans.end(), _batchID,
+                                 [](const Span &_s, size_t _batch) { return _s.m_batch < _batch; });
+    if (span == chunk.m_spans.end() || span->m_batch != _batchID)
+    {
+      continue;
+    }
+    size_t slot = static_cast<size_t>(chunk.m_slot);
+    vao->drawBaseVertex(slot * m_slotIndices + span->m_firstIndex, span->m_numIndices,
+                        static_cast<GLint>(slot * m_slotVertices));
+  }
+  m_vao->unbind();
+}
+
+bool GeometryPager::busy() const
+{
+  return m_outstanding != 0 || m_uploadedThisFrame != 0;
+}
+
+GeometryPager::Stats GeometryPager::stats() const
+{
+  Stats stats;
+  stats.m_chunks = m_chunks.size();
+  stats.m_slots = m_slotChunk.size();
+  stats.m_resident = m_slotChunk.size() - m_freeSlots.size();
+  stats.m_residentBytes = m_residentBytes;
+  stats.m_wanted = m_wanted.size();
+  stats.m_missing = m_missing;
+  stats.m_pending = m_outstanding;
+  stats.m_evictions = m_evictions;
+  if (m_vao)
+  {
+    auto &upload = reinterpret_cast<const VAO *>(m_vao.get())->uploadStats();
+    stats.m_uploadedBytes = upload.bytes;
+    stats.m_uploadMBps = upload.mbPerSecond();
+  }
+  std::lock_guard<std::mutex> lock(m_lock);
+  stats.m_pagedInBytes = m_pagedInBytes;
+  stats.m_pageInMBps = m_pageInSeconds > 0.0 ? (m_pagedInBytes / (1024.0 * 1024.0)) / m_pageInSeconds : 0.0;
+  return stats;
+}
+
+void GeometryPager::printStats(std::ostream &_out) const
+{
+  auto s = stats();
+  constexpr double mb = 1024.0 * 1024.0;
+  _out << "geometry paging : " << s.m_resident << " of " << s.m_chunks << " chunks resident in " << s.m_slots << " slots ("
+       << s.m_residentBytes / mb << " MB), " << s.m_wanted << " wanted " << s.m_missing << " in view missing "
+       << s.m_pending << " paging in, " << s.m_evictions << " evictions, " << s.m_pagedInBytes / mb << " MB paged in at "
+       << s.m_pageInMBps << " MB/s, " << s.m_uploadedBytes / mb << " MB uploaded at " << s.m_uploadMBps << " MB/s\n";
+}
+
+void GeometryPager::memoryUsage(MemoryReport &io_report) const
+{
+  size_t tables = m_chunks.capacity() * sizeof(Chunk);
+  for (auto &chunk : m_chunks)
+  {
+    tables += chunk.m_spans.capacity() * sizeof(Span);
+  }
+  auto vao = reinterpret_cast<const VAO *>(m_vao.get());
+  // the mapped file is left out of the CPU bytes, the OS pages it in and out as it likes
+  io_report.add("geometry", "paged vertex pool", tables, vao != nullptr ? vao->getBufferSize() : 0);
+  io_report.add("indices", "paged index pool", 0, vao != nullptr ? vao->getIndexBufferSize() : 0);
+}
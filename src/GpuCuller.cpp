@@ -0,0 +1,441 @@
+#include "GpuCuller.h"
+#include "Trace.h"
+#include <ngl/ShaderLib.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace
+{
+/// @brief the layout of the Groups buffer in GroupCullComp.glsl (std430)
+struct GroupRecord
+{
+  GLfloat m_min[4];
+  GLfloat m_max[4];
+  GLuint m_count;
+  GLuint m_firstIndex;
+  GLuint m_batch;
+  GLuint m_batchFirst;
+};
+static_assert(sizeof(GroupRecord) == 48, "GroupRecord must match the std430 layout");
+
+/// @brief the record glMultiDrawElementsIndirect reads
+struct DrawCommand
+{
+  GLuint m_count;
+  GLuint m_instanceCount;
+  GLuint m_firstIndex;
+  GLint m_baseVertex;
+  GLuint m_baseInstance;
+};
+
+/// @brief the counters written by the cull, in the order of the Stats buffer
+constexpr size_t c_numCounters = 4;
+
+bool buildCompute(const std::string &_program, const std::string &_file)
+{
+  // a culler made again after a reload reuses the program
+  if (ngl::ShaderLib::getProgramID(_program) != 0)
+  {
+    return true;
+  }
+  std::string shader = _program + "Compute";
+  ngl::ShaderLib::createShaderProgram(_program, ngl::ErrorExit::OFF);
+  ngl::ShaderLib::attachShader(shader, ngl::ShaderType::COMPUTE, ngl::ErrorExit::OFF);
+  ngl::ShaderLib::loadShaderSource(shader, _file);
+  if (!ngl::ShaderLib::compileShader(shader))
+  {
+    std::cerr << "failed to compile " << _file << '\n';
+    return false;
+  }
+  ngl::ShaderLib::attachShaderToProgram(_program, shader);
+  return ngl::ShaderLib::linkProgramObject(_program);
+}
+} // end anon namespace
+
+GpuCuller::GpuCuller(const GroupedObj &_mesh) : m_mesh(_mesh)
+{
+  TRACE_SCOPE("GpuCuller");
+  for (auto &slot : m_queries)
+  {
+    glGenQueries(NumStamps, slot.data());
+  }
+  GLint major = 0;
+  GLint minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  if (major * 10 + minor < 43)
+  {
+    std::cerr << "GPU culling needs GL 4.3 compute shaders, this context is " << major << '.' << minor << '\n';
+    return;
+  }
+  if (_mesh.segments().size() > 1)
+  {
+    std::cerr << "GPU culling draws from one buffer, this mesh is split into " << _mesh.segments().size() << '\n';
+    return;
+  }
+  // the draw count comes from a buffer in 4.6, before that every record is drawn
+  m_compact = major * 10 + minor >= 46;
+  if (!buildCompute("HiZReduce", "shaders/HiZReduceComp.glsl") || !buildCompute("GroupCull", "shaders/GroupCullComp.glsl"))
+  {
+    return;
+  }
+
+  // the bounds come from the welded vertices as they are kept when the CPU data is released
+  const auto &verts = _mesh.drawVertexData();
+  m_numGroups = _mesh.numMeshes();
+  std::vector<GroupRecord> groups(m_numGroups);
+  for (size_t i = 0; i < m_numGroups; ++i)
+  {
+    const MeshData &mesh = _mesh.getMeshData(i);
+    GroupRecord &g = groups[i];
+    constexpr float big = std::numeric_limits<float>::max();
+    std::fill_n(g.m_min, 4, big);
+    std::fill_n(g.m_max, 4, -big);
+    for (size_t v = mesh.m_firstVertex; v < mesh.m_firstVertex + mesh.m_numVertices; ++v)
+    {
+      const VertData &p = verts[v];
+      g.m_min[0] = std::min(g.m_min[0], p.x);
+      g.m_min[1] = std::min(g.m_min[1], p.y);
+      g.m_min[2] = std::min(g.m_min[2], p.z);
+      g.m_max[0] = std::max(g.m_max[0], p.x);
+      g.m_max[1] = std::max(g.m_max[1], p.y);
+      g.m_max[2] = std::max(g.m_max[2], p.z);
+    }
+    g.m_count = static_cast<GLuint>(mesh.m_numVerts);
+    g.m_firstIndex = static_cast<GLuint>(mesh.m_startIndex);
+    g.m_batch = 0;
+    g.m_batchFirst = static_cast<GLuint>(i);
+  }
+  // the records of a batch are its groups' slots, so a compacted batch packs into the front of them
+  for (size_t b = 0; b < _mesh.numBatches(); ++b)
+  {
+    const DrawBatch &batch = _mesh.getBatch(b);
+    for (size_t i = batch.m_firstMesh; i < batch.m_firstMesh + batch.m_numMeshes; ++i)
+    {
+      groups[i].m_batch = static_cast<GLuint>(b);
+      groups[i].m_batchFirst = static_cast<GLuint>(batch.m_firstMesh);
+    }
+  }
+  std::vector<DrawCommand> commands(m_numGroups, DrawCommand{0, 0, 0, 0, 0});
+  std::vector<GLuint> zeros(std::max<size_t>(_mesh.numBatches(), c_numCounters), 0);
+  glGenBuffers(1, &m_groups);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_groups);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(groups.size() * sizeof(GroupRecord)), groups.data(), GL_STATIC_DRAW);
+  glGenBuffers(1, &m_commands);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commands);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(commands.size() * sizeof(DrawCommand)), commands.data(), GL_DYNAMIC_COPY);
+  glGenBuffers(1, &m_counts);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counts);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(std::max<size_t>(_mesh.numBatches(), 1) * sizeof(GLuint)),
+               zeros.data(), GL_DYNAMIC_COPY);
+  glGenBuffers(1, &m_stats);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_stats);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(c_numCounters * sizeof(GLuint)), zeros.data(), GL_DYNAMIC_READ);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  m_valid = true;
+  if (trace::verbose())
+  {
+    std::ostringstream message;
+    message << "GPU culling " << m_numGroups << " groups in " << _mesh.numBatches() << " batches, "
+            << (m_compact ? "compacted with glMultiDrawElementsIndirectCount\n" : "culled records drawn with 0 instances\n");
+    trace::print(message.str());
+  }
+}
+
+GpuCuller::~GpuCuller()
+{
+  for (auto &slot : m_queries)
+  {
+    glDeleteQueries(NumStamps, slot.data());
+  }
+  GLuint buffers[] = {m_groups, m_commands, m_counts, m_stats};
+  glDeleteBuffers(4, buffers);
+  GLuint textures[] = {m_depth, m_hiz};
+  glDeleteTextures(2, textures);
+  glDeleteFramebuffers(1, &m_depthFBO);
+}
+
+void GpuCuller::beginFrame()
+{
+  size_t slot = m_frame % c_timeSlots;
+  readTimes(slot);
+  m_written[slot] = 1u << FrameStart;
+  glQueryCounter(m_queries[slot][FrameStart], GL_TIMESTAMP);
+}
+
+void GpuCuller::endFrame()
+{
+  size_t slot = m_frame % c_timeSlots;
+  m_written[slot] |= 1u << FrameEnd;
+  glQueryCounter(m_queries[slot][FrameEnd], GL_TIMESTAMP);
+  ++m_frame;
+}
+
+void GpuCuller::readTimes(size_t _slot)
+{
+  auto &queries = m_queries[_slot];
+  uint32_t written = m_written[_slot];
+  if ((written & (1u << FrameEnd)) == 0)
+  {
+    return;
+  }
+  m_written[_slot] = 0;
+  // the end stamp is the last one made so once it is ready the rest are, a frame still in flight is dropped
+  GLint available = 0;
+  glGetQueryObjectiv(queries[FrameEnd], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (available == 0)
+  {
+    return;
+  }
+  GLuint64 times[NumStamps] = {0};
+  for (int s = 0; s < NumStamps; ++s)
+  {
+    if (written & (1u << s))
+    {
+      glGetQueryObjectui64v(queries[s], GL_QUERY_RESULT, &times[s]);
+    }
+  }
+  m_frameMs += (times[FrameEnd] - times[FrameStart]) / 1.0e6;
+  if (written & (1u << CullEnd))
+  {
+    m_cullMs += (times[CullEnd] - times[CullStart]) / 1.0e6;
+  }
+  if (written & (1u << DepthEnd))
+  {
+    m_cullMs += (times[DepthEnd] - times[DepthStart]) / 1.0e6;
+  }
+  ++m_timedFrames;
+}
+
+void GpuCuller::cull(const ngl::Mat4 &_mvp)
+{
+  if (!m_valid)
+  {
+    return;
+  }
+  size_t slot = m_frame % c_timeSlots;
+  glQueryCounter(m_queries[slot][CullStart], GL_TIMESTAMP);
+  ngl::ShaderLib::use("GroupCull");
+  ngl::ShaderLib::setUniform("MVP", _mvp);
+  ngl::ShaderLib::setUniform("hizMVP", m_hizMVP);
+  ngl::ShaderLib::setUniform("useHiZ", m_hizValid ? 1 : 0);
+  ngl::ShaderLib::setUniform("compact", m_compact ? 1 : 0);
+  ngl::ShaderLib::setUniform("numGroups", static_cast<int>(m_numGroups));
+  ngl::ShaderLib::setUniform("hiz", 0);
+  GLuint zero = 0;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counts);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_stats);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_groups);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_commands);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_counts);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_stats);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_hiz);
+  glDispatchCompute(static_cast<GLuint>((m_numGroups + 63) / 64), 1, 1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  // the records are read by the draws and the counters by stats
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+  glQueryCounter(m_queries[slot][CullEnd], GL_TIMESTAMP);
+  m_written[slot] |= (1u << CullStart) | (1u << CullEnd);
+}
+
+void GpuCuller::drawBatch(size_t _batchID) const
+{
+  const DrawBatch &batch = m_mesh.getBatch(_batchID);
+  auto offset = static_cast<GLintptr>(batch.m_firstMesh * sizeof(DrawCommand));
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commands);
+  if (m_compact)
+  {
+    glBindBuffer(GL_PARAMETER_BUFFER, m_counts);
+    m_mesh.drawBatchIndirect(_batchID, offset, static_cast<GLintptr>(_batchID * sizeof(GLuint)));
+    glBindBuffer(GL_PARAMETER_BUFFER, 0);
+  }
+  else
+  {
+    m_mesh.drawBatchIndirect(_batchID, offset);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+bool GpuCuller::resize(GLuint _fbo, int _width, int _height)
+{
+  GLuint textures[] = {m_depth, m_hiz};
+  glDeleteTextures(2, textures);
+  glDeleteFramebuffers(1, &m_depthFBO);
+  m_depth = m_hiz = m_depthFBO = 0;
+  m_hizValid = false;
+  m_width = _width;
+  m_height = _height;
+
+  // depth can only be blitted between matching formats so copy into the same format the window has
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+  GLenum depthAttachment = _fbo == 0 ? GL_DEPTH : GL_DEPTH_ATTACHMENT;
+  GLenum stencilAttachment = _fbo == 0 ? GL_STENCIL : GL_STENCIL_ATTACHMENT;
+  GLint depthType = GL_NONE;
+  GLint stencilType = GL_NONE;
+  glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &depthType);
+  glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, stencilAttachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &stencilType);
+  GLint depthBits = 0;
+  GLint stencilBits = 0;
+  GLint componentType = GL_NONE;
+  if (depthType != GL_NONE)
+  {
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &componentType);
+  }
+  if (stencilType != GL_NONE)
+  {
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, stencilAttachment, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+  GLenum format = GL_NONE;
+  if (componentType == GL_FLOAT)
+    format = stencilBits != 0 ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+  else if (depthBits == 24)
+    format = stencilBits != 0 ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+  else if (depthBits == 16 && stencilBits == 0)
+    format = GL_DEPTH_COMPONENT16;
+  else if (depthBits == 32 && stencilBits == 0)
+    format = GL_DEPTH_COMPONENT32;
+  if (format == GL_NONE)
+  {
+    std::cerr << "can't copy a " << depthBits << " bit depth / " << stencilBits << " bit stencil buffer for Hi-Z\n";
+    return false;
+  }
+
+  glGenTextures(1, &m_depth);
+  glBindTexture(GL_TEXTURE_2D, m_depth);
+  glTexStorage2D(GL_TEXTURE_2D, 1, format, _width, _height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glGenFramebuffers(1, &m_depthFBO);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_depthFBO);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, stencilBits != 0 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                         m_depth, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+  if (!complete)
+  {
+    std::cerr << "the Hi-Z depth copy framebuffer is incomplete\n";
+    return false;
+  }
+
+  // every level down to 1x1 so any box can be tested with 2x2 texels
+  m_levels = 1 + static_cast<int>(std::floor(std::log2(std::max(_width, _height))));
+  glGenTextures(1, &m_hiz);
+  glBindTexture(GL_TEXTURE_2D, m_hiz);
+  glTexStorage2D(GL_TEXTURE_2D, m_levels, GL_R32F, _width, _height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_levels - 1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return true;
+}
+
+void GpuCuller::captureDepth(GLuint _fbo, int _width, int _height, const ngl::Mat4 &_mvp)
+{
+  if (!m_valid || m_hizBroken)
+  {
+    return;
+  }
+  if ((_width != m_width || _height != m_height) && !resize(_fbo, _width, _height))
+  {
+    std::cerr << "occlusion culling is off, only the frustum is tested\n";
+    m_hizBroken = true;
+    return;
+  }
+  size_t slot = m_frame % c_timeSlots;
+  glQueryCounter(m_queries[slot][DepthStart], GL_TIMESTAMP);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFBO);
+  glBlitFramebuffer(0, 0, _width, _height, 0, 0, _width, _height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+  // the first copy after a resize checks the formats really did match
+  if (!m_hizValid && glGetError() != GL_NO_ERROR)
+  {
+    std::cerr << "could not copy the depth buffer, occlusion culling is off\n";
+    m_hizBroken = true;
+    return;
+  }
+
+  ngl::ShaderLib::use("HiZReduce");
+  ngl::ShaderLib::setUniform("depthTex", 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_depth);
+  for (int level = 0; level < m_levels; ++level)
+  {
+    ngl::ShaderLib::setUniform("level", level);
+    if (level > 0)
+    {
+      glBindImageTexture(0, m_hiz, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    }
+    glBindImageTexture(1, m_hiz, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    GLuint width = static_cast<GLuint>(std::max(1, _width >> level));
+    GLuint height = static_cast<GLuint>(std::max(1, _height >> level));
+    glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+    // each level reads the one before, the last is sampled by the next cull
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  m_hizMVP = _mvp;
+  m_hizValid = true;
+  glQueryCounter(m_queries[slot][DepthEnd], GL_TIMESTAMP);
+  m_written[slot] |= (1u << DepthStart) | (1u << DepthEnd);
+}
+
+GpuCuller::Stats GpuCuller::stats()
+{
+  Stats s;
+  if (m_valid)
+  {
+    GLuint counters[c_numCounters] = {0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_stats);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    s.m_tested = counters[0];
+    s.m_frustumCulled = counters[1];
+    s.m_occluded = counters[2];
+    s.m_drawn = counters[3];
+  }
+  s.m_frames = m_timedFrames;
+  if (m_timedFrames != 0)
+  {
+    s.m_frameMs = m_frameMs / m_timedFrames;
+    s.m_cullMs = m_cullMs / m_timedFrames;
+  }
+  m_timedFrames = 0;
+  m_frameMs = 0.0;
+  m_cullMs = 0.0;
+  return s;
+}
+
+void GpuCuller::printStats(std::ostream &_out)
+{
+  auto s = stats();
+  if (s.m_tested != 0)
+  {
+    _out << "gpu culling : " << s.m_tested << " groups tested, " << s.m_frustumCulled << " outside the frustum, "
+         << s.m_occluded << " occluded, " << s.m_drawn << " drawn ("
+         << 100.0 * (s.m_frustumCulled + s.m_occluded) / s.m_tested << "% culled"
+         << (m_hizValid ? ")\n" : ", no Hi-Z yet)\n");
+  }
+  _out << "gpu frame " << s.m_frameMs << " ms, cull and Hi-Z " << s.m_cullMs << " ms, averaged over " << s.m_frames
+       << " frames\n";
+}
+
+void GpuCuller::memoryUsage(MemoryReport &io_report) const
+{
+  size_t gpuBytes = m_numGroups * (sizeof(GroupRecord) + sizeof(DrawCommand)) + (m_mesh.numBatches() + c_numCounters) * sizeof(GLuint);
+  // the depth copy and the R32F pyramid, which is a third bigger than its first level
+  size_t pixels = static_cast<size_t>(m_width) * static_cast<size_t>(m_height);
+  gpuBytes += pixels * 4 + pixels * 4 * 4 / 3;
+  io_report.add("culling", "gpu culler", sizeof(*this), gpuBytes);
+}
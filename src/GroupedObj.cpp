@@ -18,56 +18,281 @@
 #include <ngl/NGLMessage.h>
 #include <ngl/VAOFactory.h>
 #include <ngl/pystring.h>
+#include "LineReader.h"
+#include "MeshFile.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
 namespace ps = pystring;
 
-// a simple structure to hold our vertex data
-struct VertData
-{
-  GLfloat x; // position from obj
-  GLfloat y;
-  GLfloat z;
-  GLfloat nx; // normal from obj mesh
-  GLfloat ny;
-  GLfloat nz;
-  GLfloat u; // tex cords
-  GLfloat v; // tex cords
+namespace
+{
+constexpr char c_orderHeader[] = "ngl::vcachebin";
+constexpr size_t c_orderHeaderSize = sizeof(c_orderHeader) - 1;
+
+/// @brief hash and compare the raw bytes so only exactly equal corners are welded
+struct VertDataHash
+{
+  size_t operator()(const VertData &_v) const
+  {
+    auto bytes = reinterpret_cast<const unsigned char *>(&_v);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof(VertData); ++i)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash);
+  }
+};
+struct VertDataEqual
+{
+  bool operator()(const VertData &_a, const VertData &_b) const { return std::memcmp(&_a, &_b, sizeof(VertData)) == 0; }
 };
 
-GroupedObj::GroupedObj(std::string_view _fname)
+/// @brief corners packed by each parallel task, big enough that the task overhead is lost in the copy
+constexpr size_t c_packChunk = 16384;
+
+/// @brief the parsed obj arrays the packing kernel gathers from
+struct PackSource
+{
+  const ngl::Vec3 *m_verts;
+  const ngl::Vec3 *m_norm;
+  const ngl::Vec3 *m_uv;
+  const uint64_t *m_faceVerts;
+  const uint64_t *m_faceNorms;
+  const uint64_t *m_faceUVs;
+};
+
+/// @brief pack the corners [_begin,_end), which attributes exist is known at compile time so the
+/// inner loop has no branches and the compiler is free to vectorise the gathers
+template <bool HasNormals, bool HasUVs>
+void packCorners(const PackSource &_src, VertData *o_out, size_t _begin, size_t _end)
+{
+  for (size_t i = _begin; i < _end; ++i)
+  {
+    VertData &d = o_out[i];
+    const ngl::Vec3 &p = _src.m_verts[_src.m_faceVerts[i]];
+    d.x = p.m_x;
+    d.y = p.m_y;
+    d.z = p.m_z;
+    if constexpr (HasNormals)
+    {
+      const ngl::Vec3 &n = _src.m_norm[_src.m_faceNorms[i]];
+      d.nx = n.m_x;
+      d.ny = n.m_y;
+      d.nz = n.m_z;
+    }
+    else
+    {
+      d.nx = d.ny = d.nz = 0.0f;
+    }
+    if constexpr (HasUVs)
+    {
+      const ngl::Vec3 &uv = _src.m_uv[_src.m_faceUVs[i]];
+      d.u = uv.m_x;
+      d.v = uv.m_y;
+    }
+    else
+    {
+      d.u = d.v = 0.0f;
+    }
+  }
+}
+} // end anon namespace
+
+GroupedObj::GroupedObj(std::string_view _fname, CreateVAO _createVAO, const std::string &_cacheDir, SortByMaterial _sort,
+                       unsigned int _threads)
+    : m_cacheDir(_cacheDir), m_threads(_threads)
+{
+  TRACE_SCOPE("GroupedObj");
+  if (meshfile::isMeshFile(_fname))
+  {
+    // already packed by SponzaConvert so there is nothing to parse
+    TRACE_SCOPE("GroupedObj::loadMeshFile");
+    m_loaded = loadMeshFile(_fname);
+  }
+  else
+  {
+    {
+      TRACE_SCOPE("GroupedObj::load");
+      m_loaded = load(_fname, CalcBB::True);
+    }
+    // as the face triggers the push back of the meshes once we have finished the load we need to add the rest
+    m_currentMesh.m_material = m_currentMaterial;
+    m_currentMesh.m_name = m_currentMeshName;
+    m_currentMesh.m_numVerts = m_faceCount;
+    // index into the VAO data 3 tris with uv, normal and x,y,z as floats
+    m_currentMesh.m_startIndex = m_offset;
+    m_meshes.push_back(m_currentMesh);
+    std::sort(m_meshes.begin(), m_meshes.end());
+    {
+      TRACE_SCOPE("GroupedObj::packVertexData");
+      packVertexData();
+    }
+  }
+  if (m_vertexData.empty())
+  {
+    std::cerr << "no triangles loaded from " << _fname << '\n';
+    m_loaded = false;
+    return;
+  }
+  {
+    TRACE_SCOPE("GroupedObj::computeHash");
+    computeHash();
+  }
+  // the hash of the file order keys the cached triangle order, then it is re-done for the final order
+  optimiseVertexOrder();
+  // done after the optimise so the cached triangle order still matches the file order it was keyed on
+  if (_sort == SortByMaterial::True)
+  {
+    sortByMaterial();
+  }
+  buildBatches();
+  computeHash();
+  if (_createVAO == CreateVAO::True)
+  {
+    TRACE_SCOPE("GroupedObj::createVAO");
+    createVAO();
+  }
+}
+void GroupedObj::upload()
+{
+  if (!m_vao && !m_vertexData.empty())
+  {
+    TRACE_SCOPE("GroupedObj::createVAO");
+    createVAO();
+  }
+}
+
+std::vector<std::shared_ptr<GroupedObj>> GroupedObj::loadMany(const std::vector<std::string> &_paths,
+                                                               unsigned int _threads, const std::string &_cacheDir)
 {
-  m_loaded = load(_fname, CalcBB::True);
-  // as the face triggers the push back of the meshes once we have finished the load we need to add the rest
-  m_currentMesh.m_material = m_currentMaterial;
-  m_currentMesh.m_name = m_currentMeshName;
-  m_currentMesh.m_numVerts = m_faceCount;
-  // index into the VAO data 3 tris with uv, normal and x,y,z as floats
-  m_currentMesh.m_startIndex = m_offset;
-  m_meshes.push_back(m_currentMesh);
-  std::sort(m_meshes.begin(), m_meshes.end());
-  createVAO();
+  TRACE_SCOPE("GroupedObj::loadMany");
+  std::vector<std::shared_ptr<GroupedObj>> meshes(_paths.size());
+  if (_paths.empty())
+  {
+    return meshes;
+  }
+  // one model per task, a big model holds up one thread but the rest keep going. What the models don't use is
+  // shared out to the loops inside each one so the load never runs more than _threads at once
+  unsigned int threads = parallel::numThreads(_threads);
+  unsigned int outer = static_cast<unsigned int>(std::min<size_t>(threads, _paths.size()));
+  unsigned int inner = std::max(1u, threads / outer);
+  parallel::forEach(size_t(0), _paths.size(), [&](size_t _i)
+  {
+    auto mesh = std::make_shared<GroupedObj>(_paths[_i], CreateVAO::False, _cacheDir, SortByMaterial::True, inner);
+    if (!mesh->m_vertexData.empty())
+    {
+      meshes[_i] = std::move(mesh);
+    }
+  }, outer, 1);
+  return meshes;
 }
+
+std::shared_ptr<GroupedObj> GroupedObj::combine(const std::vector<std::shared_ptr<GroupedObj>> &_meshes)
+{
+  TRACE_SCOPE("GroupedObj::combine");
+  std::shared_ptr<GroupedObj> combined(new GroupedObj());
+  size_t corners = 0;
+  size_t vertices = 0;
+  for (auto &mesh : _meshes)
+  {
+    if (!mesh || mesh->m_vertexData.empty())
+    {
+      std::cerr << "can't combine a mesh that failed to load or has released its CPU data\n";
+      return nullptr;
+    }
+    corners += mesh->m_vertexData.size();
+    vertices += mesh->m_drawVertices.size();
+  }
+  if (corners == 0)
+  {
+    return nullptr;
+  }
+  combined->m_vertexData.reserve(corners);
+  combined->m_drawVertices.reserve(vertices);
+  combined->m_indices.reserve(corners);
+  combined->m_minX = combined->m_minY = combined->m_minZ = std::numeric_limits<ngl::Real>::max();
+  combined->m_maxX = combined->m_maxY = combined->m_maxZ = std::numeric_limits<ngl::Real>::lowest();
+  for (auto &mesh : _meshes)
+  {
+    // the ranges of each group move up by the data of the meshes before it
+    size_t firstCorner = combined->m_vertexData.size();
+    size_t firstVertex = combined->m_drawVertices.size();
+    combined->m_vertexData.insert(combined->m_vertexData.end(), mesh->m_vertexData.begin(), mesh->m_vertexData.end());
+    combined->m_drawVertices.insert(combined->m_drawVertices.end(), mesh->m_drawVertices.begin(),
+                                    mesh->m_drawVertices.end());
+    // the indices count from the base vertex of each group so only the bases move
+    combined->m_indices.insert(combined->m_indices.end(), mesh->m_indices.begin(), mesh->m_indices.end());
+    for (auto group : mesh->m_meshes)
+    {
+      group.m_startIndex += firstCorner;
+      group.m_firstVertex += firstVertex;
+      group.m_baseVertex += firstVertex;
+      combined->m_meshes.push_back(std::move(group));
+    }
+    combined->m_minX = std::min(combined->m_minX, mesh->m_minX);
+    combined->m_minY = std::min(combined->m_minY, mesh->m_minY);
+    combined->m_minZ = std::min(combined->m_minZ, mesh->m_minZ);
+    combined->m_maxX = std::max(combined->m_maxX, mesh->m_maxX);
+    combined->m_maxY = std::max(combined->m_maxY, mesh->m_maxY);
+    combined->m_maxZ = std::max(combined->m_maxZ, mesh->m_maxZ);
+  }
+  // keep the groups of every model sharing a material together then lay the data out to match so each
+  // material is one batch across all the models
+  std::stable_sort(combined->m_meshes.begin(), combined->m_meshes.end());
+  combined->sortByMaterial();
+  combined->buildBatches();
+  combined->m_center = ngl::Vec3((combined->m_minX + combined->m_maxX) * 0.5f, (combined->m_minY + combined->m_maxY) * 0.5f,
+                                 (combined->m_minZ + combined->m_maxZ) * 0.5f);
+  combined->m_dataPackType = GL_TRIANGLES;
+  combined->m_isLoaded = true;
+  combined->m_loaded = true;
+  combined->computeHash();
+  return combined;
+}
+
 bool GroupedObj::load(std::string_view _fname, CalcBB _calcBB) noexcept
 {
   m_faceCount = 0;
+  m_offset = 0;
+  m_inGroup = false;
+  m_meshes.clear();
+  m_verts.clear();
+  m_norm.clear();
+  m_uv.clear();
+  m_faceVerts.clear();
+  m_faceUVs.clear();
+  m_faceNorms.clear();
   m_currentMesh.m_startIndex = 0;
   m_currentMesh.m_numVerts = 0;
-  std::ifstream in(_fname.data());
-  if (in.is_open() != true)
+  auto start = std::chrono::high_resolution_clock::now();
+  // read (and decompress a .obj.gz / .obj.zst) on another thread while we parse
+  LineReader in{std::string(_fname)};
+  if (in.isOpen() != true)
   {
     ngl::NGLMessage::addError(fmt::format(" file {0} not found  ", _fname.data()));
     return false;
   }
 
   std::string str;
+  // re-used for every line so the token strings keep their capacity
+  std::vector<std::string> tokens;
   // Read the next line from File untill it reaches the end.
-  // while (std::getline(in, str))
-  while (!safeGetline(in, str).eof())
+  while (in.getline(str))
   {
     bool status = true;
     // Line contains string of length > 0 then parse it
     if (str.size() > 0)
     {
-      std::vector<std::string> tokens;
       ps::split(str, tokens);
       if (tokens[0] == "v")
       {
@@ -100,8 +325,17 @@ bool GroupedObj::load(std::string_view _fname, CalcBB _calcBB) noexcept
     if (status == false)
       return false;
   } // while
-
-  in.close();
+  if (in.failed())
+  {
+    ngl::NGLMessage::addError(fmt::format(" file {0} could not be read  ", _fname.data()));
+    return false;
+  }
+  if (in.codec() != LineReader::Codec::None && trace::verbose())
+  {
+    std::ostringstream message;
+    in.printStats(message, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+    trace::print(message.str());
+  }
   // Calculate the center of the object.
   if (_calcBB == CalcBB::True)
   {
@@ -111,16 +345,57 @@ bool GroupedObj::load(std::string_view _fname, CalcBB _calcBB) noexcept
   return true;
 }
 
-bool GroupedObj::parseGroup(std::vector<std::string> &_tokens) noexcept
+bool GroupedObj::loadMeshFile(std::string_view _fname)
 {
+  static_assert(sizeof(VertData) == meshfile::c_floatsPerCorner * sizeof(GLfloat), "VertData must match the mesh file");
+  std::ifstream fileIn(std::string(_fname), std::ios::in | std::ios::binary);
+  if (!fileIn.is_open())
+  {
+    ngl::NGLMessage::addError(fmt::format(" file {0} not found  ", _fname.data()));
+    return false;
+  }
+  meshfile::Header header;
+  if (!meshfile::readHeader(fileIn, header))
+  {
+    return false;
+  }
+  m_meshes.clear();
+  for (auto &group : header.m_groups)
+  {
+    MeshData mesh;
+    mesh.m_name = group.m_name;
+    mesh.m_material = group.m_material;
+    mesh.m_startIndex = group.m_startIndex;
+    mesh.m_numVerts = group.m_numVerts;
+    m_meshes.push_back(mesh);
+  }
+  m_vertexData.resize(header.m_numCorners);
+  fileIn.read(reinterpret_cast<char *>(m_vertexData.data()), static_cast<std::streamsize>(m_vertexData.size() * sizeof(VertData)));
+  if (!fileIn)
+  {
+    std::cerr << "mesh file " << _fname << " is truncated\n";
+    m_vertexData.clear();
+    return false;
+  }
+  // there is no obj data to calculate the extents from so use the ones stored
+  m_minX = header.m_min[0];
+  m_minY = header.m_min[1];
+  m_minZ = header.m_min[2];
+  m_maxX = header.m_max[0];
+  m_maxY = header.m_max[1];
+  m_maxZ = header.m_max[2];
+  m_center = ngl::Vec3((m_minX + m_maxX) * 0.5f, (m_minY + m_maxY) * 0.5f, (m_minZ + m_maxZ) * 0.5f);
+  m_dataPackType = GL_TRIANGLES;
+  m_isLoaded = true;
+  return true;
+}
 
-  // as the group is defined then the face data follows
-  // we need to load the first set of faces before saving the data
-  // this static int does that
-  static int firstTime = 0;
-
-  //  std::cout << "current group " << m_currentMeshName << "\n";
-  if (firstTime++ > 0)
+bool GroupedObj::parseGroup(std::vector<std::string> &_tokens) noexcept
+{
+  // as the group is defined then the face data follows so the group being read is only stored when the
+  // next one starts (or by the ctor at the end of the file). This is per instance so meshes can be
+  // loaded again, or on several threads at once
+  if (m_inGroup)
   {
     // now we add the group to our list
     m_currentMesh.m_material = m_currentMaterial;
@@ -128,12 +403,11 @@ bool GroupedObj::parseGroup(std::vector<std::string> &_tokens) noexcept
     m_currentMesh.m_numVerts = m_faceCount;
     // index into the VAO data 3 tris with uv, normal and x,y,z as floats
     m_currentMesh.m_startIndex = m_offset;
-    // std::cout << "Stored values fc " << m_faceCount << "\n";
-    // std::cout << "offset " << m_offset << "\n";
     m_meshes.push_back(m_currentMesh);
     m_offset += m_faceCount;
     m_faceCount = 0;
   }
+  m_inGroup = true;
 
   // set current group
   if (_tokens.size() == 1)
@@ -172,6 +446,12 @@ void GroupedObj::debugPrint()
     std::cout << "Start Index " << m.m_startIndex << "\n";
     std::cout << "------------------------------------\n";
   }
+  if (m_vao == true)
+  {
+    auto &stats = uploadStats();
+    std::cout << "Streamed " << stats.bytes << " bytes in " << stats.uploads << " uploads "
+              << stats.mbPerSecond() << " MB/s\n";
+  }
 }
 void GroupedObj::draw(size_t _meshID) const
 {
@@ -181,6 +461,27 @@ void GroupedObj::draw(size_t _meshID) const
 
   m_vaoMesh->unbind();
 }
+void GroupedObj::drawBatch(size_t _batchID) const
+{
+  m_vaoMesh->bind();
+  reinterpret_cast<VAO *>(m_vaoMesh.get())->draw(m_batches[_batchID].m_startIndex, m_batches[_batchID].m_numVerts);
+  m_vaoMesh->unbind();
+}
+void GroupedObj::drawGroups(size_t _first, size_t _count) const
+{
+  const MeshData &last = m_meshes[_first + _count - 1];
+  size_t start = m_meshes[_first].m_startIndex;
+  m_vaoMesh->bind();
+  reinterpret_cast<VAO *>(m_vaoMesh.get())->draw(start, last.m_startIndex + last.m_numVerts - start);
+  m_vaoMesh->unbind();
+}
+void GroupedObj::drawBatchIndirect(size_t _batchID, GLintptr _offset, GLintptr _countOffset) const
+{
+  m_vaoMesh->bind();
+  reinterpret_cast<VAO *>(m_vaoMesh.get())
+      ->drawIndirect(_offset, static_cast<GLsizei>(m_batches[_batchID].m_numMeshes), _countOffset);
+  m_vaoMesh->unbind();
+}
 size_t GroupedObj::numMeshes() const
 {
   return m_meshes.size();
@@ -194,98 +495,718 @@ std::string GroupedObj::getName(unsigned int _m) const
   return m_meshes[_m].m_name;
 }
 
-void GroupedObj::createVAO(ResetVAO _reset) noexcept
+bool GroupedObj::updateMesh(size_t _meshID, const std::vector<VertData> &_data)
+{
+  const MeshData &mesh = m_meshes[_meshID];
+  if (_data.size() != mesh.m_numVerts)
+  {
+    std::cerr << "updateMesh " << mesh.m_name << " expects " << mesh.m_numVerts << " verts got " << _data.size() << '\n';
+    return false;
+  }
+  // scatter the corners into the group's welded vertices, the CPU copies are updated so they still match what
+  // is drawn
+  for (size_t i = 0; i < mesh.m_numVerts; ++i)
+  {
+    m_drawVertices[m_indices[mesh.m_startIndex + i] + mesh.m_baseVertex] = _data[i];
+  }
+  if (!cpuDataReleased())
+  {
+    std::copy(_data.begin(), _data.end(), m_vertexData.begin() + static_cast<std::ptrdiff_t>(mesh.m_startIndex));
+  }
+  auto vao = reinterpret_cast<VAO *>(m_vaoMesh.get());
+  vao->setSubData(mesh.m_firstVertex * sizeof(VertData), mesh.m_numVertices * sizeof(VertData),
+                  &m_drawVertices[mesh.m_firstVertex]);
+  return true;
+}
+
+size_t GroupedObj::patch(const GroupedObj &_fresh)
+{
+  TRACE_SCOPE("GroupedObj::patch");
+  // the group parser can leave empty groups behind so only compare the ones with triangles
+  auto drawn = [](const std::vector<MeshData> &_meshes)
+  {
+    std::vector<const MeshData *> groups;
+    for (auto &mesh : _meshes)
+    {
+      if (mesh.m_numVerts != 0)
+      {
+        groups.push_back(&mesh);
+      }
+    }
+    return groups;
+  };
+  auto oldGroups = drawn(m_meshes);
+  auto newGroups = drawn(_fresh.m_meshes);
+  // the derived data is re-built from the corners so take them all back if they were released
+  bool released = cpuDataReleased();
+  if (released)
+  {
+    m_vertexData = _fresh.m_vertexData;
+  }
+  bool sameLayout = oldGroups.size() == newGroups.size() && m_vertexData.size() == _fresh.m_vertexData.size() &&
+                    m_drawVertices.size() == _fresh.m_drawVertices.size();
+  for (size_t i = 0; sameLayout && i < oldGroups.size(); ++i)
+  {
+    const MeshData &a = *oldGroups[i];
+    const MeshData &b = *newGroups[i];
+    sameLayout = a.m_name == b.m_name && a.m_material == b.m_material && a.m_startIndex == b.m_startIndex &&
+                 a.m_numVerts == b.m_numVerts && a.m_firstVertex == b.m_firstVertex && a.m_numVertices == b.m_numVertices &&
+                 a.m_baseVertex == b.m_baseVertex;
+  }
+
+  size_t changed = 0;
+  if (sameLayout)
+  {
+    auto vao = reinterpret_cast<VAO *>(m_vaoMesh.get());
+    if (m_vao)
+    {
+      // the element array binding belongs to the VAO
+      vao->bind();
+    }
+    for (auto group : newGroups)
+    {
+      const MeshData &mesh = *group;
+      bool vertsChanged = std::memcmp(&m_drawVertices[mesh.m_firstVertex], &_fresh.m_drawVertices[mesh.m_firstVertex],
+                                      mesh.m_numVertices * sizeof(VertData)) != 0;
+      bool indicesChanged = std::memcmp(&m_indices[mesh.m_startIndex], &_fresh.m_indices[mesh.m_startIndex],
+                                        mesh.m_numVerts * sizeof(GLuint)) != 0;
+      if (!vertsChanged && !indicesChanged)
+      {
+        if (m_vao && m_gpuEdited)
+        {
+          // the buffer was written with mapMesh so put back what the CPU copy holds
+          vao->setSubData(mesh.m_firstVertex * sizeof(VertData), mesh.m_numVertices * sizeof(VertData),
+                          &m_drawVertices[mesh.m_firstVertex]);
+        }
+        continue;
+      }
+      ++changed;
+      std::copy_n(&_fresh.m_drawVertices[mesh.m_firstVertex], mesh.m_numVertices, &m_drawVertices[mesh.m_firstVertex]);
+      std::copy_n(&_fresh.m_indices[mesh.m_startIndex], mesh.m_numVerts, &m_indices[mesh.m_startIndex]);
+      if (!released)
+      {
+        std::copy_n(&_fresh.m_vertexData[mesh.m_startIndex], mesh.m_numVerts, &m_vertexData[mesh.m_startIndex]);
+      }
+      if (m_vao && (vertsChanged || m_gpuEdited))
+      {
+        vao->setSubData(mesh.m_firstVertex * sizeof(VertData), mesh.m_numVertices * sizeof(VertData),
+                        &m_drawVertices[mesh.m_firstVertex]);
+      }
+      if (m_vao && indicesChanged)
+      {
+        vao->setIndexSubData(mesh.m_startIndex, mesh.m_numVerts, &m_indices[mesh.m_startIndex]);
+      }
+    }
+    if (m_vao)
+    {
+      vao->unbind();
+    }
+    m_gpuEdited = false;
+  }
+  else
+  {
+    changed = newGroups.size();
+    m_meshes = _fresh.m_meshes;
+    m_batches = _fresh.m_batches;
+    m_vertexData = _fresh.m_vertexData;
+    m_drawVertices = _fresh.m_drawVertices;
+    m_indices = _fresh.m_indices;
+    m_segments = _fresh.m_segments;
+    if (m_vao)
+    {
+      m_vaoMesh->removeVAO();
+      createVAO();
+    }
+  }
+  if (changed != 0)
+  {
+    m_verts = _fresh.m_verts;
+    m_norm = _fresh.m_norm;
+    m_uv = _fresh.m_uv;
+    m_faceVerts = _fresh.m_faceVerts;
+    m_faceUVs = _fresh.m_faceUVs;
+    m_faceNorms = _fresh.m_faceNorms;
+    m_center = _fresh.m_center;
+    m_hash = _fresh.m_hash;
+    m_cacheBefore = _fresh.m_cacheBefore;
+    m_cacheAfter = _fresh.m_cacheAfter;
+  }
+  return changed;
+}
+
+VertData *GroupedObj::mapMesh(size_t _meshID)
+{
+  const MeshData &mesh = m_meshes[_meshID];
+  m_gpuEdited = true;
+  auto vao = reinterpret_cast<VAO *>(m_vaoMesh.get());
+  return static_cast<VertData *>(vao->mapBufferRange(mesh.m_firstVertex * sizeof(VertData), mesh.m_numVertices * sizeof(VertData)));
+}
+
+void GroupedObj::orphanMeshes()
+{
+  m_gpuEdited = true;
+  reinterpret_cast<VAO *>(m_vaoMesh.get())->orphanBuffer();
+}
+
+void GroupedObj::unmapMesh()
+{
+  reinterpret_cast<VAO *>(m_vaoMesh.get())->unmapBufferRange();
+}
+
+bool GroupedObj::setVertexLighting(const std::vector<ngl::Vec3> &_light)
+{
+  // there is one index per corner so this still works once vertexData is released
+  if (_light.size() != m_indices.size() || !m_vaoMesh)
+  {
+    std::cerr << "setVertexLighting expects " << m_indices.size() << " values got " << _light.size() << '\n';
+    return false;
+  }
+  // average the corners welded into each vertex
+  std::vector<ngl::Vec3> light(m_drawVertices.size(), ngl::Vec3(0.0f, 0.0f, 0.0f));
+  std::vector<unsigned int> count(m_drawVertices.size(), 0);
+  for (auto &segment : m_segments)
+  {
+    for (size_t i = segment.m_firstIndex; i < segment.m_firstIndex + segment.m_numIndices; ++i)
+    {
+      size_t v = segment.m_firstVertex + m_indices[i];
+      light[v] += _light[i];
+      ++count[v];
+    }
+  }
+  for (size_t v = 0; v < light.size(); ++v)
+  {
+    if (count[v] > 1)
+    {
+      light[v] = light[v] / static_cast<float>(count[v]);
+    }
+  }
+  auto vao = reinterpret_cast<VAO *>(m_vaoMesh.get());
+  vao->bind();
+  vao->setAttributeData(3, light.size() * sizeof(ngl::Vec3), &light[0].m_x, 3);
+  vao->unbind();
+  return true;
+}
+
+const VAO::UploadStats &GroupedObj::uploadStats() const
+{
+  return reinterpret_cast<VAO *>(m_vaoMesh.get())->uploadStats();
+}
+
+size_t GroupedObj::objDataBytes() const
+{
+  size_t bytes = (m_verts.capacity() + m_norm.capacity() + m_uv.capacity()) * sizeof(ngl::Vec3);
+  bytes += (m_faceVerts.capacity() + m_faceUVs.capacity() + m_faceNorms.capacity()) * sizeof(uint64_t);
+  return bytes;
+}
+
+size_t GroupedObj::cpuBytes() const
+{
+  size_t bytes = objDataBytes();
+  bytes += (m_vertexData.capacity() + m_drawVertices.capacity()) * sizeof(VertData);
+  bytes += m_indices.capacity() * sizeof(GLuint);
+  bytes += m_meshes.capacity() * sizeof(MeshData);
+  return bytes;
+}
+
+size_t GroupedObj::gpuBytes() const
+{
+  if (!m_vaoMesh)
+  {
+    return 0;
+  }
+  auto vao = reinterpret_cast<VAO *>(m_vaoMesh.get());
+  return vao->getBufferSize() + vao->getIndexBufferSize() + vao->getAttributeBufferSize();
+}
+
+void GroupedObj::memoryUsage(MemoryReport &io_report) const
+{
+  auto vao = reinterpret_cast<const VAO *>(m_vaoMesh.get());
+  io_report.add("geometry", "obj data", objDataBytes(), 0);
+  io_report.add("geometry", "corners", m_vertexData.capacity() * sizeof(VertData), 0);
+  io_report.add("geometry", "vertices", m_drawVertices.capacity() * sizeof(VertData) + m_meshes.capacity() * sizeof(MeshData),
+                vao != nullptr ? vao->getBufferSize() : 0);
+  io_report.add("geometry", "lighting", 0, vao != nullptr ? vao->getAttributeBufferSize() : 0);
+  io_report.add("indices", "indices", m_indices.capacity() * sizeof(GLuint), vao != nullptr ? vao->getIndexBufferSize() : 0);
+}
+
+void GroupedObj::releaseCPUData()
 {
-  // else allocate space as build our VAO
-  m_dataPackType = 0;
-  if (isTriangular())
+  if (!m_vao)
   {
-    m_dataPackType = GL_TRIANGLES;
-    std::cout << "Doing Tri Data" << std::endl;
+    std::cerr << "releaseCPUData called with no VAO, keeping the data\n";
+    return;
+  }
+  size_t before = cpuBytes();
+  // swap with empties as clear keeps the capacity
+  std::vector<ngl::Vec3>().swap(m_verts);
+  std::vector<ngl::Vec3>().swap(m_norm);
+  std::vector<ngl::Vec3>().swap(m_uv);
+  std::vector<uint64_t>().swap(m_faceVerts);
+  std::vector<uint64_t>().swap(m_faceUVs);
+  std::vector<uint64_t>().swap(m_faceNorms);
+  std::vector<VertData>().swap(m_vertexData);
+  if (trace::verbose())
+  {
+    std::ostringstream message;
+    message << "released " << (before - cpuBytes()) / (1024 * 1024) << " MB of CPU geometry\n";
+    trace::print(message.str());
+  }
+}
+
+void GroupedObj::sortByMaterial()
+{
+  TRACE_SCOPE("GroupedObj::sortByMaterial");
+  std::vector<VertData> vertexData;
+  std::vector<VertData> drawVertices;
+  std::vector<GLuint> indices;
+  vertexData.reserve(m_vertexData.size());
+  drawVertices.reserve(m_drawVertices.size());
+  indices.reserve(m_indices.size());
+  // the new layout decides the segments, so work it out before the indices are re-based
+  std::vector<VAO::Segment> ranges;
+  {
+    size_t startIndex = 0;
+    size_t firstVertex = 0;
+    for (auto &m : m_meshes)
+    {
+      size_t numVertices = m.m_numVerts != 0 ? m.m_numVertices : 0;
+      ranges.push_back({firstVertex, numVertices, startIndex, m.m_numVerts});
+      startIndex += m.m_numVerts;
+      firstVertex += numVertices;
+    }
+  }
+  auto bases = planSegments(ranges);
+  for (size_t g = 0; g < m_meshes.size(); ++g)
+  {
+    MeshData &m = m_meshes[g];
+    if (m.m_numVerts != 0)
+    {
+      vertexData.insert(vertexData.end(), m_vertexData.begin() + m.m_startIndex,
+                        m_vertexData.begin() + m.m_startIndex + m.m_numVerts);
+      drawVertices.insert(drawVertices.end(), m_drawVertices.begin() + m.m_firstVertex,
+                          m_drawVertices.begin() + m.m_firstVertex + m.m_numVertices);
+      // each group was welded on its own so its indices only point into its own vertex range
+      size_t oldOffset = m.m_firstVertex - m.m_baseVertex;
+      size_t newOffset = ranges[g].m_firstVertex - bases[g];
+      for (size_t i = 0; i < m.m_numVerts; ++i)
+      {
+        indices.push_back(static_cast<GLuint>(m_indices[m.m_startIndex + i] - oldOffset + newOffset));
+      }
+    }
+    m.m_startIndex = ranges[g].m_firstIndex;
+    m.m_firstVertex = ranges[g].m_firstVertex;
+    m.m_baseVertex = bases[g];
+  }
+  m_vertexData.swap(vertexData);
+  m_drawVertices.swap(drawVertices);
+  m_indices.swap(indices);
+}
+
+void GroupedObj::buildBatches()
+{
+  m_batches.clear();
+  for (size_t i = 0; i < m_meshes.size(); ++i)
+  {
+    const MeshData &m = m_meshes[i];
+    if (m.m_numVerts == 0)
+    {
+      continue;
+    }
+    if (!m_batches.empty())
+    {
+      DrawBatch &last = m_batches.back();
+      if (last.m_material == m.m_material && last.m_startIndex + last.m_numVerts == m.m_startIndex &&
+          m_meshes[last.m_firstMesh].m_baseVertex == m.m_baseVertex)
+      {
+        last.m_numVerts += m.m_numVerts;
+        last.m_numMeshes = i + 1 - last.m_firstMesh;
+        continue;
+      }
+    }
+    m_batches.push_back({m.m_material, m.m_startIndex, m.m_numVerts, i, 1});
   }
-  // data is mixed of > quad so exit error
-  if (m_dataPackType == 0)
+  if (trace::verbose())
   {
-    std::cerr << "Can only create VBO from all Triangle or ALL Quad data at present" << std::endl;
-    exit(EXIT_FAILURE);
+    std::ostringstream message;
+    message << "drawing " << m_meshes.size() << " groups in " << m_batches.size() << " batches\n";
+    trace::print(message.str());
   }
+}
 
-  // now we are going to process and pack the mesh into an ngl::VertexArrayObject
-  std::vector<VertData> vboMesh;
-  VertData d;
-  size_t loopFaceCount = 3;
+std::vector<size_t> GroupedObj::planSegments(const std::vector<VAO::Segment> &_ranges)
+{
+  std::vector<size_t> segmentOf;
+  m_segments = VAO::planSegments(_ranges, sizeof(VertData), s_bufferLimit, segmentOf);
+  std::vector<size_t> bases(_ranges.size());
+  for (size_t r = 0; r < _ranges.size(); ++r)
+  {
+    bases[r] = m_segments[segmentOf[r]].m_firstVertex;
+  }
+  if (m_segments.size() > 1 && trace::verbose())
+  {
+    std::ostringstream message;
+    message << "split " << _ranges.back().m_firstVertex + _ranges.back().m_numVertices << " vertices into "
+            << m_segments.size() << " buffers of at most " << s_bufferLimit / (1024 * 1024) << " MB\n";
+    trace::print(message.str());
+  }
+  return bases;
+}
 
-  // loop for each of the faces
-  for (size_t i = 0; i < m_face.size(); ++i)
+void GroupedObj::computeHash()
+{
+  // 64 bit FNV-1a of the packed data and the group table, used to key any derived data we cache to disk
+  constexpr uint64_t prime = 1099511628211ULL;
+  uint64_t hash = 14695981039346656037ULL;
+  auto add = [&hash](const void *_data, size_t _size)
   {
-    // now for each triangle in the face (remember we ensured tri above)
-    for (size_t j = 0; j < loopFaceCount; ++j)
+    auto bytes = static_cast<const unsigned char *>(_data);
+    for (size_t i = 0; i < _size; ++i)
     {
+      hash ^= bytes[i];
+      hash *= prime;
+    }
+  };
+  if (m_vertexData.size() != 0)
+  {
+    add(&m_vertexData[0], m_vertexData.size() * sizeof(VertData));
+  }
+  for (auto &m : m_meshes)
+  {
+    add(m.m_name.data(), m.m_name.size());
+    add(&m.m_startIndex, sizeof(m.m_startIndex));
+    add(&m.m_numVerts, sizeof(m.m_numVerts));
+  }
+  m_hash = hash;
+}
 
-      // pack in the vertex data first
-      d.x = m_verts[m_face[i].m_vert[j]].m_x;
-      d.y = m_verts[m_face[i].m_vert[j]].m_y;
-      d.z = m_verts[m_face[i].m_vert[j]].m_z;
-      // now if we have norms of tex (possibly could not) pack them as well
-      if (m_norm.size() > 0 && m_uv.size() > 0)
+void GroupedObj::optimiseVertexOrder()
+{
+  TRACE_SCOPE("GroupedObj::optimiseVertexOrder");
+  auto start = std::chrono::high_resolution_clock::now();
+  // the ranges to weld are the groups plus any gaps between them so every packed vertex gets an index
+  std::vector<std::pair<size_t, size_t>> ranges;
+  {
+    std::vector<std::pair<size_t, size_t>> groups;
+    for (auto &m : m_meshes)
+    {
+      if (m.m_numVerts != 0)
       {
+        groups.push_back({m.m_startIndex, m.m_startIndex + m.m_numVerts});
+      }
+    }
+    std::sort(groups.begin(), groups.end());
+    size_t next = 0;
+    for (auto &g : groups)
+    {
+      if (g.first > next)
+      {
+        ranges.push_back({next, g.first});
+      }
+      if (g.first >= next)
+      {
+        ranges.push_back(g);
+        next = g.second;
+      }
+    }
+    if (next < m_vertexData.size())
+    {
+      ranges.push_back({next, m_vertexData.size()});
+    }
+  }
 
-        d.nx = m_norm[m_face[i].m_norm[j]].m_x;
-        d.ny = m_norm[m_face[i].m_norm[j]].m_y;
-        d.nz = m_norm[m_face[i].m_norm[j]].m_z;
+  // the expensive part is the triangle order, that is cached keyed on the hash of the file order
+  size_t numTriangles = m_vertexData.size() / 3;
+  std::vector<uint32_t> cachedOrder;
+  std::string cacheName;
+  if (m_cacheDir.size() != 0)
+  {
+    std::stringstream name;
+    name << m_cacheDir << '/' << std::hex << m_hash << ".vcache";
+    cacheName = name.str();
+    std::ifstream fileIn(cacheName, std::ios::in | std::ios::binary);
+    char header[c_orderHeaderSize + 1] = {0};
+    uint64_t count = 0;
+    if (fileIn.is_open() && fileIn.read(header, c_orderHeaderSize) && strcmp(header, c_orderHeader) == 0 &&
+        fileIn.read(reinterpret_cast<char *>(&count), sizeof(count)) && count == numTriangles)
+    {
+      cachedOrder.resize(numTriangles);
+      if (!fileIn.read(reinterpret_cast<char *>(cachedOrder.data()), static_cast<std::streamsize>(numTriangles * sizeof(uint32_t))))
+      {
+        std::cerr << "truncated vertex cache order " << cacheName << '\n';
+        cachedOrder.clear();
+      }
+    }
+    // each range must be a permutation of its own triangles
+    std::vector<char> used(numTriangles, 0);
+    for (size_t r = 0; r < ranges.size() && cachedOrder.size() != 0; ++r)
+    {
+      size_t first = ranges[r].first / 3;
+      size_t rangeTriangles = (ranges[r].second - ranges[r].first) / 3;
+      for (size_t t = first; t < first + rangeTriangles; ++t)
+      {
+        if (cachedOrder[t] >= rangeTriangles || used[first + cachedOrder[t]]++)
+        {
+          std::cerr << "ignoring bad vertex cache order " << cacheName << '\n';
+          cachedOrder.clear();
+          break;
+        }
+      }
+    }
+  }
 
-        d.u = m_uv[m_face[i].m_uv[j]].m_x;
-        d.v = m_uv[m_face[i].m_uv[j]].m_y;
+  struct Result
+  {
+    std::vector<VertData> m_verts;
+    std::vector<GLuint> m_indices;
+    vertexcache::CacheStats m_before;
+    vertexcache::CacheStats m_after;
+  };
+  std::vector<Result> results(ranges.size());
+  std::vector<uint32_t> order(numTriangles);
+  parallel::forEach(0, ranges.size(), [&](size_t r)
+  {
+    size_t begin = ranges[r].first;
+    size_t count = ranges[r].second - begin;
+    size_t numTris = count / 3;
+    if (numTris == 0)
+    {
+      return;
+    }
+    Result &result = results[r];
+    // weld the identical corners
+    std::unordered_map<VertData, GLuint, VertDataHash, VertDataEqual> welded;
+    welded.reserve(count);
+    std::vector<uint32_t> local(numTris * 3);
+    for (size_t i = 0; i < local.size(); ++i)
+    {
+      auto found = welded.emplace(m_vertexData[begin + i], static_cast<GLuint>(result.m_verts.size()));
+      if (found.second)
+      {
+        result.m_verts.push_back(m_vertexData[begin + i]);
       }
-      // now if neither are present (only verts like Zbrush models)
-      else if (m_norm.size() == 0 && m_uv.size() == 0)
+      local[i] = found.first->second;
+    }
+    size_t numVerts = result.m_verts.size();
+    result.m_before = vertexcache::analyse(local, numVerts);
+
+    uint32_t *triOrder = &order[begin / 3];
+    if (cachedOrder.size() != 0)
+    {
+      std::copy(cachedOrder.begin() + begin / 3, cachedOrder.begin() + begin / 3 + numTris, triOrder);
+    }
+    else
+    {
+      auto cacheOrder = vertexcache::optimiseCache(local, numVerts);
+      std::vector<uint32_t> sorted(local.size());
+      for (size_t t = 0; t < numTris; ++t)
       {
-        d.nx = 0;
-        d.ny = 0;
-        d.nz = 0;
-        d.u = 0;
-        d.v = 0;
+        std::copy(&local[cacheOrder[t] * 3], &local[cacheOrder[t] * 3] + 3, &sorted[t * 3]);
       }
-      // here we've got norms but not tex
-      else if (m_norm.size() > 0 && m_uv.size() == 0)
+      auto overdrawOrder = vertexcache::optimiseOverdraw(sorted, &result.m_verts[0].x, sizeof(VertData) / sizeof(GLfloat));
+      for (size_t t = 0; t < numTris; ++t)
       {
-        d.nx = m_norm[m_face[i].m_norm[j]].m_x;
-        d.ny = m_norm[m_face[i].m_norm[j]].m_y;
-        d.nz = m_norm[m_face[i].m_norm[j]].m_z;
-        d.u = 0;
-        d.v = 0;
+        triOrder[t] = cacheOrder[overdrawOrder[t]];
       }
-      // here we've got tex but not norm least common
-      else if (m_norm.size() == 0 && m_uv.size() > 0)
+    }
+    // re-order the packed triangles and the indices to match
+    std::vector<VertData> packed(m_vertexData.begin() + begin, m_vertexData.begin() + begin + numTris * 3);
+    result.m_indices.resize(local.size());
+    for (size_t t = 0; t < numTris; ++t)
+    {
+      for (size_t c = 0; c < 3; ++c)
       {
-        d.nx = 0;
-        d.ny = 0;
-        d.nz = 0;
-        d.u = m_uv[m_face[i].m_uv[j]].m_x;
-        d.v = m_uv[m_face[i].m_uv[j]].m_y;
+        m_vertexData[begin + t * 3 + c] = packed[triOrder[t] * 3 + c];
+        result.m_indices[t * 3 + c] = local[triOrder[t] * 3 + c];
       }
-      vboMesh.push_back(d);
     }
+    auto remap = vertexcache::optimiseFetch(result.m_indices, numVerts);
+    std::vector<VertData> fetchOrder(remap.size());
+    for (size_t v = 0; v < remap.size(); ++v)
+    {
+      fetchOrder[v] = result.m_verts[remap[v]];
+    }
+    result.m_verts.swap(fetchOrder);
+    result.m_after = vertexcache::analyse(result.m_indices, numVerts);
+  }, m_threads, 1);
+
+  // join the groups into the vertex and index buffers, each index counting from the start of its segment
+  m_drawVertices.clear();
+  m_indices.assign(m_vertexData.size(), 0);
+  m_cacheBefore = vertexcache::CacheStats();
+  m_cacheAfter = vertexcache::CacheStats();
+  std::vector<VAO::Segment> weldRanges(ranges.size());
+  size_t numVertices = 0;
+  for (size_t r = 0; r < ranges.size(); ++r)
+  {
+    weldRanges[r] = {numVertices, results[r].m_verts.size(), ranges[r].first, ranges[r].second - ranges[r].first};
+    numVertices += results[r].m_verts.size();
+  }
+  m_drawVertices.reserve(numVertices);
+  auto bases = planSegments(weldRanges);
+  std::unordered_map<size_t, size_t> rangeOf;
+  for (size_t r = 0; r < ranges.size(); ++r)
+  {
+    Result &result = results[r];
+    m_drawVertices.insert(m_drawVertices.end(), result.m_verts.begin(), result.m_verts.end());
+    size_t offset = weldRanges[r].m_firstVertex - bases[r];
+    for (size_t i = 0; i < result.m_indices.size(); ++i)
+    {
+      m_indices[ranges[r].first + i] = static_cast<GLuint>(offset + result.m_indices[i]);
+    }
+    m_cacheBefore += result.m_before;
+    m_cacheAfter += result.m_after;
+    rangeOf[ranges[r].first] = r;
+  }
+  for (auto &m : m_meshes)
+  {
+    auto found = rangeOf.find(m.m_startIndex);
+    if (found != rangeOf.end() && m.m_numVerts != 0)
+    {
+      m.m_firstVertex = weldRanges[found->second].m_firstVertex;
+      m.m_numVertices = weldRanges[found->second].m_numVertices;
+      m.m_baseVertex = bases[found->second];
+    }
+  }
+
+  bool fromCache = cachedOrder.size() != 0;
+  if (!fromCache && cacheName.size() != 0)
+  {
+    std::error_code ec;
+    std::filesystem::create_directories(m_cacheDir, ec);
+    std::ofstream fileOut(cacheName, std::ios::out | std::ios::binary);
+    if (fileOut.is_open())
+    {
+      uint64_t count = numTriangles;
+      fileOut.write(c_orderHeader, c_orderHeaderSize);
+      fileOut.write(reinterpret_cast<const char *>(&count), sizeof(count));
+      fileOut.write(reinterpret_cast<const char *>(order.data()), static_cast<std::streamsize>(order.size() * sizeof(uint32_t)));
+    }
+    else
+    {
+      std::cerr << "could not write vertex cache order " << cacheName << '\n';
+    }
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  m_optimiseTime = std::chrono::duration<double, std::milli>(end - start).count();
+  if (trace::verbose())
+  {
+    std::ostringstream message;
+    message << "vertex cache " << (fromCache ? "order loaded" : "optimised") << " in " << m_optimiseTime << " ms, "
+            << m_vertexData.size() << " corners welded to " << m_drawVertices.size() << " vertices, ACMR "
+            << m_cacheBefore.acmr() << " -> " << m_cacheAfter.acmr() << " ATVR " << m_cacheBefore.atvr() << " -> "
+            << m_cacheAfter.atvr() << '\n';
+    trace::print(message.str());
+  }
+}
+
+void GroupedObj::packVertexData()
+{
+  // the faces are split into triangles as they are parsed
+  m_dataPackType = GL_TRIANGLES;
+
+  // now we are going to process and pack the mesh into an ngl::VertexArrayObject, every corner is written
+  // in place so the array is sized once rather than grown
+  auto start = std::chrono::high_resolution_clock::now();
+  m_vertexData.resize(m_faceVerts.size());
+  PackSource source{m_verts.data(), m_norm.data(), m_uv.data(), m_faceVerts.data(), m_faceNorms.data(), m_faceUVs.data()};
+  // the obj may have no normals or uvs (only verts like Zbrush models), pick the kernel once
+  void (*kernel)(const PackSource &, VertData *, size_t, size_t);
+  if (!m_norm.empty())
+  {
+    kernel = m_uv.empty() ? &packCorners<true, false> : &packCorners<true, true>;
+  }
+  else
+  {
+    kernel = m_uv.empty() ? &packCorners<false, false> : &packCorners<false, true>;
+  }
+  size_t numCorners = m_vertexData.size();
+  size_t numChunks = (numCorners + c_packChunk - 1) / c_packChunk;
+  VertData *out = m_vertexData.data();
+  parallel::forEach(0, numChunks,
+                    [&](size_t _chunk)
+                    {
+                      size_t begin = _chunk * c_packChunk;
+                      kernel(source, out, begin, std::min(numCorners, begin + c_packChunk));
+                    },
+                    m_threads, 1);
+  if (trace::verbose())
+  {
+    std::ostringstream message;
+    message << "packed " << numCorners << " corners in "
+            << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms\n";
+    trace::print(message.str());
+  }
+}
+
+void GroupedObj::createVAO(ResetVAO _reset) noexcept
+{
+  // pack the data if it hasn't already been done then allocate space and build our VAO
+  if (m_vertexData.size() == 0 || _reset == ResetVAO::True)
+  {
+    packVertexData();
+    computeHash();
+    optimiseVertexOrder();
+    computeHash();
+  }
+
+  buildVAO(true);
+}
+
+void GroupedObj::allocateVAO()
+{
+  if (!m_vao && !m_drawVertices.empty())
+  {
+    buildVAO(false);
   }
+}
 
+bool GroupedObj::uploadGroup(size_t _meshID) const
+{
+  const MeshData &mesh = m_meshes[_meshID];
+  auto vao = reinterpret_cast<const VAO *>(m_vaoMesh.get());
+  if (vao == nullptr || mesh.m_numVerts == 0)
+  {
+    return vao != nullptr;
+  }
+  // the VAO itself can't be bound in another context so go through the copy target with the buffer ids of
+  // the segment holding the group
+  size_t s = vao->findSegment(mesh.m_startIndex);
+  const VAO::Segment &segment = vao->segment(s);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, vao->getBufferID(static_cast<unsigned int>(s)));
+  glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>((mesh.m_firstVertex - segment.m_firstVertex) * sizeof(VertData)),
+                  static_cast<GLsizeiptr>(mesh.m_numVertices * sizeof(VertData)), &m_drawVertices[mesh.m_firstVertex]);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, vao->getIndexBufferID(s));
+  glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>((mesh.m_startIndex - segment.m_firstIndex) * sizeof(GLuint)),
+                  static_cast<GLsizeiptr>(mesh.m_numVerts * sizeof(GLuint)), &m_indices[mesh.m_startIndex]);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return true;
+}
+
+void GroupedObj::buildVAO(bool _fill)
+{
   // first we grab an instance of our VOA
   m_vaoMesh = ngl::VAOFactory::createVAO("sponzaVAO", m_dataPackType);
+  m_gpuEdited = false;
   // next we bind it so it's active for setting data
   m_vaoMesh->bind();
-  m_meshSize = vboMesh.size();
-
-  // now we have our data add it to the VAO, we need to tell the VAO the following
-  // how much (in bytes) data we are copying
-  // a pointer to the first element of data (in this case the address of the first element of the
-  // std::vector
-  m_vaoMesh->setData(VAO::VertexData(m_meshSize * sizeof(VertData), vboMesh[0].x));
-  // in this case we have packed our data in interleaved format as follows
-  // x,y,,z,nx,ny,nz,u,v
-  m_vaoMesh->setVertexAttributePointer(0, 3, GL_FLOAT, sizeof(VertData), 0);
-  // uv same as above but starts at 0 and is attrib 1 and only u,v so 2
-  m_vaoMesh->setVertexAttributePointer(1, 3, GL_FLOAT, sizeof(VertData), 3);
-  // normal same as vertex only starts at position 2 (u,v)-> nx
-  m_vaoMesh->setVertexAttributePointer(2, 2, GL_FLOAT, sizeof(VertData), 6);
+  m_meshSize = m_indices.size();
+  auto vao = reinterpret_cast<VAO *>(m_vaoMesh.get());
+  // now we have our data add it to the VAO, one vertex and index buffer per segment (normally just the one).
+  // The groups are drawn from the index buffer so the welded vertices go through the post transform cache
+  vao->allocateSegments(m_segments, sizeof(VertData), _fill ? m_drawVertices.data() : nullptr,
+                        _fill ? m_indices.data() : nullptr);
+  for (size_t s = 0; s < vao->numSegments(); ++s)
+  {
+    vao->bindSegment(s);
+    // in this case we have packed our data in interleaved format as follows
+    // x,y,,z,nx,ny,nz,u,v
+    m_vaoMesh->setVertexAttributePointer(0, 3, GL_FLOAT, sizeof(VertData), 0);
+    // uv same as above but starts at 0 and is attrib 1 and only u,v so 2
+    m_vaoMesh->setVertexAttributePointer(1, 3, GL_FLOAT, sizeof(VertData), 3);
+    // normal same as vertex only starts at position 2 (u,v)-> nx
+    m_vaoMesh->setVertexAttributePointer(2, 2, GL_FLOAT, sizeof(VertData), 6);
+  }
+  vao->bindSegment(0);
 
   // now we have set the vertex attributes we tell the VAO class how many indices to draw when
   // glDrawArrays is called, in this case we use buffSize (but if we wished less of the sphere to be drawn we could
@@ -300,78 +1221,65 @@ void GroupedObj::createVAO(ResetVAO _reset) noexcept
 
 bool GroupedObj::parseFace(std::vector<std::string> &_tokens) noexcept
 {
-  bool parsedOK = true;
-  // first let's find what sort of face we are dealing with
-  // I assume most likely case is all
-  if (_tokens.size() == 4)
+  // a corner is v, v/vt, v//vn or v/vt/vn
+  size_t numCorners = _tokens.size() - 1;
+  uint64_t corner[3][3];
+  auto parseCorner = [this](const std::string &_token, uint64_t o_index[3])
   {
-
-    if (ps::count(_tokens[1], "/") == 2 && ps::find(_tokens[1], "//") == -1)
-    {
-      parsedOK = parseFaceVertexNormalUV(_tokens);
-    }
-
-    else if (ps::find(_tokens[1], "/") == -1)
+    const char *p = _token.c_str();
+    size_t counts[3] = {m_verts.size(), m_uv.size(), m_norm.size()};
+    for (int i = 0; i < 3; ++i)
     {
-      parsedOK = parseFaceVertex(_tokens);
+      // a missing index is left as 0, it is only used if the file has that attribute
+      o_index[i] = 0;
+      if (*p != '/' && *p != '\0')
+      {
+        char *end;
+        // long is 32 bits on windows
+        long long index = std::strtoll(p, &end, 10);
+        if (end == p)
+        {
+          return false;
+        }
+        p = end;
+        // negative indices count back from the last one read
+        long long resolved = index < 0 ? static_cast<long long>(counts[i]) + index : index - 1;
+        // an index past what has been read (a truncated or malformed file) fails here rather than in the pack
+        if (resolved < 0 || static_cast<uint64_t>(resolved) >= counts[i])
+        {
+          return false;
+        }
+        o_index[i] = static_cast<uint64_t>(resolved);
+      }
+      if (*p != '/')
+      {
+        break;
+      }
+      ++p;
     }
-    // look for VertNormal
-    else if (ps::find(_tokens[1], "//") != -1)
+    return true;
+  };
+  if (numCorners < 3 || !parseCorner(_tokens[1], corner[0]) || !parseCorner(_tokens[2], corner[1]))
+  {
+    ngl::NGLMessage::addError("badly formed face in obj file");
+    return false;
+  }
+  // fan the polygon into triangles, quads become 1 2 3 and 1 3 4
+  for (size_t i = 3; i <= numCorners; ++i)
+  {
+    if (!parseCorner(_tokens[i], corner[2]))
     {
-      parsedOK = parseFaceVertexNormal(_tokens);
+      ngl::NGLMessage::addError("badly formed face in obj file");
+      return false;
     }
-    // if we have 1 / it is a VertUV format
-    else if (ps::count(_tokens[1], "/") == 1)
+    for (int c = 0; c < 3; ++c)
     {
-      parsedOK = parseFaceVertexUV(_tokens);
+      m_faceVerts.push_back(corner[c][0]);
+      m_faceUVs.push_back(corner[c][1]);
+      m_faceNorms.push_back(corner[c][2]);
     }
+    std::copy_n(corner[2], 3, corner[1]);
     m_faceCount += 3;
   }
-  // we have a quad!
-  // ngl::Face f1; // index 1 2 3
-  // ngl::Face f2; // index 1 3 4
-  if (_tokens.size() == 5)
-  {
-    // std::cout << "found quad\n";
-    // for (auto t : _tokens)
-    //   std::cout << t << ' ';
-    // std::cout << '\n';
-    std::vector<std::string> tokens[2];
-
-    tokens[0].push_back(_tokens[0]);
-    tokens[0].push_back(_tokens[1]);
-    tokens[0].push_back(_tokens[2]);
-    tokens[0].push_back(_tokens[3]);
-    tokens[1].push_back(_tokens[0]);
-    tokens[1].push_back(_tokens[1]);
-    tokens[1].push_back(_tokens[3]);
-    tokens[1].push_back(_tokens[4]);
-    // int i = 1;
-    for (int i = 0; i < 2; ++i)
-    {
-      if (ps::count(tokens[i][1], "/") == 2 && ps::find(tokens[i][1], "//") == -1)
-      {
-        // /std::cout << tokens[i][0] << " " << tokens[i][1] << " " << tokens[i][2] << '\n';
-        parsedOK = parseFaceVertexNormalUV(tokens[i]);
-      }
-
-      else if (ps::find(tokens[i][1], "/") == -1)
-      {
-        parsedOK = parseFaceVertex(tokens[i]);
-      }
-      // look for VertNormal
-      else if (ps::find(tokens[i][1], "//") != -1)
-      {
-        parsedOK = parseFaceVertexNormal(tokens[i]);
-      }
-      // if we have 1 / it is a VertUV format
-      else if (ps::count(tokens[i][1], "/") == 1)
-      {
-        parsedOK = parseFaceVertexUV(tokens[i]);
-      }
-    }
-    m_faceCount += 6;
-  }
-
-  return parsedOK;
+  return true;
 }
@@ -0,0 +1,324 @@
+#include "LineReader.h"
+#include "Trace.h"
+#include <chrono>
+#include <iostream>
+#include <vector>
+#ifdef SPONZA_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SPONZA_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+bool endsWith(std::string_view _s, std::string_view _end)
+{
+  return _s.size() >= _end.size() && _s.compare(_s.size() - _end.size(), _end.size(), _end) == 0;
+}
+} // end anon namespace
+
+LineReader::Codec LineReader::codecOf(std::string_view _path)
+{
+  if (endsWith(_path, ".gz"))
+  {
+    return Codec::Gzip;
+  }
+  if (endsWith(_path, ".zst"))
+  {
+    return Codec::Zstd;
+  }
+  return Codec::None;
+}
+
+LineReader::LineReader(const std::string &_path, const LineReaderSettings &_settings)
+    : m_settings(_settings), m_path(_path), m_codec(codecOf(_path))
+{
+  // with no thread getline sees the end straight away
+  m_done = true;
+#ifndef SPONZA_HAVE_ZLIB
+  if (m_codec == Codec::Gzip)
+  {
+    std::cerr << _path << " is gzip compressed but this build has no zlib\n";
+    return;
+  }
+#endif
+#ifndef SPONZA_HAVE_ZSTD
+  if (m_codec == Codec::Zstd)
+  {
+    std::cerr << _path << " is zstd compressed but this build has no zstd\n";
+    return;
+  }
+#endif
+  m_file = std::fopen(_path.c_str(), "rb");
+  if (m_file == nullptr)
+  {
+    return;
+  }
+  m_done = false;
+  m_thread = std::thread(&LineReader::readLoop, this);
+}
+
+LineReader::~LineReader()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_quit = true;
+  }
+  m_space.notify_all();
+  if (m_thread.joinable())
+  {
+    m_thread.join();
+  }
+  if (m_file != nullptr)
+  {
+    std::fclose(m_file);
+  }
+}
+
+bool LineReader::getline(std::string &o_line)
+{
+  while (m_pos >= m_block.size())
+  {
+    std::unique_lock<std::mutex> lock(m_lock);
+    auto start = std::chrono::high_resolution_clock::now();
+    m_ready.wait(lock, [this]() { return !m_blocks.empty() || m_done; });
+    m_stats.m_waitSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    if (m_blocks.empty())
+    {
+      return false;
+    }
+    m_block = std::move(m_blocks.front());
+    m_blocks.pop_front();
+    m_pos = 0;
+    m_space.notify_one();
+  }
+  // the last line of the file may have no line end
+  size_t end = m_block.find_first_of("\r\n", m_pos);
+  if (end == std::string::npos)
+  {
+    end = m_block.size();
+  }
+  o_line.assign(m_block, m_pos, end - m_pos);
+  m_pos = end;
+  if (m_pos < m_block.size())
+  {
+    // \r\n is one line end, emit never splits the pair between blocks
+    if (m_block[m_pos] == '\r' && m_pos + 1 < m_block.size() && m_block[m_pos + 1] == '\n')
+    {
+      ++m_pos;
+    }
+    ++m_pos;
+  }
+  return true;
+}
+
+bool LineReader::failed() const
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_failed;
+}
+
+LineReader::Stats LineReader::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  return m_stats;
+}
+
+void LineReader::printStats(std::ostream &_out, double _seconds) const
+{
+  auto s = stats();
+  constexpr double mb = 1024.0 * 1024.0;
+  _out << m_path << " read " << s.m_fileBytes / mb << " MB";
+  if (m_codec != Codec::None)
+  {
+    double saved = s.m_textBytes != 0 ? 100.0 * (1.0 - static_cast<double>(s.m_fileBytes) / s.m_textBytes) : 0.0;
+    _out << " for " << s.m_textBytes / mb << " MB of text (" << saved << "% less I/O), decompressed";
+  }
+  else
+  {
+    _out << ", read";
+  }
+  _out << " in " << s.m_readSeconds * 1000.0 << " ms on its own thread, the parser waited " << s.m_waitSeconds * 1000.0
+       << " ms for it, loaded in " << _seconds * 1000.0 << " ms\n";
+}
+
+void LineReader::readLoop()
+{
+  trace::setThreadName("line reader");
+  TRACE_SCOPE("LineReader::read", "io");
+  auto start = std::chrono::high_resolution_clock::now();
+  bool ok = decompress();
+  ok = emit(nullptr, 0, true) && ok;
+  std::lock_guard<std::mutex> lock(m_lock);
+  // the time blocked on a full queue is the parser's, not ours
+  m_stats.m_readSeconds =
+      std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() - m_blockedSeconds;
+  m_failed = !ok && !m_quit;
+  m_done = true;
+  m_ready.notify_all();
+}
+
+bool LineReader::decompress()
+{
+  std::vector<char> in(m_settings.readBytes);
+  size_t read = 0;
+  auto next = [&]()
+  {
+    read = std::fread(in.data(), 1, in.size(), m_file);
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stats.m_fileBytes += read;
+    return read != 0;
+  };
+  bool ok = true;
+  if (m_codec == Codec::None)
+  {
+    while (ok && next())
+    {
+      ok = emit(in.data(), read, false);
+    }
+  }
+#ifdef SPONZA_HAVE_ZLIB
+  else if (m_codec == Codec::Gzip)
+  {
+    z_stream z = {};
+    // 15 + 32 takes a gzip or zlib header
+    if (inflateInit2(&z, 15 + 32) != Z_OK)
+    {
+      return false;
+    }
+    std::vector<char> out(m_settings.readBytes * 4);
+    bool ended = false;
+    while (ok && next())
+    {
+      z.next_in = reinterpret_cast<Bytef *>(in.data());
+      z.avail_in = static_cast<uInt>(read);
+      do
+      {
+        z.next_out = reinterpret_cast<Bytef *>(out.data());
+        z.avail_out = static_cast<uInt>(out.size());
+        int status = inflate(&z, Z_NO_FLUSH);
+        if (status == Z_STREAM_END)
+        {
+          // a .gz can be several members one after the other (pigz, or files joined with cat)
+          ended = true;
+          inflateReset(&z);
+        }
+        else if (status == Z_OK)
+        {
+          ended = false;
+        }
+        else if (status != Z_BUF_ERROR)
+        {
+          std::cerr << m_path << " is corrupt, " << (z.msg != nullptr ? z.msg : "inflate failed") << '\n';
+          ok = false;
+          break;
+        }
+        ok = emit(out.data(), out.size() - z.avail_out, false);
+        if (status == Z_BUF_ERROR)
+        {
+          break;
+        }
+      } while (ok && (z.avail_in != 0 || z.avail_out == 0));
+    }
+    inflateEnd(&z);
+    if (ok && !ended)
+    {
+      std::cerr << m_path << " is truncated\n";
+      ok = false;
+    }
+  }
+#endif
+#ifdef SPONZA_HAVE_ZSTD
+  else if (m_codec == Codec::Zstd)
+  {
+    ZSTD_DCtx *context = ZSTD_createDCtx();
+    std::vector<char> out(ZSTD_DStreamOutSize());
+    // 0 once a frame is complete
+    size_t hint = 0;
+    while (ok && next())
+    {
+      ZSTD_inBuffer input = {in.data(), read, 0};
+      bool full = false;
+      while (ok && (input.pos < input.size || full))
+      {
+        ZSTD_outBuffer output = {out.data(), out.size(), 0};
+        hint = ZSTD_decompressStream(context, &output, &input);
+        if (ZSTD_isError(hint))
+        {
+          std::cerr << m_path << " is corrupt, " << ZSTD_getErrorName(hint) << '\n';
+          ok = false;
+          break;
+        }
+        // a full buffer may have more to flush
+        full = output.pos == output.size;
+        ok = emit(out.data(), output.pos, false);
+      }
+    }
+    ZSTD_freeDCtx(context);
+    if (ok && hint != 0)
+    {
+      std::cerr << m_path << " is truncated\n";
+      ok = false;
+    }
+  }
+#endif
+  if (std::ferror(m_file))
+  {
+    std::cerr << "error reading " << m_path << '\n';
+    ok = false;
+  }
+  return ok;
+}
+
+bool LineReader::emit(const char *_data, size_t _size, bool _last)
+{
+  if (_size != 0)
+  {
+    m_pending.append(_data, _size);
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stats.m_textBytes += _size;
+  }
+  if (_last)
+  {
+    return m_pending.empty() || push(std::move(m_pending));
+  }
+  if (m_pending.size() < m_settings.blockBytes)
+  {
+    return true;
+  }
+  size_t cut = m_pending.find_last_of("\r\n");
+  if (cut != std::string::npos && cut + 1 == m_pending.size() && m_pending[cut] == '\r')
+  {
+    // the \n of a \r\n may be in the next read, so cut at the line end before it
+    cut = cut == 0 ? std::string::npos : m_pending.find_last_of("\r\n", cut - 1);
+  }
+  if (cut == std::string::npos)
+  {
+    // one very long line, keep going until it ends
+    return true;
+  }
+  // the whole lines go to the parser and the start of the next line stays
+  std::string rest(m_pending, cut + 1);
+  m_pending.resize(cut + 1);
+  std::string block;
+  block.swap(m_pending);
+  m_pending = std::move(rest);
+  m_pending.reserve(m_settings.blockBytes + m_settings.readBytes);
+  return push(std::move(block));
+}
+
+bool LineReader::push(std::string &&_block)
+{
+  std::unique_lock<std::mutex> lock(m_lock);
+  auto start = std::chrono::high_resolution_clock::now();
+  m_space.wait(lock, [this]() { return m_quit || m_blocks.size() < m_settings.maxBlocks; });
+  m_blockedSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  if (m_quit)
+  {
+    return false;
+  }
+  m_blocks.push_back(std::move(_block));
+  m_ready.notify_one();
+  return true;
+}
@@ -0,0 +1,70 @@
+#include "MemoryReport.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+void MemoryReport::add(const std::string &_subsystem, const std::string &_name, size_t _cpuBytes, size_t _gpuBytes)
+{
+  m_entries.push_back({_subsystem, _name, _cpuBytes, _gpuBytes});
+}
+
+size_t MemoryReport::cpuBytes(const std::string &_subsystem) const
+{
+  size_t bytes = 0;
+  for (auto &entry : m_entries)
+  {
+    if (_subsystem.empty() || entry.m_subsystem == _subsystem)
+    {
+      bytes += entry.m_cpuBytes;
+    }
+  }
+  return bytes;
+}
+
+size_t MemoryReport::gpuBytes(const std::string &_subsystem) const
+{
+  size_t bytes = 0;
+  for (auto &entry : m_entries)
+  {
+    if (_subsystem.empty() || entry.m_subsystem == _subsystem)
+    {
+      bytes += entry.m_gpuBytes;
+    }
+  }
+  return bytes;
+}
+
+void MemoryReport::print(std::ostream &_out, bool _detail) const
+{
+  constexpr double mb = 1024.0 * 1024.0;
+  // subsystems in the order they were first added
+  std::vector<std::string> subsystems;
+  for (auto &entry : m_entries)
+  {
+    if (std::find(subsystems.begin(), subsystems.end(), entry.m_subsystem) == subsystems.end())
+    {
+      subsystems.push_back(entry.m_subsystem);
+    }
+  }
+  // formatted on its own stream so the caller's precision and flags are left alone
+  std::ostringstream text;
+  text << std::fixed << std::setprecision(2) << "memory : CPU " << cpuBytes() / mb << " MB GPU " << gpuBytes() / mb << " MB\n";
+  for (auto &subsystem : subsystems)
+  {
+    text << "  " << subsystem << " CPU " << cpuBytes(subsystem) / mb << " MB GPU " << gpuBytes(subsystem) / mb << " MB\n";
+    if (!_detail)
+    {
+      continue;
+    }
+    for (auto &entry : m_entries)
+    {
+      if (entry.m_subsystem == subsystem)
+      {
+        text << "    " << entry.m_name << " CPU " << entry.m_cpuBytes / 1024.0 << " KB GPU " << entry.m_gpuBytes / 1024.0
+             << " KB\n";
+      }
+    }
+  }
+  _out << text.str();
+}
@@ -0,0 +1,103 @@
+#include "MeshFile.h"
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+constexpr char c_binHeader[] = "ngl::meshbin";
+constexpr size_t c_binHeaderSize = sizeof(c_binHeader) - 1;
+constexpr uint32_t c_version = 1;
+
+void writeString(std::ostream &_out, const std::string &_s)
+{
+  uint32_t size = static_cast<uint32_t>(_s.size());
+  _out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+  _out.write(_s.data(), size);
+}
+
+bool readString(std::istream &_in, std::string &o_s)
+{
+  uint32_t size = 0;
+  _in.read(reinterpret_cast<char *>(&size), sizeof(size));
+  // group and material names are short, anything bigger is a corrupt file
+  if (!_in || size > 4096)
+  {
+    return false;
+  }
+  o_s.resize(size);
+  _in.read(&o_s[0], size);
+  return static_cast<bool>(_in);
+}
+} // end anon namespace
+
+namespace meshfile
+{
+bool writeHeader(std::ostream &_out, const Header &_header)
+{
+  _out.write(c_binHeader, c_binHeaderSize);
+  _out.write(reinterpret_cast<const char *>(&c_version), sizeof(c_version));
+  uint32_t numGroups = static_cast<uint32_t>(_header.m_groups.size());
+  _out.write(reinterpret_cast<const char *>(&numGroups), sizeof(numGroups));
+  for (auto &group : _header.m_groups)
+  {
+    writeString(_out, group.m_name);
+    writeString(_out, group.m_material);
+    _out.write(reinterpret_cast<const char *>(&group.m_startIndex), sizeof(group.m_startIndex));
+    _out.write(reinterpret_cast<const char *>(&group.m_numVerts), sizeof(group.m_numVerts));
+  }
+  _out.write(reinterpret_cast<const char *>(_header.m_min), sizeof(_header.m_min));
+  _out.write(reinterpret_cast<const char *>(_header.m_max), sizeof(_header.m_max));
+  _out.write(reinterpret_cast<const char *>(&_header.m_numCorners), sizeof(_header.m_numCorners));
+  return static_cast<bool>(_out);
+}
+
+bool readHeader(std::istream &_in, Header &o_header)
+{
+  char header[c_binHeaderSize + 1];
+  _in.read(header, c_binHeaderSize);
+  header[c_binHeaderSize] = 0;
+  uint32_t version = 0;
+  _in.read(reinterpret_cast<char *>(&version), sizeof(version));
+  if (!_in || strcmp(header, c_binHeader) || version != c_version)
+  {
+    std::cerr << "this is not an " << c_binHeader << " version " << c_version << " file\n";
+    return false;
+  }
+  uint32_t numGroups = 0;
+  _in.read(reinterpret_cast<char *>(&numGroups), sizeof(numGroups));
+  o_header.m_groups.clear();
+  for (uint32_t i = 0; i < numGroups && _in; ++i)
+  {
+    Group group;
+    if (!readString(_in, group.m_name) || !readString(_in, group.m_material))
+    {
+      return false;
+    }
+    _in.read(reinterpret_cast<char *>(&group.m_startIndex), sizeof(group.m_startIndex));
+    _in.read(reinterpret_cast<char *>(&group.m_numVerts), sizeof(group.m_numVerts));
+    o_header.m_groups.push_back(group);
+  }
+  _in.read(reinterpret_cast<char *>(o_header.m_min), sizeof(o_header.m_min));
+  _in.read(reinterpret_cast<char *>(o_header.m_max), sizeof(o_header.m_max));
+  _in.read(reinterpret_cast<char *>(&o_header.m_numCorners), sizeof(o_header.m_numCorners));
+  if (!_in)
+  {
+    return false;
+  }
+  for (auto &group : o_header.m_groups)
+  {
+    if (group.m_startIndex + group.m_numVerts > o_header.m_numCorners)
+    {
+      std::cerr << "mesh group " << group.m_name << " is outside the data\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool isMeshFile(std::string_view _path)
+{
+  constexpr size_t size = sizeof(c_extension) - 1;
+  return _path.size() >= size && _path.substr(_path.size() - size) == c_extension;
+}
+} // end namespace meshfile
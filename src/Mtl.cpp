@@ -1,18 +1,27 @@
 #include "Mtl.h"
+#include "LineReader.h"
+#include "MemoryReport.h"
+#include "ResourceManager.h"
+#include "TextureStreamer.h"
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <sstream>
 #include <ngl/NGLStream.h>
 #include <ngl/Texture.h>
 #include <ngl/ShaderLib.h>
-#include <list>
 #include <ngl/pystring.h>
+#include "Trace.h"
 
 namespace ps = pystring;
 
 bool Mtl::load(const std::string &_fname)
 {
-  std::fstream fileIn;
-  fileIn.open(_fname.c_str(), std::ios::in);
-  if (!fileIn.is_open())
+  TRACE_SCOPE("Mtl::load");
+  auto start = std::chrono::high_resolution_clock::now();
+  // a .mtl.gz / .mtl.zst is decompressed on another thread as it is parsed
+  LineReader fileIn(_fname);
+  if (!fileIn.isOpen())
   {
     std::cout << "File : " << _fname << " Not found Exiting " << std::endl;
     return false;
@@ -25,10 +34,8 @@ bool Mtl::load(const std::string &_fname)
   std::vector<std::string> tokens;
 
   // loop through the file
-  while (!fileIn.eof())
+  while (fileIn.getline(lineBuffer))
   {
-    // grab a line from the input
-    getline(fileIn, lineBuffer, '\n');
     // make sure it's not an empty line
     if (lineBuffer.size() > 1)
     {
@@ -44,7 +51,8 @@ bool Mtl::load(const std::string &_fname)
         // If it does crash it could be due to this code.
         // std::cout<<"found "<<m_currentName<<"\n";
         m_currentName = tokens[1];
-        m_current = new mtlItem;
+        // value initialised so values missing from the file compare equal on reload
+        m_current = new mtlItem();
         // These are the OpenGL texture ID's so set to zero first (for no texture)
         m_current->map_KaId = 0;
         m_current->map_KdId = 0;
@@ -131,11 +139,25 @@ bool Mtl::load(const std::string &_fname)
       }
     } // end zero line
   }   // end while
+  if (fileIn.failed())
+  {
+    std::cerr << "error reading " << _fname << '\n';
+    return false;
+  }
+  if (fileIn.codec() != LineReader::Codec::None && trace::verbose())
+  {
+    std::ostringstream message;
+    fileIn.printStats(message, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+    trace::print(message.str());
+  }
 
   // as the trigger for putting the meshes back is the newmtl we will always have a hanging one
   // this adds it to the list
   m_materials[m_currentName] = m_current;
-  loadTextures();
+  if (m_loadTextures == true)
+  {
+    loadTextures();
+  }
   return true;
 }
 
@@ -143,10 +165,6 @@ Mtl::Mtl(const std::string &_fname, bool _loadTextures)
 {
   m_loadTextures = _loadTextures;
   load(_fname);
-  if (m_loadTextures == true)
-  {
-    loadTextures();
-  }
 }
 
 Mtl::~Mtl()
@@ -156,58 +174,292 @@ Mtl::~Mtl()
 
 void Mtl::loadTextures()
 {
+  TRACE_SCOPE("Mtl::loadTextures");
   m_textureID.clear();
   std::cout << "loading textures this may take some time\n";
-  // first loop and store all the texture names in the container
-  std::list<std::string> names;
-  auto end = m_materials.end();
-  auto i = m_materials.begin();
-  for (; i != end; ++i)
-  {
-    if (i->second->map_Ka.size() != 0)
-      names.push_back(i->second->map_Ka);
-    if (i->second->map_Kd.size() != 0)
-      names.push_back(i->second->map_Kd);
-    if (i->second->map_d.size() != 0)
-      names.push_back(i->second->map_d);
-    if (i->second->map_bump.size() != 0)
-      names.push_back(i->second->map_bump);
-    if (i->second->map_bump.size() != 0)
-      names.push_back(i->second->bump);
-  }
-
-  std::cout << "we have this many textures " << names.size() << "\n";
-  // now remove duplicates
-  names.unique();
+  auto names = texturesToLoad();
   std::cout << "we have " << names.size() << " unique textures to load\n";
   // now we load the textures and get the GL id
   // now we associate the ID with the mtlItem
+  for (auto &name : names)
+  {
+    GLuint textureID = loadTexture(name);
+    m_textureNames[name] = textureID;
+    assignTexture(name, textureID);
+  }
+
+  std::cout << "done \n";
+}
+
+std::vector<std::string> Mtl::texturesToLoad() const
+{
+  std::vector<std::string> names;
+  for (auto &material : m_materials)
+  {
+    if (material.second == nullptr)
+    {
+      continue;
+    }
+    for (auto *name : {&material.second->map_Ka, &material.second->map_Kd, &material.second->map_d,
+                       &material.second->map_bump, &material.second->bump})
+    {
+      if (!name->empty() && m_textureNames.count(*name) == 0)
+      {
+        names.push_back(*name);
+      }
+    }
+  }
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+  return names;
+}
 
-  for (auto name : names)
+void Mtl::addTexture(const std::string &_name, const ngl::Texture &_image)
+{
+  GLuint textureID = 0;
+  if (m_streamer != nullptr)
+  {
+    textureID = loadTexture(_name);
+  }
+  else if (m_resources != nullptr)
+  {
+    addTexture(_name, m_resources->texture(_name, &_image));
+    return;
+  }
+  else
   {
-    std::cout << "loading texture " << name << "\n";
-    ngl::Texture t(name);
-    std::cout << t.getWidth() << " x " << t.getHeight() << '\n';
-    GLuint textureID = t.setTextureGL();
+    TRACE_SCOPE("upload ", _name, "texture");
+    textureID = _image.setTextureGL();
     m_textureID.push_back(textureID);
-    std::cout << "processing " << name << " ID" << textureID << "\n";
-    i = m_materials.begin();
-    for (; i != end; ++i)
+  }
+  m_textureNames[_name] = textureID;
+  assignTexture(_name, textureID);
+}
+
+void Mtl::addTexture(const std::string &_name, std::shared_ptr<TextureResource> _texture)
+{
+  GLuint textureID = _texture ? _texture->m_id : 0;
+  m_textureHandles.push_back(std::move(_texture));
+  m_textureNames[_name] = textureID;
+  assignTexture(_name, textureID);
+}
+
+GLuint Mtl::loadTexture(const std::string &_name)
+{
+  std::cout << "loading texture " << _name << "\n";
+  if (m_streamer != nullptr)
+  {
+    // only the tail of the mip chain is loaded now, in the background
+    return m_streamer->add(_name);
+  }
+  if (m_resources != nullptr)
+  {
+    // shared with any other material set using the same file, the manager owns the GL texture
+    auto texture = m_resources->texture(_name);
+    m_textureHandles.push_back(texture);
+    return texture ? texture->m_id : 0;
+  }
+  int64_t decodeStart = trace::now();
+  ngl::Texture t(_name);
+  if (trace::enabled())
+  {
+    trace::record("decode " + _name, "texture", decodeStart, trace::now() - decodeStart);
+  }
+  std::cout << t.getWidth() << " x " << t.getHeight() << '\n';
+  GLuint textureID;
+  {
+    TRACE_SCOPE("upload ", _name, "texture");
+    textureID = t.setTextureGL();
+  }
+  m_textureID.push_back(textureID);
+  std::cout << "processing " << _name << " ID" << textureID << "\n";
+  return textureID;
+}
+
+bool Mtl::reload(const std::string &_fname, std::vector<std::string> &o_changed)
+{
+  TRACE_SCOPE("Mtl::reload");
+  Mtl fresh(_fname, false);
+  if (fresh.m_materials.empty())
+  {
+    return false;
+  }
+  auto sameVec = [](const ngl::Vec3 &_a, const ngl::Vec3 &_b)
+  { return _a.m_x == _b.m_x && _a.m_y == _b.m_y && _a.m_z == _b.m_z; };
+  auto same = [&sameVec](const mtlItem &_a, const mtlItem &_b)
+  {
+    return _a.Ns == _b.Ns && _a.Ni == _b.Ni && _a.d == _b.d && _a.Tr == _b.Tr && _a.illum == _b.illum &&
+           sameVec(_a.Tf, _b.Tf) && sameVec(_a.Ka, _b.Ka) && sameVec(_a.Kd, _b.Kd) && sameVec(_a.Ks, _b.Ks) &&
+           sameVec(_a.Ke, _b.Ke) && _a.map_Ka == _b.map_Ka && _a.map_Kd == _b.map_Kd && _a.map_d == _b.map_d &&
+           _a.map_bump == _b.map_bump && _a.bump == _b.bump && _a.map_Ks == _b.map_Ks;
+  };
+  auto textureFor = [this](const std::string &_name) -> GLuint
+  {
+    if (_name.empty())
+    {
+      return 0;
+    }
+    auto found = m_textureNames.find(_name);
+    if (found != m_textureNames.end())
+    {
+      return found->second;
+    }
+    // a map new to this edit is loaded here even if the first load handed the textures in from outside
+    GLuint id = loadTexture(_name);
+    m_textureNames[_name] = id;
+    return id;
+  };
+  for (auto &material : fresh.m_materials)
+  {
+    // the parser always adds the last material so an empty file leaves a null one
+    if (material.second == nullptr)
+    {
+      continue;
+    }
+    auto found = m_materials.find(material.first);
+    if (found != m_materials.end() && same(*found->second, *material.second))
     {
-      if (i->second->map_Ka == name)
-        i->second->map_KaId = textureID;
-      if (i->second->map_Kd == name)
-        i->second->map_KdId = textureID;
-      if (i->second->map_d == name)
-        i->second->map_dId = textureID;
-      if (i->second->map_bump == name)
-        i->second->map_bumpId = textureID;
-      if (i->second->bump == name)
-        i->second->bumpId = textureID;
+      continue;
     }
+    mtlItem *item = found != m_materials.end() ? found->second : new mtlItem();
+    // the pointer stays the same so anything holding the material sees the new values
+    *item = *material.second;
+    item->map_KaId = textureFor(item->map_Ka);
+    item->map_KdId = textureFor(item->map_Kd);
+    item->map_dId = textureFor(item->map_d);
+    item->map_bumpId = textureFor(item->map_bump);
+    item->bumpId = textureFor(item->bump);
+    m_materials[material.first] = item;
+    o_changed.push_back(material.first);
   }
+  return true;
+}
 
-  std::cout << "done \n";
+bool Mtl::reloadTexture(const std::string &_name)
+{
+  TRACE_SCOPE("Mtl::reloadTexture");
+  auto found = m_textureNames.find(_name);
+  if (found == m_textureNames.end())
+  {
+    return false;
+  }
+  if (m_streamer != nullptr)
+  {
+    std::cerr << "can't reload streamed texture " << _name << '\n';
+    return false;
+  }
+  GLuint oldID = found->second;
+  if (m_resources != nullptr)
+  {
+    // the manager sees the file is newer and loads it again, our old handle is dropped so it can go
+    auto handle = std::find_if(m_textureHandles.begin(), m_textureHandles.end(),
+                               [oldID](const std::shared_ptr<TextureResource> &_t) { return _t && _t->m_id == oldID; });
+    if (handle != m_textureHandles.end())
+    {
+      m_textureHandles.erase(handle);
+    }
+  }
+  else
+  {
+    glDeleteTextures(1, &oldID);
+    m_textureID.erase(std::remove(m_textureID.begin(), m_textureID.end(), oldID), m_textureID.end());
+  }
+  GLuint textureID = loadTexture(_name);
+  found->second = textureID;
+  assignTexture(_name, textureID);
+  return textureID != 0;
+}
+
+std::vector<std::string> Mtl::textureNames() const
+{
+  std::vector<std::string> names;
+  names.reserve(m_textureNames.size());
+  for (auto &texture : m_textureNames)
+  {
+    names.push_back(texture.first);
+  }
+  return names;
+}
+
+void Mtl::memoryUsage(MemoryReport &io_report) const
+{
+  size_t materialBytes = 0;
+  std::vector<std::string> names;
+  for (auto &material : m_materials)
+  {
+    names.push_back(material.first);
+    materialBytes += material.first.capacity() + sizeof(mtlItem);
+    if (material.second != nullptr)
+    {
+      const mtlItem &m = *material.second;
+      materialBytes += m.map_Ka.capacity() + m.map_Kd.capacity() + m.map_d.capacity() + m.map_bump.capacity() +
+                       m.bump.capacity() + m.map_Ks.capacity();
+    }
+  }
+  for (auto &texture : m_textureNames)
+  {
+    materialBytes += texture.first.capacity() + sizeof(GLuint);
+  }
+  io_report.add("materials", "mtl data", materialBytes, 0);
+
+  // sum the levels that are actually allocated, drivers store RGB8 as 4 bytes a texel so count 4 for all
+  auto textureBytes = [](GLuint _id)
+  {
+    size_t bytes = 0;
+    glBindTexture(GL_TEXTURE_2D, _id);
+    for (GLint level = 0; level < 16; ++level)
+    {
+      GLint width = 0;
+      GLint height = 0;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+      bytes += static_cast<size_t>(width) * static_cast<size_t>(height) * 4;
+    }
+    return bytes;
+  };
+  std::sort(names.begin(), names.end());
+  std::vector<GLuint> counted;
+  for (auto &name : names)
+  {
+    const mtlItem *material = m_materials.at(name);
+    if (material == nullptr)
+    {
+      continue;
+    }
+    size_t bytes = 0;
+    for (GLuint id : {material->map_KaId, material->map_KdId, material->map_dId, material->map_bumpId, material->bumpId})
+    {
+      if (id != 0 && std::find(counted.begin(), counted.end(), id) == counted.end())
+      {
+        counted.push_back(id);
+        bytes += textureBytes(id);
+      }
+    }
+    if (bytes != 0)
+    {
+      io_report.add("textures", name, 0, bytes);
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Mtl::assignTexture(const std::string &_name, GLuint _id)
+{
+  for (auto &material : m_materials)
+  {
+    if (material.second == nullptr)
+      continue;
+    if (material.second->map_Ka == _name)
+      material.second->map_KaId = _id;
+    if (material.second->map_Kd == _name)
+      material.second->map_KdId = _id;
+    if (material.second->map_d == _name)
+      material.second->map_dId = _id;
+    if (material.second->map_bump == _name)
+      material.second->map_bumpId = _id;
+    if (material.second->bump == _name)
+      material.second->bumpId = _id;
+  }
 }
 
 void Mtl::clear()
@@ -218,11 +470,16 @@ void Mtl::clear()
   {
     delete i->second;
   }
-  if (m_loadTextures == true)
+  // textures reach m_textureID from reload and addTexture as well as load, so they are ours whatever
+  // m_loadTextures says
+  if (!m_textureID.empty())
   {
-    for (auto i : m_textureID)
-      glDeleteTextures(1, &i);
+    glDeleteTextures(static_cast<GLsizei>(m_textureID.size()), m_textureID.data());
   }
+  m_textureID.clear();
+  // the manager decides when shared textures go
+  m_textureHandles.clear();
+  m_textureNames.clear();
 }
 
 std::string Mtl::convertToPath(std::string _p) const
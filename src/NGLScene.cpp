@@ -7,7 +7,15 @@
 #include <ngl/VAOPrimitives.h>
 #include <ngl/ShaderLib.h>
 #include <ngl/VAOFactory.h>
+#include <ngl/Texture.h>
 #include "VAO.h"
+#include "TaskGraph.h"
+#include "UploadThread.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 
 NGLScene::NGLScene()
 {
@@ -19,6 +27,26 @@ NGLScene::NGLScene()
 
 NGLScene::~NGLScene()
 {
+  // the loader may still be handing work to the upload thread
+  if (m_loader.joinable())
+  {
+    m_loader.join();
+  }
+  m_uploader.reset();
+  makeCurrent();
+  m_aoBaker.reset();
+  m_collision.reset();
+  m_culler.reset();
+  m_pager.reset();
+  m_streamer.reset();
+  // drop our handles then free everything the manager still caches while there is a context to free it in,
+  // the manager itself is only destroyed at static exit
+  m_mtl.reset();
+  m_model.reset();
+  m_variants.reset();
+  m_textureShader.reset();
+  ResourceManager::instance().purge();
+  doneCurrent();
   std::cout << "Shutting down NGL, removing VAO's and Shaders\n";
 }
 
@@ -31,6 +59,8 @@ void NGLScene::resizeGL(int _w, int _h)
 
 void NGLScene::initializeGL()
 {
+  int64_t traceStart = trace::now();
+  m_loadStart = std::chrono::steady_clock::now();
   // we must call this first before any other GL commands to load and link the
   // gl commands from the lib, if this is not done program will crash
   ngl::NGLInit::initialize();
@@ -51,44 +81,347 @@ void NGLScene::initializeGL()
   // set the shape using FOV 45 Aspect Ratio based on Width and Height
   // The final two are near and far clipping planes of 0.5 and 10
   m_project = ngl::perspective(50, 1024.0f / 720.0f, 0.01, 200.0);
-  // load a frag and vert shaders
-
-  ngl::ShaderLib::createShaderProgram("TextureShader");
+  // SPONZA_MODEL can name a packed mesh written by SponzaConvert for models too big to parse here
+  if (const char *model = std::getenv("SPONZA_MODEL"))
+  {
+    m_modelPath = model;
+  }
+  // SPONZA_MTL names the materials to go with it, either can be a .gz or .zst compressed file
+  if (const char *mtl = std::getenv("SPONZA_MTL"))
+  {
+    m_mtlPath = mtl;
+  }
+  // SPONZA_RELEASE_CPU frees the CPU copy of the geometry once the lighting bake no longer needs it
+  m_releaseCPU = std::getenv("SPONZA_RELEASE_CPU") != nullptr;
+  // SPONZA_GPU_CULL starts with the groups culled by a compute shader, G toggles it
+  m_gpuCull = std::getenv("SPONZA_GPU_CULL") != nullptr;
+  // SPONZA_PAGED_GEOMETRY=<MB> pages the geometry through a pool of that size instead of uploading it all
+  if (const char *paged = std::getenv("SPONZA_PAGED_GEOMETRY"))
+  {
+    m_paged = true;
+    if (std::atoi(paged) > 0)
+    {
+      m_pagerSettings.poolBytes = static_cast<size_t>(std::atoi(paged)) << 20;
+    }
+  }
+  // meshes, textures and shaders come from the shared manager so a second scene reuses them
+  ResourceManager &resources = ResourceManager::instance();
+  m_mtl.reset(new Mtl);
+  m_mtl->setResourceManager(&resources);
+  // SPONZA_STREAM_TEXTURES=<MB> streams the mip levels on demand within that budget
+  if (const char *stream = std::getenv("SPONZA_STREAM_TEXTURES"))
+  {
+    StreamSettings settings;
+    if (std::atoi(stream) > 0)
+    {
+      settings.budgetBytes = static_cast<size_t>(std::atoi(stream)) << 20;
+    }
+    m_streamer.reset(new TextureStreamer(settings));
+    m_mtl->setTextureStreamer(m_streamer.get());
+  }
+  // the textures are decoded by the graph rather than by load
+  m_mtl->setLoadTextures(false);
 
-  ngl::ShaderLib::attachShader("TextureVertex", ngl::ShaderType::VERTEX);
-  ngl::ShaderLib::attachShader("TextureFragment", ngl::ShaderType::FRAGMENT);
-  ngl::ShaderLib::loadShaderSource("TextureVertex", "shaders/TextureVert.glsl");
-  ngl::ShaderLib::loadShaderSource("TextureFragment", "shaders/TextureFrag.glsl");
+  // SPONZA_ASYNC_LOAD brings the window up straight away and streams the scene in while drawing, paged
+  // geometry streams in anyway so it always takes the synchronous path
+  if (std::getenv("SPONZA_ASYNC_LOAD") != nullptr && !m_paged)
+  {
+    loadSceneAsync();
+  }
+  else
+  {
+    loadScene();
+  }
+  // as re-size is not explicitly called we need to do this.
+  glViewport(0, 0, width(), height());
+  if (trace::enabled())
+  {
+    // finish the initializeGL span before writing
+    trace::record("NGLScene::initializeGL", "sponza", traceStart, trace::now() - traceStart);
+    if (!m_loading)
+    {
+      trace::write(std::getenv("SPONZA_TRACE"));
+    }
+  }
+}
 
-  ngl::ShaderLib::compileShader("TextureVertex");
-  ngl::ShaderLib::compileShader("TextureFragment");
-  ngl::ShaderLib::attachShaderToProgram("TextureShader", "TextureVertex");
-  ngl::ShaderLib::attachShaderToProgram("TextureShader", "TextureFragment");
-  // bind our attributes for the vertex shader
+void NGLScene::loadShaders()
+{
+  ResourceManager &resources = ResourceManager::instance();
+  // linked programs are cached on disk so only the first run pays for compiling
+  static ShaderCache s_shaderCache("cache/shaders");
+  m_shaderCache = &s_shaderCache;
+  // the original shader is used for the debug views of the other maps
+  m_textureShader = resources.shaders("TextureShader", "shaders/TextureVert.glsl", "shaders/TextureFrag.glsl", m_shaderCache);
+  m_textureShader->use(0);
+  m_variants = resources.shaders("MaterialShader", "shaders/TextureVert.glsl", "shaders/MaterialFrag.glsl", m_shaderCache);
+}
 
-  // link the shader no attributes are bound
-  ngl::ShaderLib::linkProgramObject("TextureShader");
-  ngl::ShaderLib::use("TextureShader");
+void NGLScene::loadScene()
+{
+  ResourceManager &resources = ResourceManager::instance();
+  // the obj, the mtl and the images are read and decoded on the workers while this thread compiles the
+  // shaders and uploads whatever is ready, only tasks marked Main touch GL
+  using Affinity = TaskGraph::Affinity;
+  TaskGraph graph;
+  auto loadStart = std::chrono::high_resolution_clock::now();
+  auto shaders = graph.add("shaders", Affinity::Main, [this]()
+  {
+    loadShaders();
+    return true;
+  });
+  // a mesh already in the shared cache needs no parse, the paged one is never shared
+  std::shared_ptr<GroupedObj> parsed = m_paged ? nullptr : resources.cachedMesh(m_modelPath);
+  TaskGraph::TaskId uploadMesh;
+  if (parsed)
+  {
+    uploadMesh = graph.add("cached mesh", Affinity::Main, [this, &parsed]()
+    {
+      m_model = std::move(parsed);
+      return true;
+    });
+  }
+  else
+  {
+    auto parseObj = graph.add("parse obj", Affinity::Any, [this, &parsed]()
+    {
+      parsed = std::make_shared<GroupedObj>(m_modelPath, GroupedObj::CreateVAO::False, "cache");
+      if (parsed->vertexData().empty())
+      {
+        std::cerr << "error loading obj file ";
+        return false;
+      }
+      return true;
+    });
+    uploadMesh = graph.add("upload mesh", Affinity::Main, [this, &resources, &parsed]()
+    {
+      if (m_paged)
+      {
+        // the shared mesh would be uploaded in full so the paged one is kept to this scene
+        m_model = std::move(parsed);
+        createPager();
+        return true;
+      }
+      m_model = resources.mesh(m_modelPath, "cache", std::move(parsed));
+      return m_model != nullptr;
+    }, {parseObj});
+  }
+  auto parseMtl = graph.add("parse mtl", Affinity::Any, [this, &graph, &resources, uploadMesh]()
+  {
+    if (!m_mtl->load(m_mtlPath))
+    {
+      std::cerr << "error loading mtl file ";
+      return false;
+    }
+    // now we know the textures each one gets a decode on a worker and an upload here
+    std::vector<TaskGraph::TaskId> ready = {uploadMesh};
+    if (m_streamer)
+    {
+      // the streamer decodes in the background itself
+      ready.push_back(graph.add("stream textures", Affinity::Main, [this]()
+      {
+        m_mtl->loadTextures();
+        return true;
+      }));
+    }
+    else
+    {
+      for (auto &name : m_mtl->texturesToLoad())
+      {
+        // only textures the cache doesn't have are decoded
+        if (auto cached = resources.cachedTexture(name))
+        {
+          ready.push_back(graph.add("cached " + name, Affinity::Main, [this, name, cached]()
+          {
+            m_mtl->addTexture(name, cached);
+            return true;
+          }));
+          continue;
+        }
+        auto image = std::make_shared<ngl::Texture>();
+        auto decode = graph.add("decode " + name, Affinity::Any, [name, image]()
+        {
+          // a missing image just leaves the material untextured, as loading it on the GL thread would
+          image->loadImage(name);
+          return true;
+        });
+        ready.push_back(graph.add("upload " + name, Affinity::Main, [this, name, image]()
+        {
+          m_mtl->addTexture(name, *image);
+          return true;
+        }, {decode}));
+      }
+    }
+    graph.add("build mesh data", Affinity::Main, [this]()
+    {
+      if (m_streamer)
+      {
+        m_streamer->setGroups(*m_model, *m_mtl);
+      }
+      buildMeshData();
+      return true;
+    }, ready);
+    return true;
+  });
+  // build the shader variants for every material now rather than on first use
+  graph.add("precompile shaders", Affinity::Main, [this]()
+  {
+    m_variants->precompile(*m_mtl);
+    return true;
+  }, {shaders, parseMtl});
+  if (!graph.run())
+  {
+    exit(EXIT_FAILURE);
+  }
+  auto loadEnd = std::chrono::high_resolution_clock::now();
+  std::cout << "scene loaded in " << std::chrono::duration<double, std::milli>(loadEnd - loadStart).count()
+            << " ms (" << m_shaderCache->hits() << " shaders from cache, " << m_shaderCache->misses()
+            << " compiled from source, " << m_textureShader->buildTime() + m_variants->buildTime() << " ms building)\n";
+  graph.printCriticalPath(std::cout);
+  m_materialsReady = true;
+  watchFiles();
+}
 
-  glEnable(GL_DEPTH_TEST);
+void NGLScene::loadSceneAsync()
+{
+  m_loading = true;
+  loadShaders();
+  m_uploader.reset(new UploadThread(context()));
+  m_uploadTimer = startTimer(16);
+  // the mtl is parsed on a worker and only read here once the upload thread has passed on that it is done,
+  // so paintGL never sees it half read. Everything the workers make reaches this thread the same way
+  m_loader = std::thread([this]()
+  {
+    using Affinity = TaskGraph::Affinity;
+    ResourceManager *resources = &ResourceManager::instance();
+    TaskGraph graph;
+    graph.add("parse obj", Affinity::Any, [this, resources]()
+    {
+      if (auto cached = resources->cachedMesh(m_modelPath))
+      {
+        // already uploaded so every group can be drawn as soon as it is handed over
+        m_uploader->enqueue("obj cached", nullptr, [this, cached](bool) { m_model = cached; });
+        return true;
+      }
+      auto model = std::make_shared<GroupedObj>(m_modelPath, GroupedObj::CreateVAO::False, "cache");
+      if (model->vertexData().empty())
+      {
+        std::cerr << "error loading obj file ";
+        return false;
+      }
+      m_uploader->enqueue("obj parsed", nullptr, [this, model](bool) { uploadModel(model); });
+      return true;
+    });
+    graph.add("parse mtl", Affinity::Any, [this, &graph, resources]()
+    {
+      if (!m_mtl->load(m_mtlPath))
+      {
+        std::cerr << "error loading mtl file ";
+        return false;
+      }
+      // read before handing the materials over as the uploads then change what is loaded
+      auto textures = m_mtl->texturesToLoad();
+      m_uploader->enqueue("mtl parsed", nullptr, [this](bool)
+      {
+        m_materialsReady = true;
+        if (m_streamer)
+        {
+          // the streamer decodes in the background itself
+          m_mtl->loadTextures();
+        }
+        m_variants->precompile(*m_mtl);
+      });
+      if (m_streamer)
+      {
+        return true;
+      }
+      for (auto &name : textures)
+      {
+        if (auto cached = resources->cachedTexture(name))
+        {
+          m_uploader->enqueue("cached " + name, nullptr, [this, name, cached](bool) { m_mtl->addTexture(name, cached); });
+          continue;
+        }
+        graph.add("decode " + name, Affinity::Any, [this, name, resources]()
+        {
+          auto image = std::make_shared<ngl::Texture>();
+          image->loadImage(name);
+          auto texture = std::make_shared<std::shared_ptr<TextureResource>>();
+          m_uploader->enqueue("upload " + name, [name, resources, image, texture]()
+          {
+            *texture = resources->texture(name, image.get());
+            return *texture != nullptr;
+          },
+          [this, name, texture](bool) { m_mtl->addTexture(name, *texture); });
+          return true;
+        });
+      }
+      return true;
+    });
+    bool ok = graph.run();
+    graph.printCriticalPath(std::cout);
+    m_uploader->enqueue("scene parsed", nullptr, [this, ok](bool)
+    {
+      if (!ok)
+      {
+        exit(EXIT_FAILURE);
+      }
+      m_sceneParsed = true;
+    });
+  });
+}
 
-  m_mtl.reset(new Mtl);
-  bool loaded = m_mtl->load("models/sponza.mtl");
+void NGLScene::uploadModel(std::shared_ptr<GroupedObj> _model)
+{
+  m_model = std::move(_model);
+  m_model->allocateVAO();
+  // the buffers are filled from the upload context so they have to exist there first
+  glFlush();
+  // until the bake has some results the light attribute is the generic value of white so we get ka * texture
+  glVertexAttrib3f(3, 1.0f, 1.0f, 1.0f);
+  m_groupReady.assign(m_model->numMeshes(), false);
+  for (size_t i = 0; i < m_model->numMeshes(); ++i)
+  {
+    m_uploader->enqueue("upload " + m_model->getName(static_cast<unsigned int>(i)),
+                        [model = m_model, i]() { return model->uploadGroup(i); },
+                        [this, i](bool _ok) { m_groupReady[i] = _ok; });
+  }
+}
 
-  if (loaded == false)
+void NGLScene::finishLoading()
+{
+  m_loading = false;
+  killTimer(m_uploadTimer);
+  m_uploadTimer = 0;
+  m_loader.join();
+  m_uploader.reset();
+  m_groupReady.clear();
+  if (m_streamer)
   {
-    std::cerr << "error loading mtl file ";
-    exit(EXIT_FAILURE);
+    m_streamer->setGroups(*m_model, *m_mtl);
   }
+  buildMeshData();
+  watchFiles();
+  std::cout << "scene complete in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_loadStart).count()
+            << " ms\n";
+  if (trace::enabled())
+  {
+    trace::write(std::getenv("SPONZA_TRACE"));
+  }
+}
 
-  m_model.reset(new GroupedObj("models/sponza.obj"));
-  if (loaded == false)
+void NGLScene::watchFiles()
+{
+  // edits to the model files are picked up while running
+  m_watcher.reset(new FileWatcher);
+  m_watcher->watch(m_modelPath);
+  m_watcher->watch(m_mtlPath);
+  for (auto &texture : m_mtl->textureNames())
   {
-    std::cerr << "error loading obj file ";
-    exit(EXIT_FAILURE);
+    m_watcher->watch(texture);
   }
-  // as re-size is not explicitly called we need to do this.
-  glViewport(0, 0, width(), height());
+  m_watchTimer = startTimer(100);
 }
 
 void NGLScene::loadMatricesToShader()
@@ -101,36 +434,257 @@ void NGLScene::loadMatricesToShader()
   ngl::ShaderLib::setUniform("MVP", MVP);
 }
 
-void NGLScene::paintGL()
+ngl::Mat4 NGLScene::mouseTransform(const ngl::Vec3 &_pos) const
 {
-
   // Rotation based on the mouse position for our global transform
   ngl::Mat4 rotX = ngl::Mat4::rotateX(m_win.spinXFace);
   ngl::Mat4 rotY = ngl::Mat4::rotateY(m_win.spinYFace);
   // multiply the rotations
-  m_mouseGlobalTX = rotY * rotX;
+  ngl::Mat4 tx = rotY * rotX;
   // add the translations
-  m_mouseGlobalTX.m_m[3][0] = m_modelPos.m_x;
-  m_mouseGlobalTX.m_m[3][1] = m_modelPos.m_y;
-  m_mouseGlobalTX.m_m[3][2] = m_modelPos.m_z;
+  tx.m_m[3][0] = _pos.m_x;
+  tx.m_m[3][1] = _pos.m_y;
+  tx.m_m[3][2] = _pos.m_z;
+  return tx;
+}
+
+bool NGLScene::moveCamera(const ngl::Vec3 &_pos)
+{
+  // the camera is fixed and the model moves, so work out where the eye is in model space
+  // before and after the move and sweep a small sphere between the two
+  auto eyeInModel = [this](const ngl::Vec3 &_p)
+  {
+    ngl::Vec4 eye = (m_view * mouseTransform(_p)).inverse() * ngl::Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    return ngl::Vec3(eye.m_x, eye.m_y, eye.m_z);
+  };
+  if (m_collision)
+  {
+    auto hit = m_collision->sphereSweep(eyeInModel(m_modelPos), eyeInModel(_pos), 2.0f);
+    if (hit.m_hit)
+    {
+      return false;
+    }
+  }
+  m_modelPos = _pos;
+  return true;
+}
+
+void NGLScene::pick(float _x, float _y)
+{
+  if (!m_collision)
+  {
+    return;
+  }
+  // un-project the near and far points under the mouse into model space
+  float ndcX = 2.0f * _x / width() - 1.0f;
+  float ndcY = 1.0f - 2.0f * _y / height();
+  ngl::Mat4 inv = (m_project * m_view * mouseTransform(m_modelPos)).inverse();
+  ngl::Vec4 nearP = inv * ngl::Vec4(ndcX, ndcY, -1.0f, 1.0f);
+  ngl::Vec4 farP = inv * ngl::Vec4(ndcX, ndcY, 1.0f, 1.0f);
+  ngl::Vec3 from(nearP.m_x / nearP.m_w, nearP.m_y / nearP.m_w, nearP.m_z / nearP.m_w);
+  ngl::Vec3 to(farP.m_x / farP.m_w, farP.m_y / farP.m_w, farP.m_z / farP.m_w);
+  auto hit = m_collision->rayCast(from, to);
+  if (hit.m_hit)
+  {
+    std::cout << "picked group " << m_model->getName(hit.m_meshID) << " material "
+              << m_model->getMaterial(hit.m_meshID) << " triangle " << hit.m_triangle << " at " << hit.m_point << '\n';
+    if (!m_animateGroup)
+    {
+      m_pickedGroup = hit.m_meshID;
+    }
+  }
+  else
+  {
+    std::cout << "nothing picked\n";
+  }
+}
+
+void NGLScene::streamPickedGroup(float _lift)
+{
+  const MeshData &mesh = m_model->getMeshData(m_pickedGroup);
+  const VertData *source = &m_model->drawVertexData()[mesh.m_firstVertex];
+  VertData *out = m_model->mapMesh(m_pickedGroup);
+  if (out == nullptr)
+  {
+    m_animateGroup = false;
+    return;
+  }
+  for (size_t v = 0; v < mesh.m_numVertices; ++v)
+  {
+    out[v] = source[v];
+    out[v].y += _lift;
+  }
+  m_model->unmapMesh();
+}
+
+void NGLScene::paintGL()
+{
+  m_mouseGlobalTX = mouseTransform(m_modelPos);
+  // pick up the latest bake pass
+  std::vector<ngl::Vec3> light;
+  if (m_aoBaker && !m_pager && m_aoBaker->fetchResult(light))
+  {
+    // the lit mesh no longer matches the file so it leaves the shared cache
+    ResourceManager::instance().detach(m_model);
+    m_model->setVertexLighting(light);
+  }
+  if (m_streamer && !m_loading)
+  {
+    m_streamer->update(m_project, m_view * m_mouseGlobalTX * m_transform.getMatrix(), m_win.height);
+  }
+  if (m_pager)
+  {
+    m_pager->update(m_project, m_view * m_mouseGlobalTX * m_transform.getMatrix());
+  }
+  // nothing is built or timed until culling is switched on, after that the culler stays for the G key stats
+  if (m_gpuCull && m_model && !m_loading && !m_culler && !m_pager)
+  {
+    m_culler.reset(new GpuCuller(*m_model));
+  }
+  bool timed = m_gpuCull && m_culler;
+  if (timed)
+  {
+    m_culler->beginFrame();
+  }
 
   // clear the screen and depth buffer
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   glViewport(0, 0, m_win.width, m_win.height);
+  if (m_firstFrame)
+  {
+    m_firstFrame = false;
+    std::cout << "first frame in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_loadStart).count()
+              << " ms\n";
+  }
+  // while loading asynchronously there is nothing to draw until both the mesh and the materials are in
+  if (!m_model || !m_materialsReady)
+  {
+    return;
+  }
+  if (m_animateGroup)
+  {
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - m_animateStart).count();
+    // up by its own height and back down once a second
+    streamPickedGroup(m_animateHeight * 0.5f * (1.0f - std::cos(seconds * 6.2831853f)));
+  }
+  ngl::Mat4 MVP = m_project * m_view * m_mouseGlobalTX * m_transform.getMatrix();
+  bool gpuCull = timed && m_culler->valid();
+  if (gpuCull)
+  {
+    m_culler->cull(MVP);
+  }
+  const std::string debugProgram = m_textureShader->use(0);
   loadMatricesToShader();
-  auto end = m_model->numMeshes();
+  std::string currentProgram = debugProgram;
+  auto bindTexture = [](GLenum _unit, GLuint _id)
+  {
+    glActiveTexture(_unit);
+    glBindTexture(GL_TEXTURE_2D, _id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  };
+  // the PVS is looked up from the eye in model space, outside its grid everything is drawn
+  const std::vector<char> *visible = nullptr;
+  if (!gpuCull && m_usePVS && m_pvs)
+  {
+    ngl::Vec4 eye = (m_view * m_mouseGlobalTX * m_transform.getMatrix()).inverse() * ngl::Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    visible = m_pvs->visibleFrom(ngl::Vec3(eye.m_x, eye.m_y, eye.m_z));
+  }
+  // each batch is a run of groups sharing a material, drawn with one call once all of its groups are in and
+  // visible. Otherwise the runs of groups that are drawn with one call each
+  auto drawBatch = [this, gpuCull, visible](size_t _batchID)
+  {
+    if (gpuCull)
+    {
+      m_culler->drawBatch(_batchID);
+      return;
+    }
+    if (m_pager)
+    {
+      m_pager->drawBatch(_batchID);
+      return;
+    }
+    const DrawBatch &batch = m_model->getBatch(_batchID);
+    size_t last = batch.m_firstMesh + batch.m_numMeshes;
+    auto drawable = [this, visible](size_t _meshID)
+    { return (m_groupReady.empty() || m_groupReady[_meshID]) && (visible == nullptr || (*visible)[_meshID]); };
+    size_t i = batch.m_firstMesh;
+    while (i < last)
+    {
+      if (!drawable(i))
+      {
+        ++i;
+        continue;
+      }
+      size_t first = i;
+      while (i < last && drawable(i))
+      {
+        ++i;
+      }
+      m_model->drawGroups(first, i - first);
+    }
+  };
+  auto end = m_model->numBatches();
   std::string matName;
-  for (unsigned int i = 0; i < end; ++i)
+  for (size_t b = 0; b < end; ++b)
   {
-    // m_mtl->use(m_model->getMaterial(i));
-    mtlItem *currMaterial = m_mtl->find(m_model->getMaterial(i));
+    const std::string &material = m_model->getBatch(b).m_material;
+    // m_mtl->use(material);
+    mtlItem *currMaterial = m_mtl->find(material);
     if (currMaterial == nullptr)
       continue;
     // see if we need to switch the material or not this saves on OpenGL calls and
     // should speed things up
-    if (matName != m_model->getMaterial(i))
+    if (matName != material)
     {
-      matName = m_model->getMaterial(i);
+      matName = material;
+      // in the normal view each material gets the shader variant for its features
+      uint32_t features = ShaderVariants::features(*currMaterial);
+      ngl::Vec3 ka = currMaterial->Ka;
+      if (m_loading)
+      {
+        // the maps not uploaded yet are left out and the flat Kd colour stands in for the diffuse map
+        if ((features & ShaderVariants::DiffuseMap) && currMaterial->map_KdId == 0)
+        {
+          features &= ~ShaderVariants::DiffuseMap;
+          ka = currMaterial->Kd;
+        }
+        if (currMaterial->map_dId == 0)
+          features &= ~(ShaderVariants::AlphaMap | ShaderVariants::AlphaTest);
+        if (currMaterial->map_bumpId == 0)
+          features &= ~ShaderVariants::BumpMap;
+      }
+      std::string program = m_whichMap == 0 ? m_variants->use(features) : std::string();
+      if (program.size() != 0)
+      {
+        // the matrices are per program so re-load them when the variant changes
+        if (program != currentProgram)
+        {
+          currentProgram = program;
+          loadMatricesToShader();
+        }
+        if (features & ShaderVariants::AlphaMap)
+          bindTexture(GL_TEXTURE1, currMaterial->map_dId);
+        if (features & ShaderVariants::BumpMap)
+          bindTexture(GL_TEXTURE2, currMaterial->map_bumpId);
+        if (features & ShaderVariants::DiffuseMap)
+          bindTexture(GL_TEXTURE0, currMaterial->map_KdId);
+        glActiveTexture(GL_TEXTURE0);
+        ngl::ShaderLib::setUniform("ka", ka.m_x, ka.m_y, ka.m_z);
+        if (features & ShaderVariants::Transparent)
+          ngl::ShaderLib::setUniform("transp", currMaterial->d);
+        drawBatch(b);
+        continue;
+      }
+      // the debug views of the other maps (or a variant which failed to build) use the original shader
+      if (currentProgram != debugProgram)
+      {
+        currentProgram = debugProgram;
+        ngl::ShaderLib::use(currentProgram);
+        loadMatricesToShader();
+      }
+      glActiveTexture(GL_TEXTURE0);
       switch (m_whichMap)
       {
       case 0:
@@ -156,8 +710,225 @@ void NGLScene::paintGL()
       ngl::ShaderLib::setUniform("ka", currMaterial->Ka.m_x, currMaterial->Ka.m_y, currMaterial->Ka.m_z);
       ngl::ShaderLib::setUniform("transp", currMaterial->d);
     }
-    m_model->draw(i);
+    drawBatch(b);
+  }
+  if (timed)
+  {
+    if (gpuCull)
+    {
+      // the depth of this frame is what the next one is tested against
+      m_culler->captureDepth(defaultFramebufferObject(), m_win.width, m_win.height, MVP);
+    }
+    m_culler->endFrame();
+  }
+  // keep drawing until the streamed textures and geometry settle, and while a group is animated
+  if ((m_streamer && m_streamer->busy()) || (m_pager && m_pager->busy()) || m_animateGroup)
+  {
+    update();
+  }
+}
+
+void NGLScene::buildMeshData()
+{
+  auto collisionStart = std::chrono::high_resolution_clock::now();
+  {
+    TRACE_SCOPE("CollisionMesh");
+    m_collision.reset(new CollisionMesh(*m_model, "cache"));
+  }
+  auto collisionEnd = std::chrono::high_resolution_clock::now();
+  std::cout << "collision mesh " << (m_collision->fromCache() ? "loaded" : "built") << " in "
+            << std::chrono::duration<double, std::milli>(collisionEnd - collisionStart).count() << " ms\n";
+  // until the bake has some results the light attribute is the generic value of white so we get ka * texture
+  glVertexAttrib3f(3, 1.0f, 1.0f, 1.0f);
+  {
+    TRACE_SCOPE("AOBaker load");
+    m_aoBaker.reset(new AOBaker(*m_model, "cache"));
+  }
+  if (m_aoBaker->fromCache())
+  {
+    std::cout << "ambient occlusion loaded from cache with " << m_aoBaker->samples() << " samples\n";
+  }
+  // the visible sets are only valid for the exact layout they were built for, load checks the hash
+  m_pvs.reset(new PVS);
+  if (m_pvs->load(PVS::cacheName("cache", *m_model), *m_model))
+  {
+    std::cout << "PVS loaded, ";
+    m_pvs->printStats(std::cout);
+  }
+  else
+  {
+    m_pvs.reset();
+  }
+  // the paged chunks have no lighting attribute so there is nothing to bake for
+  if (!m_aoBaker->converged() && !m_pager)
+  {
+    m_aoBaker->start();
+    m_aoTimer = startTimer(250);
+  }
+  else
+  {
+    releaseMeshData();
+  }
+}
+
+void NGLScene::createPager()
+{
+  std::string fname = GeometryPager::cacheName("cache", *m_model);
+  m_pager.reset(new GeometryPager(*m_model, fname, m_pagerSettings));
+  // a missing or stale file is written again, the hash in the name changes with the layout
+  if (!m_pager->valid() && GeometryPager::writeChunkFile(*m_model, fname, m_pagerSettings.chunkBytes))
+  {
+    m_pager.reset(new GeometryPager(*m_model, fname, m_pagerSettings));
+  }
+  if (!m_pager->valid())
+  {
+    std::cerr << "could not page the geometry, uploading all of it\n";
+    m_pager.reset();
+    m_model->upload();
+  }
+}
+
+void NGLScene::releaseMeshData()
+{
+  // everything reading the per corner data is done once the bake has finished
+  if (m_releaseCPU && !m_model->cpuDataReleased())
+  {
+    ResourceManager::instance().detach(m_model);
+    m_model->releaseCPUData();
+  }
+}
+
+void NGLScene::timerEvent(QTimerEvent *_event)
+{
+  if (_event->timerId() == m_uploadTimer)
+  {
+    // the completions and finishLoading make GL calls and a timer event has no context current
+    makeCurrent();
+    if (m_uploader->poll() != 0)
+    {
+      update();
+    }
+    if (m_sceneParsed && !m_uploader->busy())
+    {
+      finishLoading();
+      update();
+    }
+    doneCurrent();
+    return;
+  }
+  if (_event->timerId() == m_watchTimer)
+  {
+    checkForEdits();
+    return;
+  }
+  // keep drawing until the bake is done so each new pass is shown
+  if (!m_aoBaker->running())
+  {
+    killTimer(m_aoTimer);
+    m_aoTimer = 0;
+    releaseMeshData();
+  }
+  update();
+}
+
+void NGLScene::checkForEdits()
+{
+  bool redraw = false;
+  for (auto &path : m_watcher->poll())
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (path == m_modelPath)
+    {
+      // parsing is the slow part so keep it off the GUI thread, a second save while parsing is picked up by
+      // the next poll once this one is applied
+      if (!m_pendingModel.valid())
+      {
+        m_pendingModel = std::async(std::launch::async, [path]()
+                                    { return std::make_unique<GroupedObj>(path, GroupedObj::CreateVAO::False, "cache"); });
+      }
+      continue;
+    }
+    // textures are uploaded so we need the context
+    makeCurrent();
+    std::vector<std::string> changed;
+    bool reloaded = false;
+    if (path == m_mtlPath)
+    {
+      reloaded = m_mtl->reload(path, changed);
+      if (reloaded)
+      {
+        m_variants->precompile(*m_mtl);
+        for (auto &texture : m_mtl->textureNames())
+        {
+          m_watcher->watch(texture);
+        }
+      }
+    }
+    else
+    {
+      reloaded = m_mtl->reloadTexture(path);
+    }
+    doneCurrent();
+    if (reloaded)
+    {
+      std::cout << "reloaded " << path;
+      if (!changed.empty())
+      {
+        std::cout << " (" << changed.size() << " changed materials)";
+      }
+      std::cout << " in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+                << " ms\n";
+    }
+    redraw = true;
+  }
+
+  if (m_pendingModel.valid() && m_pendingModel.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+  {
+    auto fresh = m_pendingModel.get();
+    // saving without changes gives the same hash
+    if (!fresh->vertexData().empty() && fresh->hash() != m_model->hash())
+    {
+      patchModel(*fresh);
+      redraw = true;
+    }
+  }
+  if (redraw)
+  {
+    update();
+  }
+}
+
+void NGLScene::patchModel(const GroupedObj &_fresh)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  // the bake thread reads the mesh so stop it before patching
+  if (m_aoTimer != 0)
+  {
+    killTimer(m_aoTimer);
+    m_aoTimer = 0;
+  }
+  m_aoBaker.reset();
+  makeCurrent();
+  ResourceManager::instance().detach(m_model);
+  // the groups may have moved so the pick no longer means anything, patch puts back the animated vertices
+  m_animateGroup = false;
+  m_pickedGroup = std::numeric_limits<size_t>::max();
+  size_t changed = m_model->patch(_fresh);
+  // the group bounds and ranges may have moved
+  m_culler.reset();
+  if (m_pager)
+  {
+    createPager();
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  std::cout << "patched " << changed << " changed groups in "
+            << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+  if (m_streamer)
+  {
+    m_streamer->setGroups(*m_model, *m_mtl);
   }
+  buildMeshData();
+  doneCurrent();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -205,6 +976,130 @@ void NGLScene::keyPressEvent(QKeyEvent *_event)
   case Qt::Key_5:
     m_whichMap = 4;
     break;
+  // benchmark the collision mesh ray queries
+  case Qt::Key_B:
+    if (m_collision)
+    {
+      m_collision->benchmark(100000);
+    }
+    break;
+  // print what the resource manager is holding
+  case Qt::Key_M:
+  {
+    if (m_loading)
+    {
+      break;
+    }
+    ResourceManager::instance().printStats();
+    MemoryReport report;
+    makeCurrent();
+    m_model->memoryUsage(report);
+    m_mtl->memoryUsage(report);
+    m_textureShader->memoryUsage(report);
+    m_variants->memoryUsage(report);
+    if (m_culler)
+    {
+      m_culler->memoryUsage(report);
+    }
+    if (m_pager)
+    {
+      m_pager->memoryUsage(report);
+    }
+    doneCurrent();
+    report.print(std::cout, true);
+    break;
+  }
+  // switch the GPU culling on and off, the cull rates and frame times since the last print are shown first
+  case Qt::Key_G:
+    if (m_culler)
+    {
+      makeCurrent();
+      m_culler->printStats(std::cout);
+      doneCurrent();
+    }
+    m_gpuCull = !m_gpuCull;
+    std::cout << "GPU culling " << (m_gpuCull ? "on\n" : "off\n");
+    break;
+  // print the GPU cull rates and frame times
+  case Qt::Key_H:
+    if (m_culler)
+    {
+      makeCurrent();
+      m_culler->printStats(std::cout);
+      doneCurrent();
+    }
+    break;
+  // switch the PVS on and off, the cull rate from before is printed so the two can be compared
+  case Qt::Key_P:
+    if (m_pvs)
+    {
+      m_pvs->printStats(std::cout);
+    }
+    else
+    {
+      std::cout << "no PVS for this model, build one with SponzaPVS\n";
+    }
+    m_usePVS = !m_usePVS;
+    std::cout << "PVS " << (m_usePVS ? "on\n" : "off\n");
+    break;
+  // print the geometry paging residency and bandwidth
+  case Qt::Key_O:
+    if (m_pager)
+    {
+      m_pager->printStats(std::cout);
+    }
+    break;
+  // bob the picked group up and down by streaming its vertices each frame, the upload rate is printed at the end
+  case Qt::Key_A:
+  {
+    if (m_loading || m_pager || !m_model || m_pickedGroup >= m_model->numMeshes())
+    {
+      std::cout << "pick a group with the middle mouse button first (not with paged geometry)\n";
+      break;
+    }
+    const MeshData &mesh = m_model->getMeshData(m_pickedGroup);
+    makeCurrent();
+    if (!m_animateGroup)
+    {
+      // the shared copy in the manager must not move with it
+      ResourceManager::instance().detach(m_model);
+      float low = std::numeric_limits<float>::max();
+      float high = std::numeric_limits<float>::lowest();
+      for (size_t v = mesh.m_firstVertex; v < mesh.m_firstVertex + mesh.m_numVertices; ++v)
+      {
+        low = std::min(low, m_model->drawVertexData()[v].y);
+        high = std::max(high, m_model->drawVertexData()[v].y);
+      }
+      m_animateHeight = mesh.m_numVertices != 0 ? high - low : 0.0f;
+      m_animateStats = m_model->uploadStats();
+      m_animateStart = std::chrono::steady_clock::now();
+      m_animateGroup = true;
+      std::cout << "animating group " << m_model->getName(static_cast<unsigned int>(m_pickedGroup)) << " "
+                << mesh.m_numVertices << " vertices\n";
+    }
+    else
+    {
+      // put the group back where it was loaded
+      m_animateGroup = false;
+      streamPickedGroup(0.0f);
+      auto &stats = m_model->uploadStats();
+      VAO::UploadStats since;
+      since.bytes = stats.bytes - m_animateStats.bytes;
+      since.uploads = stats.uploads - m_animateStats.uploads;
+      since.seconds = stats.seconds - m_animateStats.seconds;
+      std::cout << "streamed " << since.bytes << " bytes in " << since.uploads << " group uploads "
+                << since.mbPerSecond() << " MB/s\n";
+    }
+    doneCurrent();
+    break;
+  }
+  // print the texture streaming residency
+  case Qt::Key_T:
+    if (m_streamer)
+    {
+      m_streamer->printStats();
+    }
+    break;
   }
   // finally update the GLWindow and re-draw
   // if (isExposed())
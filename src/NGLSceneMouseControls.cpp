@@ -29,8 +29,10 @@ void NGLScene::mouseMoveEvent(QMouseEvent *_event)
     int diffY = static_cast<int>(position.y() - m_win.origYPos);
     m_win.origXPos = position.x();
     m_win.origYPos = position.y();
-    m_modelPos.m_x += INCREMENT * diffX;
-    m_modelPos.m_y -= INCREMENT * diffY;
+    ngl::Vec3 pos = m_modelPos;
+    pos.m_x += INCREMENT * diffX;
+    pos.m_y -= INCREMENT * diffY;
+    moveCamera(pos);
     update();
   }
 }
@@ -59,6 +61,11 @@ void NGLScene::mousePressEvent(QMouseEvent *_event)
     m_win.origYPos = position.y();
     m_win.translate = true;
   }
+  // middle mouse picks the group under the cursor
+  else if (_event->button() == Qt::MiddleButton)
+  {
+    pick(position.x(), position.y());
+  }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -83,13 +90,15 @@ void NGLScene::wheelEvent(QWheelEvent *_event)
 {
 
   // check the diff of the wheel position (0 means no change)
+  ngl::Vec3 pos = m_modelPos;
   if (_event->angleDelta().y() > 0)
   {
-    m_modelPos.m_z += ZOOM;
+    pos.m_z += ZOOM;
   }
   else if (_event->angleDelta().y() < 0)
   {
-    m_modelPos.m_z -= ZOOM;
+    pos.m_z -= ZOOM;
   }
+  moveCamera(pos);
   update();
 }
@@ -0,0 +1,402 @@
+#include "PVS.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+
+namespace
+{
+constexpr char c_pvsHeader[] = "ngl::pvsbin";
+constexpr size_t c_pvsHeaderSize = sizeof(c_pvsHeader) - 1;
+
+/// @brief a small xorshift generator seeded per cell so the build is the same on any number of threads
+struct Rng
+{
+  explicit Rng(uint32_t _seed) : m_state(_seed * 2654435761u + 1u) {}
+  float next()
+  {
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return (m_state >> 8) * (1.0f / 16777216.0f);
+  }
+  uint32_t m_state;
+};
+
+/// @brief PackBits, a header byte h < 128 is followed by h + 1 literal bytes and h > 128 by one byte
+/// repeated 257 - h times. The sets are mostly long runs of 0x00 and 0xff
+std::vector<uint8_t> packBits(const uint8_t *_data, size_t _size)
+{
+  std::vector<uint8_t> out;
+  size_t i = 0;
+  while (i < _size)
+  {
+    size_t run = 1;
+    while (i + run < _size && run < 128 && _data[i + run] == _data[i])
+    {
+      ++run;
+    }
+    if (run >= 3)
+    {
+      out.push_back(static_cast<uint8_t>(257 - run));
+      out.push_back(_data[i]);
+      i += run;
+      continue;
+    }
+    // copy literals up to the start of the next run of 3
+    size_t literals = 0;
+    while (i + literals < _size && literals < 128)
+    {
+      size_t j = i + literals;
+      if (j + 2 < _size && _data[j] == _data[j + 1] && _data[j] == _data[j + 2])
+      {
+        break;
+      }
+      ++literals;
+    }
+    out.push_back(static_cast<uint8_t>(literals - 1));
+    out.insert(out.end(), _data + i, _data + i + literals);
+    i += literals;
+  }
+  return out;
+}
+
+bool unpackBits(const std::vector<uint8_t> &_packed, std::vector<uint8_t> &o_data)
+{
+  size_t out = 0;
+  for (size_t i = 0; i < _packed.size();)
+  {
+    uint8_t header = _packed[i++];
+    if (header < 128)
+    {
+      size_t count = header + 1u;
+      if (i + count > _packed.size() || out + count > o_data.size())
+      {
+        return false;
+      }
+      std::memcpy(&o_data[out], &_packed[i], count);
+      i += count;
+      out += count;
+    }
+    else if (header > 128)
+    {
+      size_t count = 257u - header;
+      if (i >= _packed.size() || out + count > o_data.size())
+      {
+        return false;
+      }
+      std::memset(&o_data[out], _packed[i++], count);
+      out += count;
+    }
+  }
+  return out == o_data.size();
+}
+} // end anon namespace
+
+void PVS::build(const GroupedObj &_mesh, const BVH &_bvh, const PVSSettings &_settings)
+{
+  TRACE_SCOPE("PVS build");
+  auto start = std::chrono::high_resolution_clock::now();
+  m_hash = _mesh.hash();
+  m_numGroups = _mesh.numMeshes();
+  ngl::Vec3 lo = _bvh.boundsMin();
+  ngl::Vec3 hi = _bvh.boundsMax();
+  float extent[3] = {hi.m_x - lo.m_x, hi.m_y - lo.m_y, hi.m_z - lo.m_z};
+  m_cellSize = std::max(*std::max_element(extent, extent + 3) / std::max(1, _settings.cellsOnLongestAxis), 1e-6f);
+  m_min[0] = lo.m_x;
+  m_min[1] = lo.m_y;
+  m_min[2] = lo.m_z;
+  for (int a = 0; a < 3; ++a)
+  {
+    m_dims[a] = std::max(1, static_cast<int>(std::ceil(extent[a] / m_cellSize)));
+  }
+  size_t numCells = static_cast<size_t>(m_dims[0]) * m_dims[1] * m_dims[2];
+  size_t setBytes = (m_numGroups + 7) / 8;
+
+  // the bounds of each group for the ones touching a cell
+  const auto &verts = _mesh.vertexData();
+  std::vector<float> bounds(m_numGroups * 6);
+  for (size_t g = 0; g < m_numGroups; ++g)
+  {
+    const MeshData &mesh = _mesh.getMeshData(g);
+    float *b = &bounds[g * 6];
+    std::fill(b, b + 3, std::numeric_limits<float>::max());
+    std::fill(b + 3, b + 6, std::numeric_limits<float>::lowest());
+    for (size_t v = mesh.m_startIndex; v < mesh.m_startIndex + mesh.m_numVerts; ++v)
+    {
+      const float *p = &verts[v].x;
+      for (int a = 0; a < 3; ++a)
+      {
+        b[a] = std::min(b[a], p[a]);
+        b[a + 3] = std::max(b[a + 3], p[a]);
+      }
+    }
+  }
+
+  std::vector<uint8_t> sets(numCells * setBytes, 0);
+  auto cellIndex = [this](int _x, int _y, int _z)
+  { return (static_cast<size_t>(_z) * m_dims[1] + static_cast<size_t>(_y)) * m_dims[0] + static_cast<size_t>(_x); };
+  parallel::forEach(0, numCells, [&](size_t _cell)
+  {
+    int coord[3] = {static_cast<int>(_cell % m_dims[0]), static_cast<int>(_cell / m_dims[0] % m_dims[1]),
+                    static_cast<int>(_cell / (static_cast<size_t>(m_dims[0]) * m_dims[1]))};
+    float cellMin[3];
+    for (int a = 0; a < 3; ++a)
+    {
+      cellMin[a] = m_min[a] + coord[a] * m_cellSize;
+    }
+    uint8_t *set = &sets[_cell * setBytes];
+    for (size_t g = 0; g < m_numGroups; ++g)
+    {
+      const float *b = &bounds[g * 6];
+      bool touches = true;
+      for (int a = 0; a < 3; ++a)
+      {
+        touches = touches && b[a] <= cellMin[a] + m_cellSize && b[a + 3] >= cellMin[a];
+      }
+      if (touches)
+      {
+        set[g >> 3] |= static_cast<uint8_t>(1u << (g & 7));
+      }
+    }
+    Rng rng(static_cast<uint32_t>(_cell));
+    for (unsigned int s = 0; s < _settings.samplesPerCell; ++s)
+    {
+      ngl::Vec3 origin(cellMin[0] + rng.next() * m_cellSize, cellMin[1] + rng.next() * m_cellSize,
+                       cellMin[2] + rng.next() * m_cellSize);
+      for (unsigned int r = 0; r < _settings.raysPerSample; ++r)
+      {
+        // uniform over the sphere
+        float z = 1.0f - 2.0f * rng.next();
+        float radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+        float phi = 6.28318530718f * rng.next();
+        BVHHit hit = _bvh.intersect(origin, ngl::Vec3(radius * std::cos(phi), radius * std::sin(phi), z));
+        if (hit.hit())
+        {
+          set[hit.m_meshID >> 3] |= static_cast<uint8_t>(1u << (hit.m_meshID & 7));
+        }
+      }
+    }
+  }, _settings.threads, 1);
+
+  if (_settings.dilate)
+  {
+    std::vector<uint8_t> dilated(sets);
+    parallel::forEach(0, numCells, [&](size_t _cell)
+    {
+      int x = static_cast<int>(_cell % m_dims[0]);
+      int y = static_cast<int>(_cell / m_dims[0] % m_dims[1]);
+      int z = static_cast<int>(_cell / (static_cast<size_t>(m_dims[0]) * m_dims[1]));
+      const int offsets[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+      uint8_t *set = &dilated[_cell * setBytes];
+      for (auto &o : offsets)
+      {
+        int nx = x + o[0];
+        int ny = y + o[1];
+        int nz = z + o[2];
+        if (nx < 0 || ny < 0 || nz < 0 || nx >= m_dims[0] || ny >= m_dims[1] || nz >= m_dims[2])
+        {
+          continue;
+        }
+        const uint8_t *neighbour = &sets[cellIndex(nx, ny, nz) * setBytes];
+        for (size_t i = 0; i < setBytes; ++i)
+        {
+          set[i] |= neighbour[i];
+        }
+      }
+    }, _settings.threads);
+    sets.swap(dilated);
+  }
+
+  // neighbouring cells often see exactly the same groups so each distinct set is stored once
+  std::map<std::vector<uint8_t>, uint32_t> distinct;
+  m_sets.clear();
+  m_cellSets.resize(numCells);
+  for (size_t c = 0; c < numCells; ++c)
+  {
+    auto packed = packBits(&sets[c * setBytes], setBytes);
+    auto found = distinct.emplace(std::move(packed), static_cast<uint32_t>(m_sets.size()));
+    if (found.second)
+    {
+      m_sets.push_back(found.first->first);
+    }
+    m_cellSets[c] = found.first->second;
+  }
+  m_current = ~0u;
+  auto end = std::chrono::high_resolution_clock::now();
+  m_buildTime = std::chrono::duration<double, std::milli>(end - start).count();
+  double rays = static_cast<double>(numCells) * _settings.samplesPerCell * _settings.raysPerSample;
+  std::cout << "PVS " << m_dims[0] << "x" << m_dims[1] << "x" << m_dims[2] << " cells of " << m_cellSize << " units, "
+            << m_numGroups << " groups, " << rays / 1e6 << " M rays in " << m_buildTime << " ms ("
+            << rays / (m_buildTime * 1000.0) << " Mrays/s), " << m_sets.size() << " distinct sets " << storedBytes()
+            << " bytes stored, " << rawBytes() << " as plain bitsets\n";
+}
+
+std::string PVS::cacheName(const std::string &_cacheDir, const GroupedObj &_mesh)
+{
+  std::stringstream name;
+  name << _cacheDir << '/' << std::hex << _mesh.hash() << ".pvs";
+  return name.str();
+}
+
+size_t PVS::storedBytes() const
+{
+  size_t bytes = m_cellSets.size() * sizeof(uint32_t);
+  for (auto &set : m_sets)
+  {
+    bytes += sizeof(uint32_t) + set.size();
+  }
+  return bytes;
+}
+
+bool PVS::save(const std::string &_fname) const
+{
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(_fname).parent_path(), ec);
+  std::ofstream fileOut(_fname, std::ios::out | std::ios::binary);
+  if (!fileOut.is_open())
+  {
+    std::cerr << "could not write PVS " << _fname << '\n';
+    return false;
+  }
+  uint64_t numGroups = m_numGroups;
+  uint32_t numSets = static_cast<uint32_t>(m_sets.size());
+  fileOut.write(c_pvsHeader, c_pvsHeaderSize);
+  fileOut.write(reinterpret_cast<const char *>(&m_hash), sizeof(m_hash));
+  fileOut.write(reinterpret_cast<const char *>(&numGroups), sizeof(numGroups));
+  fileOut.write(reinterpret_cast<const char *>(m_min), sizeof(m_min));
+  fileOut.write(reinterpret_cast<const char *>(&m_cellSize), sizeof(m_cellSize));
+  fileOut.write(reinterpret_cast<const char *>(m_dims), sizeof(m_dims));
+  fileOut.write(reinterpret_cast<const char *>(&numSets), sizeof(numSets));
+  fileOut.write(reinterpret_cast<const char *>(m_cellSets.data()), static_cast<std::streamsize>(m_cellSets.size() * sizeof(uint32_t)));
+  for (auto &set : m_sets)
+  {
+    uint32_t size = static_cast<uint32_t>(set.size());
+    fileOut.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    fileOut.write(reinterpret_cast<const char *>(set.data()), static_cast<std::streamsize>(set.size()));
+  }
+  return static_cast<bool>(fileOut);
+}
+
+bool PVS::load(const std::string &_fname, const GroupedObj &_mesh)
+{
+  std::ifstream fileIn(_fname, std::ios::in | std::ios::binary);
+  if (!fileIn.is_open())
+  {
+    return false;
+  }
+  char header[c_pvsHeaderSize + 1];
+  fileIn.read(header, c_pvsHeaderSize);
+  header[c_pvsHeaderSize] = 0;
+  if (strcmp(header, c_pvsHeader))
+  {
+    std::cerr << _fname << " is not an ngl::pvsbin file\n";
+    return false;
+  }
+  uint64_t hash = 0;
+  uint64_t numGroups = 0;
+  uint32_t numSets = 0;
+  fileIn.read(reinterpret_cast<char *>(&hash), sizeof(hash));
+  fileIn.read(reinterpret_cast<char *>(&numGroups), sizeof(numGroups));
+  fileIn.read(reinterpret_cast<char *>(m_min), sizeof(m_min));
+  fileIn.read(reinterpret_cast<char *>(&m_cellSize), sizeof(m_cellSize));
+  fileIn.read(reinterpret_cast<char *>(m_dims), sizeof(m_dims));
+  fileIn.read(reinterpret_cast<char *>(&numSets), sizeof(numSets));
+  if (!fileIn || hash != _mesh.hash() || numGroups != _mesh.numMeshes() || m_dims[0] <= 0 || m_dims[1] <= 0 || m_dims[2] <= 0)
+  {
+    std::cerr << _fname << " was built for a different mesh\n";
+    return false;
+  }
+  m_hash = hash;
+  m_numGroups = numGroups;
+  m_cellSets.resize(static_cast<size_t>(m_dims[0]) * m_dims[1] * m_dims[2]);
+  fileIn.read(reinterpret_cast<char *>(m_cellSets.data()), static_cast<std::streamsize>(m_cellSets.size() * sizeof(uint32_t)));
+  m_sets.resize(numSets);
+  for (auto &set : m_sets)
+  {
+    uint32_t size = 0;
+    fileIn.read(reinterpret_cast<char *>(&size), sizeof(size));
+    if (!fileIn)
+    {
+      break;
+    }
+    set.resize(size);
+    fileIn.read(reinterpret_cast<char *>(set.data()), static_cast<std::streamsize>(size));
+  }
+  bool ok = static_cast<bool>(fileIn) &&
+            std::all_of(m_cellSets.begin(), m_cellSets.end(), [numSets](uint32_t _set) { return _set < numSets; });
+  if (!ok)
+  {
+    std::cerr << "truncated PVS " << _fname << '\n';
+    m_cellSets.clear();
+    m_sets.clear();
+    return false;
+  }
+  m_current = ~0u;
+  return true;
+}
+
+const std::vector<char> *PVS::visibleFrom(const ngl::Vec3 &_pos)
+{
+  if (!valid())
+  {
+    return nullptr;
+  }
+  ++m_lookups;
+  float pos[3] = {_pos.m_x, _pos.m_y, _pos.m_z};
+  size_t cell = 0;
+  for (int a = 2; a >= 0; --a)
+  {
+    float f = std::floor((pos[a] - m_min[a]) / m_cellSize);
+    if (!(f >= 0.0f && f < m_dims[a]))
+    {
+      ++m_outside;
+      m_visibleSum += m_numGroups;
+      return nullptr;
+    }
+    cell = cell * static_cast<size_t>(m_dims[a]) + static_cast<size_t>(f);
+  }
+  uint32_t set = m_cellSets[cell];
+  if (set != m_current)
+  {
+    std::vector<uint8_t> bits((m_numGroups + 7) / 8, 0);
+    if (!unpackBits(m_sets[set], bits))
+    {
+      std::cerr << "corrupt PVS set " << set << ", drawing everything\n";
+      std::fill(bits.begin(), bits.end(), 0xff);
+    }
+    m_visible.resize(m_numGroups);
+    m_numVisible = 0;
+    for (size_t g = 0; g < m_numGroups; ++g)
+    {
+      m_visible[g] = (bits[g >> 3] >> (g & 7)) & 1;
+      m_numVisible += static_cast<size_t>(m_visible[g]);
+    }
+    m_current = set;
+  }
+  m_visibleSum += m_numVisible;
+  return &m_visible;
+}
+
+void PVS::printStats(std::ostream &_out)
+{
+  _out << "PVS " << m_dims[0] << "x" << m_dims[1] << "x" << m_dims[2] << " cells, " << m_sets.size() << " distinct sets "
+       << storedBytes() << " bytes (" << rawBytes() << " as plain bitsets)";
+  if (m_lookups != 0 && m_numGroups != 0)
+  {
+    _out << ", " << m_lookups << " frames culled " << 100.0 * (1.0 - static_cast<double>(m_visibleSum) / (m_lookups * m_numGroups))
+         << "% of the groups on average, " << m_outside << " outside the grid";
+  }
+  _out << '\n';
+  m_lookups = 0;
+  m_outside = 0;
+  m_visibleSum = 0;
+}
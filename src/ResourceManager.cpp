@@ -0,0 +1,259 @@
+#include "ResourceManager.h"
+#include "Trace.h"
+#include <ngl/Texture.h>
+#include <iostream>
+
+namespace
+{
+const char *c_kindNames[] = {"meshes", "textures", "programs"};
+
+std::filesystem::file_time_type fileTime(const std::string &_path)
+{
+  std::error_code ec;
+  auto time = std::filesystem::last_write_time(_path, ec);
+  return ec ? std::filesystem::file_time_type() : time;
+}
+} // end anon namespace
+
+ResourceManager &ResourceManager::instance()
+{
+  static ResourceManager s_instance;
+  return s_instance;
+}
+
+ResourceManager::ResourceManager(size_t _cpuBudget, size_t _gpuBudget) : m_cpuBudget(_cpuBudget), m_gpuBudget(_gpuBudget)
+{
+}
+
+void ResourceManager::setBudget(size_t _cpuBytes, size_t _gpuBytes)
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  m_cpuBudget = _cpuBytes;
+  m_gpuBudget = _gpuBytes;
+  trimLocked(m_cpuBudget, m_gpuBudget);
+}
+
+std::shared_ptr<void> ResourceManager::acquire(Kind _kind, const std::string &_key, const std::string &_path,
+                                               const std::function<bool(Entry &)> &_load)
+{
+  auto time = fileTime(_path);
+  if (auto cached = lookup(_key, time))
+  {
+    return cached;
+  }
+  // load without holding the lock so other threads can still get at the cache
+  Entry entry;
+  entry.m_kind = _kind;
+  entry.m_fileTime = time;
+  if (_load(entry) == false)
+  {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(m_lock);
+  ++m_misses;
+  auto found = m_entries.find(_key);
+  if (found != m_entries.end())
+  {
+    if (found->second.m_fileTime == time)
+    {
+      // someone else loaded it while we were, keep theirs
+      found->second.m_lastUse = ++m_clock;
+      return found->second.m_resource;
+    }
+    // the file changed, anyone still holding the old handle keeps the old copy
+    m_cpuBytes -= found->second.m_cpuBytes;
+    m_gpuBytes -= found->second.m_gpuBytes;
+    m_entries.erase(found);
+  }
+  entry.m_lastUse = ++m_clock;
+  m_cpuBytes += entry.m_cpuBytes;
+  m_gpuBytes += entry.m_gpuBytes;
+  auto resource = entry.m_resource;
+  m_entries.emplace(_key, std::move(entry));
+  // the new resource is referenced by resource so it can't be evicted here
+  trimLocked(m_cpuBudget, m_gpuBudget);
+  return resource;
+}
+
+std::shared_ptr<void> ResourceManager::lookup(const std::string &_key, std::filesystem::file_time_type _time)
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  auto found = m_entries.find(_key);
+  if (found == m_entries.end() || found->second.m_fileTime != _time)
+  {
+    return nullptr;
+  }
+  ++m_hits;
+  found->second.m_lastUse = ++m_clock;
+  return found->second.m_resource;
+}
+
+std::shared_ptr<GroupedObj> ResourceManager::cachedMesh(const std::string &_path)
+{
+  return std::static_pointer_cast<GroupedObj>(lookup("mesh:" + _path, fileTime(_path)));
+}
+
+std::shared_ptr<TextureResource> ResourceManager::cachedTexture(const std::string &_path)
+{
+  return std::static_pointer_cast<TextureResource>(lookup("texture:" + _path, fileTime(_path)));
+}
+
+std::shared_ptr<GroupedObj> ResourceManager::mesh(const std::string &_path, const std::string &_cacheDir,
+                                                  std::shared_ptr<GroupedObj> _parsed)
+{
+  auto resource = acquire(Kind::Mesh, "mesh:" + _path, _path, [&](Entry &io_entry)
+  {
+    TRACE_SCOPE("load mesh ", _path, "resource");
+    auto mesh = _parsed;
+    if (mesh)
+    {
+      mesh->upload();
+    }
+    else
+    {
+      mesh = std::make_shared<GroupedObj>(_path, GroupedObj::CreateVAO::True, _cacheDir);
+    }
+    if (mesh->vertexData().size() == 0)
+    {
+      std::cerr << "ResourceManager could not load mesh " << _path << '\n';
+      return false;
+    }
+    io_entry.m_cpuBytes = mesh->cpuBytes();
+    io_entry.m_gpuBytes = mesh->gpuBytes();
+    io_entry.m_hash = mesh->hash();
+    io_entry.m_resource = mesh;
+    return true;
+  });
+  return std::static_pointer_cast<GroupedObj>(resource);
+}
+
+std::shared_ptr<TextureResource> ResourceManager::texture(const std::string &_path, const ngl::Texture *_decoded)
+{
+  auto resource = acquire(Kind::Texture, "texture:" + _path, _path, [&_path, _decoded](Entry &io_entry)
+  {
+    TRACE_SCOPE("load texture ", _path, "resource");
+    ngl::Texture loaded;
+    if (_decoded == nullptr)
+    {
+      loaded.loadImage(_path);
+    }
+    const ngl::Texture &t = _decoded != nullptr ? *_decoded : loaded;
+    auto texture = std::make_shared<TextureResource>();
+    texture->m_width = static_cast<int>(t.getWidth());
+    texture->m_height = static_cast<int>(t.getHeight());
+    if (texture->m_width == 0 || texture->m_height == 0)
+    {
+      std::cerr << "ResourceManager could not load texture " << _path << '\n';
+      return false;
+    }
+    texture->m_id = t.setTextureGL();
+    // RGBA8 plus a third again for the mip chain, the decoded image is freed with t
+    io_entry.m_gpuBytes = static_cast<size_t>(texture->m_width) * texture->m_height * 4 * 4 / 3;
+    io_entry.m_resource = texture;
+    return true;
+  });
+  return std::static_pointer_cast<TextureResource>(resource);
+}
+
+std::shared_ptr<ShaderVariants> ResourceManager::shaders(const std::string &_baseName, const std::string &_vertex,
+                                                         const std::string &_fragment, ShaderCache *_cache)
+{
+  // keyed on the fragment file time as that is where the variant code lives
+  auto resource = acquire(Kind::Program, "program:" + _baseName + ':' + _vertex + ':' + _fragment, _fragment,
+                          [&](Entry &io_entry)
+  {
+    auto variants = std::make_shared<ShaderVariants>(_baseName, _vertex, _fragment, _cache);
+    io_entry.m_cpuBytes = variants->sourceBytes();
+    io_entry.m_resource = variants;
+    return true;
+  });
+  return std::static_pointer_cast<ShaderVariants>(resource);
+}
+
+void ResourceManager::trim()
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  trimLocked(m_cpuBudget, m_gpuBudget);
+}
+
+void ResourceManager::purge()
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  trimLocked(0, 0);
+}
+
+void ResourceManager::trimLocked(size_t _cpuBudget, size_t _gpuBudget)
+{
+  while (m_cpuBytes > _cpuBudget || m_gpuBytes > _gpuBudget)
+  {
+    // the oldest entry no one else holds a handle to, a linear scan is fine for the hundreds of assets we have
+    auto oldest = m_entries.end();
+    for (auto i = m_entries.begin(); i != m_entries.end(); ++i)
+    {
+      if (i->second.m_resource.use_count() == 1 && (oldest == m_entries.end() || i->second.m_lastUse < oldest->second.m_lastUse))
+      {
+        oldest = i;
+      }
+    }
+    if (oldest == m_entries.end())
+    {
+      // everything left is in use
+      return;
+    }
+    m_cpuBytes -= oldest->second.m_cpuBytes;
+    m_gpuBytes -= oldest->second.m_gpuBytes;
+    ++m_evictions;
+    m_entries.erase(oldest);
+  }
+}
+
+ResourceManager::Stats ResourceManager::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  Stats stats;
+  for (auto &e : m_entries)
+  {
+    int kind = static_cast<int>(e.second.m_kind);
+    ++stats.m_count[kind];
+    stats.m_cpuBytes[kind] += e.second.m_cpuBytes;
+    stats.m_gpuBytes[kind] += e.second.m_gpuBytes;
+    if (e.second.m_resource.use_count() == 1)
+    {
+      ++stats.m_unreferenced;
+    }
+  }
+  stats.m_hits = m_hits;
+  stats.m_misses = m_misses;
+  stats.m_evictions = m_evictions;
+  return stats;
+}
+
+bool ResourceManager::detach(const std::shared_ptr<GroupedObj> &_mesh)
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  for (auto i = m_entries.begin(); i != m_entries.end(); ++i)
+  {
+    if (i->second.m_kind == Kind::Mesh && i->second.m_resource == _mesh)
+    {
+      m_cpuBytes -= i->second.m_cpuBytes;
+      m_gpuBytes -= i->second.m_gpuBytes;
+      m_entries.erase(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ResourceManager::printStats() const
+{
+  auto s = stats();
+  constexpr double mb = 1024.0 * 1024.0;
+  std::cout << "resources : " << s.m_hits << " hits " << s.m_misses << " misses " << s.m_evictions << " evictions "
+            << s.m_unreferenced << " unreferenced\n";
+  for (int i = 0; i < 3; ++i)
+  {
+    std::cout << "  " << s.m_count[i] << ' ' << c_kindNames[i] << " CPU " << s.m_cpuBytes[i] / mb << " MB GPU "
+              << s.m_gpuBytes[i] / mb << " MB\n";
+  }
+  std::cout << "  budget CPU " << m_cpuBudget / mb << " MB GPU " << m_gpuBudget / mb << " MB\n";
+}
@@ -0,0 +1,178 @@
+#include "ShaderCache.h"
+#include <ngl/ShaderLib.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+constexpr char c_binHeader[] = "ngl::glbin";
+constexpr size_t c_binHeaderSize = sizeof(c_binHeader) - 1;
+
+std::string glString(GLenum _name)
+{
+  auto str = reinterpret_cast<const char *>(glGetString(_name));
+  return str != nullptr ? std::string(str) : std::string();
+}
+} // end anon namespace
+
+ShaderCache::ShaderCache(const std::string &_dir) : m_dir(_dir)
+{
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  m_enabled = formats > 0;
+  m_driver = glString(GL_VENDOR) + '\n' + glString(GL_RENDERER) + '\n' + glString(GL_VERSION);
+  if (m_enabled == false)
+  {
+    std::cout << "driver has no program binary formats, shader cache disabled\n";
+  }
+}
+
+uint64_t ShaderCache::key(const std::vector<std::string_view> &_sources) const
+{
+  // 64 bit FNV-1a of the sources and the driver strings
+  constexpr uint64_t prime = 1099511628211ULL;
+  uint64_t hash = 14695981039346656037ULL;
+  auto add = [&hash](std::string_view _data)
+  {
+    for (unsigned char c : _data)
+    {
+      hash ^= c;
+      hash *= prime;
+    }
+    // separate the strings so "ab","c" and "a","bc" differ
+    hash ^= 0xff;
+    hash *= prime;
+  };
+  for (auto &source : _sources)
+  {
+    add(source);
+  }
+  add(m_driver);
+  return hash;
+}
+
+std::string ShaderCache::fileName(uint64_t _key) const
+{
+  std::stringstream name;
+  name << m_dir << '/' << std::hex << _key << ".glbin";
+  return name.str();
+}
+
+bool ShaderCache::load(const std::string &_program, uint64_t _key)
+{
+  if (m_enabled == false)
+  {
+    return false;
+  }
+  std::ifstream fileIn(fileName(_key), std::ios::in | std::ios::binary);
+  if (!fileIn.is_open())
+  {
+    ++m_misses;
+    return false;
+  }
+  // the sizes in the file are only trusted up to what is left of it, so a corrupt entry is a miss rather
+  // than a huge allocation
+  fileIn.seekg(0, std::ios::end);
+  uint64_t remaining = static_cast<uint64_t>(std::max<std::streamoff>(fileIn.tellg(), 0));
+  fileIn.seekg(0, std::ios::beg);
+  auto stale = [&]()
+  {
+    std::cerr << "stale or corrupt shader cache entry for " << _program << '\n';
+    ++m_misses;
+    return false;
+  };
+  char header[c_binHeaderSize + 1];
+  fileIn.read(header, c_binHeaderSize);
+  header[c_binHeaderSize] = 0;
+  uint64_t key = 0;
+  uint32_t driverSize = 0;
+  fileIn.read(reinterpret_cast<char *>(&key), sizeof(key));
+  fileIn.read(reinterpret_cast<char *>(&driverSize), sizeof(driverSize));
+  constexpr uint64_t fixedSize = c_binHeaderSize + sizeof(key) + sizeof(driverSize) + sizeof(GLenum) + sizeof(uint32_t);
+  if (!fileIn || strcmp(header, c_binHeader) || key != _key || remaining < fixedSize ||
+      driverSize > remaining - fixedSize)
+  {
+    return stale();
+  }
+  remaining -= fixedSize + driverSize;
+  std::string driver(driverSize, ' ');
+  fileIn.read(&driver[0], driverSize);
+  GLenum format = 0;
+  uint32_t size = 0;
+  fileIn.read(reinterpret_cast<char *>(&format), sizeof(format));
+  fileIn.read(reinterpret_cast<char *>(&size), sizeof(size));
+  if (!fileIn || driver != m_driver || size == 0 || size > remaining)
+  {
+    return stale();
+  }
+  std::vector<char> binary(size);
+  fileIn.read(binary.data(), size);
+  if (!fileIn)
+  {
+    return stale();
+  }
+  GLuint id = ngl::ShaderLib::getProgramID(_program);
+  glProgramBinary(id, format, binary.data(), static_cast<GLsizei>(size));
+  GLint linked = GL_FALSE;
+  glGetProgramiv(id, GL_LINK_STATUS, &linked);
+  if (linked == GL_FALSE)
+  {
+    // the driver can reject binaries at any time (i.e. after an update that kept the version string)
+    std::cerr << "driver rejected cached binary for " << _program << '\n';
+    ++m_misses;
+    return false;
+  }
+  ngl::ShaderLib::autoRegisterUniforms(_program);
+  ++m_hits;
+  return true;
+}
+
+void ShaderCache::prepare(const std::string &_program) const
+{
+  if (m_enabled == true)
+  {
+    glProgramParameteri(ngl::ShaderLib::getProgramID(_program), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+}
+
+bool ShaderCache::save(const std::string &_program, uint64_t _key)
+{
+  if (m_enabled == false)
+  {
+    return false;
+  }
+  GLuint id = ngl::ShaderLib::getProgramID(_program);
+  GLint length = 0;
+  glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+  {
+    return false;
+  }
+  std::vector<char> binary(static_cast<size_t>(length));
+  GLenum format = 0;
+  glGetProgramBinary(id, length, nullptr, &format, binary.data());
+
+  std::string fname = fileName(_key);
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(fname).parent_path(), ec);
+  std::ofstream fileOut(fname, std::ios::out | std::ios::binary);
+  if (!fileOut.is_open())
+  {
+    std::cerr << "could not write shader cache " << fname << '\n';
+    return false;
+  }
+  uint32_t driverSize = static_cast<uint32_t>(m_driver.size());
+  uint32_t size = static_cast<uint32_t>(length);
+  fileOut.write(c_binHeader, c_binHeaderSize);
+  fileOut.write(reinterpret_cast<const char *>(&_key), sizeof(_key));
+  fileOut.write(reinterpret_cast<const char *>(&driverSize), sizeof(driverSize));
+  fileOut.write(m_driver.data(), driverSize);
+  fileOut.write(reinterpret_cast<const char *>(&format), sizeof(format));
+  fileOut.write(reinterpret_cast<const char *>(&size), sizeof(size));
+  fileOut.write(binary.data(), size);
+  return true;
+}
@@ -0,0 +1,190 @@
+#include "ShaderVariants.h"
+#include "Trace.h"
+#include <ngl/ShaderLib.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+std::string readFile(const std::string &_fname)
+{
+  std::ifstream fileIn(_fname);
+  if (!fileIn.is_open())
+  {
+    std::cerr << "ShaderVariants could not open " << _fname << '\n';
+    return std::string();
+  }
+  std::stringstream source;
+  source << fileIn.rdbuf();
+  return source.str();
+}
+
+// the defines must go after the #version line which has to be the first thing in the shader
+std::string insertDefines(const std::string &_source, const std::string &_defines)
+{
+  size_t version = _source.find("#version");
+  size_t lineEnd = version == std::string::npos ? std::string::npos : _source.find('\n', version);
+  if (lineEnd == std::string::npos)
+  {
+    return _defines + _source;
+  }
+  return _source.substr(0, lineEnd + 1) + _defines + _source.substr(lineEnd + 1);
+}
+} // end anon namespace
+
+ShaderVariants::ShaderVariants(const std::string &_baseName, const std::string &_vertex, const std::string &_fragment,
+                               ShaderCache *_cache)
+    : m_baseName(_baseName), m_cache(_cache)
+{
+  m_vertexSource = readFile(_vertex);
+  m_fragmentSource = readFile(_fragment);
+}
+
+uint32_t ShaderVariants::features(const mtlItem &_material)
+{
+  uint32_t features = 0;
+  if (_material.map_Kd.size() != 0)
+  {
+    features |= DiffuseMap;
+  }
+  // the mask textures are used as cut outs
+  if (_material.map_d.size() != 0)
+  {
+    features |= AlphaMap | AlphaTest;
+  }
+  if (_material.map_bump.size() != 0)
+  {
+    features |= BumpMap;
+  }
+  if (_material.d < 1.0f)
+  {
+    features |= Transparent;
+  }
+  return features;
+}
+
+std::string ShaderVariants::defines(uint32_t _features)
+{
+  std::string defines;
+  if (_features & DiffuseMap)
+    defines += "#define HAS_DIFFUSE_MAP 1\n";
+  if (_features & AlphaMap)
+    defines += "#define HAS_ALPHA_MAP 1\n";
+  if (_features & AlphaTest)
+    defines += "#define ALPHA_TEST 1\n";
+  if (_features & BumpMap)
+    defines += "#define HAS_BUMP_MAP 1\n";
+  if (_features & Transparent)
+    defines += "#define TRANSPARENT 1\n";
+  return defines;
+}
+
+void ShaderVariants::memoryUsage(MemoryReport &io_report) const
+{
+  size_t cpuBytes = sourceBytes() + m_baseName.capacity();
+  size_t gpuBytes = 0;
+  for (auto &program : m_programs)
+  {
+    cpuBytes += program.second.capacity() + sizeof(program);
+    if (program.second.empty())
+    {
+      continue;
+    }
+    // the driver's own copy isn't visible so use the binary size, it is 0 if the binary was not kept
+    GLint length = 0;
+    glGetProgramiv(ngl::ShaderLib::getProgramID(program.second), GL_PROGRAM_BINARY_LENGTH, &length);
+    gpuBytes += static_cast<size_t>(length);
+  }
+  io_report.add("shaders", m_baseName + " (" + std::to_string(m_programs.size()) + " variants)", cpuBytes, gpuBytes);
+}
+
+const std::string &ShaderVariants::use(uint32_t _features)
+{
+  auto found = m_programs.find(_features);
+  const std::string &name = found != m_programs.end() ? found->second : build(_features);
+  if (name.size() != 0)
+  {
+    ngl::ShaderLib::use(name);
+  }
+  return name;
+}
+
+void ShaderVariants::precompile(const Mtl &_mtl)
+{
+  for (auto &material : _mtl)
+  {
+    uint32_t key = features(*material.second);
+    if (m_programs.find(key) == m_programs.end())
+    {
+      build(key);
+    }
+  }
+  if (trace::verbose())
+  {
+    std::ostringstream message;
+    message << "built " << m_programs.size() << " shader variants in " << m_buildTime << " ms\n";
+    trace::print(message.str());
+  }
+}
+
+const std::string &ShaderVariants::build(uint32_t _features)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  std::stringstream key;
+  key << m_baseName << '_' << std::hex << _features;
+  std::string program = key.str();
+  std::string vertex = program + "Vertex";
+  std::string fragment = program + "Fragment";
+  std::string defines = ShaderVariants::defines(_features);
+  TRACE_SCOPE("build ", program, "shader");
+
+  std::string vertexSource = insertDefines(m_vertexSource, defines);
+  std::string fragmentSource = insertDefines(m_fragmentSource, defines);
+
+  ngl::ShaderLib::createShaderProgram(program, ngl::ErrorExit::OFF);
+  uint64_t cacheKey = m_cache != nullptr ? m_cache->key({vertexSource, fragmentSource}) : 0;
+  bool ok = m_cache != nullptr && m_cache->load(program, cacheKey);
+  if (!ok)
+  {
+    ngl::ShaderLib::attachShader(vertex, ngl::ShaderType::VERTEX, ngl::ErrorExit::OFF);
+    ngl::ShaderLib::attachShader(fragment, ngl::ShaderType::FRAGMENT, ngl::ErrorExit::OFF);
+    ngl::ShaderLib::loadShaderSourceFromString(vertex, vertexSource);
+    ngl::ShaderLib::loadShaderSourceFromString(fragment, fragmentSource);
+    ok = ngl::ShaderLib::compileShader(vertex) && ngl::ShaderLib::compileShader(fragment);
+    if (ok)
+    {
+      ngl::ShaderLib::attachShaderToProgram(program, vertex);
+      ngl::ShaderLib::attachShaderToProgram(program, fragment);
+      if (m_cache != nullptr)
+      {
+        m_cache->prepare(program);
+      }
+      ok = ngl::ShaderLib::linkProgramObject(program);
+      if (ok && m_cache != nullptr)
+      {
+        m_cache->save(program, cacheKey);
+      }
+    }
+  }
+  if (!ok)
+  {
+    std::cerr << "failed to build shader variant " << program << " with\n" << defines;
+    program.clear();
+  }
+  else
+  {
+    // the samplers live on fixed units so they only need setting once
+    ngl::ShaderLib::use(program);
+    if (_features & DiffuseMap)
+      ngl::ShaderLib::setUniform("tex", 0);
+    if (_features & AlphaMap)
+      ngl::ShaderLib::setUniform("alphaTex", 1);
+    if (_features & BumpMap)
+      ngl::ShaderLib::setUniform("bumpTex", 2);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  m_buildTime += std::chrono::duration<double, std::milli>(end - start).count();
+  return m_programs[_features] = program;
+}
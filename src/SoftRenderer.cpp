@@ -0,0 +1,543 @@
+#include "SoftRenderer.h"
+#include "Parallel.h"
+#include "SIMD.h"
+#include <ngl/Image.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+using namespace simd;
+
+namespace
+{
+constexpr int c_tileSize = 64;
+constexpr size_t c_chunkSize = 8192;
+// the same grey as glClearColor in NGLScene
+constexpr float c_clear[4] = {0.4f, 0.4f, 0.4f, 1.0f};
+} // end anon namespace
+
+SoftRenderer::SoftRenderer(const GroupedObj &_mesh, const Mtl &_mtl, int _width, int _height)
+    : m_mesh(_mesh), m_width(_width), m_height(_height)
+{
+  m_tilesX = (m_width + c_tileSize - 1) / c_tileSize;
+  m_tilesY = (m_height + c_tileSize - 1) / c_tileSize;
+  m_colour.resize(static_cast<size_t>(m_width) * m_height * 4);
+  m_depth.resize(static_cast<size_t>(m_width) * m_height);
+
+  // build the draw list in the same order as NGLScene::paintGL, groups with no material are skipped
+  std::unordered_map<std::string, uint32_t> materialIndex;
+  for (size_t i = 0; i < m_mesh.numMeshes(); ++i)
+  {
+    auto &data = m_mesh.getMeshData(i);
+    auto found = materialIndex.find(data.m_material);
+    if (found == materialIndex.end())
+    {
+      mtlItem *item = _mtl.find(data.m_material);
+      if (item == nullptr)
+      {
+        continue;
+      }
+      Material m;
+      m.m_ka[0] = item->Ka.m_x;
+      m.m_ka[1] = item->Ka.m_y;
+      m.m_ka[2] = item->Ka.m_z;
+      m.m_d = item->d;
+      if (item->map_Ka.size() != 0)
+      {
+        m.m_texture = loadTexture(item->map_Ka);
+      }
+      found = materialIndex.insert({data.m_material, static_cast<uint32_t>(m_materials.size())}).first;
+      m_materials.push_back(m);
+    }
+    uint32_t first = static_cast<uint32_t>(data.m_startIndex / 3);
+    uint32_t count = static_cast<uint32_t>(data.m_numVerts / 3);
+    for (uint32_t t = first; t < first + count; ++t)
+    {
+      m_drawTris.push_back(t);
+      m_drawMaterial.push_back(found->second);
+    }
+  }
+  size_t chunks = (m_drawTris.size() + c_chunkSize - 1) / c_chunkSize;
+  m_setup.resize(chunks);
+  m_bins.resize(chunks);
+  for (auto &b : m_bins)
+  {
+    b.resize(static_cast<size_t>(m_tilesX) * m_tilesY);
+  }
+}
+
+const SoftRenderer::Texture *SoftRenderer::loadTexture(const std::string &_name)
+{
+  auto found = m_textures.find(_name);
+  if (found != m_textures.end())
+  {
+    return found->second.get();
+  }
+  ngl::Image image;
+  if (image.load(_name) == false || image.width() == 0)
+  {
+    std::cerr << "SoftRenderer could not load texture " << _name << '\n';
+    m_textures[_name] = nullptr;
+    return nullptr;
+  }
+  auto tex = std::make_unique<Texture>();
+  int w = static_cast<int>(image.width());
+  int h = static_cast<int>(image.height());
+  int channels = image.channels();
+  const unsigned char *src = image.getPixels();
+  // level 0 as RGBA8, rows in the same order as the GL upload so v=0 is the first row
+  std::vector<unsigned char> level(static_cast<size_t>(w) * h * 4);
+  for (size_t p = 0; p < static_cast<size_t>(w) * h; ++p)
+  {
+    level[p * 4 + 0] = src[p * channels + 0];
+    level[p * 4 + 1] = channels > 1 ? src[p * channels + 1] : src[p * channels];
+    level[p * 4 + 2] = channels > 2 ? src[p * channels + 2] : src[p * channels];
+    level[p * 4 + 3] = channels > 3 ? src[p * channels + 3] : 255;
+  }
+  tex->m_width.push_back(w);
+  tex->m_height.push_back(h);
+  tex->m_mips.push_back(std::move(level));
+  // box filter down to 1x1
+  while (w > 1 || h > 1)
+  {
+    int nw = std::max(1, w / 2);
+    int nh = std::max(1, h / 2);
+    const auto &prev = tex->m_mips.back();
+    std::vector<unsigned char> next(static_cast<size_t>(nw) * nh * 4);
+    for (int y = 0; y < nh; ++y)
+    {
+      int y0 = std::min(h - 1, y * 2);
+      int y1 = std::min(h - 1, y * 2 + 1);
+      for (int x = 0; x < nw; ++x)
+      {
+        int x0 = std::min(w - 1, x * 2);
+        int x1 = std::min(w - 1, x * 2 + 1);
+        for (int c = 0; c < 4; ++c)
+        {
+          int sum = prev[(y0 * w + x0) * 4 + c] + prev[(y0 * w + x1) * 4 + c] + prev[(y1 * w + x0) * 4 + c] + prev[(y1 * w + x1) * 4 + c];
+          next[(y * nw + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+        }
+      }
+    }
+    w = nw;
+    h = nh;
+    tex->m_width.push_back(w);
+    tex->m_height.push_back(h);
+    tex->m_mips.push_back(std::move(next));
+  }
+  const Texture *result = tex.get();
+  m_textures[_name] = std::move(tex);
+  return result;
+}
+
+void SoftRenderer::render(const ngl::Mat4 &_mvp, unsigned int _threads)
+{
+  // vertex shader, gl_Position = MVP * vec4(inVert,1.0) and pass the uv through
+  auto &verts = m_mesh.vertexData();
+  m_clipVerts.resize(verts.size());
+  const auto &m = _mvp.m_m;
+  parallel::forEach(0, verts.size(), [&](size_t i)
+  {
+    const VertData &v = verts[i];
+    ClipVert &c = m_clipVerts[i];
+    c.x = m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z + m[3][0];
+    c.y = m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z + m[3][1];
+    c.z = m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z + m[3][2];
+    c.w = m[0][3] * v.x + m[1][3] * v.y + m[2][3] * v.z + m[3][3];
+    c.u = v.u;
+    c.v = v.v;
+  }, _threads, 4096);
+
+  // clip, set up and bin each chunk of triangles
+  parallel::forEach(0, m_setup.size(), [this](size_t _chunk) { setupTriangles(_chunk); }, _threads, 1);
+  m_trianglesDrawn = 0;
+  for (auto &s : m_setup)
+  {
+    m_trianglesDrawn += s.size();
+  }
+
+  // raster and shade each tile
+  parallel::forEach(0, static_cast<size_t>(m_tilesX) * m_tilesY, [this](size_t _tile) { rasterTile(_tile); }, _threads, 1);
+}
+
+void SoftRenderer::setupTriangles(size_t _chunk)
+{
+  m_setup[_chunk].clear();
+  for (auto &bin : m_bins[_chunk])
+  {
+    bin.clear();
+  }
+  size_t begin = _chunk * c_chunkSize;
+  size_t end = std::min(m_drawTris.size(), begin + c_chunkSize);
+  for (size_t i = begin; i < end; ++i)
+  {
+    const ClipVert *v = &m_clipVerts[m_drawTris[i] * 3];
+    // trivial reject if all the verts are outside the same plane
+    bool outside = false;
+    for (int axis = 0; axis < 3 && !outside; ++axis)
+    {
+      auto coord = [axis](const ClipVert &_c) { return axis == 0 ? _c.x : (axis == 1 ? _c.y : _c.z); };
+      outside = (coord(v[0]) > v[0].w && coord(v[1]) > v[1].w && coord(v[2]) > v[2].w) ||
+                (coord(v[0]) < -v[0].w && coord(v[1]) < -v[1].w && coord(v[2]) < -v[2].w);
+    }
+    if (outside)
+    {
+      continue;
+    }
+    // clip against the near plane (z >= -w), this can give a quad which we fan into two triangles
+    if (v[0].z >= -v[0].w && v[1].z >= -v[1].w && v[2].z >= -v[2].w)
+    {
+      setupClipped(v, m_drawMaterial[i], _chunk);
+      continue;
+    }
+    ClipVert poly[4];
+    int count = 0;
+    for (int e = 0; e < 3; ++e)
+    {
+      const ClipVert &a = v[e];
+      const ClipVert &b = v[(e + 1) % 3];
+      float da = a.z + a.w;
+      float db = b.z + b.w;
+      if (da >= 0.0f)
+      {
+        poly[count++] = a;
+      }
+      if ((da >= 0.0f) != (db >= 0.0f))
+      {
+        float t = da / (da - db);
+        ClipVert &c = poly[count++];
+        c.x = a.x + (b.x - a.x) * t;
+        c.y = a.y + (b.y - a.y) * t;
+        c.z = a.z + (b.z - a.z) * t;
+        c.w = a.w + (b.w - a.w) * t;
+        c.u = a.u + (b.u - a.u) * t;
+        c.v = a.v + (b.v - a.v) * t;
+      }
+    }
+    for (int t = 1; t + 1 < count; ++t)
+    {
+      ClipVert tri[3] = {poly[0], poly[t], poly[t + 1]};
+      setupClipped(tri, m_drawMaterial[i], _chunk);
+    }
+  }
+}
+
+void SoftRenderer::setupClipped(const ClipVert *_v, uint32_t _material, size_t _chunk)
+{
+  // perspective divide and viewport, y flipped so row 0 is the top of the image
+  float sx[3], sy[3];
+  SetupTri tri;
+  for (int i = 0; i < 3; ++i)
+  {
+    float q = 1.0f / _v[i].w;
+    sx[i] = (_v[i].x * q * 0.5f + 0.5f) * m_width;
+    sy[i] = (0.5f - _v[i].y * q * 0.5f) * m_height;
+    tri.m_z[i] = _v[i].z * q * 0.5f + 0.5f;
+    tri.m_q[i] = q;
+    tri.m_uq[i] = _v[i].u * q;
+    tri.m_vq[i] = _v[i].v * q;
+  }
+  float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+  if (std::fabs(area) < 1e-8f)
+  {
+    return;
+  }
+  // no back face culling in the GL version so just flip the winding to make the area positive
+  if (area < 0.0f)
+  {
+    std::swap(sx[1], sx[2]);
+    std::swap(sy[1], sy[2]);
+    std::swap(tri.m_z[1], tri.m_z[2]);
+    std::swap(tri.m_q[1], tri.m_q[2]);
+    std::swap(tri.m_uq[1], tri.m_uq[2]);
+    std::swap(tri.m_vq[1], tri.m_vq[2]);
+    area = -area;
+  }
+  tri.m_minX = std::max(0, static_cast<int>(std::floor(std::min(sx[0], std::min(sx[1], sx[2])))));
+  tri.m_minY = std::max(0, static_cast<int>(std::floor(std::min(sy[0], std::min(sy[1], sy[2])))));
+  tri.m_maxX = std::min(m_width - 1, static_cast<int>(std::ceil(std::max(sx[0], std::max(sx[1], sx[2])))));
+  tri.m_maxY = std::min(m_height - 1, static_cast<int>(std::ceil(std::max(sy[0], std::max(sy[1], sy[2])))));
+  if (tri.m_minX > tri.m_maxX || tri.m_minY > tri.m_maxY)
+  {
+    return;
+  }
+  // edge i is opposite vertex i so E_i / area is the barycentric weight of vertex i
+  float invArea = 1.0f / area;
+  float A[3], B[3], C[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    int a = (i + 1) % 3;
+    int b = (i + 2) % 3;
+    A[i] = sy[a] - sy[b];
+    B[i] = sx[b] - sx[a];
+    C[i] = sx[a] * sy[b] - sx[b] * sy[a];
+    tri.m_edgeA[i] = A[i];
+    tri.m_edgeB[i] = B[i];
+    tri.m_edgeC[i] = C[i];
+    // a shared edge has exactly negated coefficients in the neighbour, so this picks one owner for pixels on it
+    tri.m_inclusive[i] = A[i] > 0.0f || (A[i] == 0.0f && B[i] > 0.0f);
+  }
+  // turn the per vertex values into planes over the screen
+  auto makePlane = [&](float *io_values)
+  {
+    float a = 0.0f, b = 0.0f, c = 0.0f;
+    for (int i = 0; i < 3; ++i)
+    {
+      a += A[i] * io_values[i];
+      b += B[i] * io_values[i];
+      c += C[i] * io_values[i];
+    }
+    io_values[0] = a * invArea;
+    io_values[1] = b * invArea;
+    io_values[2] = c * invArea;
+  };
+  makePlane(tri.m_z);
+  makePlane(tri.m_q);
+  makePlane(tri.m_uq);
+  makePlane(tri.m_vq);
+  tri.m_material = _material;
+
+  auto &setup = m_setup[_chunk];
+  uint32_t index = static_cast<uint32_t>(setup.size());
+  setup.push_back(tri);
+  for (int ty = tri.m_minY / c_tileSize; ty <= tri.m_maxY / c_tileSize; ++ty)
+  {
+    for (int tx = tri.m_minX / c_tileSize; tx <= tri.m_maxX / c_tileSize; ++tx)
+    {
+      m_bins[_chunk][ty * m_tilesX + tx].push_back(index);
+    }
+  }
+}
+
+void SoftRenderer::rasterTile(size_t _tile)
+{
+  int x0 = static_cast<int>(_tile % m_tilesX) * c_tileSize;
+  int y0 = static_cast<int>(_tile / m_tilesX) * c_tileSize;
+  int x1 = std::min(m_width, x0 + c_tileSize);
+  int y1 = std::min(m_height, y0 + c_tileSize);
+  for (int y = y0; y < y1; ++y)
+  {
+    float *colour = &m_colour[(static_cast<size_t>(y) * m_width + x0) * 4];
+    float *depth = &m_depth[static_cast<size_t>(y) * m_width + x0];
+    for (int x = x0; x < x1; ++x)
+    {
+      std::copy(c_clear, c_clear + 4, colour);
+      colour += 4;
+      *depth++ = 1.0f;
+    }
+  }
+  for (size_t chunk = 0; chunk < m_setup.size(); ++chunk)
+  {
+    for (auto index : m_bins[chunk][_tile])
+    {
+      rasterTriangle(m_setup[chunk][index], x0, y0, x1, y1);
+    }
+  }
+}
+
+void SoftRenderer::rasterTriangle(const SetupTri &_tri, int _x0, int _y0, int _x1, int _y1)
+{
+  int minX = std::max(_x0, _tri.m_minX);
+  int maxX = std::min(_x1 - 1, _tri.m_maxX);
+  int minY = std::max(_y0, _tri.m_minY);
+  int maxY = std::min(_y1 - 1, _tri.m_maxY);
+  if (minX > maxX || minY > maxY)
+  {
+    return;
+  }
+  // start the 4 wide blocks on a multiple of 4 from the tile edge
+  minX = _x0 + ((minX - _x0) & ~3);
+  const Material &material = m_materials[_tri.m_material];
+  const Float4 zero(0.0f);
+  const Float4 laneOffset = Float4::set(0.5f, 1.5f, 2.5f, 3.5f);
+  Float4 edgeA[3], edgeB[3], edgeC[3];
+  for (int e = 0; e < 3; ++e)
+  {
+    edgeA[e] = Float4(_tri.m_edgeA[e]);
+    edgeB[e] = Float4(_tri.m_edgeB[e]);
+    edgeC[e] = Float4(_tri.m_edgeC[e]);
+  }
+  const Float4 zA(_tri.m_z[0]), zB(_tri.m_z[1]), zC(_tri.m_z[2]);
+  const Float4 qA(_tri.m_q[0]), qB(_tri.m_q[1]), qC(_tri.m_q[2]);
+  const Float4 uqA(_tri.m_uq[0]), uqB(_tri.m_uq[1]), uqC(_tri.m_uq[2]);
+  const Float4 vqA(_tri.m_vq[0]), vqB(_tri.m_vq[1]), vqC(_tri.m_vq[2]);
+  const Float4 one(1.0f);
+  const Float4 ka[3] = {Float4(material.m_ka[0]), Float4(material.m_ka[1]), Float4(material.m_ka[2])};
+  const Float4 d(material.m_d);
+  const Float4 texW(material.m_texture != nullptr ? static_cast<float>(material.m_texture->m_width[0]) : 0.0f);
+  const Float4 texH(material.m_texture != nullptr ? static_cast<float>(material.m_texture->m_height[0]) : 0.0f);
+  alignas(16) float zLane[4];
+  alignas(16) float uLane[4];
+  alignas(16) float vLane[4];
+  alignas(16) float rhoLane[4];
+  alignas(16) float texel[4][4];
+  alignas(16) float pixels[16];
+  for (int y = minY; y <= maxY; ++y)
+  {
+    Float4 py(y + 0.5f);
+    for (int x = minX; x <= maxX; x += 4)
+    {
+      Float4 px = Float4(static_cast<float>(x)) + laneOffset;
+      int covered = 0xf;
+      for (int e = 0; e < 3 && covered; ++e)
+      {
+        Float4 value = edgeA[e] * px + edgeB[e] * py + edgeC[e];
+        covered &= mask4(_tri.m_inclusive[e] ? (value >= zero) : (value > zero));
+      }
+      // lanes past the edge of the tile
+      int lanes = std::min(4, _x1 - x);
+      covered &= (1 << lanes) - 1;
+      if (covered == 0)
+      {
+        continue;
+      }
+      size_t pixel = static_cast<size_t>(y) * m_width + x;
+      Float4 z = zA * px + zB * py + zC;
+      // depth test GL_LESS, only load the lanes inside the image
+      alignas(16) float depth[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+      std::copy(&m_depth[pixel], &m_depth[pixel] + lanes, depth);
+      covered &= mask4(z < Float4::load(depth));
+      if (covered == 0)
+      {
+        continue;
+      }
+      z.store(zLane);
+      // perspective correct uv = (u/w) / (1/w)
+      Float4 invQ = one / (qA * px + qB * py + qC);
+      Float4 u = (uqA * px + uqB * py + uqC) * invQ;
+      Float4 v = (vqA * px + vqB * py + vqC) * invQ;
+      Float4 diffuse[4] = {zero, zero, zero, one};
+      if (material.m_texture != nullptr)
+      {
+        // analytic derivatives of u and v in texels to pick the mip level
+        Float4 dudx = (uqA - u * qA) * invQ * texW;
+        Float4 dudy = (uqB - u * qB) * invQ * texW;
+        Float4 dvdx = (vqA - v * qA) * invQ * texH;
+        Float4 dvdy = (vqB - v * qB) * invQ * texH;
+        max4(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy).store(rhoLane);
+        u.store(uLane);
+        v.store(vLane);
+        sample4(*material.m_texture, uLane, vLane, rhoLane, covered, texel);
+        for (int c = 0; c < 4; ++c)
+        {
+          diffuse[c] = Float4::load(texel[c]);
+        }
+        // the shader discards where the texture alpha is 0
+        covered &= mask4(diffuse[3] > zero);
+        if (covered == 0)
+        {
+          continue;
+        }
+      }
+      // fragColour = vec4(ka,transp)*diffuse blended with GL_ONE, GL_ONE_MINUS_SRC_ALPHA, the frame buffer is
+      // RGBA per pixel so it is turned into a register per channel to blend and back again
+      float *dst = &m_colour[pixel * 4];
+      std::fill(pixels, pixels + 16, 0.0f);
+      std::copy(dst, dst + lanes * 4, pixels);
+      Float4 r = Float4::load(pixels);
+      Float4 g = Float4::load(pixels + 4);
+      Float4 b = Float4::load(pixels + 8);
+      Float4 a = Float4::load(pixels + 12);
+      transpose4(r, g, b, a);
+      Float4 srcA = d * diffuse[3];
+      Float4 oneMinusAlpha = one - srcA;
+      r = ka[0] * diffuse[0] + r * oneMinusAlpha;
+      g = ka[1] * diffuse[1] + g * oneMinusAlpha;
+      b = ka[2] * diffuse[2] + b * oneMinusAlpha;
+      a = srcA + a * oneMinusAlpha;
+      transpose4(r, g, b, a);
+      r.store(pixels);
+      g.store(pixels + 4);
+      b.store(pixels + 8);
+      a.store(pixels + 12);
+      for (int lane = 0; lane < lanes; ++lane)
+      {
+        if (((covered >> lane) & 1) != 0)
+        {
+          std::copy(pixels + lane * 4, pixels + lane * 4 + 4, dst + lane * 4);
+          m_depth[pixel + lane] = zLane[lane];
+        }
+      }
+    }
+  }
+}
+
+void SoftRenderer::sample4(const Texture &_tex, const float _u[4], const float _v[4], const float _rho[4], int _covered,
+                           float o_rgba[4][4]) const
+{
+  // the corner texels of each lane and the filter weights, there is no gather so the addressing is per lane
+  alignas(16) float t00[4][4] = {}, t10[4][4] = {}, t01[4][4] = {}, t11[4][4] = {};
+  alignas(16) float weightX[4] = {}, weightY[4] = {};
+  int maxLevel = static_cast<int>(_tex.m_mips.size()) - 1;
+  for (int lane = 0; lane < 4; ++lane)
+  {
+    if (((_covered >> lane) & 1) == 0)
+    {
+      continue;
+    }
+    float lod = _rho[lane] > 1.0f ? 0.5f * std::log2(_rho[lane]) : 0.0f;
+    int level = std::min(maxLevel, static_cast<int>(lod + 0.5f));
+    int w = _tex.m_width[level];
+    int h = _tex.m_height[level];
+    const unsigned char *texels = _tex.m_mips[level].data();
+    // GL_REPEAT wrapping with the texel centres at +0.5
+    float x = (_u[lane] - std::floor(_u[lane])) * w - 0.5f;
+    float y = (_v[lane] - std::floor(_v[lane])) * h - 0.5f;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    weightX[lane] = x - fx;
+    weightY[lane] = y - fy;
+    int x0 = (static_cast<int>(fx) % w + w) % w;
+    int y0 = (static_cast<int>(fy) % h + h) % h;
+    int x1 = (x0 + 1) % w;
+    int y1 = (y0 + 1) % h;
+    const unsigned char *p00 = &texels[(y0 * w + x0) * 4];
+    const unsigned char *p10 = &texels[(y0 * w + x1) * 4];
+    const unsigned char *p01 = &texels[(y1 * w + x0) * 4];
+    const unsigned char *p11 = &texels[(y1 * w + x1) * 4];
+    for (int c = 0; c < 4; ++c)
+    {
+      t00[c][lane] = p00[c];
+      t10[c][lane] = p10[c];
+      t01[c][lane] = p01[c];
+      t11[c][lane] = p11[c];
+    }
+  }
+  Float4 tx = Float4::load(weightX);
+  Float4 ty = Float4::load(weightY);
+  const Float4 scale(1.0f / 255.0f);
+  for (int c = 0; c < 4; ++c)
+  {
+    Float4 a = Float4::load(t00[c]);
+    Float4 b = Float4::load(t01[c]);
+    Float4 top = a + (Float4::load(t10[c]) - a) * tx;
+    Float4 bottom = b + (Float4::load(t11[c]) - b) * tx;
+    ((top + (bottom - top) * ty) * scale).store(o_rgba[c]);
+  }
+}
+
+bool SoftRenderer::writeImage(const std::string &_fname) const
+{
+  std::ofstream fileOut(_fname, std::ios::out | std::ios::binary);
+  if (!fileOut.is_open())
+  {
+    std::cerr << "File : " << _fname << " could not be written for output\n";
+    return false;
+  }
+  fileOut << "P6\n" << m_width << ' ' << m_height << "\n255\n";
+  std::vector<unsigned char> row(static_cast<size_t>(m_width) * 3);
+  for (int y = 0; y < m_height; ++y)
+  {
+    for (int x = 0; x < m_width; ++x)
+    {
+      const float *c = &m_colour[(static_cast<size_t>(y) * m_width + x) * 4];
+      for (int i = 0; i < 3; ++i)
+      {
+        row[x * 3 + i] = static_cast<unsigned char>(std::clamp(c[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+      }
+    }
+    fileOut.write(reinterpret_cast<const char *>(row.data()), static_cast<std::streamsize>(row.size()));
+  }
+  return true;
+}
@@ -0,0 +1,294 @@
+#include "TaskGraph.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+/// @brief the worker the calling thread is, so tasks it readies go on its own queue
+constexpr size_t c_noWorker = ~size_t(0);
+thread_local size_t t_worker = c_noWorker;
+/// @brief the graph and task running on this thread, a task added while it runs is on its critical path
+thread_local const TaskGraph *t_graph = nullptr;
+thread_local size_t t_task = 0;
+} // end anon namespace
+
+TaskGraph::TaskId TaskGraph::add(std::string _name, Affinity _affinity, std::function<bool()> _func,
+                                 const std::vector<TaskId> &_dependencies)
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  TaskId id = m_tasks.size();
+  auto task = std::make_unique<Task>();
+  task->m_name = std::move(_name);
+  task->m_affinity = _affinity;
+  task->m_func = std::move(_func);
+  if (t_graph == this)
+  {
+    task->m_parent = t_task;
+  }
+  for (auto dependency : _dependencies)
+  {
+    if (dependency >= id)
+    {
+      std::cerr << "task " << task->m_name << " depends on a task that doesn't exist\n";
+      continue;
+    }
+    Task &before = *m_tasks[dependency];
+    task->m_dependencies.push_back(dependency);
+    if (before.m_done)
+    {
+      task->m_failed = task->m_failed || before.m_failed;
+    }
+    else
+    {
+      before.m_successors.push_back(id);
+      ++task->m_waiting;
+    }
+  }
+  bool ready = task->m_waiting == 0;
+  m_tasks.push_back(std::move(task));
+  ++m_unfinished;
+  // tasks added before run are queued when it starts
+  if (m_running && ready)
+  {
+    scheduleLocked(id, t_worker);
+  }
+  return id;
+}
+
+void TaskGraph::scheduleLocked(TaskId _id, size_t _worker)
+{
+  if (m_tasks[_id]->m_affinity == Affinity::Main)
+  {
+    m_mainQueue.push_back(_id);
+  }
+  else
+  {
+    // the calling thread only runs Any tasks when there are no workers
+    size_t workers = m_queues.size();
+    if (_worker >= workers || (_worker == 0 && workers > 1))
+    {
+      _worker = workers > 1 ? 1 + (m_nextQueue++ % (workers - 1)) : 0;
+    }
+    m_queues[_worker].push_back(_id);
+  }
+  m_wake.notify_all();
+}
+
+bool TaskGraph::takeLocked(size_t _worker, TaskId &o_id)
+{
+  if (_worker == 0)
+  {
+    if (!m_mainQueue.empty())
+    {
+      o_id = m_mainQueue.front();
+      m_mainQueue.pop_front();
+      return true;
+    }
+    if (m_queues.size() > 1)
+    {
+      return false;
+    }
+  }
+  // newest of our own first, it is most likely to use what we just made
+  auto &own = m_queues[_worker];
+  if (!own.empty())
+  {
+    o_id = own.back();
+    own.pop_back();
+    return true;
+  }
+  // otherwise steal the oldest task of another worker
+  for (size_t i = 1; i < m_queues.size(); ++i)
+  {
+    auto &victim = m_queues[(_worker + i) % m_queues.size()];
+    if (!victim.empty())
+    {
+      o_id = victim.front();
+      victim.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskGraph::execute(TaskId _id, Task &io_task, size_t _worker)
+{
+  io_task.m_start = trace::now();
+  bool ok = false;
+  if (!io_task.m_failed)
+  {
+    t_graph = this;
+    t_task = _id;
+    ok = io_task.m_func();
+    t_graph = nullptr;
+    if (!ok)
+    {
+      std::cerr << "task " << io_task.m_name << " failed\n";
+    }
+  }
+  io_task.m_end = trace::now();
+  if (trace::enabled() && !io_task.m_failed)
+  {
+    trace::record(io_task.m_name, "task", io_task.m_start, io_task.m_end - io_task.m_start);
+  }
+  // the captures may hold big things such as decoded images, let them go now
+  io_task.m_func = nullptr;
+
+  std::lock_guard<std::mutex> lock(m_lock);
+  io_task.m_done = true;
+  io_task.m_failed = !ok;
+  m_failed = m_failed || !ok;
+  for (auto id : io_task.m_successors)
+  {
+    Task &next = *m_tasks[id];
+    next.m_failed = next.m_failed || !ok;
+    if (--next.m_waiting == 0)
+    {
+      scheduleLocked(id, _worker);
+    }
+  }
+  if (--m_unfinished == 0)
+  {
+    m_wake.notify_all();
+  }
+}
+
+void TaskGraph::workerLoop(size_t _worker)
+{
+  size_t previous = t_worker;
+  t_worker = _worker;
+  for (;;)
+  {
+    Task *task = nullptr;
+    TaskId id = 0;
+    {
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_wake.wait(lock, [&]() { return m_unfinished == 0 || takeLocked(_worker, id); });
+      if (m_unfinished == 0)
+      {
+        break;
+      }
+      task = m_tasks[id].get();
+    }
+    execute(id, *task, _worker);
+  }
+  t_worker = previous;
+}
+
+bool TaskGraph::run(unsigned int _threads)
+{
+  unsigned int workers = _threads != 0 ? _threads : parallel::numThreads() - 1;
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_queues.assign(workers + 1, std::deque<TaskId>());
+    m_running = true;
+    m_failed = false;
+    m_runStart = trace::now();
+    for (TaskId id = 0; id < m_tasks.size(); ++id)
+    {
+      if (!m_tasks[id]->m_done && m_tasks[id]->m_waiting == 0)
+      {
+        scheduleLocked(id, id);
+      }
+    }
+  }
+  std::vector<std::thread> pool;
+  for (unsigned int w = 1; w <= workers; ++w)
+  {
+    pool.emplace_back([this, w]()
+    {
+      trace::setThreadName("task worker " + std::to_string(w));
+      workerLoop(w);
+    });
+  }
+  workerLoop(0);
+  for (auto &t : pool)
+  {
+    t.join();
+  }
+  bool failed;
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_running = false;
+    m_runEnd = trace::now();
+    failed = m_failed;
+  }
+  if (trace::enabled())
+  {
+    // recorded from a thread of its own so the chain gets its own row in the timeline
+    std::thread critical([this]()
+    {
+      trace::setThreadName("critical path");
+      for (auto id : criticalPath())
+      {
+        const Task &task = *m_tasks[id];
+        trace::record(task.m_name, "critical", task.m_start, task.m_end - task.m_start);
+      }
+    });
+    critical.join();
+  }
+  return !failed;
+}
+
+std::vector<TaskGraph::TaskId> TaskGraph::criticalPath() const
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  std::vector<TaskId> path;
+  auto later = [this](TaskId _a, TaskId _b) { return m_tasks[_a]->m_end < m_tasks[_b]->m_end; };
+  // start from whatever finished last and walk back through the dependency each task waited for longest, a
+  // task added by another counts the one that added it as a dependency
+  std::vector<TaskId> candidates;
+  for (TaskId id = 0; id < m_tasks.size(); ++id)
+  {
+    if (m_tasks[id]->m_done)
+    {
+      candidates.push_back(id);
+    }
+  }
+  while (!candidates.empty())
+  {
+    TaskId last = *std::max_element(candidates.begin(), candidates.end(), later);
+    path.push_back(last);
+    candidates = m_tasks[last]->m_dependencies;
+    if (m_tasks[last]->m_parent != c_noTask)
+    {
+      candidates.push_back(m_tasks[last]->m_parent);
+    }
+  }
+  std::reverse(path.begin(), path.end());
+  return path;
+}
+
+void TaskGraph::printCriticalPath(std::ostream &_out) const
+{
+  auto path = criticalPath();
+  std::lock_guard<std::mutex> lock(m_lock);
+  int64_t busy = 0;
+  for (auto &task : m_tasks)
+  {
+    busy += task->m_end - task->m_start;
+  }
+  int64_t pathTime = 0;
+  for (auto id : path)
+  {
+    pathTime += m_tasks[id]->m_end - m_tasks[id]->m_start;
+  }
+  // formatted on its own stream so the caller's precision and flags are left alone
+  std::ostringstream text;
+  text << std::fixed << std::setprecision(1) << "task graph " << m_tasks.size() << " tasks in "
+       << (m_runEnd - m_runStart) / 1000.0 << " ms, " << busy / 1000.0 << " ms of work on " << m_queues.size()
+       << " threads\ncritical path " << pathTime / 1000.0 << " ms of work\n";
+  for (auto id : path)
+  {
+    const Task &task = *m_tasks[id];
+    text << "  " << std::setw(9) << (task.m_start - m_runStart) / 1000.0 << " ms +" << std::setw(8)
+         << (task.m_end - task.m_start) / 1000.0 << " ms " << (task.m_affinity == Affinity::Main ? "[gl] " : "")
+         << task.m_name << '\n';
+  }
+  _out << text.str();
+}
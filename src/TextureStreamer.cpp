@@ -0,0 +1,511 @@
+#include "TextureStreamer.h"
+#include "Trace.h"
+#include <ngl/Image.h>
+#include <ngl/Vec4.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+
+namespace
+{
+constexpr size_t c_numPbos = 3;
+
+int numLevels(int _width, int _height)
+{
+  return 1 + static_cast<int>(std::floor(std::log2(static_cast<float>(std::max(_width, _height)))));
+}
+
+int tailLevel(int _width, int _height, int _levels, int _tailSize)
+{
+  int level = 0;
+  while (level < _levels - 1 && std::max(_width >> level, _height >> level) > _tailSize)
+  {
+    ++level;
+  }
+  return level;
+}
+
+// 2x2 box filter of RGBA8, odd edges repeat the last row / column
+void downsample(const std::vector<unsigned char> &_src, int _width, int _height, std::vector<unsigned char> &o_dst)
+{
+  int width = std::max(1, _width / 2);
+  int height = std::max(1, _height / 2);
+  o_dst.resize(static_cast<size_t>(width) * height * 4);
+  for (int y = 0; y < height; ++y)
+  {
+    int y0 = std::min(y * 2, _height - 1);
+    int y1 = std::min(y * 2 + 1, _height - 1);
+    for (int x = 0; x < width; ++x)
+    {
+      int x0 = std::min(x * 2, _width - 1);
+      int x1 = std::min(x * 2 + 1, _width - 1);
+      for (int c = 0; c < 4; ++c)
+      {
+        unsigned int sum = _src[(static_cast<size_t>(y0) * _width + x0) * 4 + c] +
+                           _src[(static_cast<size_t>(y0) * _width + x1) * 4 + c] +
+                           _src[(static_cast<size_t>(y1) * _width + x0) * 4 + c] +
+                           _src[(static_cast<size_t>(y1) * _width + x1) * 4 + c];
+        o_dst[(static_cast<size_t>(y) * width + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+float boxDistance(const ngl::Vec3 &_p, const ngl::Vec3 &_min, const ngl::Vec3 &_max)
+{
+  float dx = std::max({_min.m_x - _p.m_x, 0.0f, _p.m_x - _max.m_x});
+  float dy = std::max({_min.m_y - _p.m_y, 0.0f, _p.m_y - _max.m_y});
+  float dz = std::max({_min.m_z - _p.m_z, 0.0f, _p.m_z - _max.m_z});
+  return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+} // end anon namespace
+
+TextureStreamer::TextureStreamer(const StreamSettings &_settings) : m_settings(_settings)
+{
+  m_pbos.resize(c_numPbos);
+  glGenBuffers(static_cast<GLsizei>(m_pbos.size()), m_pbos.data());
+  m_thread = std::thread(&TextureStreamer::decodeLoop, this);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+  for (auto &t : m_textures)
+  {
+    glDeleteTextures(1, &t.m_id);
+  }
+  glDeleteBuffers(static_cast<GLsizei>(m_pbos.size()), m_pbos.data());
+}
+
+GLuint TextureStreamer::add(const std::string &_path)
+{
+  Texture t;
+  t.m_path = _path;
+  glGenTextures(1, &t.m_id);
+  glBindTexture(GL_TEXTURE_2D, t.m_id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  m_textures.push_back(t);
+  // ask for the tail straight away, the size isn't known until the image is decoded
+  request(m_textures.size() - 1, -1, -1);
+  return t.m_id;
+}
+
+void TextureStreamer::setGroups(const GroupedObj &_mesh, const Mtl &_mtl)
+{
+  std::unordered_map<GLuint, size_t> byID;
+  for (size_t i = 0; i < m_textures.size(); ++i)
+  {
+    byID[m_textures[i].m_id] = i;
+  }
+  const auto &verts = _mesh.vertexData();
+  m_groups.clear();
+  m_groups.resize(_mesh.numMeshes());
+  for (size_t i = 0; i < m_groups.size(); ++i)
+  {
+    Group &group = m_groups[i];
+    const MeshData &mesh = _mesh.getMeshData(i);
+    constexpr float big = std::numeric_limits<float>::max();
+    group.m_min = ngl::Vec3(big, big, big);
+    group.m_max = ngl::Vec3(-big, -big, -big);
+    double area = 0.0;
+    double uvArea = 0.0;
+    for (size_t v = mesh.m_startIndex; v + 2 < mesh.m_startIndex + mesh.m_numVerts; v += 3)
+    {
+      const VertData &a = verts[v];
+      const VertData &b = verts[v + 1];
+      const VertData &c = verts[v + 2];
+      for (const VertData *p : {&a, &b, &c})
+      {
+        group.m_min = ngl::Vec3(std::min(group.m_min.m_x, p->x), std::min(group.m_min.m_y, p->y), std::min(group.m_min.m_z, p->z));
+        group.m_max = ngl::Vec3(std::max(group.m_max.m_x, p->x), std::max(group.m_max.m_y, p->y), std::max(group.m_max.m_z, p->z));
+      }
+      ngl::Vec3 e1(b.x - a.x, b.y - a.y, b.z - a.z);
+      ngl::Vec3 e2(c.x - a.x, c.y - a.y, c.z - a.z);
+      area += 0.5 * e1.cross(e2).length();
+      uvArea += 0.5 * std::abs((b.u - a.u) * (c.v - a.v) - (c.u - a.u) * (b.v - a.v));
+    }
+    group.m_uvDensity = area > 0.0 ? static_cast<float>(uvArea / area) : 0.0f;
+
+    mtlItem *material = _mtl.find(_mesh.getMaterial(static_cast<unsigned int>(i)));
+    if (material == nullptr)
+    {
+      continue;
+    }
+    for (GLuint id : {material->map_KaId, material->map_KdId, material->map_dId, material->map_bumpId, material->bumpId})
+    {
+      auto found = byID.find(id);
+      if (found != byID.end() &&
+          std::find(group.m_textures.begin(), group.m_textures.end(), found->second) == group.m_textures.end())
+      {
+        group.m_textures.push_back(found->second);
+      }
+    }
+  }
+}
+
+void TextureStreamer::request(size_t _texture, int _first, int _last)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_requests.push_back({_texture, m_textures[_texture].m_path, _first, _last});
+  }
+  // the tail request doesn't know its first level yet, any value >= 0 marks it outstanding
+  m_textures[_texture].m_requested = std::max(_first, 0);
+  ++m_outstanding;
+  m_wake.notify_one();
+}
+
+void TextureStreamer::decodeLoop()
+{
+  trace::setThreadName("texture decode");
+  while (true)
+  {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_wake.wait(lock, [this]() { return m_quit || !m_requests.empty(); });
+      if (m_quit)
+      {
+        return;
+      }
+      request = std::move(m_requests.front());
+      m_requests.pop_front();
+    }
+    decode(request);
+  }
+}
+
+void TextureStreamer::decode(const Request &_request)
+{
+  TRACE_SCOPE("decode ", _request.m_path, "texture");
+  std::vector<Level> levels;
+  ngl::Image image;
+  if (!image.load(_request.m_path) || image.width() == 0 || image.height() == 0)
+  {
+    std::cerr << "TextureStreamer could not load " << _request.m_path << '\n';
+    levels.push_back({_request.m_texture, -1, 0, 0, 0, 0, true, {}});
+  }
+  else
+  {
+    int width = static_cast<int>(image.width());
+    int height = static_cast<int>(image.height());
+    int count = numLevels(width, height);
+    int first = _request.m_first < 0 ? tailLevel(width, height, count, m_settings.tailSize) : _request.m_first;
+    int last = _request.m_last < 0 ? count - 1 : std::min(_request.m_last, count - 1);
+    // expand to RGBA so every level is uploaded the same way
+    int channels = image.channels();
+    const unsigned char *src = image.getPixels();
+    std::vector<unsigned char> level(static_cast<size_t>(width) * height * 4);
+    for (size_t p = 0; p < static_cast<size_t>(width) * height; ++p)
+    {
+      for (int c = 0; c < 4; ++c)
+      {
+        level[p * 4 + c] = c < channels ? src[p * channels + c] : (c == 3 ? 255 : src[p * channels]);
+      }
+    }
+    int w = width;
+    int h = height;
+    for (int l = 0; l <= last; ++l)
+    {
+      if (l >= first)
+      {
+        levels.push_back({_request.m_texture, l, w, h, width, height, false, level});
+      }
+      if (l < last)
+      {
+        std::vector<unsigned char> next;
+        downsample(level, w, h, next);
+        level.swap(next);
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+      }
+    }
+    // uploaded coarse to fine so the texture is complete after each one
+    std::reverse(levels.begin(), levels.end());
+    if (levels.empty())
+    {
+      levels.push_back({_request.m_texture, -1, 0, 0, 0, 0, true, {}});
+    }
+    levels.back().m_lastOfRequest = true;
+  }
+  std::lock_guard<std::mutex> lock(m_lock);
+  for (auto &l : levels)
+  {
+    m_decoded.push_back(std::move(l));
+  }
+}
+
+size_t TextureStreamer::levelBytes(const Texture &_t, int _level)
+{
+  return static_cast<size_t>(std::max(1, _t.m_width >> _level)) * std::max(1, _t.m_height >> _level) * 4;
+}
+
+size_t TextureStreamer::chainBytes(const Texture &_t, int _first)
+{
+  size_t bytes = 0;
+  for (int l = _first; l < _t.m_levels; ++l)
+  {
+    bytes += levelBytes(_t, l);
+  }
+  return bytes;
+}
+
+void TextureStreamer::update(const ngl::Mat4 &_project, const ngl::Mat4 &_modelView, int _viewportHeight)
+{
+  TRACE_SCOPE("TextureStreamer::update", "texture");
+  ++m_frame;
+  // pick up what the decode thread has finished
+  std::vector<Level> decoded;
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    decoded.swap(m_decoded);
+  }
+  for (auto &l : decoded)
+  {
+    Texture &t = m_textures[l.m_texture];
+    if (l.m_lastOfRequest)
+    {
+      t.m_requested = -1;
+      --m_outstanding;
+    }
+    if (l.m_level < 0)
+    {
+      t.m_failed = true;
+      continue;
+    }
+    if (t.m_levels == 0)
+    {
+      t.m_width = l.m_fullWidth;
+      t.m_height = l.m_fullHeight;
+      t.m_levels = numLevels(t.m_width, t.m_height);
+      t.m_tail = tailLevel(t.m_width, t.m_height, t.m_levels, m_settings.tailSize);
+      t.m_resident = t.m_levels;
+      t.m_wanted = t.m_tail;
+      glBindTexture(GL_TEXTURE_2D, t.m_id);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, t.m_levels - 1);
+    }
+    ++t.m_queued;
+    m_ready.push_back(std::move(l));
+  }
+
+  // work out the level each texture needs from the visible groups, anything not seen only needs the tail
+  for (auto &t : m_textures)
+  {
+    t.m_wanted = t.m_tail;
+  }
+  ngl::Mat4 mvp = _project * _modelView;
+  ngl::Vec4 eye4 = _modelView.inverse() * ngl::Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+  ngl::Vec3 eye(eye4.m_x, eye4.m_y, eye4.m_z);
+  // the rows of the matrix give the clip planes, row i is m_m[0..3][i]
+  float planes[6][4];
+  for (int i = 0; i < 3; ++i)
+  {
+    for (int c = 0; c < 4; ++c)
+    {
+      planes[i * 2][c] = mvp.m_m[c][3] + mvp.m_m[c][i];
+      planes[i * 2 + 1][c] = mvp.m_m[c][3] - mvp.m_m[c][i];
+    }
+  }
+  // pixels covered by one model unit at a distance of one
+  float pixelsPerUnit = _project.m_m[1][1] * 0.5f * static_cast<float>(_viewportHeight);
+  for (auto &group : m_groups)
+  {
+    bool visible = true;
+    for (auto &p : planes)
+    {
+      // the corner furthest along the plane normal
+      float x = p[0] >= 0.0f ? group.m_max.m_x : group.m_min.m_x;
+      float y = p[1] >= 0.0f ? group.m_max.m_y : group.m_min.m_y;
+      float z = p[2] >= 0.0f ? group.m_max.m_z : group.m_min.m_z;
+      if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0f)
+      {
+        visible = false;
+        break;
+      }
+    }
+    if (!visible || group.m_uvDensity <= 0.0f)
+    {
+      continue;
+    }
+    float pixels = pixelsPerUnit / std::max(boxDistance(eye, group.m_min, group.m_max), 0.01f);
+    for (size_t ti : group.m_textures)
+    {
+      Texture &t = m_textures[ti];
+      if (t.m_levels == 0)
+      {
+        continue;
+      }
+      float texels = std::sqrt(group.m_uvDensity * t.m_width * t.m_height);
+      int level = static_cast<int>(std::floor(std::log2(std::max(texels / pixels, 1.0f)))) + m_bias;
+      t.m_wanted = std::clamp(std::min(t.m_wanted, level), 0, t.m_tail);
+      t.m_lastNeeded = m_frame;
+    }
+  }
+
+  m_wantedBytes = 0;
+  for (size_t i = 0; i < m_textures.size(); ++i)
+  {
+    Texture &t = m_textures[i];
+    if (t.m_levels == 0 || t.m_failed)
+    {
+      continue;
+    }
+    m_wantedBytes += chainBytes(t, t.m_wanted);
+    if (t.m_wanted < t.m_resident && t.m_requested < 0 && t.m_queued == 0)
+    {
+      request(i, t.m_wanted, t.m_resident - 1);
+    }
+  }
+
+  upload(m_settings.uploadBytesPerFrame);
+
+  // fade in the detail that has arrived
+  for (auto &t : m_textures)
+  {
+    if (t.m_minLod > 0.0f)
+    {
+      t.m_minLod = std::max(0.0f, t.m_minLod - m_settings.fadeRate);
+      glBindTexture(GL_TEXTURE_2D, t.m_id);
+      glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, t.m_minLod);
+    }
+  }
+
+  evict();
+  trace::counter("texture resident KB", static_cast<int64_t>(m_residentBytes >> 10));
+  trace::counter("texture wanted KB", static_cast<int64_t>(m_wantedBytes >> 10));
+}
+
+void TextureStreamer::upload(size_t _budget)
+{
+  size_t uploaded = 0;
+  while (!m_ready.empty() && (uploaded == 0 || uploaded < _budget))
+  {
+    Level l = std::move(m_ready.front());
+    m_ready.pop_front();
+    Texture &t = m_textures[l.m_texture];
+    --t.m_queued;
+    // levels only go on directly above what is resident, anything else was overtaken by an eviction
+    if (l.m_level != t.m_resident - 1)
+    {
+      continue;
+    }
+    TRACE_SCOPE("upload level", "texture");
+    GLuint pbo = m_pbos[m_nextPbo];
+    m_nextPbo = (m_nextPbo + 1) % m_pbos.size();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    // orphan the buffer so we never wait for the copy out of the previous contents
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(l.m_pixels.size()), nullptr, GL_STREAM_DRAW);
+    void *data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(l.m_pixels.size()),
+                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (data == nullptr)
+    {
+      std::cerr << "TextureStreamer could not map the unpack buffer\n";
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return;
+    }
+    std::memcpy(data, l.m_pixels.data(), l.m_pixels.size());
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindTexture(GL_TEXTURE_2D, t.m_id);
+    glTexImage2D(GL_TEXTURE_2D, l.m_level, GL_RGBA8, l.m_width, l.m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    t.m_resident = l.m_level;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.m_resident);
+    // the LOD is relative to the base level so this keeps the old detail showing until it fades
+    if (l.m_level < t.m_tail)
+    {
+      t.m_minLod += 1.0f;
+      glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, t.m_minLod);
+    }
+    uploaded += l.m_pixels.size();
+    m_residentBytes += l.m_pixels.size();
+    m_uploadedBytes += l.m_pixels.size();
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureStreamer::evict()
+{
+  while (m_residentBytes > m_settings.budgetBytes)
+  {
+    // release the finest level of the texture least recently needed at that detail
+    Texture *victim = nullptr;
+    for (auto &t : m_textures)
+    {
+      if (t.m_resident < t.m_wanted && t.m_resident < t.m_tail &&
+          (victim == nullptr || t.m_lastNeeded < victim->m_lastNeeded))
+      {
+        victim = &t;
+      }
+    }
+    if (victim == nullptr)
+    {
+      // everything resident is needed, ask for less detail everywhere from the next frame
+      m_bias = std::min(m_bias + 1, 4);
+      return;
+    }
+    size_t bytes = levelBytes(*victim, victim->m_resident);
+    glBindTexture(GL_TEXTURE_2D, victim->m_id);
+    // a zero sized image frees the level's storage
+    glTexImage2D(GL_TEXTURE_2D, victim->m_resident, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    ++victim->m_resident;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, victim->m_resident);
+    victim->m_minLod = std::max(0.0f, victim->m_minLod - 1.0f);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, victim->m_minLod);
+    m_residentBytes -= bytes;
+    m_evictedBytes += bytes;
+  }
+  // going a level finer costs about four times the bytes so only drop the bias when that would fit
+  if (m_bias > 0 && m_wantedBytes * 4 < m_settings.budgetBytes)
+  {
+    --m_bias;
+  }
+}
+
+bool TextureStreamer::busy() const
+{
+  if (m_outstanding != 0 || !m_ready.empty())
+  {
+    return true;
+  }
+  for (auto &t : m_textures)
+  {
+    if (t.m_minLod > 0.0f)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+TextureStreamer::Stats TextureStreamer::stats() const
+{
+  Stats stats;
+  stats.m_textures = m_textures.size();
+  stats.m_residentBytes = m_residentBytes;
+  stats.m_wantedBytes = m_wantedBytes;
+  stats.m_uploadedBytes = m_uploadedBytes;
+  stats.m_evictedBytes = m_evictedBytes;
+  stats.m_pending = m_outstanding + m_ready.size();
+  stats.m_bias = m_bias;
+  return stats;
+}
+
+void TextureStreamer::printStats() const
+{
+  auto s = stats();
+  constexpr double mb = 1024.0 * 1024.0;
+  std::cout << "texture streaming : " << s.m_textures << " textures " << s.m_residentBytes / mb << " MB resident of "
+            << m_settings.budgetBytes / mb << " MB, " << s.m_wantedBytes / mb << " MB wanted, " << s.m_uploadedBytes / mb
+            << " MB uploaded " << s.m_evictedBytes / mb << " MB evicted, " << s.m_pending << " pending, bias "
+            << s.m_bias << '\n';
+}
@@ -0,0 +1,225 @@
+#include "Trace.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+struct Event
+{
+  std::string m_name;
+  const char *m_category;
+  int64_t m_start;
+  // the value for counter events
+  int64_t m_duration;
+  char m_phase;
+};
+
+constexpr size_t c_chunkSize = 1024;
+constexpr size_t c_maxChunks = 1024;
+using Chunk = std::array<Event, c_chunkSize>;
+
+/// @brief the events of one thread. Only the owning thread writes, the chunk table is fixed size so the
+/// writer never moves anything a reader could be looking at and m_count publishes complete events
+struct ThreadBuffer
+{
+  uint32_t m_tid = 0;
+  std::string m_name;
+  std::array<std::atomic<Chunk *>, c_maxChunks> m_chunks{};
+  std::atomic<size_t> m_count{0};
+  ~ThreadBuffer()
+  {
+    for (auto &c : m_chunks)
+    {
+      delete c.load();
+    }
+  }
+};
+
+std::atomic<bool> s_enabled{false};
+std::atomic<bool> s_verbose{std::getenv("SPONZA_VERBOSE") != nullptr};
+std::mutex s_printLock;
+const auto s_epoch = std::chrono::steady_clock::now();
+// the registry is only locked the first time a thread records and when writing the file
+std::mutex s_registryLock;
+std::vector<std::unique_ptr<ThreadBuffer>> s_buffers;
+// buffers of threads which have exited, a short lived thread per load would otherwise add a buffer each time
+std::vector<ThreadBuffer *> s_freeBuffers;
+thread_local ThreadBuffer *t_buffer = nullptr;
+
+/// @brief gives the thread's buffer back when the thread exits, its events are kept and the next new thread
+/// carries on recording into it
+struct BufferReturn
+{
+  ThreadBuffer *m_buffer = nullptr;
+  ~BufferReturn()
+  {
+    if (m_buffer != nullptr)
+    {
+      std::lock_guard<std::mutex> lock(s_registryLock);
+      s_freeBuffers.push_back(m_buffer);
+    }
+  }
+};
+thread_local BufferReturn t_return;
+
+ThreadBuffer &threadBuffer()
+{
+  if (t_buffer == nullptr)
+  {
+    std::lock_guard<std::mutex> lock(s_registryLock);
+    if (!s_freeBuffers.empty())
+    {
+      t_buffer = s_freeBuffers.back();
+      s_freeBuffers.pop_back();
+    }
+    else
+    {
+      s_buffers.push_back(std::make_unique<ThreadBuffer>());
+      t_buffer = s_buffers.back().get();
+      t_buffer->m_tid = static_cast<uint32_t>(s_buffers.size());
+    }
+    t_return.m_buffer = t_buffer;
+  }
+  return *t_buffer;
+}
+
+void writeEscaped(std::ostream &_out, const std::string &_str)
+{
+  for (char c : _str)
+  {
+    if (c == '"' || c == '\\')
+      _out << '\\' << c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+      _out << ' ';
+    else
+      _out << c;
+  }
+}
+
+void recordEvent(std::string _name, const char *_category, int64_t _start, int64_t _duration, char _phase)
+{
+  ThreadBuffer &buffer = threadBuffer();
+  size_t index = buffer.m_count.load(std::memory_order_relaxed);
+  size_t chunk = index / c_chunkSize;
+  if (chunk >= c_maxChunks)
+  {
+    // buffer full, drop the event rather than slow down the traced code
+    return;
+  }
+  Chunk *events = buffer.m_chunks[chunk].load(std::memory_order_relaxed);
+  if (events == nullptr)
+  {
+    events = new Chunk;
+    buffer.m_chunks[chunk].store(events, std::memory_order_release);
+  }
+  (*events)[index % c_chunkSize] = Event{std::move(_name), _category, _start, _duration, _phase};
+  buffer.m_count.store(index + 1, std::memory_order_release);
+}
+} // end anon namespace
+
+namespace trace
+{
+void setEnabled(bool _enabled)
+{
+  s_enabled = _enabled;
+}
+
+bool enabled()
+{
+  return s_enabled.load(std::memory_order_relaxed);
+}
+
+void setVerbose(bool _verbose)
+{
+  s_verbose = _verbose;
+}
+
+bool verbose()
+{
+  return s_verbose.load(std::memory_order_relaxed);
+}
+
+void print(const std::string &_message)
+{
+  std::lock_guard<std::mutex> lock(s_printLock);
+  std::cout << _message;
+}
+
+int64_t now()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_epoch).count();
+}
+
+void record(std::string _name, const char *_category, int64_t _start, int64_t _duration)
+{
+  recordEvent(std::move(_name), _category, _start, _duration, 'X');
+}
+
+void counter(std::string _name, int64_t _value)
+{
+  if (enabled())
+  {
+    recordEvent(std::move(_name), "counter", now(), _value, 'C');
+  }
+}
+
+void setThreadName(const std::string &_name)
+{
+  if (enabled())
+  {
+    ThreadBuffer &buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(s_registryLock);
+    buffer.m_name = _name;
+  }
+}
+
+bool write(const std::string &_fname)
+{
+  std::ofstream fileOut(_fname);
+  if (!fileOut.is_open())
+  {
+    std::cerr << "could not write trace " << _fname << '\n';
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(s_registryLock);
+  size_t total = 0;
+  fileOut << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  for (auto &buffer : s_buffers)
+  {
+    if (buffer->m_name.size() != 0)
+    {
+      fileOut << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->m_tid
+              << ",\"args\":{\"name\":\"";
+      writeEscaped(fileOut, buffer->m_name);
+      fileOut << "\"}}";
+      first = false;
+    }
+    size_t count = buffer->m_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i)
+    {
+      const Event &e = (*buffer->m_chunks[i / c_chunkSize].load(std::memory_order_acquire))[i % c_chunkSize];
+      fileOut << (first ? "" : ",\n") << "{\"name\":\"";
+      writeEscaped(fileOut, e.m_name);
+      fileOut << "\",\"cat\":\"" << e.m_category << "\",\"ph\":\"" << e.m_phase << "\",\"pid\":1,\"tid\":"
+              << buffer->m_tid << ",\"ts\":" << e.m_start;
+      if (e.m_phase == 'C')
+        fileOut << ",\"args\":{\"value\":" << e.m_duration << "}}";
+      else
+        fileOut << ",\"dur\":" << e.m_duration << '}';
+      first = false;
+    }
+    total += count;
+  }
+  fileOut << "\n]}\n";
+  std::cout << "wrote " << total << " trace events to " << _fname << '\n';
+  return true;
+}
+} // end namespace trace
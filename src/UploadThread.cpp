@@ -0,0 +1,127 @@
+#include "UploadThread.h"
+#include "Trace.h"
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QThread>
+#include <iostream>
+
+UploadThread::UploadThread(QOpenGLContext *_share)
+{
+  // the surface has to be made on the GUI thread, the context is moved to the upload thread to be used
+  m_surface.reset(new QOffscreenSurface);
+  m_surface->setFormat(_share->format());
+  m_surface->create();
+  m_context.reset(new QOpenGLContext);
+  m_context->setFormat(_share->format());
+  m_context->setShareContext(_share);
+  if (!m_context->create())
+  {
+    std::cerr << "could not create a shared context for uploads\n";
+  }
+  m_thread.reset(QThread::create([this]() { uploadLoop(); }));
+  m_context->moveToThread(m_thread.get());
+  m_thread->start();
+}
+
+UploadThread::~UploadThread()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  m_thread->wait();
+}
+
+void UploadThread::enqueue(std::string _name, std::function<bool()> _upload, std::function<void(bool)> _done)
+{
+  Job job;
+  job.m_name = std::move(_name);
+  job.m_upload = std::move(_upload);
+  job.m_done = std::move(_done);
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_queue.push_back(std::move(job));
+  }
+  m_wake.notify_one();
+}
+
+void UploadThread::uploadLoop()
+{
+  trace::setThreadName("gl upload");
+  if (!m_context->makeCurrent(m_surface.get()))
+  {
+    std::cerr << "could not make the upload context current\n";
+  }
+  for (;;)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(m_lock);
+      m_wake.wait(lock, [this]() { return m_quit || !m_queue.empty(); });
+      if (m_quit)
+      {
+        break;
+      }
+      job = std::move(m_queue.front());
+      m_queue.pop_front();
+      ++m_running;
+    }
+    if (job.m_upload)
+    {
+      TRACE_SCOPE("", job.m_name, "upload");
+      job.m_ok = job.m_upload();
+    }
+    job.m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // an unflushed fence may never signal for the other context
+    glFlush();
+    std::lock_guard<std::mutex> lock(m_lock);
+    --m_running;
+    m_fenced.push_back(std::move(job));
+  }
+  // the fences were made here so tidy them up while we still have a context
+  std::lock_guard<std::mutex> lock(m_lock);
+  for (auto &job : m_fenced)
+  {
+    glDeleteSync(job.m_fence);
+  }
+  m_fenced.clear();
+  m_context->doneCurrent();
+}
+
+size_t UploadThread::poll()
+{
+  size_t completed = 0;
+  for (;;)
+  {
+    Job job;
+    {
+      std::lock_guard<std::mutex> lock(m_lock);
+      if (m_fenced.empty())
+      {
+        break;
+      }
+      // the fences signal in order so stop at the first one still pending
+      GLenum status = glClientWaitSync(m_fenced.front().m_fence, 0, 0);
+      if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      {
+        break;
+      }
+      job = std::move(m_fenced.front());
+      m_fenced.pop_front();
+    }
+    glDeleteSync(job.m_fence);
+    if (job.m_done)
+    {
+      job.m_done(job.m_ok);
+    }
+    ++completed;
+  }
+  return completed;
+}
+
+bool UploadThread::busy() const
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  return !m_queue.empty() || m_running != 0 || !m_fenced.empty();
+}
@@ -1,6 +1,45 @@
 #include "VAO.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
 #include <iostream>
 
+namespace
+{
+/// @brief the most indices drawn by one call, a whole number of triangles (and lines) that fits a GLsizei
+constexpr size_t c_maxDrawCount = (INT_MAX / 6) * 6;
+} // end anon namespace
+
+std::vector<VAO::Segment> VAO::planSegments(const std::vector<Segment> &_ranges, size_t _vertexBytes, size_t _maxBytes,
+                                            std::vector<size_t> &o_segmentOf)
+{
+  // a segment's indices count from its first vertex so it can't reach more than 2^32 vertices
+  size_t maxVertices = std::min<size_t>(_maxBytes / std::max<size_t>(_vertexBytes, 1), size_t(UINT32_MAX) + 1);
+  size_t maxIndices = _maxBytes / sizeof(GLuint);
+  std::vector<Segment> segments(1);
+  o_segmentOf.assign(_ranges.size(), 0);
+  for (size_t r = 0; r < _ranges.size(); ++r)
+  {
+    const Segment &range = _ranges[r];
+    Segment *current = &segments.back();
+    bool empty = current->m_numVertices == 0 && current->m_numIndices == 0;
+    if (!empty && (current->m_numVertices + range.m_numVertices > maxVertices ||
+                   current->m_numIndices + range.m_numIndices > maxIndices))
+    {
+      segments.push_back({current->m_firstVertex + current->m_numVertices, 0, current->m_firstIndex + current->m_numIndices, 0});
+      current = &segments.back();
+    }
+    if (range.m_numVertices > size_t(UINT32_MAX) + 1)
+    {
+      std::cerr << "a range of " << range.m_numVertices << " vertices can't be drawn with 32 bit indices\n";
+    }
+    current->m_numVertices += range.m_numVertices;
+    current->m_numIndices += range.m_numIndices;
+    o_segmentOf[r] = segments.size() - 1;
+  }
+  return segments;
+}
+
 void VAO::draw() const
 {
   if (m_allocated == false)
@@ -11,10 +50,20 @@ void VAO::draw() const
   {
     std::cerr << "Warning trying to draw an unbound VOA\n";
   }
-  glDrawArrays(m_mode, 0, static_cast<GLsizei>(m_indicesCount));
+  if (m_stores[0].m_indexBuffer == 0)
+  {
+    glDrawArrays(m_mode, 0, static_cast<GLsizei>(m_indicesCount));
+    return;
+  }
+  if (m_stores.size() == 1)
+  {
+    glDrawElements(m_mode, static_cast<GLsizei>(m_indicesCount), GL_UNSIGNED_INT, nullptr);
+    return;
+  }
+  draw(0, m_stores.back().m_range.m_firstIndex + m_stores.back().m_range.m_numIndices, m_mode);
 }
 
-void VAO::draw(unsigned int _startIndex, unsigned int _numVerts, GLenum _mode) const
+void VAO::draw(size_t _startIndex, size_t _numVerts, GLenum _mode) const
 {
   if (m_allocated == false)
   {
@@ -24,7 +73,108 @@ void VAO::draw(unsigned int _startIndex, unsigned int _numVerts, GLenum _mode) c
   {
     std::cerr << "Warning trying to draw an unbound VOA\n";
   }
-  glDrawArrays(_mode, static_cast<GLsizei>(_startIndex), static_cast<GLsizei>(_numVerts)); // draw first object
+  if (m_stores[0].m_indexBuffer != 0)
+  {
+    drawBaseVertex(_startIndex, _numVerts, 0, _mode);
+    return;
+  }
+  for (size_t done = 0; done < _numVerts; done += c_maxDrawCount)
+  {
+    glDrawArrays(_mode, static_cast<GLint>(_startIndex + done), static_cast<GLsizei>(std::min(c_maxDrawCount, _numVerts - done)));
+  }
+}
+
+void VAO::drawIndirect(GLintptr _offset, GLsizei _maxDraws, GLintptr _countOffset, GLenum _mode) const
+{
+  if (m_stores[0].m_indexBuffer == 0)
+  {
+    std::cerr << "Warning indirect draws need an index buffer\n";
+    return;
+  }
+  if (_countOffset >= 0)
+  {
+    glMultiDrawElementsIndirectCount(_mode, GL_UNSIGNED_INT, reinterpret_cast<const GLvoid *>(_offset), _countOffset,
+                                     _maxDraws, 0);
+    return;
+  }
+  glMultiDrawElementsIndirect(_mode, GL_UNSIGNED_INT, reinterpret_cast<const GLvoid *>(_offset), _maxDraws, 0);
+}
+
+void VAO::drawBaseVertex(size_t _startIndex, size_t _numIndices, GLint _baseVertex, GLenum _mode) const
+{
+  if (m_stores[0].m_indexBuffer == 0)
+  {
+    std::cerr << "Warning base vertex draws need an index buffer\n";
+    return;
+  }
+  // the range is drawn from each segment it covers with that segment's vertex array bound
+  for (size_t s = findSegment(_startIndex); _numIndices != 0 && s < m_stores.size(); ++s)
+  {
+    const Segment &range = m_stores[s].m_range;
+    size_t first = _startIndex - range.m_firstIndex;
+    size_t count = std::min(_numIndices, range.m_numIndices - std::min(first, range.m_numIndices));
+    if (m_stores.size() == 1)
+    {
+      // a single buffer VAO knows its index count from setIndexData
+      count = _numIndices;
+    }
+    if (m_stores.size() > 1 && count != 0)
+    {
+      glBindVertexArray(vertexArray(s));
+    }
+    for (size_t done = 0; done < count; done += c_maxDrawCount)
+    {
+      auto offset = reinterpret_cast<const GLvoid *>((first + done) * sizeof(GLuint));
+      auto n = static_cast<GLsizei>(std::min(c_maxDrawCount, count - done));
+      if (_baseVertex == 0)
+      {
+        glDrawElements(_mode, n, GL_UNSIGNED_INT, offset);
+      }
+      else
+      {
+        glDrawElementsBaseVertex(_mode, n, GL_UNSIGNED_INT, offset, _baseVertex);
+      }
+    }
+    _startIndex += count;
+    _numIndices -= count;
+  }
+  if (m_stores.size() > 1)
+  {
+    glBindVertexArray(m_id);
+  }
+}
+
+size_t VAO::findSegment(size_t _index) const
+{
+  auto found = std::upper_bound(m_stores.begin(), m_stores.end(), _index,
+                                [](size_t _i, const Store &_s) { return _i < _s.m_range.m_firstIndex; });
+  return found == m_stores.begin() ? 0 : static_cast<size_t>(found - m_stores.begin()) - 1;
+}
+
+void VAO::deleteStores()
+{
+  for (size_t s = 0; s < m_stores.size(); ++s)
+  {
+    Store &store = m_stores[s];
+    if (store.m_buffer != 0)
+    {
+      glDeleteBuffers(1, &store.m_buffer);
+    }
+    if (store.m_indexBuffer != 0)
+    {
+      glDeleteBuffers(1, &store.m_indexBuffer);
+    }
+    for (auto &attribute : store.m_attributes)
+    {
+      glDeleteBuffers(1, &attribute.second.first);
+    }
+    if (s != 0)
+    {
+      glDeleteVertexArrays(1, &store.m_vao);
+    }
+  }
+  m_stores.assign(1, Store());
+  m_vertexBytes = 0;
 }
 
 void VAO::removeVAO()
@@ -33,10 +183,7 @@ void VAO::removeVAO()
   {
     unbind();
   }
-  if (m_allocated == true)
-  {
-    glDeleteBuffers(1, &m_buffer);
-  }
+  deleteStores();
   glDeleteVertexArrays(1, &m_id);
   m_allocated = false;
 }
@@ -47,18 +194,282 @@ void VAO::setData(const VertexData &_data)
   {
     std::cerr << "trying to set VOA data when unbound\n";
   }
-  if (m_allocated == true)
+  bufferData(_data.m_size, &_data.m_data, _data.m_mode);
+}
+
+void VAO::allocateData(size_t _size, GLenum _usage)
+{
+  if (m_bound == false)
   {
-    glDeleteBuffers(1, &m_buffer);
+    std::cerr << "trying to allocate VOA data when unbound\n";
   }
+  bufferData(_size, nullptr, _usage);
+}
 
-  glGenBuffers(1, &m_buffer);
+void VAO::bufferData(size_t _size, const GLvoid *_data, GLenum _usage)
+{
+  if (m_stores.size() > 1)
+  {
+    // back to a single buffer, the segments are gone
+    deleteStores();
+    glBindVertexArray(m_id);
+    m_allocated = false;
+  }
+  Store &store = m_stores[0];
+  // if we already have a buffer of the same size and usage we re-use the name and let the driver
+  // orphan the old store, otherwise we start again with a new buffer
+  if (m_allocated == true && (store.m_size != _size || m_usage != _usage))
+  {
+    glDeleteBuffers(1, &store.m_buffer);
+    m_allocated = false;
+  }
+  if (m_allocated == false)
+  {
+    glGenBuffers(1, &store.m_buffer);
+  }
   // now we will bind an array buffer to the first one and load the data for the verts
-  glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
-  glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(_data.m_size), &_data.m_data, _data.m_mode);
+  glBindBuffer(GL_ARRAY_BUFFER, store.m_buffer);
+  glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(_size), _data, _usage);
+  store.m_size = _size;
+  m_vertexBytes = 0;
+  m_usage = _usage;
   m_allocated = true;
 }
 
+void VAO::allocateSegments(const std::vector<Segment> &_segments, size_t _vertexBytes, const GLvoid *_vertices,
+                           const GLuint *_indices, GLenum _usage)
+{
+  if (m_bound == false)
+  {
+    std::cerr << "trying to allocate VOA segments when unbound\n";
+  }
+  deleteStores();
+  m_stores.resize(std::max<size_t>(_segments.size(), 1));
+  m_vertexBytes = _vertexBytes;
+  m_usage = _usage;
+  auto vertices = static_cast<const unsigned char *>(_vertices);
+  for (size_t s = 0; s < _segments.size(); ++s)
+  {
+    Store &store = m_stores[s];
+    store.m_range = _segments[s];
+    if (s != 0)
+    {
+      glGenVertexArrays(1, &store.m_vao);
+    }
+    // the element array binding is part of the vertex array state
+    glBindVertexArray(vertexArray(s));
+    store.m_size = store.m_range.m_numVertices * _vertexBytes;
+    glGenBuffers(1, &store.m_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, store.m_buffer);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(store.m_size),
+                 vertices != nullptr ? vertices + firstByte(s) : nullptr, _usage);
+    store.m_indexSize = store.m_range.m_numIndices * sizeof(GLuint);
+    glGenBuffers(1, &store.m_indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, store.m_indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(store.m_indexSize),
+                 _indices != nullptr ? _indices + store.m_range.m_firstIndex : nullptr, GL_STATIC_DRAW);
+  }
+  glBindVertexArray(m_id);
+  glBindBuffer(GL_ARRAY_BUFFER, m_stores[0].m_buffer);
+  m_allocated = true;
+}
+
+void VAO::bindSegment(size_t _segment)
+{
+  glBindVertexArray(vertexArray(_segment));
+  glBindBuffer(GL_ARRAY_BUFFER, m_stores[_segment].m_buffer);
+  m_bound = true;
+}
+
+void VAO::setSubData(size_t _offset, size_t _size, const GLvoid *_data)
+{
+  if (m_allocated == false)
+  {
+    std::cerr << "trying to set VOA sub data with no buffer allocated\n";
+    return;
+  }
+  size_t total = getBufferSize();
+  if (_offset + _size > total)
+  {
+    std::cerr << "VAO sub data range " << _offset << " + " << _size << " is outside the buffer of size " << total << '\n';
+    return;
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  auto data = static_cast<const unsigned char *>(_data);
+  for (size_t s = 0; s < m_stores.size(); ++s)
+  {
+    // the part of the range in this segment
+    size_t begin = std::max(_offset, firstByte(s));
+    size_t end = std::min(_offset + _size, firstByte(s) + m_stores[s].m_size);
+    if (begin >= end)
+    {
+      continue;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, m_stores[s].m_buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(begin - firstByte(s)), static_cast<GLsizeiptr>(end - begin),
+                    data + (begin - _offset));
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  m_stats.bytes += _size;
+  ++m_stats.uploads;
+  m_stats.seconds += std::chrono::duration<double>(end - start).count();
+}
+
+void VAO::setAttributeData(GLuint _index, size_t _size, const GLvoid *_data, GLint _components, GLenum _usage)
+{
+  if (m_bound == false)
+  {
+    std::cerr << "trying to set VOA attribute data when unbound\n";
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  auto data = static_cast<const unsigned char *>(_data);
+  size_t vertexBytes = static_cast<size_t>(_components) * sizeof(GLfloat);
+  for (size_t s = 0; s < m_stores.size(); ++s)
+  {
+    // each segment's vertex array reads the attribute for its own vertices from a buffer of its own
+    size_t offset = m_stores.size() == 1 ? 0 : m_stores[s].m_range.m_firstVertex * vertexBytes;
+    size_t size = m_stores.size() == 1 ? _size : m_stores[s].m_range.m_numVertices * vertexBytes;
+    if (offset + size > _size)
+    {
+      std::cerr << "VAO attribute data of " << _size << " bytes is too small for segment " << s << '\n';
+      break;
+    }
+    if (m_stores.size() > 1)
+    {
+      glBindVertexArray(vertexArray(s));
+    }
+    auto &attribute = m_stores[s].m_attributes[_index];
+    if (attribute.first != 0 && attribute.second == size)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, attribute.first);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, static_cast<GLsizeiptr>(size), data + offset);
+    }
+    else
+    {
+      if (attribute.first == 0)
+      {
+        glGenBuffers(1, &attribute.first);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, attribute.first);
+      glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(size), data + offset, _usage);
+      attribute.second = size;
+    }
+    glVertexAttribPointer(_index, _components, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glEnableVertexAttribArray(_index);
+  }
+  if (m_stores.size() > 1)
+  {
+    glBindVertexArray(m_id);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  m_stats.bytes += _size;
+  ++m_stats.uploads;
+  m_stats.seconds += std::chrono::duration<double>(end - start).count();
+}
+
+void VAO::setIndexData(size_t _count, const GLuint *_data)
+{
+  if (m_bound == false)
+  {
+    std::cerr << "trying to set VOA index data when unbound\n";
+  }
+  if (m_stores.size() > 1)
+  {
+    std::cerr << "setIndexData is for a single buffer VAO, use setIndexSubData on a segmented one\n";
+    return;
+  }
+  Store &store = m_stores[0];
+  if (store.m_indexBuffer == 0)
+  {
+    glGenBuffers(1, &store.m_indexBuffer);
+  }
+  // the element array binding is part of the VAO state
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, store.m_indexBuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(_count * sizeof(GLuint)), _data, GL_STATIC_DRAW);
+  store.m_indexSize = _count * sizeof(GLuint);
+  store.m_range.m_numIndices = _count;
+}
+
+void VAO::setIndexSubData(size_t _first, size_t _count, const GLuint *_data)
+{
+  if (m_bound == false)
+  {
+    std::cerr << "trying to set VOA index sub data when unbound\n";
+  }
+  size_t total = getIndexBufferSize() / sizeof(GLuint);
+  if (_first + _count > total)
+  {
+    std::cerr << "VAO index range " << _first << " + " << _count << " is outside the " << total << " indices\n";
+    return;
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t s = findSegment(_first); s < m_stores.size(); ++s)
+  {
+    const Segment &range = m_stores[s].m_range;
+    size_t begin = std::max(_first, range.m_firstIndex);
+    size_t end = std::min(_first + _count, range.m_firstIndex + m_stores[s].m_indexSize / sizeof(GLuint));
+    if (begin >= end)
+    {
+      break;
+    }
+    // the copy target leaves the element array binding of whichever vertex array is bound alone
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_stores[s].m_indexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>((begin - range.m_firstIndex) * sizeof(GLuint)),
+                    static_cast<GLsizeiptr>((end - begin) * sizeof(GLuint)), _data + (begin - _first));
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  auto end = std::chrono::high_resolution_clock::now();
+  m_stats.bytes += _count * sizeof(GLuint);
+  ++m_stats.uploads;
+  m_stats.seconds += std::chrono::duration<double>(end - start).count();
+}
+
+size_t VAO::getBufferSize() const
+{
+  size_t bytes = 0;
+  for (auto &store : m_stores)
+  {
+    bytes += store.m_size;
+  }
+  return bytes;
+}
+
+size_t VAO::getIndexBufferSize() const
+{
+  size_t bytes = 0;
+  for (auto &store : m_stores)
+  {
+    bytes += store.m_indexSize;
+  }
+  return bytes;
+}
+
+size_t VAO::getAttributeBufferSize() const
+{
+  size_t bytes = 0;
+  for (auto &store : m_stores)
+  {
+    for (auto &buffer : store.m_attributes)
+    {
+      bytes += buffer.second.second;
+    }
+  }
+  return bytes;
+}
+
+void VAO::orphanBuffer()
+{
+  if (m_allocated == false)
+  {
+    return;
+  }
+  for (auto &store : m_stores)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, store.m_buffer);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(store.m_size), nullptr, m_usage);
+  }
+}
+
 int VAO::getSize() const
 {
   if (m_bound == false)
@@ -75,10 +486,65 @@ ngl::Real *VAO::mapBuffer(unsigned int, GLenum _accessMode)
 {
   ngl::Real *ptr = nullptr;
   bind();
-  glBindBuffer(GL_ARRAY_BUFFER, m_id);
+  glBindBuffer(GL_ARRAY_BUFFER, m_stores[0].m_buffer);
   ptr = static_cast<ngl::Real *>(glMapBuffer(GL_ARRAY_BUFFER, _accessMode));
   // modern GL allows this but not on mac!
   // ptr = static_cast<Real *>(glMapNamedBuffer(m_id, _accessMode));
 
   return ptr;
 }
+
+void *VAO::mapBufferRange(size_t _offset, size_t _size, GLbitfield _access)
+{
+  // a mapping is of one buffer so the range must sit in one segment
+  size_t s = 0;
+  while (s + 1 < m_stores.size() && _offset >= firstByte(s + 1))
+  {
+    ++s;
+  }
+  size_t size = m_stores[s].m_size;
+  if (m_allocated == false || _offset < firstByte(s) || _offset + _size > firstByte(s) + size || _size == 0)
+  {
+    std::cerr << "VAO map range " << _offset << " + " << _size << " is not valid for segment " << s << " of size " << size << '\n';
+    return nullptr;
+  }
+  if (m_mappedSize != 0)
+  {
+    std::cerr << "VAO buffer is already mapped\n";
+    return nullptr;
+  }
+  m_mapTime = std::chrono::high_resolution_clock::now();
+  glBindBuffer(GL_ARRAY_BUFFER, m_stores[s].m_buffer);
+  void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, static_cast<GLintptr>(_offset - firstByte(s)), static_cast<GLsizeiptr>(_size),
+                               _access);
+  if (ptr != nullptr)
+  {
+    m_mappedSize = _size;
+    m_mappedSegment = s;
+    m_mappedForWrite = (_access & GL_MAP_WRITE_BIT) != 0;
+  }
+  return ptr;
+}
+
+void VAO::unmapBufferRange()
+{
+  if (m_mappedSize == 0)
+  {
+    return;
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, m_stores[m_mappedSegment].m_buffer);
+  if (glUnmapBuffer(GL_ARRAY_BUFFER) == GL_FALSE)
+  {
+    // the data store has been corrupted (mode switch etc) the caller will need to re-upload
+    std::cerr << "VAO buffer contents lost during unmap\n";
+  }
+  if (m_mappedForWrite == true)
+  {
+    auto end = std::chrono::high_resolution_clock::now();
+    m_stats.bytes += m_mappedSize;
+    ++m_stats.uploads;
+    m_stats.seconds += std::chrono::duration<double>(end - m_mapTime).count();
+  }
+  m_mappedSize = 0;
+  m_mappedForWrite = false;
+}
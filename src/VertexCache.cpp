@@ -0,0 +1,296 @@
+#include "VertexCache.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace
+{
+// the LRU size used for scoring, Forsyth found 32 works well for any real cache up to that size
+constexpr int c_scoreCacheSize = 32;
+
+float vertexScore(int _cachePosition, uint32_t _remaining)
+{
+  if (_remaining == 0)
+  {
+    // no triangles left so the vertex doesn't matter
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (_cachePosition >= 0)
+  {
+    // the last triangle's vertices get a fixed score so we don't favour the strip order too much
+    if (_cachePosition < 3)
+    {
+      score = 0.75f;
+    }
+    else
+    {
+      score = std::pow(1.0f - (_cachePosition - 3) * (1.0f / (c_scoreCacheSize - 3)), 1.5f);
+    }
+  }
+  // boost vertices with few triangles left so we finish them off rather than leave lone triangles
+  return score + 2.0f / std::sqrt(static_cast<float>(_remaining));
+}
+} // end anon namespace
+
+namespace vertexcache
+{
+CacheStats analyse(const std::vector<uint32_t> &_indices, size_t _numVertices, unsigned int _cacheSize)
+{
+  CacheStats stats;
+  stats.m_triangles = _indices.size() / 3;
+  // a vertex is in the FIFO if it was added within the last _cacheSize misses
+  std::vector<size_t> added(_numVertices, 0);
+  size_t time = _cacheSize + 1;
+  for (uint32_t i : _indices)
+  {
+    if (added[i] == 0)
+    {
+      ++stats.m_vertices;
+    }
+    if (time - added[i] > _cacheSize)
+    {
+      added[i] = time++;
+      ++stats.m_misses;
+    }
+  }
+  return stats;
+}
+
+std::vector<uint32_t> optimiseCache(const std::vector<uint32_t> &_indices, size_t _numVertices)
+{
+  size_t numTriangles = _indices.size() / 3;
+  std::vector<uint32_t> order;
+  order.reserve(numTriangles);
+  if (numTriangles == 0)
+  {
+    return order;
+  }
+  // the triangles using each vertex, the live ones are kept at the front of each vertex's range
+  std::vector<uint32_t> remaining(_numVertices, 0);
+  for (uint32_t i : _indices)
+  {
+    ++remaining[i];
+  }
+  std::vector<uint32_t> offsets(_numVertices + 1, 0);
+  for (size_t v = 0; v < _numVertices; ++v)
+  {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+  std::vector<uint32_t> adjacency(_indices.size());
+  {
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < _indices.size(); ++i)
+    {
+      adjacency[fill[_indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<int> cachePosition(_numVertices, -1);
+  std::vector<float> score(_numVertices);
+  for (size_t v = 0; v < _numVertices; ++v)
+  {
+    score[v] = vertexScore(-1, remaining[v]);
+  }
+  std::vector<float> triangleScore(numTriangles);
+  for (size_t t = 0; t < numTriangles; ++t)
+  {
+    triangleScore[t] = score[_indices[t * 3]] + score[_indices[t * 3 + 1]] + score[_indices[t * 3 + 2]];
+  }
+  std::vector<char> emitted(numTriangles, 0);
+
+  std::array<uint32_t, c_scoreCacheSize + 3> cache;
+  std::array<uint32_t, c_scoreCacheSize + 3> newCache;
+  size_t cacheSize = 0;
+  size_t scan = 0;
+  int64_t best = static_cast<int64_t>(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+  while (order.size() < numTriangles)
+  {
+    if (best < 0)
+    {
+      // nothing in the cache has triangles left, carry on from the next one not drawn
+      while (emitted[scan])
+      {
+        ++scan;
+      }
+      best = static_cast<int64_t>(scan);
+    }
+    emitted[best] = 1;
+    order.push_back(static_cast<uint32_t>(best));
+    const uint32_t *tri = &_indices[best * 3];
+    for (int c = 0; c < 3; ++c)
+    {
+      uint32_t v = tri[c];
+      // move the triangle out of the live part of the vertex's list
+      uint32_t *begin = &adjacency[offsets[v]];
+      uint32_t *end = begin + remaining[v];
+      std::iter_swap(std::find(begin, end, static_cast<uint32_t>(best)), end - 1);
+      --remaining[v];
+    }
+    // the triangle's vertices go to the front of the LRU
+    size_t newSize = 0;
+    for (int c = 0; c < 3; ++c)
+    {
+      newCache[newSize++] = tri[c];
+    }
+    for (size_t i = 0; i < cacheSize; ++i)
+    {
+      uint32_t v = cache[i];
+      if (v != tri[0] && v != tri[1] && v != tri[2])
+      {
+        newCache[newSize++] = v;
+      }
+    }
+    // rescore everything that moved, including what just fell out
+    for (size_t i = 0; i < newSize; ++i)
+    {
+      uint32_t v = newCache[i];
+      cachePosition[v] = i < c_scoreCacheSize ? static_cast<int>(i) : -1;
+      float newScore = vertexScore(cachePosition[v], remaining[v]);
+      float delta = newScore - score[v];
+      score[v] = newScore;
+      for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; ++a)
+      {
+        triangleScore[adjacency[a]] += delta;
+      }
+    }
+    cacheSize = std::min<size_t>(newSize, c_scoreCacheSize);
+    std::copy(newCache.begin(), newCache.begin() + cacheSize, cache.begin());
+    // the next triangle is the best one using a cached vertex
+    best = -1;
+    float bestScore = -1.0f;
+    for (size_t i = 0; i < cacheSize; ++i)
+    {
+      uint32_t v = cache[i];
+      for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; ++a)
+      {
+        if (triangleScore[adjacency[a]] > bestScore)
+        {
+          bestScore = triangleScore[adjacency[a]];
+          best = adjacency[a];
+        }
+      }
+    }
+  }
+  return order;
+}
+
+std::vector<uint32_t> optimiseOverdraw(const std::vector<uint32_t> &_indices, const float *_positions, size_t _stride,
+                                       unsigned int _cacheSize)
+{
+  size_t numTriangles = _indices.size() / 3;
+  // start a new cluster wherever all three vertices missed the cache, moving those costs nothing
+  std::vector<size_t> clusterStart;
+  {
+    uint32_t maxIndex = _indices.empty() ? 0 : *std::max_element(_indices.begin(), _indices.end());
+    std::vector<size_t> added(maxIndex + 1, 0);
+    size_t time = _cacheSize + 1;
+    for (size_t t = 0; t < numTriangles; ++t)
+    {
+      int misses = 0;
+      for (int c = 0; c < 3; ++c)
+      {
+        uint32_t v = _indices[t * 3 + c];
+        if (time - added[v] > _cacheSize)
+        {
+          added[v] = time++;
+          ++misses;
+        }
+      }
+      if (t == 0 || misses == 3)
+      {
+        clusterStart.push_back(t);
+      }
+    }
+  }
+  clusterStart.push_back(numTriangles);
+
+  auto position = [&](uint32_t _v, int _axis) { return _positions[_v * _stride + _axis]; };
+  struct Cluster
+  {
+    size_t m_begin;
+    size_t m_end;
+    float m_centroid[3] = {0.0f, 0.0f, 0.0f};
+    float m_normal[3] = {0.0f, 0.0f, 0.0f};
+    float m_area = 0.0f;
+    float m_key = 0.0f;
+  };
+  std::vector<Cluster> clusters(clusterStart.size() - 1);
+  float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+  float meshArea = 0.0f;
+  for (size_t c = 0; c < clusters.size(); ++c)
+  {
+    Cluster &cluster = clusters[c];
+    cluster.m_begin = clusterStart[c];
+    cluster.m_end = clusterStart[c + 1];
+    for (size_t t = cluster.m_begin; t < cluster.m_end; ++t)
+    {
+      const uint32_t *tri = &_indices[t * 3];
+      float e1[3], e2[3], n[3];
+      for (int a = 0; a < 3; ++a)
+      {
+        e1[a] = position(tri[1], a) - position(tri[0], a);
+        e2[a] = position(tri[2], a) - position(tri[0], a);
+      }
+      // the cross product is twice the area times the normal so it is already area weighted
+      n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+      n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+      n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+      float area = 0.5f * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      for (int a = 0; a < 3; ++a)
+      {
+        float centre = (position(tri[0], a) + position(tri[1], a) + position(tri[2], a)) / 3.0f;
+        cluster.m_centroid[a] += centre * area;
+        cluster.m_normal[a] += n[a];
+      }
+      cluster.m_area += area;
+    }
+    for (int a = 0; a < 3; ++a)
+    {
+      meshCentroid[a] += cluster.m_centroid[a];
+    }
+    meshArea += cluster.m_area;
+  }
+  for (auto &cluster : clusters)
+  {
+    float length = std::sqrt(cluster.m_normal[0] * cluster.m_normal[0] + cluster.m_normal[1] * cluster.m_normal[1] +
+                             cluster.m_normal[2] * cluster.m_normal[2]);
+    for (int a = 0; a < 3; ++a)
+    {
+      float centroid = cluster.m_area > 0.0f ? cluster.m_centroid[a] / cluster.m_area : 0.0f;
+      float centre = meshArea > 0.0f ? meshCentroid[a] / meshArea : 0.0f;
+      cluster.m_key += (centroid - centre) * (length > 0.0f ? cluster.m_normal[a] / length : 0.0f);
+    }
+  }
+  // clusters facing away from the centre are more likely to occlude the others so draw them first
+  std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &_a, const Cluster &_b) { return _a.m_key > _b.m_key; });
+  std::vector<uint32_t> order;
+  order.reserve(numTriangles);
+  for (auto &cluster : clusters)
+  {
+    for (size_t t = cluster.m_begin; t < cluster.m_end; ++t)
+    {
+      order.push_back(static_cast<uint32_t>(t));
+    }
+  }
+  return order;
+}
+
+std::vector<uint32_t> optimiseFetch(std::vector<uint32_t> &io_indices, size_t _numVertices)
+{
+  constexpr uint32_t unused = ~0u;
+  std::vector<uint32_t> newIndex(_numVertices, unused);
+  std::vector<uint32_t> remap;
+  remap.reserve(_numVertices);
+  for (auto &i : io_indices)
+  {
+    if (newIndex[i] == unused)
+    {
+      newIndex[i] = static_cast<uint32_t>(remap.size());
+      remap.push_back(i);
+    }
+    i = newIndex[i];
+  }
+  return remap;
+}
+} // end namespace vertexcache
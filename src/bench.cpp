@@ -0,0 +1,317 @@
+/****************************************************************************
+headless benchmarks for the CPU side parts of the Sponza demo, these don't
+need a GL context so can be run on any machine.
+usage SponzaBench test [options]
+****************************************************************************/
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "GroupedObj.h"
+#include "BVH.h"
+#include "AOBaker.h"
+#include "Mtl.h"
+#include "SoftRenderer.h"
+#include <ngl/Util.h>
+#include <thread>
+
+namespace
+{
+struct Args
+{
+  std::string model = "models/sponza.obj";
+  std::string mtl = "models/sponza.mtl";
+  std::string output = "soft.ppm";
+  unsigned int threads = 0;
+  int count = 8;
+  int width = 1024;
+  int height = 720;
+  /// @brief the buffer limit in MB for the stress test, 0 to pick one that splits the mesh into about 8
+  size_t bufferMB = 0;
+};
+
+std::unique_ptr<GroupedObj> loadModel(const Args &_args)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  auto mesh = std::make_unique<GroupedObj>(_args.model, GroupedObj::CreateVAO::False);
+  auto end = std::chrono::high_resolution_clock::now();
+  std::cout << "loaded " << _args.model << " " << mesh->vertexData().size() / 3 << " triangles " << mesh->numMeshes()
+            << " groups in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+  return mesh;
+}
+
+int benchVertexCache(const Args &_args)
+{
+  // loadModel has no cache dir so the optimisation is always run, it prints the ACMR / ATVR as it goes
+  auto mesh = loadModel(_args);
+  std::cout << "vertex cache optimised in " << mesh->optimiseTime() << " ms, " << mesh->indices().size() / 3
+            << " triangles " << mesh->drawVertexData().size() << " vertices ACMR " << mesh->cacheStatsBefore().acmr()
+            << " -> " << mesh->cacheStatsAfter().acmr() << " ATVR " << mesh->cacheStatsBefore().atvr() << " -> "
+            << mesh->cacheStatsAfter().atvr() << '\n';
+  return EXIT_SUCCESS;
+}
+
+int benchBVH(const Args &_args)
+{
+  auto mesh = loadModel(_args);
+  BVH bvh(*mesh, _args.threads);
+  bvh.benchmark(_args.width, _args.height, _args.threads);
+  return EXIT_SUCCESS;
+}
+
+int benchAO(const Args &_args)
+{
+  auto mesh = loadModel(_args);
+  // no cache so the bake is always timed
+  AOSettings settings;
+  settings.threads = _args.threads;
+  settings.maxSamples = 64;
+  AOBaker baker(*mesh, "", settings);
+  auto start = std::chrono::high_resolution_clock::now();
+  while (baker.runPass())
+  {
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << "baked " << mesh->vertexData().size() << " verts x " << baker.samples() << " samples in " << seconds
+            << " s " << mesh->vertexData().size() * baker.samples() / seconds / 1e6 << " Msamples/s\n";
+  return EXIT_SUCCESS;
+}
+
+int benchSoft(const Args &_args)
+{
+  auto mesh = loadModel(_args);
+  // no GL context here so don't create the GL textures, the renderer loads its own copies
+  Mtl mtl(_args.mtl, false);
+  SoftRenderer renderer(*mesh, mtl, _args.width, _args.height);
+  // the same camera as NGLScene
+  ngl::Mat4 view = ngl::lookAt(ngl::Vec3(0, 40, -140), ngl::Vec3(0, 40, 0), ngl::Vec3(0, 1, 0));
+  ngl::Mat4 project = ngl::perspective(45.0f, static_cast<float>(_args.width) / _args.height, 0.5f, 3550.0f);
+  ngl::Mat4 mvp = project * view;
+  // warm up, this also sizes the per frame buffers
+  renderer.render(mvp, _args.threads);
+  std::cout << "software render " << _args.width << "x" << _args.height << " " << renderer.trianglesDrawn()
+            << " triangles after clipping\n";
+  constexpr int frames = 20;
+  unsigned int maxThreads = _args.threads != 0 ? _args.threads : std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned int threads = 1;; threads = std::min(threads * 2, maxThreads))
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+      renderer.render(mvp, threads);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << threads << " threads " << frames / seconds << " fps " << seconds * 1000.0 / frames << " ms per frame\n";
+    if (threads == maxThreads)
+    {
+      break;
+    }
+  }
+  return renderer.writeImage(_args.output) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int benchLoad(const Args &_args)
+{
+  // the same model loaded count times stands in for a scene of many models, there is no cache dir so every
+  // load parses and optimises
+  std::vector<std::string> paths(static_cast<size_t>(std::max(1, _args.count)), _args.model);
+  unsigned int maxThreads = _args.threads != 0 ? _args.threads : std::max(1u, std::thread::hardware_concurrency());
+  double single = 0.0;
+  std::vector<std::shared_ptr<GroupedObj>> meshes;
+  for (unsigned int threads = 1;; threads = std::min(threads * 2, maxThreads))
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    meshes = GroupedObj::loadMany(paths, threads);
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (threads == 1)
+    {
+      single = seconds;
+    }
+    std::cout << threads << " threads loaded " << paths.size() << " models in " << seconds * 1000.0 << " ms "
+              << paths.size() / seconds << " models/s speedup " << single / seconds << '\n';
+    if (threads == maxThreads)
+    {
+      break;
+    }
+  }
+  // every copy must come out the same, the parser used to share its group state between instances
+  for (auto &mesh : meshes)
+  {
+    if (!mesh || mesh->numMeshes() != meshes[0]->numMeshes() || mesh->hash() != meshes[0]->hash())
+    {
+      std::cerr << "the models loaded differ\n";
+      return EXIT_FAILURE;
+    }
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  auto combined = GroupedObj::combine(meshes);
+  auto end = std::chrono::high_resolution_clock::now();
+  if (!combined)
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "combined into " << combined->numMeshes() << " groups " << combined->indices().size() / 3
+            << " triangles in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+  return EXIT_SUCCESS;
+}
+int benchStress(const Args &_args)
+{
+  // a synthetic terrain of count million triangles, one group per tile with 4 materials, written as an obj so
+  // the whole parse and pack path is run. The buffer limit is dropped so the mesh is split into several
+  // segments, which is what happens to a scan too big for 32 bit indices or one buffer
+  constexpr size_t quadsPerTile = 128;
+  size_t triangles = static_cast<size_t>(std::max(1, _args.count)) << 20;
+  size_t tiles = static_cast<size_t>(std::ceil(std::sqrt(triangles / (2.0 * quadsPerTile * quadsPerTile))));
+  size_t side = tiles * quadsPerTile + 1;
+  auto path = (std::filesystem::temp_directory_path() / "sponza_stress.obj").string();
+  auto start = std::chrono::high_resolution_clock::now();
+  {
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+      std::cerr << "can't write " << path << '\n';
+      return EXIT_FAILURE;
+    }
+    for (size_t z = 0; z < side; ++z)
+    {
+      for (size_t x = 0; x < side; ++x)
+      {
+        float h = std::sin(x * 0.05f) * std::cos(z * 0.05f);
+        out << "v " << x << ' ' << h << ' ' << z << "\nvt " << x / float(side) << ' ' << z / float(side) << '\n';
+      }
+    }
+    out << "vn 0 1 0\n";
+    for (size_t tile = 0; tile < tiles * tiles; ++tile)
+    {
+      out << "g tile" << tile << "\nusemtl stress" << tile % 4 << '\n';
+      size_t x0 = (tile % tiles) * quadsPerTile;
+      size_t z0 = (tile / tiles) * quadsPerTile;
+      for (size_t z = z0; z < z0 + quadsPerTile; ++z)
+      {
+        for (size_t x = x0; x < x0 + quadsPerTile; ++x)
+        {
+          size_t v[4] = {z * side + x + 1, z * side + x + 2, (z + 1) * side + x + 2, (z + 1) * side + x + 1};
+          out << 'f';
+          for (auto i : v)
+          {
+            out << ' ' << i << '/' << i << "/1";
+          }
+          out << '\n';
+        }
+      }
+    }
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  size_t expected = tiles * tiles * quadsPerTile * quadsPerTile * 2;
+  std::cout << "wrote " << expected << " triangles in " << tiles * tiles << " groups to " << path << " in "
+            << std::chrono::duration<double>(end - start).count() << " s\n";
+
+  // each group welds to about (quadsPerTile + 1)^2 vertices
+  size_t vertexBytes = tiles * tiles * (quadsPerTile + 1) * (quadsPerTile + 1) * sizeof(VertData);
+  size_t limit = _args.bufferMB != 0 ? _args.bufferMB << 20 : std::max<size_t>(vertexBytes / 8, 1 << 20);
+  size_t oldLimit = GroupedObj::bufferLimit();
+  GroupedObj::setBufferLimit(limit);
+  start = std::chrono::high_resolution_clock::now();
+  auto mesh = std::make_unique<GroupedObj>(path, GroupedObj::CreateVAO::False);
+  end = std::chrono::high_resolution_clock::now();
+  GroupedObj::setBufferLimit(oldLimit);
+  std::filesystem::remove(path);
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << "loaded in " << seconds << " s " << expected / seconds / 1e6 << " Mtris/s, " << mesh->drawVertexData().size()
+            << " vertices in " << mesh->segments().size() << " segments of at most " << limit / (1024 * 1024) << " MB\n";
+
+  // every count and offset must add up and every index reach the right vertex from its segment
+  bool ok = mesh->vertexData().size() == expected * 3 && mesh->indices().size() == expected * 3;
+  const auto &segments = mesh->segments();
+  size_t nextVertex = 0;
+  size_t nextIndex = 0;
+  for (auto &segment : segments)
+  {
+    ok = ok && segment.m_firstVertex == nextVertex && segment.m_firstIndex == nextIndex &&
+         segment.m_numVertices <= size_t(UINT32_MAX) + 1;
+    nextVertex += segment.m_numVertices;
+    nextIndex += segment.m_numIndices;
+  }
+  ok = ok && nextVertex == mesh->drawVertexData().size() && nextIndex == mesh->indices().size();
+  const auto &corners = mesh->vertexData();
+  const auto &verts = mesh->drawVertexData();
+  const auto &indices = mesh->indices();
+  for (size_t g = 0; ok && g < mesh->numMeshes(); ++g)
+  {
+    const MeshData &m = mesh->getMeshData(g);
+    for (size_t i = m.m_startIndex; ok && i < m.m_startIndex + m.m_numVerts; ++i)
+    {
+      size_t v = m.m_baseVertex + indices[i];
+      ok = v >= m.m_firstVertex && v < m.m_firstVertex + m.m_numVertices &&
+           std::memcmp(&verts[v], &corners[i], sizeof(VertData)) == 0;
+    }
+  }
+  for (size_t b = 0; ok && b < mesh->numBatches(); ++b)
+  {
+    const DrawBatch &batch = mesh->getBatch(b);
+    for (size_t g = batch.m_firstMesh; g < batch.m_firstMesh + batch.m_numMeshes; ++g)
+    {
+      ok = ok && mesh->getMeshData(g).m_baseVertex == mesh->getMeshData(batch.m_firstMesh).m_baseVertex;
+    }
+  }
+  std::cout << (ok ? "offsets and indices check out\n" : "the segment bookkeeping is wrong\n");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+} // end anon namespace
+
+int main(int argc, char **argv)
+{
+  std::map<std::string, std::function<int(const Args &)>> tests = {
+      {"ao", benchAO},
+      {"bvh", benchBVH},
+      {"load", benchLoad},
+      {"soft", benchSoft},
+      {"stress", benchStress},
+      {"vcache", benchVertexCache}};
+
+  if (argc < 2 || tests.find(argv[1]) == tests.end())
+  {
+    std::cerr << "usage " << argv[0] << " test [-m model.obj] [-t threads] [-n count] [-w width] [-h height] [-l model.mtl] [-o image.ppm] [-b bufferMB]\ntests :";
+    for (auto &t : tests)
+    {
+      std::cerr << ' ' << t.first;
+    }
+    std::cerr << '\n';
+    return EXIT_FAILURE;
+  }
+  Args args;
+  for (int i = 2; i + 1 < argc; i += 2)
+  {
+    std::string flag = argv[i];
+    if (flag == "-m")
+      args.model = argv[i + 1];
+    else if (flag == "-t")
+      args.threads = static_cast<unsigned int>(std::stoul(argv[i + 1]));
+    else if (flag == "-n")
+      args.count = std::stoi(argv[i + 1]);
+    else if (flag == "-w")
+      args.width = std::stoi(argv[i + 1]);
+    else if (flag == "-h")
+      args.height = std::stoi(argv[i + 1]);
+    else if (flag == "-l")
+      args.mtl = argv[i + 1];
+    else if (flag == "-o")
+      args.output = argv[i + 1];
+    else if (flag == "-b")
+      args.bufferMB = std::stoul(argv[i + 1]);
+    else
+      std::cerr << "ignoring unknown option " << flag << '\n';
+  }
+  return tests[argv[1]](args);
+}
@@ -0,0 +1,508 @@
+/****************************************************************************
+converts an OBJ file to the packed .nmesh format GroupedObj loads directly.
+The file is streamed and the corners are put in order with external merge
+sorts so the memory used is bounded by -m however big the model is, only the
+group table is held in memory. The mtl file is small and is used as it is.
+usage SponzaConvert model.obj model.nmesh [-m memoryMB] [-t tempDir]
+****************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "LineReader.h"
+#include "MeshFile.h"
+
+namespace
+{
+/// @brief an attribute index the corner doesn't have, and a face not yet given a group
+constexpr uint64_t c_none = ~uint64_t(0);
+constexpr uint32_t c_noGroup = ~0u;
+// more runs than this are merged in several passes to keep the number of open files down
+constexpr size_t c_maxMergeWays = 64;
+
+struct Args
+{
+  std::string input;
+  std::string output;
+  std::string tempDir;
+  size_t memoryBytes = size_t(256) << 20;
+};
+
+/// @brief a triangle corner on its way through the sorts
+struct Corner
+{
+  /// @brief the file order of the corner, keeps the triangles of a group in order
+  uint64_t m_order;
+  uint32_t m_group;
+  /// @brief 0 based indices into the attribute files, 64 bit as a converted model can have over 4G of each
+  uint64_t m_vert;
+  uint64_t m_uv;
+  uint64_t m_norm;
+  /// @brief x,y,z,nx,ny,nz,u,v as GroupedObj packs them
+  float m_data[meshfile::c_floatsPerCorner];
+};
+
+template <typename Record>
+bool readRecord(std::istream &_in, Record &o_record)
+{
+  return static_cast<bool>(_in.read(reinterpret_cast<char *>(&o_record), sizeof(Record)));
+}
+
+template <typename Record>
+void writeRecord(std::ostream &_out, const Record &_record)
+{
+  _out.write(reinterpret_cast<const char *>(&_record), sizeof(Record));
+}
+
+class TempFiles
+{
+public:
+  explicit TempFiles(const std::string &_dir) : m_dir(_dir) { std::filesystem::create_directories(m_dir); }
+  ~TempFiles()
+  {
+    std::error_code ec;
+    std::filesystem::remove_all(m_dir, ec);
+  }
+  std::string next(const std::string &_name) { return (m_dir / (_name + std::to_string(m_count++) + ".tmp")).string(); }
+
+private:
+  std::filesystem::path m_dir;
+  size_t m_count = 0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief merge sorted runs into one sorted file
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Record, typename Less>
+bool mergeRuns(const std::vector<std::string> &_runs, const std::string &_out, Less _less)
+{
+  std::vector<std::unique_ptr<std::ifstream>> inputs;
+  for (auto &run : _runs)
+  {
+    inputs.push_back(std::make_unique<std::ifstream>(run, std::ios::in | std::ios::binary));
+  }
+  std::ofstream fileOut(_out, std::ios::out | std::ios::binary);
+  // the smallest head of each run is at the top of the heap
+  using Head = std::pair<Record, size_t>;
+  auto greater = [&_less](const Head &_a, const Head &_b) { return _less(_b.first, _a.first); };
+  std::priority_queue<Head, std::vector<Head>, decltype(greater)> heads(greater);
+  for (size_t i = 0; i < inputs.size(); ++i)
+  {
+    Record record;
+    if (readRecord(*inputs[i], record))
+    {
+      heads.push({record, i});
+    }
+  }
+  while (!heads.empty())
+  {
+    Head head = heads.top();
+    heads.pop();
+    writeRecord(fileOut, head.first);
+    if (readRecord(*inputs[head.second], head.first))
+    {
+      heads.push(head);
+    }
+  }
+  inputs.clear();
+  for (auto &run : _runs)
+  {
+    std::filesystem::remove(run);
+  }
+  return static_cast<bool>(fileOut);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief sort a file of records using at most _maxRecords in memory, the input file is removed
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Record, typename Less>
+bool externalSort(const std::string &_in, const std::string &_out, Less _less, size_t _maxRecords, TempFiles &_temp)
+{
+  std::vector<std::string> runs;
+  {
+    std::ifstream fileIn(_in, std::ios::in | std::ios::binary);
+    std::vector<Record> buffer;
+    buffer.reserve(_maxRecords);
+    Record record;
+    bool more = true;
+    while (more)
+    {
+      buffer.clear();
+      while (buffer.size() < _maxRecords && (more = readRecord(fileIn, record)))
+      {
+        buffer.push_back(record);
+      }
+      if (buffer.empty())
+      {
+        break;
+      }
+      std::sort(buffer.begin(), buffer.end(), _less);
+      runs.push_back(_temp.next("run"));
+      std::ofstream fileOut(runs.back(), std::ios::out | std::ios::binary);
+      fileOut.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(buffer.size() * sizeof(Record)));
+      if (!fileOut)
+      {
+        std::cerr << "could not write " << runs.back() << '\n';
+        return false;
+      }
+    }
+  }
+  std::filesystem::remove(_in);
+  while (runs.size() > c_maxMergeWays)
+  {
+    std::vector<std::string> merged;
+    for (size_t i = 0; i < runs.size(); i += c_maxMergeWays)
+    {
+      std::vector<std::string> batch(runs.begin() + i, runs.begin() + std::min(runs.size(), i + c_maxMergeWays));
+      merged.push_back(_temp.next("run"));
+      if (!mergeRuns<Record>(batch, merged.back(), _less))
+      {
+        return false;
+      }
+    }
+    runs.swap(merged);
+  }
+  return mergeRuns<Record>(runs, _out, _less);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief fill in one attribute of every corner, the corners must be sorted by that attribute's index so the
+/// attribute file is read once from start to end. The input file is removed
+/// @param[in] _index the member holding the attribute index
+/// @param[in] _size the floats per attribute
+/// @param[in] _offset where in m_data the attribute goes
+//----------------------------------------------------------------------------------------------------------------------
+bool resolve(const std::string &_in, const std::string &_out, const std::string &_attributes, uint64_t Corner::*_index,
+             size_t _size, size_t _offset)
+{
+  std::ifstream fileIn(_in, std::ios::in | std::ios::binary);
+  std::ifstream attributes(_attributes, std::ios::in | std::ios::binary);
+  std::ofstream fileOut(_out, std::ios::out | std::ios::binary);
+  float value[3] = {0.0f, 0.0f, 0.0f};
+  uint64_t current = c_none;
+  Corner corner;
+  while (readRecord(fileIn, corner))
+  {
+    uint64_t index = corner.*_index;
+    if (index == c_none)
+    {
+      std::fill(corner.m_data + _offset, corner.m_data + _offset + _size, 0.0f);
+    }
+    else
+    {
+      while (current == c_none || current < index)
+      {
+        if (!attributes.read(reinterpret_cast<char *>(value), static_cast<std::streamsize>(_size * sizeof(float))))
+        {
+          std::cerr << "face index " << index + 1 << " is past the end of " << _attributes << '\n';
+          return false;
+        }
+        current = current == c_none ? 0 : current + 1;
+      }
+      std::copy(value, value + _size, corner.m_data + _offset);
+    }
+    writeRecord(fileOut, corner);
+  }
+  fileIn.close();
+  std::filesystem::remove(_in);
+  return static_cast<bool>(fileOut);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief turn an obj index (1 based, or negative from the end) into a 0 based one, an empty token is c_none
+/// @returns false if the token is not a number or not one of the _count read so far
+//----------------------------------------------------------------------------------------------------------------------
+bool objIndex(const std::string &_token, uint64_t _count, uint64_t &o_index)
+{
+  o_index = c_none;
+  if (_token.empty())
+  {
+    return true;
+  }
+  char *end;
+  // long is 32 bits on windows
+  long long index = std::strtoll(_token.c_str(), &end, 10);
+  if (end == _token.c_str() || *end != '\0')
+  {
+    return false;
+  }
+  long long resolved = index < 0 ? static_cast<long long>(_count) + index : index - 1;
+  if (resolved < 0 || static_cast<uint64_t>(resolved) >= _count)
+  {
+    return false;
+  }
+  o_index = static_cast<uint64_t>(resolved);
+  return true;
+}
+
+int convert(const Args &_args)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  auto elapsed = [&start]() { return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count(); };
+  // a .obj.gz / .obj.zst is decompressed on another thread as it is read, never to disk
+  LineReader fileIn(_args.input);
+  if (!fileIn.isOpen())
+  {
+    std::cerr << "File : " << _args.input << " Not found\n";
+    return EXIT_FAILURE;
+  }
+  TempFiles temp(_args.tempDir.empty() ? _args.output + ".tmp" : _args.tempDir);
+  std::string positionFile = temp.next("positions");
+  std::string normalFile = temp.next("normals");
+  std::string uvFile = temp.next("uvs");
+  std::string cornerFile = temp.next("corners");
+  std::ofstream positions(positionFile, std::ios::out | std::ios::binary);
+  std::ofstream normals(normalFile, std::ios::out | std::ios::binary);
+  std::ofstream uvs(uvFile, std::ios::out | std::ios::binary);
+  std::ofstream corners(cornerFile, std::ios::out | std::ios::binary);
+
+  // pass 1, split the attributes into their own files and write out every triangle corner
+  meshfile::Header header;
+  for (int a = 0; a < 3; ++a)
+  {
+    header.m_min[a] = std::numeric_limits<float>::max();
+    header.m_max[a] = std::numeric_limits<float>::lowest();
+  }
+  std::map<std::pair<std::string, std::string>, uint32_t> groupIDs;
+  std::vector<meshfile::Group> groups;
+  std::string groupName = "none";
+  std::string material = "default";
+  uint32_t group = c_noGroup;
+  uint64_t numVerts = 0;
+  uint64_t numNormals = 0;
+  uint64_t numUVs = 0;
+  uint64_t order = 0;
+  std::string line;
+  std::string token;
+  std::vector<std::string> face;
+  while (fileIn.getline(line))
+  {
+    std::istringstream tokens(line);
+    if (!(tokens >> token))
+    {
+      continue;
+    }
+    if (token == "v")
+    {
+      float p[3] = {0.0f, 0.0f, 0.0f};
+      tokens >> p[0] >> p[1] >> p[2];
+      for (int a = 0; a < 3; ++a)
+      {
+        header.m_min[a] = std::min(header.m_min[a], p[a]);
+        header.m_max[a] = std::max(header.m_max[a], p[a]);
+      }
+      positions.write(reinterpret_cast<const char *>(p), sizeof(p));
+      ++numVerts;
+    }
+    else if (token == "vn")
+    {
+      float n[3] = {0.0f, 0.0f, 0.0f};
+      tokens >> n[0] >> n[1] >> n[2];
+      normals.write(reinterpret_cast<const char *>(n), sizeof(n));
+      ++numNormals;
+    }
+    else if (token == "vt")
+    {
+      float uv[2] = {0.0f, 0.0f};
+      tokens >> uv[0] >> uv[1];
+      uvs.write(reinterpret_cast<const char *>(uv), sizeof(uv));
+      ++numUVs;
+    }
+    else if (token == "g")
+    {
+      groupName = (tokens >> token) ? token : std::string("none");
+      group = c_noGroup;
+    }
+    else if (token == "usemtl")
+    {
+      material = (tokens >> token) ? token : std::string("default");
+      group = c_noGroup;
+    }
+    else if (token == "f")
+    {
+      if (group == c_noGroup)
+      {
+        auto found = groupIDs.emplace(std::make_pair(groupName, material), static_cast<uint32_t>(groups.size()));
+        if (found.second)
+        {
+          meshfile::Group g;
+          g.m_name = groupName;
+          g.m_material = material;
+          groups.push_back(g);
+        }
+        group = found.first->second;
+      }
+      face.clear();
+      while (tokens >> token)
+      {
+        face.push_back(token);
+      }
+      // fan the polygon into triangles the same way GroupedObj splits quads
+      for (size_t t = 1; t + 1 < face.size(); ++t)
+      {
+        for (size_t c : {size_t(0), t, t + 1})
+        {
+          Corner corner = {};
+          corner.m_order = order++;
+          corner.m_group = group;
+          std::string indices[3];
+          std::istringstream parts(face[c]);
+          for (int p = 0; p < 3 && std::getline(parts, indices[p], '/'); ++p)
+          {
+          }
+          if (!objIndex(indices[0], numVerts, corner.m_vert) || !objIndex(indices[1], numUVs, corner.m_uv) ||
+              !objIndex(indices[2], numNormals, corner.m_norm))
+          {
+            std::cerr << "bad face index " << face[c] << " in " << _args.input << '\n';
+            return EXIT_FAILURE;
+          }
+          if (corner.m_vert == c_none)
+          {
+            std::cerr << "face with no position in " << _args.input << '\n';
+            return EXIT_FAILURE;
+          }
+          writeRecord(corners, corner);
+          ++groups[group].m_numVerts;
+        }
+      }
+    }
+  }
+  if (fileIn.failed())
+  {
+    std::cerr << "error reading " << _args.input << '\n';
+    return EXIT_FAILURE;
+  }
+  fileIn.printStats(std::cout, elapsed());
+  positions.close();
+  normals.close();
+  uvs.close();
+  corners.close();
+  header.m_numCorners = order;
+  std::cout << "read " << numVerts << " positions " << numNormals << " normals " << numUVs << " uvs " << order / 3
+            << " triangles in " << groups.size() << " groups " << elapsed() << " s\n";
+
+  // pass 2, sort by each attribute index in turn and read that attribute file in order
+  size_t maxRecords = std::max<size_t>(_args.memoryBytes / sizeof(Corner), 1024);
+  struct Attribute
+  {
+    uint64_t Corner::*m_index;
+    std::string m_file;
+    size_t m_size;
+    size_t m_offset;
+  };
+  std::vector<Attribute> attributes = {{&Corner::m_vert, positionFile, 3, 0},
+                                       {&Corner::m_norm, normalFile, 3, 3},
+                                       {&Corner::m_uv, uvFile, 2, 6}};
+  for (auto &attribute : attributes)
+  {
+    auto index = attribute.m_index;
+    std::string sorted = temp.next("sorted");
+    std::string resolved = temp.next("resolved");
+    if (!externalSort<Corner>(cornerFile, sorted, [index](const Corner &_a, const Corner &_b) { return _a.*index < _b.*index; },
+                              maxRecords, temp) ||
+        !resolve(sorted, resolved, attribute.m_file, index, attribute.m_size, attribute.m_offset))
+    {
+      return EXIT_FAILURE;
+    }
+    std::filesystem::remove(attribute.m_file);
+    cornerFile = resolved;
+  }
+  std::cout << "attributes resolved " << elapsed() << " s\n";
+
+  // pass 3, groups of the same material go next to each other so the viewer's material sort doesn't jump around
+  std::vector<uint32_t> groupOrder(groups.size());
+  for (uint32_t g = 0; g < groups.size(); ++g)
+  {
+    groupOrder[g] = g;
+  }
+  std::stable_sort(groupOrder.begin(), groupOrder.end(),
+                   [&groups](uint32_t _a, uint32_t _b) { return groups[_a].m_material < groups[_b].m_material; });
+  std::vector<uint32_t> rank(groups.size());
+  uint64_t startIndex = 0;
+  for (uint32_t r = 0; r < groupOrder.size(); ++r)
+  {
+    rank[groupOrder[r]] = r;
+    groups[groupOrder[r]].m_startIndex = startIndex;
+    startIndex += groups[groupOrder[r]].m_numVerts;
+  }
+  std::string sorted = temp.next("sorted");
+  if (!externalSort<Corner>(cornerFile, sorted, [&rank](const Corner &_a, const Corner &_b)
+                            { return rank[_a.m_group] != rank[_b.m_group] ? rank[_a.m_group] < rank[_b.m_group] : _a.m_order < _b.m_order; },
+                            maxRecords, temp))
+  {
+    return EXIT_FAILURE;
+  }
+  for (uint32_t g : groupOrder)
+  {
+    header.m_groups.push_back(groups[g]);
+  }
+
+  std::ofstream fileOut(_args.output, std::ios::out | std::ios::binary);
+  if (!fileOut.is_open() || !meshfile::writeHeader(fileOut, header))
+  {
+    std::cerr << "could not write " << _args.output << '\n';
+    return EXIT_FAILURE;
+  }
+  std::ifstream sortedIn(sorted, std::ios::in | std::ios::binary);
+  Corner corner;
+  while (readRecord(sortedIn, corner))
+  {
+    fileOut.write(reinterpret_cast<const char *>(corner.m_data), sizeof(corner.m_data));
+  }
+  if (!fileOut)
+  {
+    std::cerr << "could not write " << _args.output << '\n';
+    return EXIT_FAILURE;
+  }
+  std::cout << "wrote " << _args.output << " " << header.m_numCorners * sizeof(corner.m_data) / (1024 * 1024) << " MB in "
+            << elapsed() << " s\n";
+  return EXIT_SUCCESS;
+}
+} // end anon namespace
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    std::cerr << "usage " << argv[0] << " model.obj model" << meshfile::c_extension << " [-m memoryMB] [-t tempDir]\n";
+    return EXIT_FAILURE;
+  }
+  Args args;
+  args.input = argv[1];
+  args.output = argv[2];
+  if (!meshfile::isMeshFile(args.output))
+  {
+    std::cerr << "the viewer only loads " << meshfile::c_extension << " files as packed meshes\n";
+  }
+  for (int i = 3; i + 1 < argc; i += 2)
+  {
+    std::string flag = argv[i];
+    if (flag == "-m")
+    {
+      char *end;
+      unsigned long long mb = std::strtoull(argv[i + 1], &end, 10);
+      if (end == argv[i + 1] || *end != '\0')
+      {
+        std::cerr << "-m takes the memory to use in MB\n";
+        return EXIT_FAILURE;
+      }
+      args.memoryBytes = static_cast<size_t>(mb) << 20;
+    }
+    else if (flag == "-t")
+      args.tempDir = argv[i + 1];
+    else
+      std::cerr << "ignoring unknown option " << flag << '\n';
+  }
+  return convert(args);
+}
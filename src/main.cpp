@@ -3,12 +3,20 @@ basic OpenGL demo modified from http://qt-project.org/doc/qt-5.0/qtgui/openglwin
 ****************************************************************************/
 #include <QtGui/QGuiApplication>
 #include <iostream>
+#include <cstdlib>
 #include "NGLScene.h"
+#include "Trace.h"
 
 
 
 int main(int argc, char **argv)
 {
+  // SPONZA_TRACE=file.json records a timeline of the startup which is written once the scene is loaded
+  if (std::getenv("SPONZA_TRACE") != nullptr)
+  {
+    trace::setEnabled(true);
+    trace::setThreadName("main");
+  }
   QGuiApplication app(argc, argv);
   // create an OpenGL format specifier
   QSurfaceFormat format;
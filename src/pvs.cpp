@@ -0,0 +1,91 @@
+/****************************************************************************
+builds the potentially visible sets of a model offline and writes them to the
+cache the viewer loads them from. A model that never moves only needs this
+run once, again if the model or the settings change.
+usage SponzaPVS model.obj [-c cacheDir] [-n cells] [-s samples] [-r rays] [-t threads]
+****************************************************************************/
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include "BVH.h"
+#include "GroupedObj.h"
+#include "PVS.h"
+
+namespace
+{
+struct Args
+{
+  std::string model;
+  std::string cacheDir = "cache";
+  PVSSettings settings;
+};
+
+/// @brief look the sets up from random points in the bounds to see how much they would cull
+void reportCulling(PVS &_pvs, const BVH &_bvh)
+{
+  constexpr int c_lookups = 10000;
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  ngl::Vec3 lo = _bvh.boundsMin();
+  ngl::Vec3 size = _bvh.boundsMax() - lo;
+  for (int i = 0; i < c_lookups; ++i)
+  {
+    _pvs.visibleFrom(ngl::Vec3(lo.m_x + unit(rng) * size.m_x, lo.m_y + unit(rng) * size.m_y, lo.m_z + unit(rng) * size.m_z));
+  }
+  std::cout << "from " << c_lookups << " random points: ";
+  _pvs.printStats(std::cout);
+}
+} // end anon namespace
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    std::cerr << "usage " << argv[0] << " model.obj [-c cacheDir] [-n cells] [-s samples] [-r rays] [-t threads]\n";
+    return EXIT_FAILURE;
+  }
+  Args args;
+  args.model = argv[1];
+  for (int i = 2; i + 1 < argc; i += 2)
+  {
+    std::string flag = argv[i];
+    if (flag == "-c")
+      args.cacheDir = argv[i + 1];
+    else if (flag == "-n")
+      args.settings.cellsOnLongestAxis = std::stoi(argv[i + 1]);
+    else if (flag == "-s")
+      args.settings.samplesPerCell = static_cast<unsigned int>(std::stoul(argv[i + 1]));
+    else if (flag == "-r")
+      args.settings.raysPerSample = static_cast<unsigned int>(std::stoul(argv[i + 1]));
+    else if (flag == "-t")
+      args.settings.threads = static_cast<unsigned int>(std::stoul(argv[i + 1]));
+    else
+      std::cerr << "ignoring unknown option " << flag << '\n';
+  }
+  // the same cache dir as the viewer so the layout, and so the hash, matches what it draws
+  auto start = std::chrono::high_resolution_clock::now();
+  auto mesh = std::make_unique<GroupedObj>(args.model, GroupedObj::CreateVAO::False, args.cacheDir);
+  if (!mesh->isLoaded() || mesh->numMeshes() == 0)
+  {
+    std::cerr << "could not load " << args.model << '\n';
+    return EXIT_FAILURE;
+  }
+  BVH bvh(*mesh, args.settings.threads);
+  auto end = std::chrono::high_resolution_clock::now();
+  std::cout << "loaded " << args.model << " " << mesh->numMeshes() << " groups and built the BVH in "
+            << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+
+  PVS pvs;
+  pvs.build(*mesh, bvh, args.settings);
+  std::string fname = PVS::cacheName(args.cacheDir, *mesh);
+  if (!pvs.save(fname))
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "wrote " << fname << '\n';
+  reportCulling(pvs, bvh);
+  return EXIT_SUCCESS;
+}